@@ -251,7 +251,7 @@ extern size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size);
 #define apedsa_da_grow(da, n, min_cap) ((da) = __apedsa_da_growf_wrapper((da), sizeof(*(da)), (n), (min_cap)))
 #define apedsa_da_reserve(da, n) \
 	((!(da) || apedsa_da_header(da)->count + (n) > apedsa_da_header(da)->capacity) ? (apedsa_da_grow(da, n, 0), 0) : 0)
-#define apedsa_da_free(da) ((da) ? apedsa_da_header(da)->count = 0, apedsa_da_header(da)->capacity = 0, APEDSA_FREE(da) : 0)
+#define apedsa_da_free(da) ((da) ? (APEDSA_FREE(apedsa_da_header(da)), (da) = NULL, 0) : 0)
 
 #define apedsa_hm_put(t, k, v)                                                                                             \
 	((t) = __apedsa_hashmap_put_internal_wrapper((t), APEDSA_ADDRESSOF((t)->key, (k)), sizeof((t)->key), sizeof(*(t)), \
@@ -1147,10 +1147,12 @@ void *__apedsa_hashmap_free_internal(void *a, size_t kv_size)
 	char *da = a;
 	a = (char *)a - kv_size;
 	ApedsaHashIndex *table = (ApedsaHashIndex *)apedsa_da_header(a)->aux;
-	if (table != NULL)
+	if (table != NULL) {
+		apedsa_string_arena_reset(&table->string);
 		APEDSA_FREE(table);
-	APEDSA_FREE(a);
-	return a;
+	}
+	APEDSA_FREE(apedsa_da_header(a));
+	return NULL;
 }
 
 float apedsa_hashmap_load_factor(void *a, size_t kv_size)
@@ -26,7 +26,107 @@
  */
 
 /*
- * apelexer.h - v0.1
+ * apelexer.h - v0.4
+ *
+ * Example usage:
+ *     #define APELEXER_IMPLEMENTATION
+ *     #include "apelexer.h"
+ * 
+ *     int main(void) {
+ *         size_t count = 0;
+ *         ApelexerToken *tokens = apelexer_tokenize("int x = 42;", &count);
+ *         for (size_t i = 0; i < count; i++) {
+ *             printf("%s: %s\n", apelexer_token_type_to_string(tokens[i].type), tokens[i].value);
+ *         }
+ *         apelexer_free_tokens(tokens); // frees the array and every value at once
+ *     }
+ * 
+ * Streaming input can be lexed one token at a time without keeping it all in memory:
+ * 
+ *     ApelexerCtx ctx;
+ *     apelexer_init(&ctx);
+ *     apelexer_set_reader(&ctx, my_read_fn, my_file); // or push chunks with apelexer_feed()
+ *     ApelexerToken tok;
+ *     while (apelexer_next(&ctx, &tok) == APELEXER_NEXT_TOKEN) {
+ *         // tok.value is only valid until the next call
+ *     }
+ *     apelexer_free(&ctx);
+ * 
+ * Identifiers can be interned into a symbol table so they compare as integers:
+ * 
+ *     ApelexerSymbols *symbols = apelexer_symbols_new();
+ *     ApelexerToken *tokens = apelexer_tokenize_interned(NULL, symbols, src, &count);
+ *     // apelexer_token_symbol(tokens, i) is the same ID for every occurrence of a name,
+ *     // tokens[i].value points to the single interned copy (ctx.symbol when streaming)
+ *     apelexer_symbols_free(symbols);
+ * 
+ * Other languages are described with an ApelexerLanguageSpec and compiled once:
+ * 
+ *     static const char *const keywords[] = { "let", "fn" };
+ *     static const ApelexerOperatorDef operators[] = { { "=", APELEXER_TOKEN_OPERATOR }, { "(", APELEXER_TOKEN_OPEN_PAREN } };
+ *     ApelexerLanguageSpec spec = { .keywords = keywords, .keyword_count = 2, .operators = operators,
+ *                                   .operator_count = 2, .line_comment = "#", .string_quote = '"' };
+ *     ApelexerLanguage *lang = apelexer_language_compile(&spec);
+ *     ApelexerToken *tokens = apelexer_tokenize_lang(lang, "let x = f(1)", &count);
+ *     apelexer_language_free(lang);
+ * 
+ * Languages with decode_numbers set also decode INT and FLOAT tokens while lexing:
+ * 
+ *     spec.decode_numbers = 1;
+ *     // apelexer_token_number(tokens, i).i (INT) or .f (FLOAT) holds the value
+ *     // (ctx.number when streaming)
+ * 
+ * Token rules can also be written as regex-like patterns and compiled into a minimized DFA,
+ * which can be run directly or emitted as C source (transition tables or a direct-coded switch):
+ * 
+ *     static const ApelexerRule rules[] = {
+ *         { "[ \t\n]+", APELEXER_TOKEN_NONE }, // skipped
+ *         { "[A-Za-z_]\\w*", APELEXER_TOKEN_IDENTIFIER },
+ *         { "\\d+", APELEXER_TOKEN_INT },
+ *     };
+ *     ApelexerDfa *dfa = apelexer_dfa_compile(rules, 3);
+ *     ApelexerToken *tokens = apelexer_dfa_tokenize(dfa, src, strlen(src), &count);
+ *     apelexer_dfa_emit_c(dfa, stdout, "my_lexer_match", APELEXER_DFA_EMIT_DIRECT);
+ *     apelexer_dfa_free(dfa);
+ * 
+ * API functions:
+ *   apelexer_tokenize - Tokenize a NUL-terminated string into an array of tokens
+ *   apelexer_tokenize_lang - Tokenize a string with a compiled language
+ *   apelexer_free_tokens - Free a token array and all of its values
+ *   apelexer_tokenize_interned - Tokenize a string and intern its identifiers
+ *   apelexer_symbols_new - Create a symbol table
+ *   apelexer_symbols_free - Free a symbol table and every interned name
+ *   apelexer_symbols_intern - Symbol ID of a name, interning it if it's new
+ *   apelexer_symbols_name - Name of a symbol ID
+ *   apelexer_symbols_count - Number of interned symbols
+ *   apelexer_language_compile - Compile a language spec (NULL if the spec is invalid)
+ *   apelexer_language_free - Free a compiled language
+ *   apelexer_language_c - The built-in C language used when lang is NULL
+ *   apelexer_dfa_compile - Compile regex-like token rules into a minimized DFA
+ *   apelexer_dfa_free - Free a compiled DFA
+ *   apelexer_dfa_state_count - Number of states of a DFA
+ *   apelexer_dfa_match - Longest rule match at the start of a buffer
+ *   apelexer_dfa_tokenize - Tokenize a buffer with a DFA
+ *   apelexer_dfa_emit_c - Write a DFA as a standalone C matcher function
+ *   apelexer_tokenize_parallel - Tokenize a large buffer on multiple threads
+ *   apelexer_tokenize_compact - Tokenize into a compact struct-of-arrays token list
+ *   apelexer_token_list_position - Line and column of a token in a compact list
+ *   apelexer_token_list_free - Free a compact token list
+ *   apelexer_token_type_to_string - Returns a human-readable name for a token type
+ *   apelexer_token_symbol - Symbol ID of a token of a returned token array
+ *   apelexer_token_number - Decoded value of a number token of a returned token array
+ *   apelexer_parse_int - Decode a decimal, 0x, 0b or 0o integer literal
+ *   apelexer_parse_float - Decode a decimal float literal, correctly rounded
+ *   apelexer_init - Initialize a streaming lexer context
+ *   apelexer_set_language - Set the language of a streaming context
+ *   apelexer_set_symbols - Intern identifiers of a streaming context
+ *   apelexer_set_reader - Pull input through a read callback
+ *   apelexer_feed - Push a chunk of input
+ *   apelexer_finish - Signal that no more input will be fed
+ *   apelexer_next - Get the next token
+ *   apelexer_tokenize_ctx - Tokenize a buffer into memory owned by a context
+ *   apelexer_reset - Discard a context's input and tokens, keeping its memory for reuse
+ *   apelexer_free - Release the context's buffers
  */
 
 #ifndef APELEXER_EXTERNAL_APEDSA
@@ -287,7 +387,7 @@ extern size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size);
 #define apedsa_da_grow(da, n, min_cap) ((da) = __apedsa_da_growf_wrapper((da), sizeof(*(da)), (n), (min_cap)))
 #define apedsa_da_reserve(da, n) \
 	((!(da) || apedsa_da_header(da)->count + (n) > apedsa_da_header(da)->capacity) ? (apedsa_da_grow(da, n, 0), 0) : 0)
-#define apedsa_da_free(da) ((da) ? apedsa_da_header(da)->count = 0, apedsa_da_header(da)->capacity = 0, APEDSA_FREE(da) : 0)
+#define apedsa_da_free(da) ((da) ? (APEDSA_FREE(apedsa_da_header(da)), (da) = NULL, 0) : 0)
 
 #define apedsa_hm_put(t, k, v)                                                                                             \
 	((t) = __apedsa_hashmap_put_internal_wrapper((t), APEDSA_ADDRESSOF((t)->key, (k)), sizeof((t)->key), sizeof(*(t)), \
@@ -306,7 +406,7 @@ extern size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size);
 #define apedsa_hm_getp(t, k) ((void)apedsa_hm_geti(t, k), &(t)[apedsa_da_temp((t) - 1)])
 
 #define apedsa_hm_del(t, k)                                                                                                  \
-	(__apedsa_hashmap_del_internal_wrapper((t), (void *)APEDSA_ADDRESSOF((t)->key, (k)), sizeof((t)->key), sizeof(*(t)), \
+	((t) = __apedsa_hashmap_del_internal_wrapper((t), (void *)APEDSA_ADDRESSOF((t)->key, (k)), sizeof((t)->key), sizeof(*(t)), \
 					       APEDSA_OFFSETOF((t), key), APEDSA_HASHMAP_MODE_BINARY))
 
 #define apedsa_hm_gets(t, k) (*apedsa_hm_getp(t, k))
@@ -326,7 +426,7 @@ extern size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size);
 #define apedsa_hm_load_factor(a) apedsa_hashmap_load_factor(a, sizeof(*(a)))
 #define apedsa_hm_tombstone_count(a) apedsa_hashmap_tombstone_count(a, sizeof(*(a)))
 
-#define apedsa_shm_len(t) (apedsa_da_count((t) - 1) - 1)
+#define apedsa_shm_len(t) ((t) ? (apedsa_da_count((t) - 1) - 1) : 0)
 
 #define apedsa_shm_put(t, k, v)                                                                                                \
 	((t) = __apedsa_hashmap_put_internal_wrapper((t), (void *)(k), sizeof((k)), sizeof(*(t)), APEDSA_HASHMAP_MODE_STRING), \
@@ -334,7 +434,7 @@ extern size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size);
 
 #define apedsa_shm_puts(t, s)                                                                                                  \
 	((t) = __apedsa_hashmap_put_internal_wrapper((t), (s).key, sizeof((s).key), sizeof(*(t)), APEDSA_HASHMAP_MODE_STRING), \
-	 (t)[apedsa_da_temp((t) - 1)].value = (v))
+	 (t)[apedsa_da_temp((t) - 1)] = (s))
 
 #define apedsa_shm_geti(t, k)                                                                                                       \
 	((t) = __apedsa_hashmap_get_internal_wrapper((t), (void *)(k), sizeof((t)->key), sizeof(*(t)), APEDSA_HASHMAP_MODE_STRING), \
@@ -463,6 +563,7 @@ static T *__apedsa_hashmap_put_internal_batch_wrapper(T *hashmap, size_t count,
 
 #ifdef APEDSA_IMPLEMENTATION
 
+
 #ifndef APEDSA_IMPLEMENTATION_INCLUDED
 #define APEDSA_IMPLEMENTATION_INCLUDED
 
@@ -490,6 +591,7 @@ static T *__apedsa_hashmap_put_internal_batch_wrapper(T *hashmap, size_t count,
 
 #include <stdint.h>
 
+
 /* BEGIN da.c */
 
 void *__apedsa_da_growf(void *da, size_t esz, size_t growby, size_t min_cap)
@@ -514,6 +616,7 @@ void *__apedsa_da_growf(void *da, size_t esz, size_t growby, size_t min_cap)
 }
 /* END da.c */
 
+
 /* BEGIN hashmap.c */
 
 static size_t __apedsa_hash_seed = 0x31415926;
@@ -814,18 +917,19 @@ ApedsaHashIndex *__apedsa_hashmap_rehash(size_t slot_count, ApedsaHashIndex *old
 
 APEDSA_PRIVATE int __apedsa_is_key_equal(void *a, void *key, size_t key_size, size_t kv_size, size_t i, int mode)
 {
-	// clang-format off
-    size_t len = mode >= APEDSA_HASHMAP_MODE_STRING ? strlen((char *)key) : key_size;
-    if (len <= 8) { // compare bytes directly for small keys
-        size_t key_masked = len == 8 ? *(size_t*)key : ((size_t)KEY_SIZE_MASK(len) & *(size_t*)key);
-        char *key2 = mode >= APEDSA_HASHMAP_MODE_STRING ? (char *)*(char **)((char *)a + i * kv_size)
-            : (char *)a + i * kv_size;
-        size_t key2_masked = len == 8 ? *(size_t*)key2 : ((size_t)KEY_SIZE_MASK(len) & *(size_t*)key2);
-        return key_masked == key2_masked;
-    }
-	// clang-format on
+	// // clang-format off
+	//    size_t len = mode >= APEDSA_HASHMAP_MODE_STRING ? strlen((char *)key) : key_size;
+	//    if (len <= 8) { // compare bytes directly for small keys
+	//        size_t key_masked = len == 8 ? *(size_t*)key : ((size_t)KEY_SIZE_MASK(len) & *(size_t*)key);
+	//        char *key2 = mode >= APEDSA_HASHMAP_MODE_STRING ? (char *)*(char **)((char *)a + i * kv_size)
+	//            : (char *)a + i * kv_size;
+	//        size_t key2_masked = len == 8 ? *(size_t*)key2 : ((size_t)KEY_SIZE_MASK(len) & *(size_t*)key2);
+	//        return key_masked == key2_masked;
+	//    }
+	// // clang-format on
 	if (mode >= APEDSA_HASHMAP_MODE_STRING)
-		return strcmp(*(char **)((char *)a + i * kv_size), (char *)key) == 0;
+		return strlen(*(char **)((char *)a + i * kv_size)) == strlen((char *)key) &&
+            strcmp(*(char **)((char *)a + i * kv_size), (char *)key) == 0;
 	return memcmp((char *)a + i * kv_size, key, key_size) == 0;
 }
 
@@ -1032,6 +1136,7 @@ void *__apedsa_hashmap_get_internal(void *a, void *key, size_t key_size, size_t
 		a = __apedsa_da_growf(a, kv_size, 0, 1);
 		memset(a, 0, kv_size);
 		apedsa_da_temp(a) = APEDSA_HASHMAP_INDEX_EMPTY;
+        apedsa_da_header(a)->count = 1;
 		return (char *)a + kv_size;
 	}
 	void *da = a;
@@ -1062,10 +1167,10 @@ void *__apedsa_hashmap_del_internal(void *a, void *key, size_t key_size, size_t
 	a = (char *)a - kv_size;
 	ApedsaHashIndex *table = (ApedsaHashIndex *)apedsa_da_header(a)->aux;
 	if (table == NULL)
-		return a;
+		return (char *)a + kv_size;
 	ptrdiff_t slot = __apedsa_hashmap_find_slot(da, key, key_size, kv_size, mode);
 	if (slot < 0)
-		return a;
+		return (char *)a + kv_size;
 #ifdef APEDSA_HASHMAP_STATS
 	table->stat_total_operations++;
 #endif
@@ -1093,11 +1198,20 @@ void *__apedsa_hashmap_del_internal(void *a, void *key, size_t key_size, size_t
 		b->slots[i].index = old_index;
 	}
 	apedsa_da_header(a)->count--;
-	if (table->used_count < table->used_count_shrink_threshold && table->slot_count > APEDSA_HASHMAP_BUCKET_SIZE)
-		apedsa_da_header(a)->aux = __apedsa_hashmap_rehash(table->slot_count >> 1, table);
-	else if (table->tombstone_count > table->tombstone_count_threshold)
-		apedsa_da_header(a)->aux = __apedsa_hashmap_rehash(table->slot_count, table);
-
+	if (table->used_count < table->used_count_shrink_threshold && table->slot_count > APEDSA_HASHMAP_BUCKET_SIZE) {
+        ApedsaHashIndex *new_table = __apedsa_hashmap_rehash(table->slot_count >> 1, table);
+        if (table) {
+            APEDSA_FREE(table);
+        }
+        apedsa_da_header(a)->aux = table = new_table;
+    }
+	else if (table->tombstone_count > table->tombstone_count_threshold) {
+        ApedsaHashIndex *new_table = __apedsa_hashmap_rehash(table->slot_count, table);
+        if (table) {
+            APEDSA_FREE(table);
+        }
+        apedsa_da_header(a)->aux = table = new_table;
+    }
 	return (char *)a + kv_size;
 }
 
@@ -1106,7 +1220,7 @@ void *__apedsa_hashmap_reserve_internal(void *a, size_t count, size_t kv_size)
 	if (a == NULL) {
 		a = __apedsa_da_growf(a, kv_size, count + 1, 0);
 		memset(a, 0, kv_size * (count + 1));
-		apedsa_da_header(a)->count = count + 1; // reserve space for invalid index
+		apedsa_da_header(a)->count = 1; // reserve space for invalid index
 		a = (char *)a + kv_size;
 	}
 	a = (char *)a - kv_size;
@@ -1157,7 +1271,7 @@ void *__apedsa_hashmap_clear_internal(void *a, size_t kv_size)
 	}
 	table->used_count = 0;
 	apedsa_string_arena_reset(&table->string);
-	table = __apedsa_hashmap_rehash(0, table);
+	table = __apedsa_hashmap_rehash(APEDSA_HASHMAP_BUCKET_SIZE, table);
 	apedsa_da_header(a)->aux = table;
 	return (char *)a + kv_size;
 }
@@ -1169,10 +1283,12 @@ void *__apedsa_hashmap_free_internal(void *a, size_t kv_size)
 	char *da = a;
 	a = (char *)a - kv_size;
 	ApedsaHashIndex *table = (ApedsaHashIndex *)apedsa_da_header(a)->aux;
-	if (table != NULL)
+	if (table != NULL) {
+		apedsa_string_arena_reset(&table->string);
 		APEDSA_FREE(table);
-	APEDSA_FREE(a);
-	return a;
+	}
+	APEDSA_FREE(apedsa_da_header(a));
+	return NULL;
 }
 
 float apedsa_hashmap_load_factor(void *a, size_t kv_size)
@@ -1194,6 +1310,7 @@ size_t apedsa_hashmap_tombstone_count(void *a, size_t kv_size)
 }
 /* END hashmap.c */
 
+
 /* BEGIN string.c */
 
 #ifndef APEDSA_STRING_ARENA_BLOCKSIZE_MIN
@@ -1264,7 +1381,7 @@ APEDSA_DEF void apedsa_string_arena_reset(ApedsaStringArena *arena)
 #define APELEXER_INCLUDED
 
 #define APELEXER_VERSION_MAJOR 0
-#define APELEXER_VERSION_MINOR 1
+#define APELEXER_VERSION_MINOR 4
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
 #define APELEXER_WINDOWS
@@ -1307,6 +1424,10 @@ APEDSA_DEF void apedsa_string_arena_reset(ApedsaStringArena *arena)
 #endif
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 typedef enum {
 	APELEXER_TOKEN_NONE,
 	APELEXER_TOKEN_KEYWORD,
@@ -1341,8 +1462,215 @@ typedef struct ApelexerToken {
 	size_t end_column;
 } ApelexerToken;
 
+/* Decoded value of an INT or FLOAT token */
+typedef union ApelexerNumber {
+	uint64_t i;
+	double f;
+} ApelexerNumber;
+
+/*
+ * Language definitions
+ *
+ * The lexer is driven by a compiled language: a character class table, an operator
+ * trie and a perfect hash of the keywords, all built once by apelexer_language_compile().
+ * Every function taking a language accepts NULL for the built-in C language
+ * (C99 keywords, C operators, // and block comments, '#' preprocessor lines).
+ */
+typedef struct {
+	const char *text;
+	ApelexerTokenType type;
+} ApelexerOperatorDef;
+
+typedef struct ApelexerLanguageSpec {
+	const char *const *keywords;
+	size_t keyword_count;
+	const ApelexerOperatorDef *operators; /* ASCII only, the longest match wins */
+	size_t operator_count;
+	const char *line_comment;	/* NULL if the language has no line comments */
+	const char *block_comment_open; /* NULL if the language has no block comments */
+	const char *block_comment_close;
+	char string_quote;	      /* 0 if the language has no strings */
+	char char_quote;	      /* 0 if the language has no character literals */
+	int escapes;		      /* Backslash escapes in strings and character literals */
+	int preprocessor;	      /* '#' in the first column starts a preprocessor line */
+	int number_prefixes;	      /* 0x, 0b and 0o integer prefixes */
+	int number_floats;	      /* Fractions and exponents */
+	int decode_numbers;	      /* Decode INT and FLOAT tokens while lexing, see apelexer_token_number() */
+	const char *identifier_chars; /* Allowed after the first character of an identifier besides [A-Za-z0-9_] */
+} ApelexerLanguageSpec;
+
+typedef struct ApelexerLanguage ApelexerLanguage;
+
+/* Returns NULL if the spec is invalid, e.g. lists a keyword twice. The strings in spec are not copied and must outlive the language */
+extern ApelexerLanguage *apelexer_language_compile(const ApelexerLanguageSpec *spec);
+extern void apelexer_language_free(ApelexerLanguage *lang);
+/* The built-in C language, compiled on first use */
+extern const ApelexerLanguage *apelexer_language_c(void);
+
+/*
+ * DFA lexer generator
+ *
+ * Token rules are regex-like patterns compiled into a single minimized DFA. Patterns support
+ * literal bytes, '.' (any byte but a newline), [a-z] and [^...] classes, the \d \w \s \n \r \t
+ * escapes (any other escaped byte is literal), grouping, '|', '*', '+' and '?'. The longest
+ * match wins and ties go to the earliest rule. Rules of type APELEXER_TOKEN_NONE are matched
+ * but not emitted, which is how whitespace and comments are skipped.
+ */
+typedef struct ApelexerRule {
+	const char *pattern;
+	ApelexerTokenType type;
+} ApelexerRule;
+
+typedef struct ApelexerDfa ApelexerDfa;
+
+typedef enum {
+	APELEXER_DFA_EMIT_TABLES, /* Transition tables driven by a loop */
+	APELEXER_DFA_EMIT_DIRECT, /* A label per state with a switch on the next byte (re2c style) */
+} ApelexerDfaEmitStyle;
+
+/* Returns NULL if a pattern is invalid or matches the empty string */
+extern ApelexerDfa *apelexer_dfa_compile(const ApelexerRule *rules, size_t rule_count);
+extern void apelexer_dfa_free(ApelexerDfa *dfa);
+/* Number of states, including the dead state */
+extern size_t apelexer_dfa_state_count(const ApelexerDfa *dfa);
+/* Length of the longest match at input[0, len) (0 if none), the index of the matching rule is stored in rule */
+extern size_t apelexer_dfa_match(const ApelexerDfa *dfa, const char *input, size_t len, int *rule);
+extern ApelexerToken *apelexer_dfa_tokenize(const ApelexerDfa *dfa, const char *input, size_t len, size_t *token_count);
+/* Writes a standalone C matcher `static int name(const char *s, size_t n, size_t *len)` which returns
+ * the index of the rule with the longest match at s (-1 if none) and stores the match length in len */
+extern void apelexer_dfa_emit_c(const ApelexerDfa *dfa, FILE *out, const char *name, ApelexerDfaEmitStyle style);
+
+/*
+ * Identifier interning
+ *
+ * A symbol table maps every distinct identifier to a dense ID starting at 1, so later passes
+ * can compare and hash names as integers. The value of an interned token points to the name
+ * stored in the table (shared by every occurrence) and stays valid until the table is freed.
+ */
+#define APELEXER_NO_SYMBOL 0
+
+typedef struct ApelexerSymbols ApelexerSymbols;
+
+extern ApelexerSymbols *apelexer_symbols_new(void);
+extern void apelexer_symbols_free(ApelexerSymbols *symbols);
+/* ID of name[0, len), interning it if it's new */
+extern uint32_t apelexer_symbols_intern(ApelexerSymbols *symbols, const char *name, size_t len);
+/* NUL-terminated name of a symbol, NULL if the ID is invalid */
+extern const char *apelexer_symbols_name(const ApelexerSymbols *symbols, uint32_t id);
+extern size_t apelexer_symbols_count(const ApelexerSymbols *symbols);
+
+/*
+ * Token arrays returned by the tokenize functions own the values of their tokens, they are
+ * allocated in a few large blocks and released together with apelexer_free_tokens().
+ */
 extern ApelexerToken *apelexer_tokenize(const char *input, size_t *token_count);
+extern ApelexerToken *apelexer_tokenize_lang(const ApelexerLanguage *lang, const char *input, size_t *token_count);
+/* Like apelexer_tokenize_lang(), identifiers are interned into symbols */
+extern ApelexerToken *apelexer_tokenize_interned(const ApelexerLanguage *lang, ApelexerSymbols *symbols, const char *input,
+						 size_t *token_count);
+extern void apelexer_free_tokens(ApelexerToken *tokens);
 extern char *apelexer_token_type_to_string(ApelexerTokenType type);
+/* Symbol ID of tokens[index] of a returned token array, APELEXER_NO_SYMBOL if it wasn't interned */
+extern uint32_t apelexer_token_symbol(const ApelexerToken *tokens, size_t index);
+/* Value of tokens[index] if it is a number of a language with decode_numbers set, 0 otherwise */
+extern ApelexerNumber apelexer_token_number(const ApelexerToken *tokens, size_t index);
+
+/*
+ * Number decoding, used by languages with decode_numbers set and usable on any token value
+ * (eg. from a compact token list). Integers are decimal unless they start with 0x, 0b or 0o.
+ * Floats are decoded exactly with a fast path for up to 15-16 significant digits and
+ * strtod() (which follows LC_NUMERIC) otherwise. Both return APELEXER_FALSE if s[0, len)
+ * isn't a valid literal or an integer doesn't fit in 64 bits
+ */
+extern int apelexer_parse_int(const char *s, size_t len, uint64_t *value);
+extern int apelexer_parse_float(const char *s, size_t len, double *value);
+
+/*
+ * Tokenize input[0, len) on up to `threads` worker threads (0 = one per CPU).
+ * The input is split at newlines that can't be inside a token, each chunk is lexed
+ * independently and the results are concatenated with line numbers fixed up, so the
+ * output is identical to apelexer_tokenize(). Small inputs are lexed on the calling thread.
+ */
+extern ApelexerToken *apelexer_tokenize_parallel(const ApelexerLanguage *lang, const char *input, size_t len, size_t *token_count,
+						 int threads);
+
+/*
+ * Compact (struct-of-arrays) token output
+ *
+ * Stores 9 bytes per token instead of a full ApelexerToken and doesn't copy values:
+ * token i's value is input[offsets[i], offsets[i] + lengths[i]). Positions are computed
+ * on demand from an index of line start offsets. Input must be smaller than 4 GiB.
+ */
+typedef struct ApelexerTokenList {
+	uint8_t *types; /* ApelexerTokenType */
+	uint32_t *offsets;
+	uint32_t *lengths;
+	size_t count;
+	size_t capacity;
+	uint32_t *line_starts; /* Offset of the first byte of every line */
+	size_t line_count;
+} ApelexerTokenList;
+
+/* Returns APELEXER_FALSE if the input is too large */
+extern int apelexer_tokenize_compact(const ApelexerLanguage *lang, const char *input, size_t len, ApelexerTokenList *list);
+/* 1-based line and column of the first byte of token index's value */
+extern void apelexer_token_list_position(const ApelexerTokenList *list, size_t index, size_t *line, size_t *column);
+extern void apelexer_token_list_free(ApelexerTokenList *list);
+
+/*
+ * Pull-based tokenizer
+ *
+ * Input is either pushed with apelexer_feed() (and closed with apelexer_finish())
+ * or pulled through a reader callback set with apelexer_set_reader(). Tokens never
+ * span an unescaped newline, so only complete lines are lexed; the trailing partial
+ * line of a chunk is carried over until more input arrives.
+ *
+ * Tokens returned by apelexer_next() point into lexer-owned memory and stay valid
+ * until the next call to apelexer_next() or apelexer_free().
+ */
+
+/* Reads up to cap bytes into buf, returns the number of bytes read (0 = end of input) */
+typedef size_t (*ApelexerReadFn)(void *user, char *buf, size_t cap);
+
+typedef enum {
+	APELEXER_NEXT_TOKEN,	  /* A token was written to tok */
+	APELEXER_NEXT_NEED_INPUT, /* More input is required, call apelexer_feed() or apelexer_finish() */
+	APELEXER_NEXT_DONE,	  /* All input was consumed */
+} ApelexerNextResult;
+
+typedef struct ApelexerCtx {
+	ApelexerReadFn read;
+	void *read_user;
+	char *buf; /* Buffered input, always NUL-terminated */
+	size_t buf_len;
+	size_t buf_cap;
+	size_t pos;   /* Scan position inside buf */
+	size_t limit; /* End of the region that can be lexed without more input */
+	size_t line;
+	size_t column;
+	int eof;
+	const ApelexerLanguage *lang;
+	ApelexerSymbols *symbols; /* Identifiers are interned if set */
+	ApelexerToken *tokens;	  /* Result of apelexer_tokenize_ctx(), reused by the next run */
+	char *value;		  /* NUL-terminated copy of the last token's value */
+	size_t value_cap;
+	uint32_t symbol;       /* Symbol ID of the last token returned by apelexer_next() */
+	ApelexerNumber number; /* Decoded value of the last token returned by apelexer_next() */
+} ApelexerCtx;
+
+extern void apelexer_init(ApelexerCtx *ctx);
+extern void apelexer_set_reader(ApelexerCtx *ctx, ApelexerReadFn read, void *user);
+extern void apelexer_set_language(ApelexerCtx *ctx, const ApelexerLanguage *lang);
+extern void apelexer_set_symbols(ApelexerCtx *ctx, ApelexerSymbols *symbols);
+extern void apelexer_feed(ApelexerCtx *ctx, const char *data, size_t len);
+extern void apelexer_finish(ApelexerCtx *ctx);
+extern ApelexerNextResult apelexer_next(ApelexerCtx *ctx, ApelexerToken *tok);
+/* Tokenizes input[0, len) with ctx's language and symbols into memory owned by ctx. The tokens
+ * stay valid until the next apelexer_tokenize_ctx(), apelexer_reset() or apelexer_free() */
+extern ApelexerToken *apelexer_tokenize_ctx(ApelexerCtx *ctx, const char *input, size_t len, size_t *token_count);
+/* Discards the input and tokens of ctx but keeps its memory (and settings) for the next run */
+extern void apelexer_reset(ApelexerCtx *ctx);
+extern void apelexer_free(ApelexerCtx *ctx);
 
 #if defined(__cplusplus)
 extern "C" {
@@ -1364,7 +1692,16 @@ extern "C" {
 #define APELEXER_IMPLEMENTATION_INCLUDED
 
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <float.h>
+
+/* Define APELEXER_NO_THREADS to make apelexer_tokenize_parallel always run on the calling thread */
+#if !defined(APELEXER_NO_THREADS) && (defined(APELEXER_LINUX) || defined(APELEXER_APPLE))
+#define APELEXER_HAS_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 /* User can define a custom function prefix (eg. static) */
 #ifndef APELEXER_DEF
@@ -1385,85 +1722,6 @@ extern "C" {
 #endif
 #endif
 
-/* BEGIN lexer.c */
-
-static const char *apelexer_keywords[] = {
-	// only keywords defined in C99
-	// clang-format off
-    "break",
-    "case",
-    "char",
-    "const",
-    "continue",
-    "default",
-    "do",
-    "double",
-    "else",
-    "enum",
-    "extern",
-    "float",
-    "for",
-    "goto",
-    "if",
-    "inline",
-    "int",
-    "long",
-    "register",
-    "return",
-    "short",
-    "signed",
-    "sizeof",
-    "static",
-    "struct",
-    "switch",
-    "typedef",
-    "union",
-    "unsigned",
-    "void",
-    "volatile",
-    "while",
-	// clang-format on
-};
-
-static const char *apelexer_operator[] = {
-	// clang-format off
-    "+", // done
-    "-", // done
-    "*", // done
-    "/", // done
-    "%", // done
-    "&", // done
-    "|", // done
-    "^", // done
-    "~", // done
-    "!", // done
-    "<<", // done
-    ">>", // done
-    "++", // done
-    "--", // done
-    "<", // done
-    ">", // done
-    "<=", // done
-    ">=", // done
-    "==", // done
-    "!=", // done
-    "&&", // done
-    "||", // done
-    "?", // done
-    "=", // done
-    "+=", // done
-    "-=", // done
-    "*=", // done
-    "/=", // done
-    "%=", // done
-    "&=", // done
-    "|=", // done
-    "^=", // done
-    "<<=", // done
-    ">>=", // done
-	// clang-format on
-};
-
 typedef enum {
 	APELEXER_ERROR_NONE,
 	APELEXER_ERROR_UNEXPECTED_CHAR,
@@ -1475,199 +1733,1673 @@ typedef enum {
 	APELEXER_ERROR_INVALID_FLOAT,
 	APELEXER_ERROR_INVALID_NUMBER,
 	APELEXER_ERROR_INVALID_CHAR,
+	APELEXER_ERROR_UNTERMINATED_COMMENT,
+	APELEXER_ERROR_NUMBER_TOO_LARGE,
+	APELEXER_ERROR_MALFORMED_NUMBER,
 } ApelexerErrorType;
 
-#define APELEXER_MAX_TOKEN_LENGTH 128
+/* Prints the error and exits */
+APELEXER_DEF void apelexer_error(ApelexerErrorType type, size_t line, size_t column);
+
+/* Character classes of a compiled language */
+#define APELEXER_CLASS_NEWLINE (1 << 0)
+#define APELEXER_CLASS_SPACE (1 << 1)
+#define APELEXER_CLASS_DIGIT (1 << 2)
+#define APELEXER_CLASS_IDENT_START (1 << 3)
+#define APELEXER_CLASS_IDENT (1 << 4)
+#define APELEXER_CLASS_OPERATOR (1 << 5) /* First character of an operator */
+#define APELEXER_CLASS_COMMENT (1 << 6)	 /* First character of a comment delimiter */
+
+struct ApelexerLanguage {
+	ApelexerLanguageSpec spec;
+	uint8_t char_class[256];
+	size_t line_comment_len; /* 0 if disabled */
+	size_t block_open_len;	 /* 0 if disabled */
+	size_t block_close_len;
+	uint16_t (*op_next)[128]; /* Operator trie transitions, 0 = no edge */
+	uint8_t *op_accept;	  /* Token type accepted in each trie state, APELEXER_TOKEN_NONE if none */
+	size_t op_states;
+	int32_t *kw_slots; /* Perfect hash slot -> keyword index, -1 if empty */
+	uint32_t kw_mask;
+	uint32_t kw_seed;
+};
 
-APELEXER_PRIVATE const char *apelexer_error_type_to_string(ApelexerErrorType type)
+typedef struct ApelexerArenaBlock {
+	struct ApelexerArenaBlock *next;
+	size_t size;
+	size_t used;
+	char data[];
+} ApelexerArenaBlock;
+
+/* Storage for token values. Resetting keeps the blocks so the next run reuses them */
+typedef struct {
+	ApelexerArenaBlock *head;
+	ApelexerArenaBlock *current; /* Blocks after the current one are free */
+} ApelexerArena;
+
+/* NUL-terminated copy of s[0, len) */
+APELEXER_DEF char *apelexer_arena_strdup(ApelexerArena *arena, const char *s, size_t len);
+APELEXER_DEF void apelexer_arena_reset(ApelexerArena *arena);
+APELEXER_DEF void apelexer_arena_release(ApelexerArena *arena);
+/* Moves all of from's blocks into to */
+APELEXER_DEF void apelexer_arena_append(ApelexerArena *to, ApelexerArena *from);
+
+/* Token arrays handed out to the user are preceded by this header, their values live in its arena.
+ * Symbols and numbers are kept in side arrays so tokens that don't need them stay small */
+typedef struct {
+	ApelexerArena arena;
+	size_t capacity;
+	uint32_t *symbols;	 /* NULL until a token is interned */
+	ApelexerNumber *numbers; /* NULL until a number is decoded */
+} ApelexerTokensHeader;
+
+#define APELEXER_TOKENS_HEADER(tokens) ((ApelexerTokensHeader *)(tokens) - 1)
+
+/* Grows tokens (a header array or NULL) to hold at least capacity tokens */
+APELEXER_DEF ApelexerToken *apelexer_tokens_reserve(ApelexerToken *tokens, size_t capacity);
+/* Stores tok at tokens[count], its value is copied into the array's arena unless it is interned */
+APELEXER_DEF ApelexerToken *apelexer_tokens_push(ApelexerToken *tokens, size_t count, ApelexerToken tok, uint32_t symbol,
+						 ApelexerNumber number);
+/* Moves the count tokens of from (a header array, freed) to tokens[at], which must have room for them */
+APELEXER_DEF void apelexer_tokens_move(ApelexerToken *tokens, size_t at, ApelexerToken *from, size_t count);
+
+/* Appends the tokens of input[0, len) to tokens (a header array or NULL) and returns the array */
+APELEXER_DEF ApelexerToken *apelexer_tokenize_into(ApelexerToken *tokens, const ApelexerLanguage *lang, ApelexerSymbols *symbols,
+						  const char *input, size_t len, size_t *token_count);
+
+typedef struct {
+	char *key;
+	uint32_t value;
+} ApelexerSymbolEntry;
+
+struct ApelexerSymbols {
+	ApelexerSymbolEntry *map; /* apedsa string hashmap, name -> ID */
+	char **names;		  /* apedsa dynamic array, ID -> name owned by the map (0 is unused) */
+	char *scratch;		  /* NUL-terminated copy of the name being looked up */
+	size_t scratch_cap;
+};
+
+struct ApelexerDfa {
+	uint8_t byte_class[256]; /* Bytes that no pattern tells apart share a class */
+	size_t class_count;
+	size_t state_count;	  /* State 0 is the dead state and 1 the start state */
+	uint16_t *next;		  /* state_count * class_count transitions */
+	int16_t *accept;	  /* Rule accepted in each state, -1 if none */
+	ApelexerTokenType *types; /* Token type of each rule */
+	size_t rule_count;
+};
+
+APELEXER_DEF int apelexer_language_is_keyword(const ApelexerLanguage *lang, const char *s, size_t n);
+/* Length of the longest operator at s (0 if none), its token type is stored in type */
+APELEXER_DEF size_t apelexer_language_match_operator(const ApelexerLanguage *lang, const char *s, size_t n, ApelexerTokenType *type);
+
+/* Scans input[i, len), tokens never extend past len */
+typedef struct {
+	const char *input;
+	size_t len;
+	size_t i;
+	size_t line;
+	size_t column;
+	const ApelexerLanguage *lang;
+	int partial;	       /* More input may follow len, a block comment reaching len is left unscanned */
+	ApelexerNumber number; /* Decoded value of the last scanned token, 0 unless the language decodes numbers */
+} ApelexerScanner;
+
+/* Scans the next token, value points into the input and is not NUL-terminated.
+ * Returns APELEXER_FALSE when the end of the scanned region is reached, in partial mode
+ * s->i may then stop short of len at the start of an unterminated block comment. */
+APELEXER_DEF int apelexer_scan(ApelexerScanner *s, ApelexerToken *tok);
+
+/* True if input[k - 1] ends a line that no token continues past: the line break isn't
+ * escaped with a backslash and isn't the \r of a (possibly incomplete) \r\n pair */
+APELEXER_DEF int apelexer_is_line_end(const char *input, size_t len, size_t k);
+
+
+
+/* BEGIN arena.c */
+
+#define APELEXER_ARENA_BLOCK_MIN (4096 - sizeof(ApelexerArenaBlock))
+#define APELEXER_ARENA_BLOCK_MAX (1 << 20)
+
+APELEXER_DEF char *apelexer_arena_strdup(ApelexerArena *arena, const char *s, size_t len)
 {
-	switch (type) {
-		case APELEXER_ERROR_NONE: return "none";
-		case APELEXER_ERROR_UNEXPECTED_CHAR: return "unexpected char";
-		case APELEXER_ERROR_UNEXPECTED_EOF: return "unexpected eof";
-		case APELEXER_ERROR_QUOTED_QUOTE: return "quoted quote";
-		case APELEXER_ERROR_UNEXPECTED_NEWLINE: return "unexpected newline";
-		case APELEXER_ERROR_UNTERMINATED_STRING: return "unterminated string";
-		case APELEXER_ERROR_CHAR_TOO_LONG: return "char too long";
-		case APELEXER_ERROR_INVALID_FLOAT: return "invalid float";
-		case APELEXER_ERROR_INVALID_NUMBER: return "invalid number";
+	size_t n = len + 1;
+	ApelexerArenaBlock *b = arena->current;
+	if (!b || b->used + n > b->size) {
+		// Move on to the next free block that is large enough, or add one after the current block
+		ApelexerArenaBlock *next = b ? b->next : arena->head;
+		while (next && next->size < n) {
+			next = next->next;
+		}
+		if (!next) {
+			size_t size = b ? b->size * 2 : APELEXER_ARENA_BLOCK_MIN;
+			if (size > APELEXER_ARENA_BLOCK_MAX)
+				size = APELEXER_ARENA_BLOCK_MAX;
+			if (size < n)
+				size = n;
+			next = APELEXER_MALLOC(sizeof(ApelexerArenaBlock) + size);
+			next->size = size;
+			if (b) {
+				next->next = b->next;
+				b->next = next;
+			} else {
+				next->next = arena->head;
+				arena->head = next;
+			}
+		}
+		next->used = 0;
+		arena->current = b = next;
 	}
-	return "unknown";
+	char *p = b->data + b->used;
+	b->used += n;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
 }
 
-APELEXER_PRIVATE void apelexer_error(ApelexerErrorType type, size_t line, size_t column)
+APELEXER_DEF void apelexer_arena_reset(ApelexerArena *arena)
 {
-	fprintf(stderr, "apelexer error: %s, at %zu:%zu\n", apelexer_error_type_to_string(type), line, column);
-	exit(1);
+	arena->current = arena->head;
+	if (arena->head)
+		arena->head->used = 0;
 }
 
-APELEXER_DEF char *apelexer_token_type_to_string(ApelexerTokenType type)
+APELEXER_DEF void apelexer_arena_release(ApelexerArena *arena)
 {
-	switch (type) {
-		case APELEXER_TOKEN_NONE: return "none";
-		case APELEXER_TOKEN_KEYWORD: return "keyword";
-		case APELEXER_TOKEN_IDENTIFIER: return "identifier";
-		case APELEXER_TOKEN_INT: return "int";
-		case APELEXER_TOKEN_FLOAT: return "float";
-		case APELEXER_TOKEN_CHAR: return "char";
-		case APELEXER_TOKEN_STRING: return "string";
-		case APELEXER_TOKEN_OPERATOR: return "operator";
-		case APELEXER_TOKEN_PREPROCESSOR: return "preprocessor";
-		case APELEXER_TOKEN_OPEN_PAREN: return "open paren";
-		case APELEXER_TOKEN_CLOSE_PAREN: return "close paren";
-		case APELEXER_TOKEN_OPEN_BRACKET: return "open bracket";
-		case APELEXER_TOKEN_CLOSE_BRACKET: return "close bracket";
-		case APELEXER_TOKEN_OPEN_BRACE: return "open brace";
-		case APELEXER_TOKEN_CLOSE_BRACE: return "close brace";
-		case APELEXER_TOKEN_COMMA: return "comma";
-		case APELEXER_TOKEN_SEMICOLON: return "semicolon";
-		case APELEXER_TOKEN_COLON: return "colon";
-		case APELEXER_TOKEN_DOT: return "dot";
-		case APELEXER_TOKEN_ARROW: return "arrow";
-		case APELEXER_TOKEN_EOF: return "eof";
+	ApelexerArenaBlock *b = arena->head;
+	while (b) {
+		ApelexerArenaBlock *next = b->next;
+		APELEXER_FREE(b);
+		b = next;
 	}
+	arena->head = NULL;
+	arena->current = NULL;
 }
 
-APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_count)
+APELEXER_DEF void apelexer_arena_append(ApelexerArena *to, ApelexerArena *from)
 {
-	ApelexerToken *tokens = NULL;
-	*token_count = 0;
-	size_t token_capacity = 0;
-	size_t i = 0;
-	size_t line = 1;
-	size_t column = 1;
-	size_t len = strlen(input);
-#define APELEXER_TOKENIZER_PUSH_TOKEN(t, v)                                               \
-	do {                                                                              \
-		if (*token_count + 1 >= token_capacity) {                                 \
-			token_capacity = token_capacity ? token_capacity * 2 : 32;        \
-			tokens = realloc(tokens, sizeof(ApelexerToken) * token_capacity); \
-		}                                                                         \
-		tokens[*token_count].type = t;                                            \
-		tokens[*token_count].value = malloc(strlen(v) + 1);                       \
-		strcpy(tokens[*token_count].value, v);                                    \
-		tokens[*token_count].length = strlen(v);                                  \
-		*token_count = *token_count + 1;                                          \
-	} while (0)
+	if (!from->head)
+		return;
+	// from's blocks go right after to's current block, so all free blocks stay behind the new current one
+	ApelexerArenaBlock *last = from->head;
+	while (last->next) {
+		last = last->next;
+	}
+	if (to->current) {
+		last->next = to->current->next;
+		to->current->next = from->head;
+	} else {
+		last->next = to->head;
+		to->head = from->head;
+	}
+	to->current = from->current ? from->current : from->head;
+	from->head = NULL;
+	from->current = NULL;
+}
 
-	while (i < len) {
-		if (input[i] == '\0') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_EOF, "EOF");
-		}
-		if (input[i] == '\n' || input[i] == '\r') {
-			line++;
-			column = 1;
-			i++;
+APELEXER_DEF ApelexerToken *apelexer_tokens_reserve(ApelexerToken *tokens, size_t capacity)
+{
+	ApelexerTokensHeader *h = tokens ? APELEXER_TOKENS_HEADER(tokens) : NULL;
+	if (h && h->capacity >= capacity)
+		return tokens;
+	size_t cap = h ? h->capacity : 32;
+	while (cap < capacity) {
+		cap *= 2;
+	}
+	size_t old_cap = h ? h->capacity : 0;
+	h = APELEXER_REALLOC(h, sizeof(ApelexerTokensHeader) + sizeof(ApelexerToken) * cap);
+	if (!tokens) {
+		memset(&h->arena, 0, sizeof(h->arena));
+		h->symbols = NULL;
+		h->numbers = NULL;
+	}
+	if (h->symbols) {
+		h->symbols = APELEXER_REALLOC(h->symbols, sizeof(uint32_t) * cap);
+		memset(h->symbols + old_cap, 0, sizeof(uint32_t) * (cap - old_cap));
+	}
+	if (h->numbers) {
+		h->numbers = APELEXER_REALLOC(h->numbers, sizeof(ApelexerNumber) * cap);
+		memset(h->numbers + old_cap, 0, sizeof(ApelexerNumber) * (cap - old_cap));
+	}
+	h->capacity = cap;
+	return (ApelexerToken *)(h + 1);
+}
+
+APELEXER_PRIVATE void *apelexer_tokens_side_array(size_t capacity, size_t size)
+{
+	void *a = APELEXER_MALLOC(size * capacity);
+	memset(a, 0, size * capacity);
+	return a;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokens_push(ApelexerToken *tokens, size_t count, ApelexerToken tok, uint32_t symbol,
+						 ApelexerNumber number)
+{
+	tokens = apelexer_tokens_reserve(tokens, count + 1);
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	if (symbol == APELEXER_NO_SYMBOL)
+		tok.value = apelexer_arena_strdup(&h->arena, tok.value, tok.length);
+	tokens[count] = tok;
+	// A reused array may hold values of an earlier run, so once allocated every slot is written
+	if (symbol != APELEXER_NO_SYMBOL && !h->symbols)
+		h->symbols = apelexer_tokens_side_array(h->capacity, sizeof(uint32_t));
+	if (h->symbols)
+		h->symbols[count] = symbol;
+	if (number.i != 0 && !h->numbers)
+		h->numbers = apelexer_tokens_side_array(h->capacity, sizeof(ApelexerNumber));
+	if (h->numbers)
+		h->numbers[count] = number;
+	return tokens;
+}
+
+APELEXER_DEF void apelexer_tokens_move(ApelexerToken *tokens, size_t at, ApelexerToken *from, size_t count)
+{
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	ApelexerTokensHeader *f = APELEXER_TOKENS_HEADER(from);
+	memcpy(&tokens[at], from, sizeof(ApelexerToken) * count);
+	if (f->symbols && !h->symbols)
+		h->symbols = apelexer_tokens_side_array(h->capacity, sizeof(uint32_t));
+	if (h->symbols) {
+		if (f->symbols)
+			memcpy(&h->symbols[at], f->symbols, sizeof(uint32_t) * count);
+		else
+			memset(&h->symbols[at], 0, sizeof(uint32_t) * count);
+	}
+	if (f->numbers && !h->numbers)
+		h->numbers = apelexer_tokens_side_array(h->capacity, sizeof(ApelexerNumber));
+	if (h->numbers) {
+		if (f->numbers)
+			memcpy(&h->numbers[at], f->numbers, sizeof(ApelexerNumber) * count);
+		else
+			memset(&h->numbers[at], 0, sizeof(ApelexerNumber) * count);
+	}
+	apelexer_arena_append(&h->arena, &f->arena);
+	apelexer_free_tokens(from);
+}
+
+APELEXER_DEF uint32_t apelexer_token_symbol(const ApelexerToken *tokens, size_t index)
+{
+	const ApelexerTokensHeader *h = (const ApelexerTokensHeader *)tokens - 1;
+	return h->symbols ? h->symbols[index] : APELEXER_NO_SYMBOL;
+}
+
+APELEXER_DEF ApelexerNumber apelexer_token_number(const ApelexerToken *tokens, size_t index)
+{
+	const ApelexerTokensHeader *h = (const ApelexerTokensHeader *)tokens - 1;
+	ApelexerNumber zero = { 0 };
+	return h->numbers ? h->numbers[index] : zero;
+}
+
+APELEXER_DEF void apelexer_free_tokens(ApelexerToken *tokens)
+{
+	if (!tokens)
+		return;
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	apelexer_arena_release(&h->arena);
+	APELEXER_FREE(h->symbols);
+	APELEXER_FREE(h->numbers);
+	APELEXER_FREE(h);
+}
+/* END arena.c */
+
+
+/* BEGIN compact.c */
+
+APELEXER_PRIVATE void apelexer_token_list_push(ApelexerTokenList *list, uint8_t type, uint32_t offset, uint32_t length)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 1024;
+		list->types = APELEXER_REALLOC(list->types, sizeof(uint8_t) * list->capacity);
+		list->offsets = APELEXER_REALLOC(list->offsets, sizeof(uint32_t) * list->capacity);
+		list->lengths = APELEXER_REALLOC(list->lengths, sizeof(uint32_t) * list->capacity);
+	}
+	list->types[list->count] = type;
+	list->offsets[list->count] = offset;
+	list->lengths[list->count] = length;
+	list->count++;
+}
+
+/* Line breaks are counted the same way the scanner counts them, \r\n is one break */
+APELEXER_PRIVATE void apelexer_token_list_index_lines(ApelexerTokenList *list, const char *input, size_t len)
+{
+	size_t cap = 256;
+	list->line_starts = APELEXER_MALLOC(sizeof(uint32_t) * cap);
+	list->line_starts[0] = 0;
+	list->line_count = 1;
+	for (size_t i = 0; i < len; i++) {
+		if (input[i] != '\n' && input[i] != '\r')
 			continue;
-		}
-		if (isspace(input[i])) {
-			column++;
+		if (input[i] == '\r' && i + 1 < len && input[i + 1] == '\n')
 			i++;
-			continue;
+		if (list->line_count == cap) {
+			cap *= 2;
+			list->line_starts = APELEXER_REALLOC(list->line_starts, sizeof(uint32_t) * cap);
 		}
-		if (input[i] == '"') {
-			i++, column++;
-			size_t start_line = line;
-			size_t start_column = column;
-			size_t start = i;
-			while (i < len) {
-				if (input[i] == '\n' || input[i] == '\r') {
-					if (input[i - 1] != '\\')
-						apelexer_error(APELEXER_ERROR_UNTERMINATED_STRING, line, column);
-					line++, column = 1;
-				}
-				if (input[i] == '"' && input[i - 1] != '\\') {
-					break;
+		list->line_starts[list->line_count++] = (uint32_t)(i + 1);
+	}
+}
+
+APELEXER_DEF int apelexer_tokenize_compact(const ApelexerLanguage *lang, const char *input, size_t len, ApelexerTokenList *list)
+{
+	memset(list, 0, sizeof(*list));
+	if (len > UINT32_MAX)
+		return APELEXER_FALSE;
+	ApelexerScanner s = { input, len, 0, 1, 1, lang, APELEXER_FALSE, { 0 } };
+	ApelexerToken tok;
+	while (apelexer_scan(&s, &tok)) {
+		apelexer_token_list_push(list, (uint8_t)tok.type, (uint32_t)(tok.value - input), (uint32_t)tok.length);
+	}
+	apelexer_token_list_index_lines(list, input, len);
+	return APELEXER_TRUE;
+}
+
+APELEXER_DEF void apelexer_token_list_position(const ApelexerTokenList *list, size_t index, size_t *line, size_t *column)
+{
+	uint32_t offset = list->offsets[index];
+	size_t lo = 0;
+	size_t hi = list->line_count;
+	// find the last line that starts at or before offset
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (list->line_starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*line = lo + 1;
+	*column = offset - list->line_starts[lo] + 1;
+}
+
+APELEXER_DEF void apelexer_token_list_free(ApelexerTokenList *list)
+{
+	APELEXER_FREE(list->types);
+	APELEXER_FREE(list->offsets);
+	APELEXER_FREE(list->lengths);
+	APELEXER_FREE(list->line_starts);
+	memset(list, 0, sizeof(*list));
+}
+/* END compact.c */
+
+
+/* BEGIN dfa.c */
+
+/*
+ * DFA lexer generator
+ *
+ * Every rule is parsed into a Thompson NFA, all rules share one start set and the subset
+ * construction turns them into a DFA over byte classes (bytes no pattern tells apart),
+ * which is then minimized with Moore's partition refinement.
+ */
+
+typedef enum {
+	APELEXER_NFA_EPSILON,
+	APELEXER_NFA_SET,
+	APELEXER_NFA_ACCEPT,
+} ApelexerNfaKind;
+
+typedef struct {
+	ApelexerNfaKind kind;
+	int32_t out;  /* -1 if none */
+	int32_t out2; /* Second epsilon edge, -1 if none */
+	int32_t rule; /* Rule of an accept node */
+	uint8_t set[32];
+} ApelexerNfaNode;
+
+typedef struct {
+	ApelexerNfaNode *nodes;
+	size_t count;
+	size_t capacity;
+	const char *p; /* Parse position in the current pattern */
+	int error;
+} ApelexerNfa;
+
+/* Nodes are referenced by index since the node array moves as it grows */
+typedef struct {
+	int32_t start;
+	int32_t end; /* Epsilon node with no out edge yet */
+} ApelexerNfaFrag;
+
+#define APELEXER_SET_HAS(set, c) ((set)[(uint8_t)(c) >> 3] & (1u << ((uint8_t)(c) & 7)))
+#define APELEXER_SET_ADD(set, c) ((set)[(uint8_t)(c) >> 3] |= (uint8_t)(1u << ((uint8_t)(c) & 7)))
+
+APELEXER_PRIVATE int32_t apelexer_nfa_node(ApelexerNfa *nfa, ApelexerNfaKind kind)
+{
+	if (nfa->count == nfa->capacity) {
+		nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+		nfa->nodes = APELEXER_REALLOC(nfa->nodes, sizeof(ApelexerNfaNode) * nfa->capacity);
+	}
+	ApelexerNfaNode *node = &nfa->nodes[nfa->count];
+	memset(node, 0, sizeof(*node));
+	node->kind = kind;
+	node->out = -1;
+	node->out2 = -1;
+	node->rule = -1;
+	return (int32_t)nfa->count++;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_set(ApelexerNfa *nfa, const uint8_t *set)
+{
+	int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+	int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_SET);
+	memcpy(nfa->nodes[start].set, set, sizeof(nfa->nodes[start].set));
+	nfa->nodes[start].out = end;
+	return (ApelexerNfaFrag){ start, end };
+}
+
+/* Adds the bytes matched by the escape after a backslash to set */
+APELEXER_PRIVATE void apelexer_nfa_escape(ApelexerNfa *nfa, uint8_t *set)
+{
+	char c = *nfa->p;
+	if (!c) {
+		nfa->error = APELEXER_TRUE;
+		return;
+	}
+	nfa->p++;
+	switch (c) {
+		case 'd':
+			for (int b = '0'; b <= '9'; b++) {
+				APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 'w':
+			for (int b = 0; b < 256; b++) {
+				if (isalnum(b) || b == '_')
+					APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 's':
+			for (int b = 0; b < 256; b++) {
+				if (isspace(b))
+					APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 'n': APELEXER_SET_ADD(set, '\n'); break;
+		case 'r': APELEXER_SET_ADD(set, '\r'); break;
+		case 't': APELEXER_SET_ADD(set, '\t'); break;
+		default: APELEXER_SET_ADD(set, c); break;
+	}
+}
+
+/* Parses a bracket expression after the opening '[' */
+APELEXER_PRIVATE void apelexer_nfa_class(ApelexerNfa *nfa, uint8_t *set)
+{
+	int negate = APELEXER_FALSE;
+	if (*nfa->p == '^') {
+		negate = APELEXER_TRUE;
+		nfa->p++;
+	}
+	const char *first = nfa->p;
+	while (*nfa->p && !nfa->error && (*nfa->p != ']' || nfa->p == first)) {
+		if (*nfa->p == '\\') {
+			nfa->p++;
+			apelexer_nfa_escape(nfa, set);
+			continue;
+		}
+		uint8_t lo = (uint8_t)*nfa->p++;
+		if (nfa->p[0] == '-' && nfa->p[1] && nfa->p[1] != ']') {
+			uint8_t hi = (uint8_t)nfa->p[1];
+			nfa->p += 2;
+			if (hi < lo) {
+				nfa->error = APELEXER_TRUE;
+				return;
+			}
+			for (int b = lo; b <= hi; b++) {
+				APELEXER_SET_ADD(set, b);
+			}
+		} else {
+			APELEXER_SET_ADD(set, lo);
+		}
+	}
+	if (*nfa->p != ']') {
+		nfa->error = APELEXER_TRUE;
+		return;
+	}
+	nfa->p++;
+	if (negate) {
+		for (int k = 0; k < 32; k++) {
+			set[k] = (uint8_t)~set[k];
+		}
+	}
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_alternation(ApelexerNfa *nfa);
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_atom(ApelexerNfa *nfa)
+{
+	uint8_t set[32] = { 0 };
+	char c = *nfa->p++;
+	switch (c) {
+		case '(': {
+			ApelexerNfaFrag frag = apelexer_nfa_alternation(nfa);
+			if (*nfa->p != ')') {
+				nfa->error = APELEXER_TRUE;
+				return frag;
+			}
+			nfa->p++;
+			return frag;
+		}
+		case '[': apelexer_nfa_class(nfa, set); break;
+		case '.':
+			memset(set, 0xff, sizeof(set));
+			set['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+			break;
+		case '\\': apelexer_nfa_escape(nfa, set); break;
+		case '*':
+		case '+':
+		case '?': nfa->error = APELEXER_TRUE; break;
+		default: APELEXER_SET_ADD(set, c); break;
+	}
+	return apelexer_nfa_set(nfa, set);
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_repeat(ApelexerNfa *nfa)
+{
+	ApelexerNfaFrag frag = apelexer_nfa_atom(nfa);
+	while (!nfa->error && (*nfa->p == '*' || *nfa->p == '+' || *nfa->p == '?')) {
+		char op = *nfa->p++;
+		int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		if (op == '+') {
+			nfa->nodes[frag.end].out = frag.start;
+			nfa->nodes[frag.end].out2 = end;
+		} else {
+			int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+			nfa->nodes[start].out = frag.start;
+			nfa->nodes[start].out2 = end;
+			nfa->nodes[frag.end].out = op == '*' ? frag.start : end;
+			if (op == '*')
+				nfa->nodes[frag.end].out2 = end;
+			frag.start = start;
+		}
+		frag.end = end;
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_concat(ApelexerNfa *nfa)
+{
+	int32_t empty = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+	ApelexerNfaFrag frag = { empty, empty };
+	while (!nfa->error && *nfa->p && *nfa->p != '|' && *nfa->p != ')') {
+		ApelexerNfaFrag next = apelexer_nfa_repeat(nfa);
+		nfa->nodes[frag.end].out = next.start;
+		frag.end = next.end;
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_alternation(ApelexerNfa *nfa)
+{
+	ApelexerNfaFrag frag = apelexer_nfa_concat(nfa);
+	while (!nfa->error && *nfa->p == '|') {
+		nfa->p++;
+		ApelexerNfaFrag other = apelexer_nfa_concat(nfa);
+		int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		nfa->nodes[start].out = frag.start;
+		nfa->nodes[start].out2 = other.start;
+		nfa->nodes[frag.end].out = end;
+		nfa->nodes[other.end].out = end;
+		frag = (ApelexerNfaFrag){ start, end };
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE int apelexer_nfa_compare(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Epsilon closure of the depth nodes on stack, only set and accept nodes are kept, sorted, in out */
+APELEXER_PRIVATE size_t apelexer_nfa_closure(const ApelexerNfa *nfa, int32_t *stack, size_t depth, uint32_t *mark, uint32_t stamp, int32_t *out)
+{
+	size_t n = 0;
+	while (depth > 0) {
+		int32_t k = stack[--depth];
+		if (k < 0 || mark[k] == stamp)
+			continue;
+		mark[k] = stamp;
+		const ApelexerNfaNode *node = &nfa->nodes[k];
+		if (node->kind == APELEXER_NFA_EPSILON) {
+			stack[depth++] = node->out;
+			stack[depth++] = node->out2;
+		} else {
+			out[n++] = k;
+		}
+	}
+	qsort(out, n, sizeof(int32_t), apelexer_nfa_compare);
+	return n;
+}
+
+APELEXER_PRIVATE uint32_t apelexer_dfa_hash(const uint32_t *words, size_t n)
+{
+	uint32_t h = 2166136261u;
+	for (size_t k = 0; k < n; k++) {
+		h = (h ^ words[k]) * 16777619u;
+	}
+	return h;
+}
+
+/* DFA states are deduplicated by their NFA node sets (subset construction) or by their
+ * signatures (minimization) through an open addressing table of state indices */
+typedef struct {
+	uint32_t *slots; /* State index + 1, 0 = empty */
+	uint32_t mask;
+} ApelexerDfaTable;
+
+APELEXER_PRIVATE void apelexer_dfa_table_init(ApelexerDfaTable *t, size_t max_states)
+{
+	size_t cap = 64;
+	while (cap < max_states * 2) {
+		cap *= 2;
+	}
+	t->slots = APELEXER_MALLOC(sizeof(uint32_t) * cap);
+	memset(t->slots, 0, sizeof(uint32_t) * cap);
+	t->mask = (uint32_t)(cap - 1);
+}
+
+typedef struct {
+	uint32_t *items; /* NFA node sets of all states, back to back */
+	size_t items_len;
+	size_t items_cap;
+	size_t *offsets;
+	size_t *lengths;
+	uint32_t *next; /* count * class_count transitions */
+	size_t count;
+	size_t capacity;
+	size_t class_count;
+	ApelexerDfaTable table;
+} ApelexerDfaBuilder;
+
+#define APELEXER_DFA_MAX_STATES 65535
+
+/* Index of the state with the given node set, adds it if it's new. Returns -1 if there are too many states */
+APELEXER_PRIVATE int64_t apelexer_dfa_builder_state(ApelexerDfaBuilder *b, const int32_t *set, size_t n)
+{
+	uint32_t h = apelexer_dfa_hash((const uint32_t *)set, n);
+	uint32_t slot = h & b->table.mask;
+	while (b->table.slots[slot]) {
+		size_t s = b->table.slots[slot] - 1;
+		if (b->lengths[s] == n && memcmp(&b->items[b->offsets[s]], set, n * sizeof(int32_t)) == 0)
+			return (int64_t)s;
+		slot = (slot + 1) & b->table.mask;
+	}
+	if (b->count == APELEXER_DFA_MAX_STATES)
+		return -1;
+	if (b->count == b->capacity) {
+		b->capacity *= 2;
+		b->offsets = APELEXER_REALLOC(b->offsets, sizeof(size_t) * b->capacity);
+		b->lengths = APELEXER_REALLOC(b->lengths, sizeof(size_t) * b->capacity);
+		b->next = APELEXER_REALLOC(b->next, sizeof(uint32_t) * b->capacity * b->class_count);
+	}
+	while (b->items_len + n > b->items_cap) {
+		b->items_cap *= 2;
+		b->items = APELEXER_REALLOC(b->items, sizeof(uint32_t) * b->items_cap);
+	}
+	memcpy(&b->items[b->items_len], set, n * sizeof(int32_t));
+	b->offsets[b->count] = b->items_len;
+	b->lengths[b->count] = n;
+	b->items_len += n;
+	b->table.slots[slot] = (uint32_t)b->count + 1;
+	return (int64_t)b->count++;
+}
+
+/* Merges equivalent states of the subset construction and writes the result to dfa */
+APELEXER_PRIVATE int apelexer_dfa_minimize(ApelexerDfa *dfa, const uint32_t *next, const int16_t *accept, size_t count)
+{
+	size_t k = dfa->class_count;
+	uint32_t *group = APELEXER_MALLOC(sizeof(uint32_t) * count);
+	uint32_t *new_group = APELEXER_MALLOC(sizeof(uint32_t) * count);
+	uint32_t *sig = APELEXER_MALLOC(sizeof(uint32_t) * (k + 1));
+	uint32_t *other = APELEXER_MALLOC(sizeof(uint32_t) * (k + 1));
+	ApelexerDfaTable table;
+	apelexer_dfa_table_init(&table, count);
+
+	// Start with one group per accepted rule and one for the non-accepting states
+	size_t groups = 0;
+	uint32_t *rule_group = APELEXER_MALLOC(sizeof(uint32_t) * (dfa->rule_count + 1));
+	memset(rule_group, 0xff, sizeof(uint32_t) * (dfa->rule_count + 1));
+	for (size_t s = 0; s < count; s++) {
+		uint32_t *g = &rule_group[accept[s] + 1];
+		if (*g == UINT32_MAX)
+			*g = (uint32_t)groups++;
+		group[s] = *g;
+	}
+	APELEXER_FREE(rule_group);
+
+	// Split groups by the groups their transitions lead to until nothing changes
+	for (;;) {
+		memset(table.slots, 0, sizeof(uint32_t) * ((size_t)table.mask + 1));
+		size_t new_groups = 0;
+		for (size_t s = 0; s < count; s++) {
+			sig[0] = group[s];
+			for (size_t c = 0; c < k; c++) {
+				sig[c + 1] = group[next[s * k + c]];
+			}
+			uint32_t slot = apelexer_dfa_hash(sig, k + 1) & table.mask;
+			for (;;) {
+				if (!table.slots[slot]) {
+					table.slots[slot] = (uint32_t)s + 1;
+					new_group[s] = (uint32_t)new_groups++;
+					break;
+				}
+				size_t r = table.slots[slot] - 1;
+				other[0] = group[r];
+				for (size_t c = 0; c < k; c++) {
+					other[c + 1] = group[next[r * k + c]];
+				}
+				if (memcmp(sig, other, sizeof(uint32_t) * (k + 1)) == 0) {
+					new_group[s] = new_group[r];
+					break;
 				}
-				if (input[i] == '\\') {
+				slot = (slot + 1) & table.mask;
+			}
+		}
+		uint32_t *tmp = group;
+		group = new_group;
+		new_group = tmp;
+		if (new_groups == groups)
+			break;
+		groups = new_groups;
+	}
+
+	int ok = group[1] != group[0]; // A start state equivalent to the dead state matches nothing
+	if (ok) {
+		// Number the groups so the dead state is 0 and the start state 1
+		uint32_t *id = new_group;
+		memset(id, 0xff, sizeof(uint32_t) * count);
+		uint32_t *rep = APELEXER_MALLOC(sizeof(uint32_t) * groups);
+		size_t n = 0;
+		for (size_t s = 0; s < count; s++) {
+			if (id[group[s]] == UINT32_MAX) {
+				id[group[s]] = (uint32_t)n;
+				rep[n++] = (uint32_t)s;
+			}
+		}
+		dfa->state_count = n;
+		dfa->next = APELEXER_MALLOC(sizeof(uint16_t) * n * k);
+		dfa->accept = APELEXER_MALLOC(sizeof(int16_t) * n);
+		for (size_t d = 0; d < n; d++) {
+			for (size_t c = 0; c < k; c++) {
+				dfa->next[d * k + c] = (uint16_t)id[group[next[rep[d] * k + c]]];
+			}
+			dfa->accept[d] = accept[rep[d]];
+		}
+		APELEXER_FREE(rep);
+	}
+
+	APELEXER_FREE(table.slots);
+	APELEXER_FREE(other);
+	APELEXER_FREE(sig);
+	APELEXER_FREE(new_group);
+	APELEXER_FREE(group);
+	return ok;
+}
+
+APELEXER_PRIVATE int apelexer_dfa_build(ApelexerDfa *dfa, ApelexerNfa *nfa, int32_t *starts)
+{
+	// Split the bytes into classes that every set node either fully contains or excludes
+	size_t classes = 1;
+	int map[512];
+	for (size_t n = 0; n < nfa->count; n++) {
+		if (nfa->nodes[n].kind != APELEXER_NFA_SET)
+			continue;
+		memset(map, 0xff, sizeof(map));
+		size_t new_classes = 0;
+		for (int b = 0; b < 256; b++) {
+			int key = dfa->byte_class[b] * 2 + (APELEXER_SET_HAS(nfa->nodes[n].set, b) ? 1 : 0);
+			if (map[key] < 0)
+				map[key] = (int)new_classes++;
+			dfa->byte_class[b] = (uint8_t)map[key];
+		}
+		classes = new_classes;
+	}
+	dfa->class_count = classes;
+	uint8_t rep[256];
+	for (int b = 255; b >= 0; b--) {
+		rep[dfa->byte_class[b]] = (uint8_t)b;
+	}
+
+	ApelexerDfaBuilder b = { 0 };
+	b.capacity = 64;
+	b.class_count = classes;
+	b.offsets = APELEXER_MALLOC(sizeof(size_t) * b.capacity);
+	b.lengths = APELEXER_MALLOC(sizeof(size_t) * b.capacity);
+	b.next = APELEXER_MALLOC(sizeof(uint32_t) * b.capacity * classes);
+	b.items_cap = 256;
+	b.items = APELEXER_MALLOC(sizeof(uint32_t) * b.items_cap);
+	apelexer_dfa_table_init(&b.table, APELEXER_DFA_MAX_STATES);
+
+	uint32_t *mark = APELEXER_MALLOC(sizeof(uint32_t) * nfa->count);
+	memset(mark, 0, sizeof(uint32_t) * nfa->count);
+	uint32_t stamp = 0;
+	int32_t *stack = APELEXER_MALLOC(sizeof(int32_t) * (nfa->count * 3 + dfa->rule_count));
+	int32_t *set = APELEXER_MALLOC(sizeof(int32_t) * nfa->count);
+
+	apelexer_dfa_builder_state(&b, set, 0); // Dead state
+	memcpy(stack, starts, sizeof(int32_t) * dfa->rule_count);
+	size_t n = apelexer_nfa_closure(nfa, stack, dfa->rule_count, mark, ++stamp, set);
+	apelexer_dfa_builder_state(&b, set, n);
+
+	int ok = APELEXER_TRUE;
+	for (size_t s = 0; s < b.count && ok; s++) {
+		for (size_t c = 0; c < classes; c++) {
+			size_t depth = 0;
+			for (size_t k = 0; k < b.lengths[s]; k++) {
+				const ApelexerNfaNode *node = &nfa->nodes[b.items[b.offsets[s] + k]];
+				if (node->kind == APELEXER_NFA_SET && APELEXER_SET_HAS(node->set, rep[c]))
+					stack[depth++] = node->out;
+			}
+			n = apelexer_nfa_closure(nfa, stack, depth, mark, ++stamp, set);
+			int64_t target = apelexer_dfa_builder_state(&b, set, n);
+			if (target < 0) {
+				ok = APELEXER_FALSE;
+				break;
+			}
+			b.next[s * classes + c] = (uint32_t)target;
+		}
+	}
+
+	int16_t *accept = NULL;
+	if (ok) {
+		// Ties go to the earliest rule, accept nodes are numbered in rule order
+		accept = APELEXER_MALLOC(sizeof(int16_t) * b.count);
+		for (size_t s = 0; s < b.count; s++) {
+			accept[s] = -1;
+			for (size_t k = 0; k < b.lengths[s]; k++) {
+				const ApelexerNfaNode *node = &nfa->nodes[b.items[b.offsets[s] + k]];
+				if (node->kind == APELEXER_NFA_ACCEPT && (accept[s] < 0 || node->rule < accept[s]))
+					accept[s] = (int16_t)node->rule;
+			}
+		}
+		ok = accept[1] < 0 && apelexer_dfa_minimize(dfa, b.next, accept, b.count);
+	}
+
+	APELEXER_FREE(accept);
+	APELEXER_FREE(set);
+	APELEXER_FREE(stack);
+	APELEXER_FREE(mark);
+	APELEXER_FREE(b.table.slots);
+	APELEXER_FREE(b.items);
+	APELEXER_FREE(b.next);
+	APELEXER_FREE(b.lengths);
+	APELEXER_FREE(b.offsets);
+	return ok;
+}
+
+APELEXER_DEF ApelexerDfa *apelexer_dfa_compile(const ApelexerRule *rules, size_t rule_count)
+{
+	if (rule_count == 0 || rule_count > INT16_MAX)
+		return NULL;
+	ApelexerNfa nfa = { 0 };
+	int32_t *starts = APELEXER_MALLOC(sizeof(int32_t) * rule_count);
+	for (size_t r = 0; r < rule_count && !nfa.error; r++) {
+		nfa.p = rules[r].pattern;
+		if (!nfa.p) {
+			nfa.error = APELEXER_TRUE;
+			break;
+		}
+		ApelexerNfaFrag frag = apelexer_nfa_alternation(&nfa);
+		if (*nfa.p)
+			nfa.error = APELEXER_TRUE; // Unbalanced ')'
+		int32_t accept = apelexer_nfa_node(&nfa, APELEXER_NFA_ACCEPT);
+		nfa.nodes[accept].rule = (int32_t)r;
+		nfa.nodes[frag.end].out = accept;
+		starts[r] = frag.start;
+	}
+
+	ApelexerDfa *dfa = NULL;
+	if (!nfa.error) {
+		dfa = APELEXER_MALLOC(sizeof(ApelexerDfa));
+		memset(dfa, 0, sizeof(*dfa));
+		dfa->rule_count = rule_count;
+		dfa->types = APELEXER_MALLOC(sizeof(ApelexerTokenType) * rule_count);
+		for (size_t r = 0; r < rule_count; r++) {
+			dfa->types[r] = rules[r].type;
+		}
+		if (!apelexer_dfa_build(dfa, &nfa, starts)) {
+			apelexer_dfa_free(dfa);
+			dfa = NULL;
+		}
+	}
+	APELEXER_FREE(starts);
+	APELEXER_FREE(nfa.nodes);
+	return dfa;
+}
+
+APELEXER_DEF void apelexer_dfa_free(ApelexerDfa *dfa)
+{
+	if (!dfa)
+		return;
+	APELEXER_FREE(dfa->next);
+	APELEXER_FREE(dfa->accept);
+	APELEXER_FREE(dfa->types);
+	APELEXER_FREE(dfa);
+}
+
+APELEXER_DEF size_t apelexer_dfa_state_count(const ApelexerDfa *dfa)
+{
+	return dfa->state_count;
+}
+
+APELEXER_DEF size_t apelexer_dfa_match(const ApelexerDfa *dfa, const char *input, size_t len, int *rule)
+{
+	const uint16_t *next = dfa->next;
+	const uint8_t *byte_class = dfa->byte_class;
+	size_t k = dfa->class_count;
+	size_t state = 1;
+	size_t match = 0;
+	*rule = -1;
+	for (size_t i = 0; i < len; i++) {
+		state = next[state * k + byte_class[(uint8_t)input[i]]];
+		if (!state)
+			break;
+		if (dfa->accept[state] >= 0) {
+			*rule = dfa->accept[state];
+			match = i + 1;
+		}
+	}
+	return match;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_dfa_tokenize(const ApelexerDfa *dfa, const char *input, size_t len, size_t *token_count)
+{
+	ApelexerToken *tokens = NULL;
+	size_t line = 1, column = 1;
+	size_t i = 0;
+	*token_count = 0;
+	while (i < len) {
+		int rule;
+		size_t n = apelexer_dfa_match(dfa, input + i, len - i, &rule);
+		if (n == 0)
+			apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
+		ApelexerToken tok;
+		tok.type = dfa->types[rule];
+		tok.length = n;
+		tok.start_line = line;
+		tok.start_column = column;
+		for (size_t k = i; k < i + n; k++) {
+			if (input[k] == '\n' || (input[k] == '\r' && (k + 1 >= len || input[k + 1] != '\n'))) {
+				line++;
+				column = 1;
+			} else {
+				column++;
+			}
+		}
+		tok.end_line = line;
+		tok.end_column = column;
+		if (tok.type != APELEXER_TOKEN_NONE) {
+			tok.value = (char *)input + i;
+			tokens = apelexer_tokens_push(tokens, (*token_count)++, tok, APELEXER_NO_SYMBOL, (ApelexerNumber){ 0 });
+		}
+		i += n;
+	}
+	return tokens;
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_byte(FILE *out, int b)
+{
+	if (b == '\'' || b == '\\')
+		fprintf(out, "'\\%c'", b);
+	else if (isprint(b))
+		fprintf(out, "'%c'", b);
+	else
+		fprintf(out, "0x%02x", b);
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_tables(const ApelexerDfa *dfa, FILE *out, const char *name)
+{
+	size_t k = dfa->class_count;
+	fprintf(out, "static const unsigned char %s_class[256] = {", name);
+	for (int b = 0; b < 256; b++) {
+		fprintf(out, "%s%d,", b % 16 ? " " : "\n\t", dfa->byte_class[b]);
+	}
+	fprintf(out, "\n};\n\nstatic const unsigned short %s_next[%zu][%zu] = {\n", name, dfa->state_count, k);
+	for (size_t s = 0; s < dfa->state_count; s++) {
+		fprintf(out, "\t{");
+		for (size_t c = 0; c < k; c++) {
+			fprintf(out, "%s%u,", c % 16 ? " " : c ? "\n\t " : " ", dfa->next[s * k + c]);
+		}
+		fprintf(out, " },\n");
+	}
+	fprintf(out, "};\n\nstatic const short %s_accept[%zu] = {", name, dfa->state_count);
+	for (size_t s = 0; s < dfa->state_count; s++) {
+		fprintf(out, "%s%d,", s % 16 ? " " : "\n\t", dfa->accept[s]);
+	}
+	fprintf(out, "\n};\n\n");
+	fprintf(out, "static int %s(const char *s, size_t n, size_t *len)\n{\n", name);
+	fprintf(out, "\tunsigned state = 1;\n\tint rule = -1;\n\t*len = 0;\n");
+	fprintf(out, "\tfor (size_t i = 0; i < n; i++) {\n");
+	fprintf(out, "\t\tstate = %s_next[state][%s_class[(unsigned char)s[i]]];\n", name, name);
+	fprintf(out, "\t\tif (!state)\n\t\t\tbreak;\n");
+	fprintf(out, "\t\tif (%s_accept[state] >= 0) {\n\t\t\trule = %s_accept[state];\n\t\t\t*len = i + 1;\n\t\t}\n", name, name);
+	fprintf(out, "\t}\n\treturn rule;\n}\n");
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_direct(const ApelexerDfa *dfa, FILE *out, const char *name)
+{
+	size_t k = dfa->class_count;
+	uint8_t *targeted = APELEXER_MALLOC(dfa->state_count);
+	memset(targeted, 0, dfa->state_count);
+	for (size_t t = 0; t < dfa->state_count * k; t++) {
+		targeted[dfa->next[t]] = APELEXER_TRUE;
+	}
+
+	fprintf(out, "static int %s(const char *s, size_t n, size_t *len)\n{\n", name);
+	fprintf(out, "\tsize_t i = 0;\n\tint rule = -1;\n\t*len = 0;\n");
+	for (size_t s = 1; s < dfa->state_count; s++) {
+		if (targeted[s])
+			fprintf(out, "s%zu:\n", s);
+		if (dfa->accept[s] >= 0)
+			fprintf(out, "\trule = %d;\n\t*len = i;\n", dfa->accept[s]);
+		int live = APELEXER_FALSE;
+		for (size_t c = 0; c < k; c++) {
+			live |= dfa->next[s * k + c] != 0;
+		}
+		if (!live) {
+			fprintf(out, "\treturn rule;\n");
+			continue;
+		}
+		fprintf(out, "\tif (i == n)\n\t\treturn rule;\n\tswitch ((unsigned char)s[i++]) {\n");
+		// One case list per target state, bytes leading to the dead state fall through to default
+		for (size_t t = 1; t < dfa->state_count; t++) {
+			int cases = 0;
+			for (int b = 0; b < 256; b++) {
+				if (dfa->next[s * k + dfa->byte_class[b]] != t)
+					continue;
+				fprintf(out, "%s", cases % 8 ? " " : cases ? "\n\t\t" : "\t\t");
+				fprintf(out, "case ");
+				apelexer_dfa_emit_byte(out, b);
+				fprintf(out, ":");
+				cases++;
+			}
+			if (cases)
+				fprintf(out, "\n\t\t\tgoto s%zu;\n", t);
+		}
+		fprintf(out, "\t\tdefault:\n\t\t\treturn rule;\n\t}\n");
+	}
+	fprintf(out, "}\n");
+	APELEXER_FREE(targeted);
+}
+
+APELEXER_DEF void apelexer_dfa_emit_c(const ApelexerDfa *dfa, FILE *out, const char *name, ApelexerDfaEmitStyle style)
+{
+	fprintf(out, "/* Generated by apelexer: %zu states, %zu byte classes */\n", dfa->state_count, dfa->class_count);
+	fprintf(out, "/* Rule token types:");
+	for (size_t r = 0; r < dfa->rule_count; r++) {
+		fprintf(out, " %zu=%s", r, apelexer_token_type_to_string(dfa->types[r]));
+	}
+	fprintf(out, " */\n");
+	switch (style) {
+		case APELEXER_DFA_EMIT_TABLES: apelexer_dfa_emit_tables(dfa, out, name); break;
+		case APELEXER_DFA_EMIT_DIRECT: apelexer_dfa_emit_direct(dfa, out, name); break;
+	}
+}
+
+#undef APELEXER_SET_HAS
+#undef APELEXER_SET_ADD
+/* END dfa.c */
+
+
+/* BEGIN language.c */
+
+static const char *const apelexer_keywords[] = {
+	// only keywords defined in C99
+	// clang-format off
+    "break",
+    "case",
+    "char",
+    "const",
+    "continue",
+    "default",
+    "do",
+    "double",
+    "else",
+    "enum",
+    "extern",
+    "float",
+    "for",
+    "goto",
+    "if",
+    "inline",
+    "int",
+    "long",
+    "register",
+    "return",
+    "short",
+    "signed",
+    "sizeof",
+    "static",
+    "struct",
+    "switch",
+    "typedef",
+    "union",
+    "unsigned",
+    "void",
+    "volatile",
+    "while",
+	// clang-format on
+};
+
+static const ApelexerOperatorDef apelexer_operators[] = {
+	// clang-format off
+    { "+", APELEXER_TOKEN_OPERATOR },
+    { "-", APELEXER_TOKEN_OPERATOR },
+    { "*", APELEXER_TOKEN_OPERATOR },
+    { "/", APELEXER_TOKEN_OPERATOR },
+    { "%", APELEXER_TOKEN_OPERATOR },
+    { "&", APELEXER_TOKEN_OPERATOR },
+    { "|", APELEXER_TOKEN_OPERATOR },
+    { "^", APELEXER_TOKEN_OPERATOR },
+    { "~", APELEXER_TOKEN_OPERATOR },
+    { "!", APELEXER_TOKEN_OPERATOR },
+    { "<<", APELEXER_TOKEN_OPERATOR },
+    { ">>", APELEXER_TOKEN_OPERATOR },
+    { "++", APELEXER_TOKEN_OPERATOR },
+    { "--", APELEXER_TOKEN_OPERATOR },
+    { "<", APELEXER_TOKEN_OPERATOR },
+    { ">", APELEXER_TOKEN_OPERATOR },
+    { "<=", APELEXER_TOKEN_OPERATOR },
+    { ">=", APELEXER_TOKEN_OPERATOR },
+    { "==", APELEXER_TOKEN_OPERATOR },
+    { "!=", APELEXER_TOKEN_OPERATOR },
+    { "&&", APELEXER_TOKEN_OPERATOR },
+    { "||", APELEXER_TOKEN_OPERATOR },
+    { "?", APELEXER_TOKEN_OPERATOR },
+    { "=", APELEXER_TOKEN_OPERATOR },
+    { "+=", APELEXER_TOKEN_OPERATOR },
+    { "-=", APELEXER_TOKEN_OPERATOR },
+    { "*=", APELEXER_TOKEN_OPERATOR },
+    { "/=", APELEXER_TOKEN_OPERATOR },
+    { "%=", APELEXER_TOKEN_OPERATOR },
+    { "&=", APELEXER_TOKEN_OPERATOR },
+    { "|=", APELEXER_TOKEN_OPERATOR },
+    { "^=", APELEXER_TOKEN_OPERATOR },
+    { "<<=", APELEXER_TOKEN_OPERATOR },
+    { ">>=", APELEXER_TOKEN_OPERATOR },
+    { "->", APELEXER_TOKEN_ARROW },
+    { "(", APELEXER_TOKEN_OPEN_PAREN },
+    { ")", APELEXER_TOKEN_CLOSE_PAREN },
+    { "[", APELEXER_TOKEN_OPEN_BRACKET },
+    { "]", APELEXER_TOKEN_CLOSE_BRACKET },
+    { "{", APELEXER_TOKEN_OPEN_BRACE },
+    { "}", APELEXER_TOKEN_CLOSE_BRACE },
+    { ",", APELEXER_TOKEN_COMMA },
+    { ";", APELEXER_TOKEN_SEMICOLON },
+    { ":", APELEXER_TOKEN_COLON },
+    { ".", APELEXER_TOKEN_DOT },
+	// clang-format on
+};
+
+static const ApelexerLanguageSpec apelexer_c_spec = {
+	.keywords = apelexer_keywords,
+	.keyword_count = sizeof(apelexer_keywords) / sizeof(apelexer_keywords[0]),
+	.operators = apelexer_operators,
+	.operator_count = sizeof(apelexer_operators) / sizeof(apelexer_operators[0]),
+	.line_comment = "//",
+	.block_comment_open = "/*",
+	.block_comment_close = "*/",
+	.string_quote = '"',
+	.char_quote = '\'',
+	.escapes = APELEXER_TRUE,
+	.preprocessor = APELEXER_TRUE,
+	.number_prefixes = APELEXER_TRUE,
+	.number_floats = APELEXER_TRUE,
+	.decode_numbers = APELEXER_FALSE,
+	.identifier_chars = NULL,
+};
+
+/* Seeded FNV-1a, the seed is picked at compile time so that no two keywords share a slot */
+APELEXER_PRIVATE uint32_t apelexer_keyword_hash(const char *s, size_t n, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	for (size_t i = 0; i < n; i++) {
+		h ^= (uint8_t)s[i];
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+/* Duplicates collide under every seed, so they are rejected before searching */
+APELEXER_PRIVATE int apelexer_language_has_duplicate_keywords(const ApelexerLanguageSpec *spec)
+{
+	for (size_t a = 0; a < spec->keyword_count; a++) {
+		for (size_t b = a + 1; b < spec->keyword_count; b++) {
+			if (strcmp(spec->keywords[a], spec->keywords[b]) == 0)
+				return APELEXER_TRUE;
+		}
+	}
+	return APELEXER_FALSE;
+}
+
+APELEXER_PRIVATE int apelexer_language_build_keywords(ApelexerLanguage *lang)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	if (spec->keyword_count == 0)
+		return APELEXER_TRUE;
+	if (apelexer_language_has_duplicate_keywords(spec))
+		return APELEXER_FALSE;
+	// A table of n^2 slots is collision free for about half of all seeds, larger ones don't help
+	size_t size = 16;
+	while (size < spec->keyword_count * 2)
+		size *= 2;
+	size_t max_size = 16;
+	while (max_size < spec->keyword_count * spec->keyword_count && max_size < (1u << 20))
+		max_size *= 2;
+	if (max_size < size)
+		max_size = size;
+	lang->kw_slots = APELEXER_MALLOC(sizeof(int32_t) * max_size);
+	for (; size <= max_size; size *= 2) {
+		memset(lang->kw_slots, 0xff, sizeof(int32_t) * size);
+		for (uint32_t seed = 0; seed < 4096; seed++) {
+			size_t k = 0;
+			for (; k < spec->keyword_count; k++) {
+				const char *kw = spec->keywords[k];
+				uint32_t slot = apelexer_keyword_hash(kw, strlen(kw), seed) & (uint32_t)(size - 1);
+				if (lang->kw_slots[slot] >= 0)
+					break;
+				lang->kw_slots[slot] = (int32_t)k;
+			}
+			if (k == spec->keyword_count) {
+				lang->kw_mask = (uint32_t)(size - 1);
+				lang->kw_seed = seed;
+				return APELEXER_TRUE;
+			}
+			// Only clear the slots this seed filled, so a failed seed costs O(keywords)
+			while (k-- > 0) {
+				const char *kw = spec->keywords[k];
+				lang->kw_slots[apelexer_keyword_hash(kw, strlen(kw), seed) & (uint32_t)(size - 1)] = -1;
+			}
+		}
+	}
+	return APELEXER_FALSE;
+}
+
+APELEXER_PRIVATE int apelexer_language_build_operators(ApelexerLanguage *lang)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	size_t cap = 16;
+	lang->op_next = APELEXER_MALLOC(sizeof(*lang->op_next) * cap);
+	lang->op_accept = APELEXER_MALLOC(sizeof(uint8_t) * cap);
+	memset(lang->op_next[0], 0, sizeof(lang->op_next[0]));
+	lang->op_accept[0] = APELEXER_TOKEN_NONE;
+	lang->op_states = 1;
+	for (size_t k = 0; k < spec->operator_count; k++) {
+		const unsigned char *text = (const unsigned char *)spec->operators[k].text;
+		if (!text || !text[0] || spec->operators[k].type == APELEXER_TOKEN_NONE)
+			return APELEXER_FALSE;
+		uint16_t state = 0;
+		for (; *text; text++) {
+			if (*text >= 128)
+				return APELEXER_FALSE;
+			if (lang->op_next[state][*text] == 0) {
+				if (lang->op_states == UINT16_MAX)
+					return APELEXER_FALSE;
+				if (lang->op_states == cap) {
+					cap *= 2;
+					lang->op_next = APELEXER_REALLOC(lang->op_next, sizeof(*lang->op_next) * cap);
+					lang->op_accept = APELEXER_REALLOC(lang->op_accept, sizeof(uint8_t) * cap);
+				}
+				memset(lang->op_next[lang->op_states], 0, sizeof(lang->op_next[0]));
+				lang->op_accept[lang->op_states] = APELEXER_TOKEN_NONE;
+				lang->op_next[state][*text] = (uint16_t)lang->op_states++;
+			}
+			state = lang->op_next[state][*text];
+		}
+		lang->op_accept[state] = (uint8_t)spec->operators[k].type;
+		lang->char_class[(unsigned char)spec->operators[k].text[0]] |= APELEXER_CLASS_OPERATOR;
+	}
+	return APELEXER_TRUE;
+}
+
+APELEXER_PRIVATE int apelexer_language_init(ApelexerLanguage *lang, const ApelexerLanguageSpec *spec)
+{
+	memset(lang, 0, sizeof(*lang));
+	lang->spec = *spec;
+	if ((spec->block_comment_open == NULL) != (spec->block_comment_close == NULL))
+		return APELEXER_FALSE;
+	if ((spec->line_comment && !spec->line_comment[0]) || (spec->block_comment_open && !spec->block_comment_open[0]) ||
+	    (spec->block_comment_close && !spec->block_comment_close[0]))
+		return APELEXER_FALSE;
+	for (int c = 0; c < 256; c++) {
+		uint8_t cls = 0;
+		if (c == '\n' || c == '\r')
+			cls |= APELEXER_CLASS_NEWLINE;
+		else if (isspace(c))
+			cls |= APELEXER_CLASS_SPACE;
+		if (isdigit(c))
+			cls |= APELEXER_CLASS_DIGIT | APELEXER_CLASS_IDENT;
+		if (isalpha(c) || c == '_')
+			cls |= APELEXER_CLASS_IDENT_START | APELEXER_CLASS_IDENT;
+		lang->char_class[c] = cls;
+	}
+	for (const char *p = spec->identifier_chars; p && *p; p++) {
+		lang->char_class[(unsigned char)*p] |= APELEXER_CLASS_IDENT;
+	}
+	if (spec->line_comment) {
+		lang->line_comment_len = strlen(spec->line_comment);
+		lang->char_class[(unsigned char)spec->line_comment[0]] |= APELEXER_CLASS_COMMENT;
+	}
+	if (spec->block_comment_open) {
+		lang->block_open_len = strlen(spec->block_comment_open);
+		lang->block_close_len = strlen(spec->block_comment_close);
+		lang->char_class[(unsigned char)spec->block_comment_open[0]] |= APELEXER_CLASS_COMMENT;
+	}
+	return apelexer_language_build_operators(lang) && apelexer_language_build_keywords(lang);
+}
+
+APELEXER_PRIVATE void apelexer_language_release(ApelexerLanguage *lang)
+{
+	APELEXER_FREE(lang->op_next);
+	APELEXER_FREE(lang->op_accept);
+	APELEXER_FREE(lang->kw_slots);
+}
+
+APELEXER_DEF ApelexerLanguage *apelexer_language_compile(const ApelexerLanguageSpec *spec)
+{
+	ApelexerLanguage *lang = APELEXER_MALLOC(sizeof(ApelexerLanguage));
+	if (!apelexer_language_init(lang, spec)) {
+		apelexer_language_release(lang);
+		APELEXER_FREE(lang);
+		return NULL;
+	}
+	return lang;
+}
+
+APELEXER_DEF void apelexer_language_free(ApelexerLanguage *lang)
+{
+	if (!lang)
+		return;
+	apelexer_language_release(lang);
+	APELEXER_FREE(lang);
+}
+
+APELEXER_PRIVATE ApelexerLanguage apelexer_c_language;
+
+APELEXER_PRIVATE void apelexer_c_language_init(void)
+{
+	apelexer_language_init(&apelexer_c_language, &apelexer_c_spec);
+}
+
+APELEXER_DEF const ApelexerLanguage *apelexer_language_c(void)
+{
+#ifdef APELEXER_HAS_THREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, apelexer_c_language_init);
+#else
+	static int initialized = APELEXER_FALSE;
+	if (!initialized) {
+		apelexer_c_language_init();
+		initialized = APELEXER_TRUE;
+	}
+#endif
+	return &apelexer_c_language;
+}
+
+APELEXER_DEF int apelexer_language_is_keyword(const ApelexerLanguage *lang, const char *s, size_t n)
+{
+	if (!lang->kw_slots)
+		return APELEXER_FALSE;
+	int32_t k = lang->kw_slots[apelexer_keyword_hash(s, n, lang->kw_seed) & lang->kw_mask];
+	if (k < 0)
+		return APELEXER_FALSE;
+	const char *kw = lang->spec.keywords[k];
+	return strncmp(kw, s, n) == 0 && kw[n] == '\0';
+}
+
+APELEXER_DEF size_t apelexer_language_match_operator(const ApelexerLanguage *lang, const char *s, size_t n, ApelexerTokenType *type)
+{
+	uint16_t state = 0;
+	size_t match = 0;
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = (unsigned char)s[i];
+		if (c >= 128 || lang->op_next[state][c] == 0)
+			break;
+		state = lang->op_next[state][c];
+		if (lang->op_accept[state] != APELEXER_TOKEN_NONE) {
+			match = i + 1;
+			*type = (ApelexerTokenType)lang->op_accept[state];
+		}
+	}
+	return match;
+}
+/* END language.c */
+
+
+/* BEGIN lexer.c */
+
+#define APELEXER_MAX_TOKEN_LENGTH 128
+
+APELEXER_PRIVATE const char *apelexer_error_type_to_string(ApelexerErrorType type)
+{
+	switch (type) {
+		case APELEXER_ERROR_NONE: return "none";
+		case APELEXER_ERROR_UNEXPECTED_CHAR: return "unexpected char";
+		case APELEXER_ERROR_UNEXPECTED_EOF: return "unexpected eof";
+		case APELEXER_ERROR_QUOTED_QUOTE: return "quoted quote";
+		case APELEXER_ERROR_UNEXPECTED_NEWLINE: return "unexpected newline";
+		case APELEXER_ERROR_UNTERMINATED_STRING: return "unterminated string";
+		case APELEXER_ERROR_CHAR_TOO_LONG: return "char too long";
+		case APELEXER_ERROR_INVALID_FLOAT: return "invalid float";
+		case APELEXER_ERROR_INVALID_NUMBER: return "invalid number";
+		case APELEXER_ERROR_INVALID_CHAR: return "invalid char";
+		case APELEXER_ERROR_UNTERMINATED_COMMENT: return "unterminated comment";
+		case APELEXER_ERROR_NUMBER_TOO_LARGE: return "number too large";
+		case APELEXER_ERROR_MALFORMED_NUMBER: return "malformed number";
+	}
+	return "unknown";
+}
+
+APELEXER_DEF void apelexer_error(ApelexerErrorType type, size_t line, size_t column)
+{
+	fprintf(stderr, "apelexer error: %s, at %zu:%zu\n", apelexer_error_type_to_string(type), line, column);
+	exit(1);
+}
+
+APELEXER_DEF char *apelexer_token_type_to_string(ApelexerTokenType type)
+{
+	switch (type) {
+		case APELEXER_TOKEN_NONE: return "none";
+		case APELEXER_TOKEN_KEYWORD: return "keyword";
+		case APELEXER_TOKEN_IDENTIFIER: return "identifier";
+		case APELEXER_TOKEN_INT: return "int";
+		case APELEXER_TOKEN_FLOAT: return "float";
+		case APELEXER_TOKEN_CHAR: return "char";
+		case APELEXER_TOKEN_STRING: return "string";
+		case APELEXER_TOKEN_OPERATOR: return "operator";
+		case APELEXER_TOKEN_PREPROCESSOR: return "preprocessor";
+		case APELEXER_TOKEN_OPEN_PAREN: return "open paren";
+		case APELEXER_TOKEN_CLOSE_PAREN: return "close paren";
+		case APELEXER_TOKEN_OPEN_BRACKET: return "open bracket";
+		case APELEXER_TOKEN_CLOSE_BRACKET: return "close bracket";
+		case APELEXER_TOKEN_OPEN_BRACE: return "open brace";
+		case APELEXER_TOKEN_CLOSE_BRACE: return "close brace";
+		case APELEXER_TOKEN_COMMA: return "comma";
+		case APELEXER_TOKEN_SEMICOLON: return "semicolon";
+		case APELEXER_TOKEN_COLON: return "colon";
+		case APELEXER_TOKEN_DOT: return "dot";
+		case APELEXER_TOKEN_ARROW: return "arrow";
+		case APELEXER_TOKEN_EOF: return "eof";
+	}
+	return "unknown";
+}
+
+APELEXER_DEF int apelexer_is_line_end(const char *input, size_t len, size_t k)
+{
+	if (k == 0 || k > len)
+		return APELEXER_FALSE;
+	size_t nl = k - 1;
+	if (input[nl] == '\r') {
+		if (k == len || input[k] == '\n')
+			return APELEXER_FALSE;
+	} else if (input[nl] == '\n') {
+		if (nl > 0 && input[nl - 1] == '\r')
+			nl--;
+	} else {
+		return APELEXER_FALSE;
+	}
+	return nl == 0 || input[nl - 1] != '\\';
+}
+
+APELEXER_DEF int apelexer_scan(ApelexerScanner *s, ApelexerToken *tok)
+{
+	const char *input = s->input;
+	size_t len = s->len;
+	size_t i = s->i;
+	size_t line = s->line;
+	size_t column = s->column;
+	const ApelexerLanguage *lang = s->lang ? s->lang : apelexer_language_c();
+	const ApelexerLanguageSpec *spec = &lang->spec;
+#define APELEXER_PEEK_AT(p) ((p) < len ? input[p] : '\0')
+#define APELEXER_PEEK(n) APELEXER_PEEK_AT(i + (n))
+#define APELEXER_STARTS_WITH(str, n) (len - i >= (n) && memcmp(&input[i], (str), (n)) == 0)
+/* \r\n counts as a single line break */
+#define APELEXER_SCAN_NEWLINE()                                              \
+	do {                                                                 \
+		i += (input[i] == '\r' && APELEXER_PEEK(1) == '\n') ? 2 : 1; \
+		line++, column = 1;                                          \
+	} while (0)
+#define APELEXER_SCAN_SET_VALUE(t, start, end)        \
+	do {                                          \
+		tok->type = (t);                      \
+		tok->value = (char *)&input[(start)]; \
+		tok->length = (end) - (start);        \
+		s->number.i = 0;                      \
+	} while (0)
+
+	while (i < len) {
+		char c = input[i];
+		uint8_t cls = lang->char_class[(unsigned char)c];
+		if (cls & APELEXER_CLASS_NEWLINE) {
+			APELEXER_SCAN_NEWLINE();
+			continue;
+		}
+		if (cls & APELEXER_CLASS_SPACE) {
+			column++;
+			i++;
+			continue;
+		}
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->line_comment_len && APELEXER_STARTS_WITH(spec->line_comment, lang->line_comment_len)) {
+			while (i < len && input[i] != '\n' && input[i] != '\r') {
+				i++, column++;
+			}
+			continue;
+		}
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->block_open_len &&
+		    APELEXER_STARTS_WITH(spec->block_comment_open, lang->block_open_len)) {
+			size_t start = i;
+			size_t start_line = line;
+			size_t start_column = column;
+			i += lang->block_open_len, column += lang->block_open_len;
+			while (i < len && !APELEXER_STARTS_WITH(spec->block_comment_close, lang->block_close_len)) {
+				if (input[i] == '\n' || input[i] == '\r') {
+					APELEXER_SCAN_NEWLINE();
+					continue;
+				}
+				i++, column++;
+			}
+			if (i >= len) {
+				if (s->partial) {
+					// wait for the rest of the comment
+					i = start, line = start_line, column = start_column;
+					break;
+				}
+				apelexer_error(APELEXER_ERROR_UNTERMINATED_COMMENT, start_line, start_column);
+			}
+			i += lang->block_close_len, column += lang->block_close_len;
+			continue;
+		}
+		if (spec->string_quote && c == spec->string_quote) {
+			i++, column++;
+			size_t start_line = line;
+			size_t start_column = column;
+			size_t start = i;
+			while (i < len) {
+				if (input[i] == '\n' || input[i] == '\r') {
+					apelexer_error(APELEXER_ERROR_UNTERMINATED_STRING, line, column);
+				}
+				if (input[i] == spec->string_quote) {
+					break;
+				}
+				if (spec->escapes && input[i] == '\\') {
 					i++, column++;
 					if (i < len && input[i] == 'x') {
 						i += 2, column += 2;
-					} else if (i < len && input[i] == 'u') {
-						for (size_t j = 0; j < 4; j++) {
-							if (!isxdigit(input[i + j])) {
-								apelexer_error(APELEXER_ERROR_INVALID_CHAR, line, column);
-							}
-							i++, column++;
-						}
-					} else if (i < len && input[i] == 'U') {
-						for (size_t j = 0; j < 8; j++) {
-							if (!isxdigit(input[i + j])) {
+					} else if (i < len && (input[i] == 'u' || input[i] == 'U')) {
+						// the hex digits follow the u/U, i ends on the last one
+						size_t esc = i;
+						size_t digits = input[i] == 'u' ? 4 : 8;
+						for (size_t j = 1; j <= digits; j++) {
+							if (!isxdigit((unsigned char)APELEXER_PEEK_AT(esc + j))) {
 								apelexer_error(APELEXER_ERROR_INVALID_CHAR, line, column);
 							}
 							i++, column++;
 						}
+					} else if (i < len && (input[i] == '\n' || input[i] == '\r')) {
+						APELEXER_SCAN_NEWLINE();
+						continue;
 					}
 				}
 				i++, column++;
 			}
-			if (input[i] != '"') {
+			if (i >= len || input[i] != spec->string_quote) {
 				apelexer_error(APELEXER_ERROR_UNTERMINATED_STRING, line, column);
 			}
-			size_t end = i;
-			// end--; // remove the last "
-			char *value = malloc(end - start + 1);
-			memcpy(value, &input[start], end - start);
-			value[end - start] = '\0';
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_STRING, value);
-			tokens[*token_count - 1].start_line = start_line;
-			tokens[*token_count - 1].start_column = start_column;
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_STRING, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
 			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			free(value);
-			continue;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
 		}
-		if (input[i] == '\'') {
+		if (spec->char_quote && c == spec->char_quote) {
 			size_t start_line = line;
 			size_t start_column = column;
 			i++, column++;
+			if (spec->escapes && APELEXER_PEEK(0) == '\\')
+				i++, column++;
 			i++, column++;
-			if (input[i] != '\'') {
-				if (input[i - 1] == '\\')
-					i++;
-				else
-					apelexer_error(APELEXER_ERROR_CHAR_TOO_LONG, line, column);
-			}
-			if (input[i] != '\'') {
+			if (APELEXER_PEEK(0) != spec->char_quote) {
 				apelexer_error(APELEXER_ERROR_CHAR_TOO_LONG, line, column);
 			}
-			char v[2] = { input[i - 1], '\0' };
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_CHAR, v);
-			tokens[*token_count - 1].start_line = start_line;
-			tokens[*token_count - 1].start_column = start_column;
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_CHAR, i - 1, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
 			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
 		}
-		if (isdigit(input[i])) {
+		if (cls & APELEXER_CLASS_DIGIT) {
 			size_t start_line = line;
 			size_t start_column = column;
 			int base = 10;
 			size_t start = i;
 			size_t end = i;
 			int dots = 0;
+			int exponent = 0;
 			int is_float = 0;
-			if (input[i] == '0' && input[i + 1] == 'x') {
+			char prefix = spec->number_prefixes && c == '0' ? APELEXER_PEEK(1) : '\0';
+			if (prefix == 'x') {
 				i += 2;
 				column += 2;
 				base = 16;
-			} else if (input[i] == '0' && input[i + 1] == 'b') {
+			} else if (prefix == 'b') {
 				i += 2;
 				column += 2;
 				base = 2;
-			} else if (input[i] == '0' && input[i + 1] == 'o') {
+			} else if (prefix == 'o') {
 				i += 2;
 				column += 2;
 				base = 8;
 			}
 			while (i < len) {
-				// if (isspace(input[i])) {
-				// 	break;
-				// }
 				if (input[i] == '.') {
-					if (base != 10) {
+					if (!spec->number_floats) {
+						break;
+					}
+					if (base != 10 || exponent) {
 						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 					}
 					dots++;
@@ -1679,25 +3411,31 @@ APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_c
 					end = i;
 					continue;
 				}
-				if (input[i] == 'e' || input[i] == 'E') {
-					if (base != 10) {
+				if ((input[i] == 'e' || input[i] == 'E') && spec->number_floats && base != 16) {
+					if (base != 10 || exponent) {
 						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 					}
 					if (end - start < 1) {
 						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 					}
 					i++, column++;
+					if (APELEXER_PEEK(0) == '+' || APELEXER_PEEK(0) == '-')
+						i++, column++;
+					if (!isdigit((unsigned char)APELEXER_PEEK(0))) {
+						apelexer_error(APELEXER_ERROR_MALFORMED_NUMBER, line, column);
+					}
 					end = i;
+					exponent = 1;
 					is_float = 1;
 					continue;
 				}
-				if (isdigit(input[i])) {
+				if (isdigit((unsigned char)input[i])) {
 					if (base == 8) {
 						if (input[i] > '7') {
 							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 						}
 					} else if (base == 2) {
-						if (input[i] < '2') {
+						if (input[i] > '1') {
 							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 						}
 					}
@@ -1705,42 +3443,38 @@ APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_c
 					end = i;
 					continue;
 				}
-				if (isxdigit(input[i])) {
-					if (!isdigit(input[i]) && base != 16) {
+				if (isxdigit((unsigned char)input[i])) {
+					if (base != 16) {
 						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
 					}
-					if (base == 8) {
-						if (input[i] > '7') {
-							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
-						}
-					} else if (base == 2) {
-						if (input[i] < '2') {
-							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
-						}
-					}
 					i++, column++;
 					end = i;
 					continue;
 				}
 				break;
 			}
-			char last = input[i - 1];
-			if (last == '.') {
+			if (input[i - 1] == '.') {
 				apelexer_error(APELEXER_ERROR_INVALID_FLOAT, line, column);
 			}
-			char *value = malloc(end - start + 1);
-			memcpy(value, &input[start], end - start);
-			value[end - start] = '\0';
-			APELEXER_TOKENIZER_PUSH_TOKEN(is_float ? APELEXER_TOKEN_FLOAT : APELEXER_TOKEN_INT, value);
-			tokens[*token_count - 1].start_line = start_line;
-			tokens[*token_count - 1].start_column = start_column;
-			// i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			free(value);
-			continue;
+			if (end == start) {
+				// a 0x, 0b or 0o prefix without digits
+				apelexer_error(APELEXER_ERROR_MALFORMED_NUMBER, start_line, start_column);
+			}
+			APELEXER_SCAN_SET_VALUE(is_float ? APELEXER_TOKEN_FLOAT : APELEXER_TOKEN_INT, start, end);
+			if (spec->decode_numbers) {
+				int ok = is_float ? apelexer_parse_float(tok->value, tok->length, &s->number.f)
+						  : apelexer_parse_int(tok->value, tok->length, &s->number.i);
+				if (!ok) {
+					apelexer_error(APELEXER_ERROR_NUMBER_TOO_LARGE, start_line, start_column);
+				}
+			}
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
 		}
-		if (input[i] == '#') {
+		if (c == '#' && spec->preprocessor) {
 			if (column != 1) {
 				apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
 			}
@@ -1752,453 +3486,701 @@ APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_c
 				if (input[i] == '\n' || input[i] == '\r') {
 					if (input[i - 1] != '\\')
 						break;
+					APELEXER_SCAN_NEWLINE();
+					continue;
 				}
 				i++, column++;
 			}
-			char *value = malloc(i - start + 1);
-			memcpy(value, &input[start], i - start);
-			value[i - start] = '\0';
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_PREPROCESSOR, value);
-			tokens[*token_count - 1].start_line = start_line;
-			tokens[*token_count - 1].start_column = start_column;
-			// i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			free(value);
-			continue;
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_PREPROCESSOR, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (cls & APELEXER_CLASS_IDENT_START) {
+			size_t start_line = line;
+			size_t start_column = column;
+			size_t start = i;
+			while (i < len && (lang->char_class[(unsigned char)input[i]] & APELEXER_CLASS_IDENT)) {
+				i++, column++;
+			}
+			int is_keyword = apelexer_language_is_keyword(lang, &input[start], i - start);
+			APELEXER_SCAN_SET_VALUE(is_keyword ? APELEXER_TOKEN_KEYWORD : APELEXER_TOKEN_IDENTIFIER, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (cls & APELEXER_CLASS_OPERATOR) {
+			ApelexerTokenType type = APELEXER_TOKEN_NONE;
+			size_t n = apelexer_language_match_operator(lang, &input[i], len - i, &type);
+			if (n > 0) {
+				APELEXER_SCAN_SET_VALUE(type, i, i + n);
+				tok->start_line = line;
+				tok->start_column = column;
+				i += n, column += n;
+				tok->end_line = line;
+				tok->end_column = column;
+				goto emit;
+			}
+		}
+		apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
+	}
+	s->i = i;
+	s->line = line;
+	s->column = column;
+	return APELEXER_FALSE;
+emit:
+	s->i = i;
+	s->line = line;
+	s->column = column;
+	return APELEXER_TRUE;
+#undef APELEXER_SCAN_SET_VALUE
+#undef APELEXER_SCAN_NEWLINE
+#undef APELEXER_STARTS_WITH
+#undef APELEXER_PEEK
+#undef APELEXER_PEEK_AT
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_into(ApelexerToken *tokens, const ApelexerLanguage *lang, ApelexerSymbols *symbols,
+						  const char *input, size_t len, size_t *token_count)
+{
+	ApelexerScanner s = { input, len, 0, 1, 1, lang, APELEXER_FALSE, { 0 } };
+	ApelexerToken tok;
+	*token_count = 0;
+	while (apelexer_scan(&s, &tok)) {
+		uint32_t symbol = APELEXER_NO_SYMBOL;
+		if (symbols && tok.type == APELEXER_TOKEN_IDENTIFIER) {
+			symbol = apelexer_symbols_intern(symbols, tok.value, tok.length);
+			tok.value = (char *)apelexer_symbols_name(symbols, symbol);
+		}
+		tokens = apelexer_tokens_push(tokens, (*token_count)++, tok, symbol, s.number);
+	}
+	return tokens;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_interned(const ApelexerLanguage *lang, ApelexerSymbols *symbols, const char *input,
+						       size_t *token_count)
+{
+	return apelexer_tokenize_into(NULL, lang, symbols, input, strlen(input), token_count);
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_lang(const ApelexerLanguage *lang, const char *input, size_t *token_count)
+{
+	return apelexer_tokenize_interned(lang, NULL, input, token_count);
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_count)
+{
+	return apelexer_tokenize_lang(NULL, input, token_count);
+}
+/* END lexer.c */
+
+
+/* BEGIN number.c */
+
+/* Significant decimal digits that always fit in a uint64_t */
+#define APELEXER_MAX_MANTISSA_DIGITS 19
+/* Integers up to 2^53 are exactly representable as doubles */
+#define APELEXER_MAX_EXACT_INT ((uint64_t)1 << 53)
+/* Largest power of ten that is exactly representable as a double */
+#define APELEXER_MAX_EXACT_POW10 22
+
+static const double apelexer_pow10[APELEXER_MAX_EXACT_POW10 + 1] = {
+	1e0,  1e1,  1e2,  1e3,	1e4,  1e5,  1e6,  1e7,	1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define APELEXER_SWAR_DIGITS
+#endif
+
+#ifdef APELEXER_SWAR_DIGITS
+/* Loads 8 bytes so that p[0] is the lowest byte */
+APELEXER_PRIVATE uint64_t apelexer_load8(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* All 8 bytes are '0'..'9': the high nibble of every byte is 3 and adding 6 doesn't carry into it */
+APELEXER_PRIVATE int apelexer_is_eight_digits(uint64_t v)
+{
+	return (((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+/* Combines 8 ASCII digits into their value, pairwise: 8 x 1 digit -> 4 x 2 -> 2 x 4 -> 1 x 8 */
+APELEXER_PRIVATE uint32_t apelexer_parse_eight_digits(uint64_t v)
+{
+	v = (v & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+	v = (v & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+	return (uint32_t)((v & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+}
+#endif
+
+/*
+ * Accumulates the decimal digits at p into m, counting significant digits in nd. Stops at the
+ * first non-digit, or before a digit that would overflow APELEXER_MAX_MANTISSA_DIGITS
+ */
+APELEXER_PRIVATE const char *apelexer_parse_digits(const char *p, const char *end, uint64_t *m, int *nd)
+{
+	while (p < end) {
+#ifdef APELEXER_SWAR_DIGITS
+		if (end - p >= 8 && *m != 0 && *nd + 8 <= APELEXER_MAX_MANTISSA_DIGITS) {
+			uint64_t v = apelexer_load8(p);
+			if (apelexer_is_eight_digits(v)) {
+				*m = *m * 100000000 + apelexer_parse_eight_digits(v);
+				*nd += 8;
+				p += 8;
+				continue;
+			}
 		}
-		if (input[i] == '(') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPEN_PAREN, "(");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == ')') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_CLOSE_PAREN, ")");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == '[') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPEN_BRACKET, "[");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == ']') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_CLOSE_BRACKET, "]");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == '{') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPEN_BRACE, "{");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+#endif
+		if (!isdigit((unsigned char)*p) || *nd == APELEXER_MAX_MANTISSA_DIGITS)
+			break;
+		*m = *m * 10 + (uint64_t)(*p - '0');
+		if (*m != 0)
+			(*nd)++; // leading zeros aren't significant
+		p++;
+	}
+	return p;
+}
+
+APELEXER_PRIVATE int apelexer_digit_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 16;
+}
+
+APELEXER_DEF int apelexer_parse_int(const char *s, size_t len, uint64_t *value)
+{
+	const char *p = s;
+	const char *end = s + len;
+	int bits = 0;
+	if (len > 2 && p[0] == '0') {
+		bits = p[1] == 'x' ? 4 : p[1] == 'o' ? 3 : p[1] == 'b' ? 1 : 0;
+		if (bits)
+			p += 2;
+	}
+	if (p == end)
+		return APELEXER_FALSE;
+	uint64_t v = 0;
+	if (bits) {
+		for (; p < end; p++) {
+			int d = apelexer_digit_value(*p);
+			if (d >> bits || v >> (64 - bits))
+				return APELEXER_FALSE;
+			v = v << bits | (uint64_t)d;
 		}
-		if (input[i] == '}') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_CLOSE_BRACE, "}");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		*value = v;
+		return APELEXER_TRUE;
+	}
+	int nd = 0;
+	p = apelexer_parse_digits(p, end, &v, &nd);
+	if (p < end) {
+		// Only a 20th digit can still fit
+		if (!isdigit((unsigned char)*p) || p + 1 < end || v > (UINT64_MAX - (uint64_t)(*p - '0')) / 10)
+			return APELEXER_FALSE;
+		v = v * 10 + (uint64_t)(*p - '0');
+	}
+	*value = v;
+	return APELEXER_TRUE;
+}
+
+/* Correctly rounded conversion for everything the fast paths can't prove exact */
+APELEXER_PRIVATE double apelexer_parse_float_slow(const char *s, size_t len)
+{
+	char small[128];
+	char *buf = len < sizeof(small) ? small : APELEXER_MALLOC(len + 1);
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	double d = strtod(buf, NULL);
+	if (buf != small)
+		APELEXER_FREE(buf);
+	return d;
+}
+
+APELEXER_DEF int apelexer_parse_float(const char *s, size_t len, double *value)
+{
+	const char *p = s;
+	const char *end = s + len;
+	uint64_t m = 0;
+	int nd = 0;
+	p = apelexer_parse_digits(p, end, &m, &nd);
+	if (p == s)
+		return APELEXER_FALSE;
+	long exp10 = 0;
+	int truncated = p < end && isdigit((unsigned char)*p);
+	while (p < end && isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if (p < end && *p == '.') {
+		const char *frac = ++p;
+		if (!truncated) {
+			p = apelexer_parse_digits(p, end, &m, &nd);
+			exp10 = -(long)(p - frac);
+			truncated = p < end && isdigit((unsigned char)*p);
 		}
-		if (input[i] == ',') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_COMMA, ",");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		while (p < end && isdigit((unsigned char)*p)) {
+			p++;
 		}
-		if (input[i] == ';') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_SEMICOLON, ";");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		int negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+'))
+			p++;
+		if (p == end)
+			return APELEXER_FALSE;
+		long e = 0;
+		for (; p < end && isdigit((unsigned char)*p); p++) {
+			if (e < 100000)
+				e = e * 10 + (*p - '0');
 		}
-		if (input[i] == ':') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_COLON, ":");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		exp10 += negative ? -e : e;
+	}
+	if (p != end)
+		return APELEXER_FALSE;
+
+	// Clinger's fast path: the mantissa and the power of ten are both exact doubles, so a
+	// single correctly rounded multiplication or division gives the correctly rounded result.
+	// It needs doubles to be evaluated at double precision (not on the x87 stack)
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+	if (!truncated && m <= APELEXER_MAX_EXACT_INT) {
+		if (m == 0) {
+			*value = 0.0;
+			return APELEXER_TRUE;
 		}
-		if (input[i] == '.') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_DOT, ".");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		if (exp10 >= -APELEXER_MAX_EXACT_POW10 && exp10 <= APELEXER_MAX_EXACT_POW10) {
+			double d = (double)m;
+			*value = exp10 < 0 ? d / apelexer_pow10[-exp10] : d * apelexer_pow10[exp10];
+			return APELEXER_TRUE;
 		}
-		if (input[i] == '+') {
-			if (i + 1 < len && input[i + 1] == '+') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "++");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
+		// 123e25 = 123000e22: move zeros into the mantissa while it stays exact
+		if (exp10 > APELEXER_MAX_EXACT_POW10 && exp10 <= APELEXER_MAX_EXACT_POW10 + 15) {
+			uint64_t scaled = m;
+			for (long k = exp10; k > APELEXER_MAX_EXACT_POW10 && scaled <= APELEXER_MAX_EXACT_INT; k--) {
+				scaled *= 10;
 			}
-			if (i + 1 < len && input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "+=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
+			if (scaled <= APELEXER_MAX_EXACT_INT) {
+				*value = (double)scaled * apelexer_pow10[APELEXER_MAX_EXACT_POW10];
+				return APELEXER_TRUE;
 			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "+");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
 		}
-		if (input[i] == '-') {
-			if (i + 1 < len && input[i + 1] == '-') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "--");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (i + 1 < len && input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "-=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (i + 1 < len && input[i + 1] == '>') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_ARROW, "->");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "-");
-			i++, column++;
+	}
+#endif
+	*value = apelexer_parse_float_slow(s, len);
+	return APELEXER_TRUE;
+}
+/* END number.c */
+
+
+/* BEGIN parallel.c */
+
+/* Inputs smaller than this per thread are not worth splitting */
+#define APELEXER_PARALLEL_MIN_CHUNK (256 * 1024)
+
+typedef struct {
+	ApelexerScanner scanner;
+	ApelexerToken *tokens; /* Token array with its own arena, the first chunk's becomes the result */
+	size_t count;
+} ApelexerChunk;
+
+APELEXER_PRIVATE void *apelexer_lex_chunk(void *arg)
+{
+	ApelexerChunk *chunk = arg;
+	ApelexerToken tok;
+	while (apelexer_scan(&chunk->scanner, &tok)) {
+		chunk->tokens = apelexer_tokens_push(chunk->tokens, chunk->count++, tok, APELEXER_NO_SYMBOL, chunk->scanner.number);
+	}
+	return NULL;
+}
+
+/* First line start at or after pos that no token spans */
+APELEXER_PRIVATE size_t apelexer_find_split(const char *input, size_t len, size_t pos)
+{
+	while (pos < len) {
+		const char *nl = memchr(input + pos, '\n', len - pos);
+		if (!nl)
+			return len;
+		pos = (size_t)(nl - input) + 1;
+		if (apelexer_is_line_end(input, len, pos))
+			return pos;
+	}
+	return len;
+}
+
+/* Block comments can span lines, so a line start is only safe if it isn't inside one. This walks
+ * the input once, skipping comments, strings, chars and preprocessor lines the way the scanner
+ * does, and stores the first safe line start at or after each target in splits */
+APELEXER_PRIVATE void apelexer_prescan_splits(const ApelexerLanguage *lang, const char *input, size_t len, size_t *splits, int nsplits)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	size_t i = 0;
+	int k = 0;
+	while (k < nsplits) {
+		size_t target = len / (nsplits + 1) * (k + 1);
+		if (i >= len) {
+			splits[k++] = len;
 			continue;
 		}
-		if (input[i] == '*') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "*=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "*");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
+		if (i >= target && apelexer_is_line_end(input, len, i)) {
+			splits[k++] = i;
 			continue;
 		}
-		if (input[i] == '/') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "/=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "/");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
+		char c = input[i];
+		uint8_t cls = lang->char_class[(unsigned char)c];
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->line_comment_len && len - i >= lang->line_comment_len &&
+		    memcmp(&input[i], spec->line_comment, lang->line_comment_len) == 0) {
+			while (i < len && input[i] != '\n' && input[i] != '\r')
+				i++;
 			continue;
 		}
-		if (input[i] == '%') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "%=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "%");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->block_open_len && len - i >= lang->block_open_len &&
+		    memcmp(&input[i], spec->block_comment_open, lang->block_open_len) == 0) {
+			i += lang->block_open_len;
+			while (i < len && !(len - i >= lang->block_close_len && memcmp(&input[i], spec->block_comment_close, lang->block_close_len) == 0))
+				i++;
+			i = i + lang->block_close_len < len ? i + lang->block_close_len : len;
 			continue;
 		}
-		if (input[i] == '&') {
-			if (input[i + 1] == '&') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "&&");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "&=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "&");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
+		if ((spec->string_quote && c == spec->string_quote) || (spec->char_quote && c == spec->char_quote)) {
+			i++;
+			while (i < len && input[i] != c && input[i] != '\n' && input[i] != '\r')
+				i += spec->escapes && input[i] == '\\' ? 2 : 1;
+			i++;
 			continue;
 		}
-		if (input[i] == '|') {
-			if (input[i + 1] == '|') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "||");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "|=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "|");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
+		if (c == '#' && spec->preprocessor && (i == 0 || input[i - 1] == '\n' || input[i - 1] == '\r')) {
+			while (i < len && !((input[i] == '\n' || input[i] == '\r') && input[i - 1] != '\\'))
+				i++;
 			continue;
 		}
-		if (input[i] == '<') {
-			if (input[i + 1] == '<') {
-				if (input[i + 2] == '=') {
-					APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "<<=");
-					tokens[*token_count - 1].start_line = line;
-					tokens[*token_count - 1].start_column = column;
-					i += 3, column += 3;
-					tokens[*token_count - 1].end_line = line;
-					tokens[*token_count - 1].end_column = column;
-					continue;
-				}
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "<<");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "<=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "<");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		i++;
+	}
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_parallel(const ApelexerLanguage *lang, const char *input, size_t len, size_t *token_count,
+						      int threads)
+{
+#ifdef APELEXER_HAS_THREADS
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int)cpus : 1;
+	}
+#else
+	threads = 1;
+#endif
+	if ((size_t)threads > len / APELEXER_PARALLEL_MIN_CHUNK)
+		threads = (int)(len / APELEXER_PARALLEL_MIN_CHUNK);
+	if (threads <= 1)
+		return apelexer_tokenize_into(NULL, lang, NULL, input, len, token_count);
+
+	if (!lang)
+		lang = apelexer_language_c();
+
+	size_t *splits = APELEXER_MALLOC(sizeof(size_t) * threads);
+	if (lang->block_open_len) {
+		apelexer_prescan_splits(lang, input, len, splits, threads - 1);
+	} else {
+		for (int k = 0; k < threads - 1; k++) {
+			splits[k] = apelexer_find_split(input, len, len / threads * (k + 1));
 		}
-		if (input[i] == '>') {
-			if (input[i + 1] == '>') {
-				if (input[i + 2] == '=') {
-					APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, ">>=");
-					tokens[*token_count - 1].start_line = line;
-					tokens[*token_count - 1].start_column = column;
-					i += 3, column += 3;
-					tokens[*token_count - 1].end_line = line;
-					tokens[*token_count - 1].end_column = column;
-					continue;
-				}
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, ">>");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, ">=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
+	}
+	splits[threads - 1] = len;
+
+	ApelexerChunk *chunks = APELEXER_MALLOC(sizeof(ApelexerChunk) * threads);
+	int nchunks = 0;
+	size_t start = 0;
+	for (int k = 0; k < threads && start < len; k++) {
+		size_t end = splits[k] < start ? start : splits[k];
+		ApelexerChunk *c = &chunks[nchunks++];
+		memset(c, 0, sizeof(*c));
+		c->scanner = (ApelexerScanner){ input, end, start, 1, 1, lang, APELEXER_FALSE, { 0 } };
+		start = end;
+	}
+	APELEXER_FREE(splits);
+
+#ifdef APELEXER_HAS_THREADS
+	pthread_t *workers = APELEXER_MALLOC(sizeof(pthread_t) * nchunks);
+	int *started = APELEXER_MALLOC(sizeof(int) * nchunks);
+	for (int k = 1; k < nchunks; k++) {
+		started[k] = pthread_create(&workers[k], NULL, apelexer_lex_chunk, &chunks[k]) == 0;
+	}
+	if (nchunks > 0)
+		apelexer_lex_chunk(&chunks[0]);
+	for (int k = 1; k < nchunks; k++) {
+		if (started[k])
+			pthread_join(workers[k], NULL);
+		else
+			apelexer_lex_chunk(&chunks[k]);
+	}
+	APELEXER_FREE(workers);
+	APELEXER_FREE(started);
+#else
+	for (int k = 0; k < nchunks; k++) {
+		apelexer_lex_chunk(&chunks[k]);
+	}
+#endif
+
+	// The first chunk's array is grown in place and the others are appended to it
+	size_t total = 0;
+	for (int k = 0; k < nchunks; k++) {
+		total += chunks[k].count;
+	}
+	ApelexerToken *tokens = nchunks > 0 ? chunks[0].tokens : NULL;
+	if (total > 0) {
+		tokens = apelexer_tokens_reserve(tokens, total);
+	}
+	size_t n = nchunks > 0 ? chunks[0].count : 0;
+	size_t line_base = nchunks > 0 ? chunks[0].scanner.line - 1 : 0;
+	for (int k = 1; k < nchunks; k++) {
+		ApelexerChunk *c = &chunks[k];
+		if (c->tokens) {
+			for (size_t j = 0; j < c->count; j++) {
+				c->tokens[j].start_line += line_base;
+				c->tokens[j].end_line += line_base;
 			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, ">");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+			apelexer_tokens_move(tokens, n, c->tokens, c->count);
+			n += c->count;
 		}
-		if (input[i] == '?') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "?");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
+		line_base += c->scanner.line - 1;
+	}
+	APELEXER_FREE(chunks);
+	*token_count = total;
+	return tokens;
+}
+/* END parallel.c */
+
+
+/* BEGIN stream.c */
+
+#define APELEXER_STREAM_READ_SIZE 4096
+
+APELEXER_PRIVATE void apelexer_stream_reserve(ApelexerCtx *ctx, size_t extra)
+{
+	if (ctx->buf_len + extra + 1 <= ctx->buf_cap)
+		return;
+	size_t cap = ctx->buf_cap ? ctx->buf_cap : APELEXER_STREAM_READ_SIZE;
+	while (cap < ctx->buf_len + extra + 1)
+		cap *= 2;
+	ctx->buf = APELEXER_REALLOC(ctx->buf, cap);
+	ctx->buf_cap = cap;
+}
+
+/* Drop the already lexed part of the buffer so it doesn't grow with the input */
+APELEXER_PRIVATE void apelexer_stream_compact(ApelexerCtx *ctx)
+{
+	if (ctx->pos == 0)
+		return;
+	memmove(ctx->buf, ctx->buf + ctx->pos, ctx->buf_len - ctx->pos);
+	ctx->buf_len -= ctx->pos;
+	ctx->limit -= ctx->pos;
+	ctx->pos = 0;
+	ctx->buf[ctx->buf_len] = '\0';
+}
+
+/* Tokens never cross an unescaped newline, so everything up to the last one can be lexed */
+APELEXER_PRIVATE void apelexer_stream_update_limit(ApelexerCtx *ctx)
+{
+	if (ctx->eof) {
+		ctx->limit = ctx->buf_len;
+		return;
+	}
+	for (size_t k = ctx->buf_len; k > ctx->limit; k--) {
+		if (apelexer_is_line_end(ctx->buf, ctx->buf_len, k)) {
+			ctx->limit = k;
+			return;
 		}
-		if (input[i] == '=') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "==");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
+	}
+}
+
+APELEXER_DEF void apelexer_init(ApelexerCtx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->line = 1;
+	ctx->column = 1;
+}
+
+APELEXER_DEF void apelexer_set_reader(ApelexerCtx *ctx, ApelexerReadFn read, void *user)
+{
+	ctx->read = read;
+	ctx->read_user = user;
+}
+
+APELEXER_DEF void apelexer_set_language(ApelexerCtx *ctx, const ApelexerLanguage *lang)
+{
+	ctx->lang = lang;
+}
+
+APELEXER_DEF void apelexer_set_symbols(ApelexerCtx *ctx, ApelexerSymbols *symbols)
+{
+	ctx->symbols = symbols;
+}
+
+APELEXER_DEF void apelexer_feed(ApelexerCtx *ctx, const char *data, size_t len)
+{
+	apelexer_stream_compact(ctx);
+	apelexer_stream_reserve(ctx, len);
+	memcpy(ctx->buf + ctx->buf_len, data, len);
+	ctx->buf_len += len;
+	ctx->buf[ctx->buf_len] = '\0';
+	apelexer_stream_update_limit(ctx);
+}
+
+APELEXER_DEF void apelexer_finish(ApelexerCtx *ctx)
+{
+	ctx->eof = APELEXER_TRUE;
+	apelexer_stream_update_limit(ctx);
+}
+
+APELEXER_PRIVATE int apelexer_stream_fill(ApelexerCtx *ctx)
+{
+	if (!ctx->read) {
+		return APELEXER_FALSE;
+	}
+	apelexer_stream_compact(ctx);
+	apelexer_stream_reserve(ctx, APELEXER_STREAM_READ_SIZE);
+	size_t n = ctx->read(ctx->read_user, ctx->buf + ctx->buf_len, ctx->buf_cap - ctx->buf_len - 1);
+	if (n == 0) {
+		apelexer_finish(ctx);
+		return APELEXER_TRUE;
+	}
+	ctx->buf_len += n;
+	ctx->buf[ctx->buf_len] = '\0';
+	apelexer_stream_update_limit(ctx);
+	return APELEXER_TRUE;
+}
+
+APELEXER_DEF ApelexerNextResult apelexer_next(ApelexerCtx *ctx, ApelexerToken *tok)
+{
+	for (;;) {
+		if (ctx->buf) {
+			ApelexerScanner s = { ctx->buf, ctx->limit, ctx->pos, ctx->line, ctx->column, ctx->lang, !ctx->eof, { 0 } };
+			int found = apelexer_scan(&s, tok);
+			ctx->pos = s.i;
+			ctx->line = s.line;
+			ctx->column = s.column;
+			ctx->symbol = APELEXER_NO_SYMBOL;
+			ctx->number = s.number;
+			if (found && ctx->symbols && tok->type == APELEXER_TOKEN_IDENTIFIER) {
+				ctx->symbol = apelexer_symbols_intern(ctx->symbols, tok->value, tok->length);
+				tok->value = (char *)apelexer_symbols_name(ctx->symbols, ctx->symbol);
+				return APELEXER_NEXT_TOKEN;
 			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "=");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == '!') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "!=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
+			if (found) {
+				if (tok->length + 1 > ctx->value_cap) {
+					ctx->value_cap = tok->length + 1 > 64 ? tok->length + 1 : 64;
+					ctx->value = APELEXER_REALLOC(ctx->value, ctx->value_cap);
+				}
+				memcpy(ctx->value, tok->value, tok->length);
+				ctx->value[tok->length] = '\0';
+				tok->value = ctx->value;
+				return APELEXER_NEXT_TOKEN;
 			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "!");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
-		}
-		if (input[i] == '~') {
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "~");
-			tokens[*token_count - 1].start_line = line;
-			tokens[*token_count - 1].start_column = column;
-			i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			continue;
 		}
-		if (input[i] == '^') {
-			if (input[i + 1] == '=') {
-				APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "^=");
-				tokens[*token_count - 1].start_line = line;
-				tokens[*token_count - 1].start_column = column;
-				i += 2, column += 2;
-				tokens[*token_count - 1].end_line = line;
-				tokens[*token_count - 1].end_column = column;
-				continue;
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(APELEXER_TOKEN_OPERATOR, "^");
-			i++, column++;
-			continue;
+		// a block comment that isn't closed yet leaves pos short of the limit
+		if (ctx->eof && ctx->pos >= ctx->buf_len) {
+			return APELEXER_NEXT_DONE;
 		}
-		if (isalpha(input[i]) || input[i] == '_') {
-			size_t start_line = line;
-			size_t start_column = column;
-			size_t start = i;
-			while (i < len) {
-				if (isalnum(input[i]) || input[i] == '_') {
-					i++, column++;
-					continue;
-				}
-				break;
-			}
-			char *value = malloc(i - start + 1);
-			memcpy(value, &input[start], i - start);
-			value[i - start] = '\0';
-			int is_keyword = 0;
-			for (size_t j = 0; j < sizeof(apelexer_keywords) / sizeof(apelexer_keywords[0]); j++) {
-				if (strcmp(apelexer_keywords[j], value) == 0) {
-					is_keyword = 1;
-					break;
-				}
-			}
-			APELEXER_TOKENIZER_PUSH_TOKEN(is_keyword ? APELEXER_TOKEN_KEYWORD : APELEXER_TOKEN_IDENTIFIER, value);
-			tokens[*token_count - 1].start_line = start_line;
-			tokens[*token_count - 1].start_column = start_column;
-			// i++, column++;
-			tokens[*token_count - 1].end_line = line;
-			tokens[*token_count - 1].end_column = column;
-			free(value);
-			continue;
+		if (!apelexer_stream_fill(ctx)) {
+			return APELEXER_NEXT_NEED_INPUT;
 		}
 	}
-#undef APELEXER_TOKENIZER_PUSH_TOKEN
-	return tokens;
 }
-/* END lexer.c */
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_ctx(ApelexerCtx *ctx, const char *input, size_t len, size_t *token_count)
+{
+	if (ctx->tokens)
+		apelexer_arena_reset(&APELEXER_TOKENS_HEADER(ctx->tokens)->arena);
+	ctx->tokens = apelexer_tokenize_into(ctx->tokens, ctx->lang, ctx->symbols, input, len, token_count);
+	return ctx->tokens;
+}
+
+APELEXER_DEF void apelexer_reset(ApelexerCtx *ctx)
+{
+	ctx->buf_len = 0;
+	if (ctx->buf)
+		ctx->buf[0] = '\0';
+	ctx->pos = 0;
+	ctx->limit = 0;
+	ctx->line = 1;
+	ctx->column = 1;
+	ctx->eof = APELEXER_FALSE;
+	if (ctx->tokens)
+		apelexer_arena_reset(&APELEXER_TOKENS_HEADER(ctx->tokens)->arena);
+}
+
+APELEXER_DEF void apelexer_free(ApelexerCtx *ctx)
+{
+	APELEXER_FREE(ctx->buf);
+	APELEXER_FREE(ctx->value);
+	apelexer_free_tokens(ctx->tokens);
+	apelexer_init(ctx);
+}
+/* END stream.c */
+
+
+/* BEGIN symbols.c */
+
+APELEXER_DEF ApelexerSymbols *apelexer_symbols_new(void)
+{
+	ApelexerSymbols *symbols = APELEXER_MALLOC(sizeof(ApelexerSymbols));
+	memset(symbols, 0, sizeof(*symbols));
+	apedsa_da_push(symbols->names, NULL); // ID 0 is APELEXER_NO_SYMBOL
+	return symbols;
+}
+
+APELEXER_DEF void apelexer_symbols_free(ApelexerSymbols *symbols)
+{
+	if (!symbols)
+		return;
+	apedsa_shm_free(symbols->map);
+	apedsa_da_free(symbols->names);
+	APELEXER_FREE(symbols->scratch);
+	APELEXER_FREE(symbols);
+}
+
+APELEXER_DEF uint32_t apelexer_symbols_intern(ApelexerSymbols *symbols, const char *name, size_t len)
+{
+	// The map wants NUL-terminated keys and token values point into the input
+	if (len + 1 > symbols->scratch_cap) {
+		symbols->scratch_cap = len + 1 > 64 ? len + 1 : 64;
+		symbols->scratch = APELEXER_REALLOC(symbols->scratch, symbols->scratch_cap);
+	}
+	memcpy(symbols->scratch, name, len);
+	symbols->scratch[len] = '\0';
+	ptrdiff_t i = apedsa_shm_geti(symbols->map, symbols->scratch);
+	if (i >= 0)
+		return symbols->map[i].value;
+	uint32_t id = (uint32_t)apedsa_da_count(symbols->names);
+	apedsa_shm_put(symbols->map, symbols->scratch, id);
+	// Nothing is ever deleted, so the new entry is the last one. Its key was copied into the
+	// map's string arena, which never moves
+	apedsa_da_push(symbols->names, symbols->map[apedsa_shm_len(symbols->map) - 1].key);
+	return id;
+}
+
+APELEXER_DEF const char *apelexer_symbols_name(const ApelexerSymbols *symbols, uint32_t id)
+{
+	if (id == APELEXER_NO_SYMBOL || id >= apedsa_da_count(symbols->names))
+		return NULL;
+	return symbols->names[id];
+}
+
+APELEXER_DEF size_t apelexer_symbols_count(const ApelexerSymbols *symbols)
+{
+	return apedsa_da_count(symbols->names) - 1;
+}
+/* END symbols.c */
 
 #endif
 
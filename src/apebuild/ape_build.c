@@ -2,7 +2,9 @@
  * ape_build.c - Core build module implementation
  *
  * Uses handle-based storage for all build objects (toolchains, builders, tasks)
- * instead of pointers. Objects are stored in fixed-size global arrays.
+ * instead of pointers. Objects live in generation-checked slot maps that grow
+ * in chunks of 256 slots, so they never move once allocated. A handle packs a
+ * 20-bit slot index with an 11-bit generation, and freed slots are reused.
  */
 
 #include "apebuild_internal.h"
@@ -10,6 +12,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <limits.h>
 
 /* ============================================================================
  * Embedded Default Emscripten Shell HTML
@@ -140,14 +146,131 @@ APEBUILD_PRIVATE const char ape_emcc_default_shell_html[] = "<!doctype html>\n"
 							    "</html>\n";
 
 /* ============================================================================
- * Global Storage Arrays
+ * Global Storage
+ *
+ * Each kind of object lives in a slot map. Slots are allocated in chunks that
+ * never move, so pointers to objects stay valid while more are created. Freed
+ * slots are reused first. A slot's generation is odd while it holds an object
+ * and is part of the handle, which catches handles to freed objects.
  * ============================================================================ */
 
-APEBUILD_PRIVATE ApeToolchain ape_toolchain_storage[APE_MAX_TOOLCHAINS];
-APEBUILD_PRIVATE ApeBuilder ape_builder_storage[APE_MAX_BUILDERS];
-APEBUILD_PRIVATE ApeTask ape_task_storage[APE_MAX_TASKS];
+#define APE_SLOT_CHUNK_BITS 8
+#define APE_SLOT_CHUNK_SIZE (1u << APE_SLOT_CHUNK_BITS)
+#define APE_SLOT_INDEX_MASK ((1u << APE_HANDLE_INDEX_BITS) - 1)
+#define APE_SLOT_GENERATION_MASK ((1u << (31 - APE_HANDLE_INDEX_BITS)) - 1)
+
+typedef struct {
+	size_t elem_size;
+	unsigned char **chunks;
+	size_t chunk_count;
+	uint16_t *generations; /* One per slot */
+	size_t slot_count;     /* Slots handed out so far */
+	uint32_t *free_slots;
+	size_t free_count;
+	size_t free_capacity;
+} ApeSlotMap;
+
+APEBUILD_PRIVATE ApeSlotMap ape_toolchain_slots = { .elem_size = sizeof(ApeToolchain) };
+APEBUILD_PRIVATE ApeSlotMap ape_builder_slots = { .elem_size = sizeof(ApeBuilder) };
+APEBUILD_PRIVATE ApeSlotMap ape_task_slots = { .elem_size = sizeof(ApeTask) };
 APEBUILD_PRIVATE int ape_build_initialized = 0;
 
+APEBUILD_PRIVATE void *ape_slots_at(const ApeSlotMap *map, uint32_t index)
+{
+	return map->chunks[index >> APE_SLOT_CHUNK_BITS] + (size_t)(index & (APE_SLOT_CHUNK_SIZE - 1)) * map->elem_size;
+}
+
+APEBUILD_PRIVATE int ape_slots_live(const ApeSlotMap *map, uint32_t index)
+{
+	return index < map->slot_count && (map->generations[index] & 1);
+}
+
+/* Returns a handle to a zeroed object, -1 when the index space is exhausted */
+APEBUILD_PRIVATE int32_t ape_slots_alloc(ApeSlotMap *map)
+{
+	uint32_t index;
+	if (map->free_count > 0) {
+		index = map->free_slots[--map->free_count];
+	} else {
+		if (map->slot_count > APE_SLOT_INDEX_MASK)
+			return -1;
+		index = (uint32_t)map->slot_count;
+		if ((index & (APE_SLOT_CHUNK_SIZE - 1)) == 0) {
+			map->chunks = (unsigned char **)APEBUILD_REALLOC(map->chunks, (map->chunk_count + 1) * sizeof(unsigned char *));
+			map->chunks[map->chunk_count++] = (unsigned char *)APEBUILD_MALLOC(APE_SLOT_CHUNK_SIZE * map->elem_size);
+			size_t slots = map->chunk_count * APE_SLOT_CHUNK_SIZE;
+			map->generations = (uint16_t *)APEBUILD_REALLOC(map->generations, slots * sizeof(uint16_t));
+		}
+		map->generations[index] = 0;
+		map->slot_count++;
+	}
+
+	map->generations[index]++;
+	memset(ape_slots_at(map, index), 0, map->elem_size);
+	return (int32_t)(((map->generations[index] & APE_SLOT_GENERATION_MASK) << APE_HANDLE_INDEX_BITS) | index);
+}
+
+APEBUILD_PRIVATE void *ape_slots_get(const ApeSlotMap *map, int32_t handle)
+{
+	if (handle < 0)
+		return NULL;
+	uint32_t index = (uint32_t)handle & APE_SLOT_INDEX_MASK;
+	if (!ape_slots_live(map, index))
+		return NULL;
+	if ((map->generations[index] & APE_SLOT_GENERATION_MASK) != ((uint32_t)handle >> APE_HANDLE_INDEX_BITS))
+		return NULL;
+	return ape_slots_at(map, index);
+}
+
+APEBUILD_PRIVATE void ape_slots_release(ApeSlotMap *map, int32_t handle)
+{
+	if (!ape_slots_get(map, handle))
+		return;
+	uint32_t index = (uint32_t)handle & APE_SLOT_INDEX_MASK;
+	map->generations[index]++;
+	if (map->free_count >= map->free_capacity) {
+		map->free_capacity = map->free_capacity == 0 ? APEBUILD_INIT_CAP : map->free_capacity * 2;
+		map->free_slots = (uint32_t *)APEBUILD_REALLOC(map->free_slots, map->free_capacity * sizeof(uint32_t));
+	}
+	map->free_slots[map->free_count++] = index;
+}
+
+/* Handle of the object in a live slot */
+APEBUILD_PRIVATE int32_t ape_slots_handle(const ApeSlotMap *map, uint32_t index)
+{
+	return (int32_t)(((map->generations[index] & APE_SLOT_GENERATION_MASK) << APE_HANDLE_INDEX_BITS) | index);
+}
+
+/* Frees the storage itself, objects must be cleared first */
+APEBUILD_PRIVATE void ape_slots_free(ApeSlotMap *map)
+{
+	for (size_t i = 0; i < map->chunk_count; i++)
+		APEBUILD_FREE(map->chunks[i]);
+	APEBUILD_FREE(map->chunks);
+	APEBUILD_FREE(map->generations);
+	APEBUILD_FREE(map->free_slots);
+	size_t elem_size = map->elem_size;
+	memset(map, 0, sizeof(ApeSlotMap));
+	map->elem_size = elem_size;
+}
+
+/* Context passed to ape_ctx_build(), its settings apply to every builder it builds */
+APEBUILD_PRIVATE ApeBuildCtx *ape_active_ctx = NULL;
+
+/* Compiler identities for the object cache, so each compiler is only asked for --version once */
+typedef struct {
+	char *compiler;
+	ApeHash id;
+} ApeCompilerId;
+
+typedef struct {
+	size_t capacity;
+	size_t count;
+	ApeCompilerId *items;
+} ApeCompilerIdList;
+
+APEBUILD_PRIVATE ApeCompilerIdList ape_compiler_ids = { 0 };
+
 /* ============================================================================
  * Initialization and Shutdown
  * ============================================================================ */
@@ -157,10 +280,6 @@ APEBUILD_DEF void ape_build_init(void)
 	if (ape_build_initialized)
 		return;
 
-	memset(ape_toolchain_storage, 0, sizeof(ape_toolchain_storage));
-	memset(ape_builder_storage, 0, sizeof(ape_builder_storage));
-	memset(ape_task_storage, 0, sizeof(ape_task_storage));
-
 	ape_build_initialized = 1;
 }
 
@@ -186,8 +305,12 @@ APEBUILD_PRIVATE void ape_task_clear(ApeTask *task)
 	APEBUILD_FREE(task->name);
 	APEBUILD_FREE(task->input);
 	APEBUILD_FREE(task->output);
+	APEBUILD_FREE(task->cache_key);
+	APEBUILD_FREE(task->depfile);
 	ape_sl_free(&task->inputs);
+	ape_sl_free(&task->headers);
 	ape_cmd_free(&task->cmd);
+	ape_da_free(&task->deps);
 	memset(task, 0, sizeof(ApeTask));
 }
 
@@ -197,6 +320,7 @@ APEBUILD_PRIVATE void ape_builder_clear(ApeBuilder *builder)
 	APEBUILD_FREE(builder->output_dir);
 	APEBUILD_FREE(builder->output_name);
 	APEBUILD_FREE(builder->shell_file);
+	APEBUILD_FREE(builder->pch_header);
 	ape_sl_free(&builder->sources);
 	ape_sl_free(&builder->cflags);
 	ape_sl_free(&builder->include_dirs);
@@ -207,6 +331,8 @@ APEBUILD_PRIVATE void ape_builder_clear(ApeBuilder *builder)
 	ape_sl_free(&builder->exported_functions);
 	ape_sl_free(&builder->preload_files);
 	ape_sl_free(&builder->embed_files);
+	ape_da_free(&builder->deps);
+	ape_da_free(&builder->tasks);
 	memset(builder, 0, sizeof(ApeBuilder));
 }
 
@@ -216,25 +342,33 @@ APEBUILD_DEF void ape_build_shutdown(void)
 		return;
 
 	/* Free all toolchains */
-	for (int i = 0; i < APE_MAX_TOOLCHAINS; i++) {
-		if (ape_toolchain_storage[i].in_use) {
-			ape_toolchain_clear(&ape_toolchain_storage[i]);
+	for (uint32_t i = 0; i < ape_toolchain_slots.slot_count; i++) {
+		if (ape_slots_live(&ape_toolchain_slots, i)) {
+			ape_toolchain_clear((ApeToolchain *)ape_slots_at(&ape_toolchain_slots, i));
 		}
 	}
+	ape_slots_free(&ape_toolchain_slots);
 
 	/* Free all tasks */
-	for (int i = 0; i < APE_MAX_TASKS; i++) {
-		if (ape_task_storage[i].in_use) {
-			ape_task_clear(&ape_task_storage[i]);
+	for (uint32_t i = 0; i < ape_task_slots.slot_count; i++) {
+		if (ape_slots_live(&ape_task_slots, i)) {
+			ape_task_clear((ApeTask *)ape_slots_at(&ape_task_slots, i));
 		}
 	}
+	ape_slots_free(&ape_task_slots);
 
 	/* Free all builders */
-	for (int i = 0; i < APE_MAX_BUILDERS; i++) {
-		if (ape_builder_storage[i].in_use) {
-			ape_builder_clear(&ape_builder_storage[i]);
+	for (uint32_t i = 0; i < ape_builder_slots.slot_count; i++) {
+		if (ape_slots_live(&ape_builder_slots, i)) {
+			ape_builder_clear((ApeBuilder *)ape_slots_at(&ape_builder_slots, i));
 		}
 	}
+	ape_slots_free(&ape_builder_slots);
+
+	for (size_t i = 0; i < ape_compiler_ids.count; i++) {
+		APEBUILD_FREE(ape_compiler_ids.items[i].compiler);
+	}
+	ape_da_free(&ape_compiler_ids);
 
 	ape_build_initialized = 0;
 }
@@ -253,29 +387,26 @@ APEBUILD_DEF ApeToolchainHandle ape_toolchain_new(const char *name)
 {
 	ape_build_init();
 
-	for (int i = 0; i < APE_MAX_TOOLCHAINS; i++) {
-		if (!ape_toolchain_storage[i].in_use) {
-			ApeToolchain *tc = &ape_toolchain_storage[i];
-			memset(tc, 0, sizeof(ApeToolchain));
+	ApeToolchainHandle handle = ape_slots_alloc(&ape_toolchain_slots);
+	ApeToolchain *tc = (ApeToolchain *)ape_slots_get(&ape_toolchain_slots, handle);
+	if (!tc)
+		return APE_INVALID_TOOLCHAIN;
 
-			tc->in_use = 1;
-			tc->name = ape_str_dup(name);
-			tc->cc = ape_str_dup("cc");
-			tc->cxx = ape_str_dup("c++");
-			tc->ld = ape_str_dup("cc");
-			tc->ar = ape_str_dup("ar");
-			tc->obj_ext = ape_str_dup(".o");
-			tc->exe_ext = ape_str_dup("");
-			tc->static_lib_ext = ape_str_dup(".a");
-			tc->shared_lib_ext = ape_str_dup(".so");
-			tc->lib_prefix = ape_str_dup("lib");
-			ape_sl_init(&tc->default_cflags);
-			ape_sl_init(&tc->default_ldflags);
+	tc->in_use = 1;
+	tc->name = ape_str_dup(name);
+	tc->cc = ape_str_dup("cc");
+	tc->cxx = ape_str_dup("c++");
+	tc->ld = ape_str_dup("cc");
+	tc->ar = ape_str_dup("ar");
+	tc->obj_ext = ape_str_dup(".o");
+	tc->exe_ext = ape_str_dup("");
+	tc->static_lib_ext = ape_str_dup(".a");
+	tc->shared_lib_ext = ape_str_dup(".so");
+	tc->lib_prefix = ape_str_dup("lib");
+	ape_sl_init(&tc->default_cflags);
+	ape_sl_init(&tc->default_ldflags);
 
-			return (ApeToolchainHandle)i;
-		}
-	}
-	return APE_INVALID_TOOLCHAIN;
+	return handle;
 }
 
 APEBUILD_DEF void ape_toolchain_free(ApeToolchainHandle handle)
@@ -283,16 +414,13 @@ APEBUILD_DEF void ape_toolchain_free(ApeToolchainHandle handle)
 	ApeToolchain *tc = ape_toolchain_get(handle);
 	if (tc) {
 		ape_toolchain_clear(tc);
+		ape_slots_release(&ape_toolchain_slots, handle);
 	}
 }
 
 APEBUILD_DEF ApeToolchain *ape_toolchain_get(ApeToolchainHandle handle)
 {
-	if (handle < 0 || handle >= APE_MAX_TOOLCHAINS)
-		return NULL;
-	if (!ape_toolchain_storage[handle].in_use)
-		return NULL;
-	return &ape_toolchain_storage[handle];
+	return (ApeToolchain *)ape_slots_get(&ape_toolchain_slots, handle);
 }
 
 APEBUILD_DEF int ape_toolchain_valid(ApeToolchainHandle handle)
@@ -445,6 +573,331 @@ APEBUILD_DEF void ape_toolchain_add_ldflag(ApeToolchainHandle handle, const char
 	ape_sl_append_dup(&tc->default_ldflags, flag);
 }
 
+/* ============================================================================
+ * Path Index
+ * ============================================================================ */
+
+/* Open addressing index from path to its position in a string list */
+typedef struct {
+	size_t capacity; /* Power of two */
+	uint32_t *slots; /* Position + 1, 0 = empty */
+} ApePathIndex;
+
+APEBUILD_PRIVATE void ape_path_index_insert(ApePathIndex *index, const ApeStrList *paths, uint32_t pos)
+{
+	size_t mask = index->capacity - 1;
+	size_t slot = (size_t)ape_hash_string(paths->items[pos]) & mask;
+	while (index->slots[slot])
+		slot = (slot + 1) & mask;
+	index->slots[slot] = pos + 1;
+}
+
+APEBUILD_PRIVATE void ape_path_index_build(ApePathIndex *index, const ApeStrList *paths)
+{
+	index->capacity = 16;
+	while (index->capacity < paths->count * 2)
+		index->capacity *= 2;
+	index->slots = (uint32_t *)APEBUILD_MALLOC(index->capacity * sizeof(uint32_t));
+	memset(index->slots, 0, index->capacity * sizeof(uint32_t));
+	for (size_t i = 0; i < paths->count; i++) {
+		ape_path_index_insert(index, paths, (uint32_t)i);
+	}
+}
+
+/* Returns the position of path in paths, or -1 */
+APEBUILD_PRIVATE int64_t ape_path_index_find(const ApePathIndex *index, const ApeStrList *paths, const char *path)
+{
+	size_t mask = index->capacity - 1;
+	for (size_t slot = (size_t)ape_hash_string(path) & mask; index->slots[slot]; slot = (slot + 1) & mask) {
+		uint32_t pos = index->slots[slot] - 1;
+		if (strcmp(paths->items[pos], path) == 0)
+			return pos;
+	}
+	return -1;
+}
+
+/* Returns the position of path in paths, appending it first if needed */
+APEBUILD_PRIVATE uint32_t ape_path_index_intern(ApePathIndex *index, ApeStrList *paths, const char *path)
+{
+	int64_t found = ape_path_index_find(index, paths, path);
+	if (found >= 0)
+		return (uint32_t)found;
+
+	ape_sl_append_dup(paths, path);
+	if (paths->count * 2 > index->capacity) {
+		APEBUILD_FREE(index->slots);
+		ape_path_index_build(index, paths);
+	} else {
+		ape_path_index_insert(index, paths, (uint32_t)(paths->count - 1));
+	}
+	return (uint32_t)(paths->count - 1);
+}
+
+/* ============================================================================
+ * Build Log
+ *
+ * <output_dir>/<name>.buildlog records, for each output of a builder, a hash
+ * of the command that produced it, a hash of its inputs' mtimes at the time,
+ * how long it took and how much memory it needed. Records are appended as tasks finish and later records
+ * win:
+ *
+ *   "APELOG02"
+ *   per record: u32 path length, path, u64 command hash, u64 inputs hash, u32 milliseconds, u32 peak KiB
+ *
+ * During a build every mtime is looked up once, so a header that all sources
+ * include is stat'ed once rather than once per object.
+ * ============================================================================ */
+
+#define APE_LOG_MAGIC "APELOG02"
+
+/* The log is rewritten once it holds this many records per output */
+#define APE_LOG_COMPACT_RATIO 4
+
+typedef struct {
+	size_t capacity;
+	size_t count;
+	time_t *items;
+} ApeMtimeList;
+
+APEBUILD_PRIVATE int ape_mtime_memo_active = 0;
+APEBUILD_PRIVATE ApeStrList ape_mtime_paths;
+APEBUILD_PRIVATE ApePathIndex ape_mtime_index;
+APEBUILD_PRIVATE ApeMtimeList ape_mtimes;
+
+APEBUILD_PRIVATE void ape_mtime_memo_begin(void)
+{
+	ape_sl_init(&ape_mtime_paths);
+	ape_path_index_build(&ape_mtime_index, &ape_mtime_paths);
+	ape_da_init(&ape_mtimes);
+	ape_mtime_memo_active = 1;
+}
+
+APEBUILD_PRIVATE void ape_mtime_memo_end(void)
+{
+	if (!ape_mtime_memo_active)
+		return;
+	ape_sl_free(&ape_mtime_paths);
+	APEBUILD_FREE(ape_mtime_index.slots);
+	ape_da_free(&ape_mtimes);
+	ape_mtime_memo_active = 0;
+}
+
+/* ape_fs_mtime(), memoized while a build runs */
+APEBUILD_PRIVATE time_t ape_build_mtime(const char *path)
+{
+	if (!ape_mtime_memo_active)
+		return ape_fs_mtime(path);
+
+	uint32_t pos = ape_path_index_intern(&ape_mtime_index, &ape_mtime_paths, path);
+	if (pos == ape_mtimes.count)
+		ape_da_append(&ape_mtimes, ape_fs_mtime(path));
+	return ape_mtimes.items[pos];
+}
+
+/* Called for files the build itself just wrote */
+APEBUILD_PRIVATE void ape_build_mtime_refresh(const char *path)
+{
+	if (!ape_mtime_memo_active)
+		return;
+
+	int64_t pos = ape_path_index_find(&ape_mtime_index, &ape_mtime_paths, path);
+	if (pos >= 0)
+		ape_mtimes.items[pos] = ape_fs_mtime(path);
+}
+
+APEBUILD_PRIVATE uint64_t ape_build_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+APEBUILD_PRIVATE ApeHash ape_task_cmd_hash(const ApeTask *task)
+{
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	for (size_t i = 0; i < task->cmd.count; i++) {
+		ape_hash_update_str(&hc, task->cmd.items[i]);
+	}
+	for (size_t i = 0; i < task->cmd.env.count; i++) {
+		ape_hash_update_str(&hc, task->cmd.env.items[i]);
+	}
+	if (task->cmd.cwd)
+		ape_hash_update_str(&hc, task->cmd.cwd);
+	return ape_hash_final(&hc);
+}
+
+APEBUILD_PRIVATE void ape_hash_update_mtime(ApeHashContext *hc, const char *path)
+{
+	int64_t mtime = (int64_t)ape_build_mtime(path);
+	ape_hash_update_str(hc, path);
+	ape_hash_update(hc, &mtime, sizeof(mtime));
+}
+
+/* Changes when an input is added, removed or gets a different mtime, including an older one */
+APEBUILD_PRIVATE ApeHash ape_task_inputs_hash(const ApeTask *task)
+{
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	if (task->input)
+		ape_hash_update_mtime(&hc, task->input);
+	for (size_t i = 0; i < task->inputs.count; i++) {
+		ape_hash_update_mtime(&hc, task->inputs.items[i]);
+	}
+	for (size_t i = 0; i < task->headers.count; i++) {
+		ape_hash_update_mtime(&hc, task->headers.items[i]);
+	}
+	return ape_hash_final(&hc);
+}
+
+APEBUILD_PRIVATE char *ape_builder_log_path(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return NULL;
+
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s/%s.buildlog", builder->output_dir ? builder->output_dir : "build", builder->name);
+	char *path = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return path;
+}
+
+APEBUILD_PRIVATE void ape_build_log_write_record(ApeStrBuilder *sb, const ApeTask *task)
+{
+	uint32_t len = (uint32_t)strlen(task->output);
+	ape_sb_append_strn(sb, (const char *)&len, sizeof(len));
+	ape_sb_append_strn(sb, task->output, len);
+	ape_sb_append_strn(sb, (const char *)&task->logged_cmd_hash, sizeof(task->logged_cmd_hash));
+	ape_sb_append_strn(sb, (const char *)&task->logged_inputs_hash, sizeof(task->logged_inputs_hash));
+	ape_sb_append_strn(sb, (const char *)&task->duration_ms, sizeof(task->duration_ms));
+	ape_sb_append_strn(sb, (const char *)&task->peak_rss_kb, sizeof(task->peak_rss_kb));
+}
+
+/* Rewrites the log with one record per logged output */
+APEBUILD_PRIVATE void ape_builder_compact_log(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	char *log_path = ape_builder_log_path(handle);
+	if (!builder || !log_path)
+		return;
+
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_str(&sb, APE_LOG_MAGIC);
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (task && task->output && task->logged)
+			ape_build_log_write_record(&sb, task);
+	}
+
+	char *tmp_path = ape_str_concat(log_path, ".tmp");
+	if (ape_fs_write_file(tmp_path, sb.items, sb.count))
+		ape_fs_rename(tmp_path, log_path);
+
+	APEBUILD_FREE(tmp_path);
+	APEBUILD_FREE(log_path);
+	ape_sb_free(&sb);
+}
+
+/* Gives the builder's tasks what the log knows about their outputs */
+APEBUILD_PRIVATE void ape_builder_load_log(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return;
+
+	ApeStrList outputs = ape_sl_new();
+	ApeTaskHandleList output_tasks = { 0 };
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (!task || !task->output)
+			continue;
+		ape_sl_append_dup(&outputs, task->output);
+		ape_da_append(&output_tasks, builder->tasks.items[i]);
+	}
+
+	char *log_path = ape_builder_log_path(handle);
+	size_t size = 0;
+	char *data = outputs.count > 0 ? ape_fs_read_file(log_path, &size) : NULL;
+	if (!data || size < strlen(APE_LOG_MAGIC) || memcmp(data, APE_LOG_MAGIC, strlen(APE_LOG_MAGIC)) != 0) {
+		/* Not a log (or an older format), start over */
+		if (data)
+			ape_fs_remove(log_path);
+		APEBUILD_FREE(log_path);
+		APEBUILD_FREE(data);
+		ape_sl_free(&outputs);
+		ape_da_free(&output_tasks);
+		return;
+	}
+	APEBUILD_FREE(log_path);
+
+	ApePathIndex index;
+	ape_path_index_build(&index, &outputs);
+
+	const char *p = data + strlen(APE_LOG_MAGIC);
+	const char *end = data + size;
+	const size_t fixed = sizeof(ApeHash) * 2 + sizeof(uint32_t) * 2;
+	size_t records = 0;
+	ApeStrBuilder path = ape_sb_new();
+	for (;;) {
+		/* A torn last record from an interrupted build is ignored */
+		uint32_t len = 0;
+		if ((size_t)(end - p) < sizeof(len))
+			break;
+		memcpy(&len, p, sizeof(len));
+		if ((size_t)(end - p) - sizeof(len) < (size_t)len + fixed)
+			break;
+		p += sizeof(len);
+
+		ape_sb_clear(&path);
+		ape_sb_append_strn(&path, p, len);
+		ape_sb_append_char(&path, '\0');
+		p += len;
+
+		int64_t pos = ape_path_index_find(&index, &outputs, path.items);
+		ApeTask *task = pos >= 0 ? ape_task_get(output_tasks.items[pos]) : NULL;
+		if (task) {
+			memcpy(&task->logged_cmd_hash, p, sizeof(ApeHash));
+			memcpy(&task->logged_inputs_hash, p + sizeof(ApeHash), sizeof(ApeHash));
+			memcpy(&task->duration_ms, p + sizeof(ApeHash) * 2, sizeof(uint32_t));
+			memcpy(&task->peak_rss_kb, p + sizeof(ApeHash) * 2 + sizeof(uint32_t), sizeof(uint32_t));
+			task->logged = 1;
+		}
+		p += fixed;
+		records++;
+	}
+	ape_sb_free(&path);
+
+	if (records > APE_LOG_COMPACT_RATIO * outputs.count)
+		ape_builder_compact_log(handle);
+
+	APEBUILD_FREE(index.slots);
+	ape_sl_free(&outputs);
+	ape_da_free(&output_tasks);
+	APEBUILD_FREE(data);
+}
+
+/* Records a task that just produced its output */
+APEBUILD_PRIVATE void ape_builder_log_task(ApeBuilderHandle handle, ApeTask *task)
+{
+	if (!task->output)
+		return;
+
+	ape_build_mtime_refresh(task->output);
+	task->logged = 1;
+	task->logged_cmd_hash = ape_task_cmd_hash(task);
+	task->logged_inputs_hash = ape_task_inputs_hash(task);
+
+	char *log_path = ape_builder_log_path(handle);
+	ApeStrBuilder sb = ape_sb_new();
+	if (!ape_fs_exists(log_path))
+		ape_sb_append_str(&sb, APE_LOG_MAGIC);
+	ape_build_log_write_record(&sb, task);
+	ape_fs_append_file(log_path, sb.items, sb.count);
+	ape_sb_free(&sb);
+	APEBUILD_FREE(log_path);
+}
+
 /* ============================================================================
  * Task Implementation
  * ============================================================================ */
@@ -453,26 +906,26 @@ APEBUILD_DEF ApeTaskHandle ape_task_new(ApeBuilderHandle builder_handle, ApeTask
 {
 	ape_build_init();
 
-	for (int i = 0; i < APE_MAX_TASKS; i++) {
-		if (!ape_task_storage[i].in_use) {
-			ApeTask *task = &ape_task_storage[i];
-			memset(task, 0, sizeof(ApeTask));
+	ApeTaskHandle handle = ape_slots_alloc(&ape_task_slots);
+	ApeTask *task = (ApeTask *)ape_slots_get(&ape_task_slots, handle);
+	if (!task)
+		return APE_INVALID_TASK;
 
-			task->in_use = 1;
-			task->type = type;
-			task->status = APE_TASK_PENDING;
-			task->name = ape_str_dup(name);
-			task->builder = builder_handle;
-			task->proc = APE_INVALID_HANDLE;
-			task->exit_code = -1;
-			ape_sl_init(&task->inputs);
-			ape_cmd_init(&task->cmd);
-			task->deps.count = 0;
+	task->in_use = 1;
+	task->type = type;
+	task->status = APE_TASK_PENDING;
+	task->name = ape_str_dup(name);
+	task->builder = builder_handle;
+	task->proc = APE_INVALID_HANDLE;
+	task->exit_code = -1;
+	task->sched_index = -1;
+	task->slot = -1;
+	ape_sl_init(&task->inputs);
+	ape_sl_init(&task->headers);
+	ape_cmd_init(&task->cmd);
+	ape_da_init(&task->deps);
 
-			return (ApeTaskHandle)i;
-		}
-	}
-	return APE_INVALID_TASK;
+	return handle;
 }
 
 APEBUILD_DEF void ape_task_free(ApeTaskHandle handle)
@@ -480,16 +933,13 @@ APEBUILD_DEF void ape_task_free(ApeTaskHandle handle)
 	ApeTask *task = ape_task_get(handle);
 	if (task) {
 		ape_task_clear(task);
+		ape_slots_release(&ape_task_slots, handle);
 	}
 }
 
 APEBUILD_DEF ApeTask *ape_task_get(ApeTaskHandle handle)
 {
-	if (handle < 0 || handle >= APE_MAX_TASKS)
-		return NULL;
-	if (!ape_task_storage[handle].in_use)
-		return NULL;
-	return &ape_task_storage[handle];
+	return (ApeTask *)ape_slots_get(&ape_task_slots, handle);
 }
 
 APEBUILD_DEF int ape_task_valid(ApeTaskHandle handle)
@@ -528,9 +978,7 @@ APEBUILD_DEF void ape_task_add_dep(ApeTaskHandle handle, ApeTaskHandle dep)
 	ApeTask *task = ape_task_get(handle);
 	if (!task)
 		return;
-	if (task->deps.count >= APE_MAX_TASK_DEPS)
-		return;
-	task->deps.items[task->deps.count++] = dep;
+	ape_da_append(&task->deps, dep);
 }
 
 APEBUILD_DEF void ape_task_set_cmd(ApeTaskHandle handle, ApeCmd cmd)
@@ -553,18 +1001,34 @@ APEBUILD_DEF int ape_task_needs_rebuild(ApeTaskHandle handle)
 		return APEBUILD_TRUE;
 
 	/* Output doesn't exist */
-	if (!ape_fs_exists(task->output))
+	if (ape_build_mtime(task->output) == 0 && !ape_fs_exists(task->output))
+		return APEBUILD_TRUE;
+
+	/* Don't know which headers it was built from */
+	if (task->depfile && !task->deps_known)
 		return APEBUILD_TRUE;
 
+	/* The build log knows what the output was built from */
+	if (task->logged)
+		return task->logged_cmd_hash != ape_task_cmd_hash(task) || task->logged_inputs_hash != ape_task_inputs_hash(task);
+
+	time_t output_mtime = ape_build_mtime(task->output);
+
 	/* Check primary input */
 	if (task->input) {
-		if (ape_fs_is_newer(task->input, task->output))
+		if (ape_build_mtime(task->input) > output_mtime)
 			return APEBUILD_TRUE;
 	}
 
-	/* Check additional inputs */
+	/* Check additional inputs, one that disappeared (eg. a moved header) counts as changed */
 	for (size_t i = 0; i < task->inputs.count; i++) {
-		if (ape_fs_is_newer(task->inputs.items[i], task->output))
+		time_t input_mtime = ape_build_mtime(task->inputs.items[i]);
+		if (input_mtime == 0 || input_mtime > output_mtime)
+			return APEBUILD_TRUE;
+	}
+	for (size_t i = 0; i < task->headers.count; i++) {
+		time_t header_mtime = ape_build_mtime(task->headers.items[i]);
+		if (header_mtime == 0 || header_mtime > output_mtime)
 			return APEBUILD_TRUE;
 	}
 
@@ -596,40 +1060,37 @@ APEBUILD_DEF ApeBuilderHandle ape_builder_new(const char *name)
 {
 	ape_build_init();
 
-	for (int i = 0; i < APE_MAX_BUILDERS; i++) {
-		if (!ape_builder_storage[i].in_use) {
-			ApeBuilder *builder = &ape_builder_storage[i];
-			memset(builder, 0, sizeof(ApeBuilder));
-
-			builder->in_use = 1;
-			builder->name = ape_str_dup(name);
-			builder->type = APE_TARGET_EXECUTABLE;
-			builder->toolchain = APE_INVALID_TOOLCHAIN;
-
-			ape_sl_init(&builder->sources);
-			ape_sl_init(&builder->cflags);
-			ape_sl_init(&builder->include_dirs);
-			ape_sl_init(&builder->defines);
-			ape_sl_init(&builder->ldflags);
-			ape_sl_init(&builder->lib_dirs);
-			ape_sl_init(&builder->libs);
-
-			/* Emscripten/WASM defaults */
-			builder->shell_file = NULL;
-			builder->wasm_html_output = 1; /* Default to .html output */
-			ape_sl_init(&builder->exported_functions);
-			ape_sl_init(&builder->preload_files);
-			ape_sl_init(&builder->embed_files);
-			builder->wasm_initial_memory = 0;
-			builder->wasm_max_memory = 0;
-
-			builder->deps.count = 0;
-			builder->tasks.count = 0;
+	ApeBuilderHandle handle = ape_slots_alloc(&ape_builder_slots);
+	ApeBuilder *builder = (ApeBuilder *)ape_slots_get(&ape_builder_slots, handle);
+	if (!builder)
+		return APE_INVALID_BUILDER;
+
+	builder->in_use = 1;
+	builder->name = ape_str_dup(name);
+	builder->type = APE_TARGET_EXECUTABLE;
+	builder->toolchain = APE_INVALID_TOOLCHAIN;
+
+	ape_sl_init(&builder->sources);
+	ape_sl_init(&builder->cflags);
+	ape_sl_init(&builder->include_dirs);
+	ape_sl_init(&builder->defines);
+	ape_sl_init(&builder->ldflags);
+	ape_sl_init(&builder->lib_dirs);
+	ape_sl_init(&builder->libs);
+
+	/* Emscripten/WASM defaults */
+	builder->shell_file = NULL;
+	builder->wasm_html_output = 1; /* Default to .html output */
+	ape_sl_init(&builder->exported_functions);
+	ape_sl_init(&builder->preload_files);
+	ape_sl_init(&builder->embed_files);
+	builder->wasm_initial_memory = 0;
+	builder->wasm_max_memory = 0;
+
+	ape_da_init(&builder->deps);
+	ape_da_init(&builder->tasks);
 
-			return (ApeBuilderHandle)i;
-		}
-	}
-	return APE_INVALID_BUILDER;
+	return handle;
 }
 
 APEBUILD_DEF void ape_builder_free(ApeBuilderHandle handle)
@@ -644,15 +1105,12 @@ APEBUILD_DEF void ape_builder_free(ApeBuilderHandle handle)
 	}
 
 	ape_builder_clear(builder);
+	ape_slots_release(&ape_builder_slots, handle);
 }
 
 APEBUILD_DEF ApeBuilder *ape_builder_get(ApeBuilderHandle handle)
 {
-	if (handle < 0 || handle >= APE_MAX_BUILDERS)
-		return NULL;
-	if (!ape_builder_storage[handle].in_use)
-		return NULL;
-	return &ape_builder_storage[handle];
+	return (ApeBuilder *)ape_slots_get(&ape_builder_slots, handle);
 }
 
 APEBUILD_DEF int ape_builder_valid(ApeBuilderHandle handle)
@@ -662,9 +1120,9 @@ APEBUILD_DEF int ape_builder_valid(ApeBuilderHandle handle)
 
 APEBUILD_DEF ApeBuilderHandle ape_builder_find(const char *name)
 {
-	for (int i = 0; i < APE_MAX_BUILDERS; i++) {
-		if (ape_builder_storage[i].in_use && ape_str_eq(ape_builder_storage[i].name, name)) {
-			return (ApeBuilderHandle)i;
+	for (uint32_t i = 0; i < ape_builder_slots.slot_count; i++) {
+		if (ape_slots_live(&ape_builder_slots, i) && ape_str_eq(((ApeBuilder *)ape_slots_at(&ape_builder_slots, i))->name, name)) {
+			return ape_slots_handle(&ape_builder_slots, i);
 		}
 	}
 	return APE_INVALID_BUILDER;
@@ -704,6 +1162,23 @@ APEBUILD_DEF void ape_builder_set_output_name(ApeBuilderHandle handle, const cha
 	builder->output_name = ape_str_dup(name);
 }
 
+APEBUILD_DEF void ape_builder_set_unity(ApeBuilderHandle handle, int batches)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return;
+	builder->unity_batches = batches > 0 ? batches : 0;
+}
+
+APEBUILD_DEF void ape_builder_set_pch(ApeBuilderHandle handle, const char *header)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return;
+	APEBUILD_FREE(builder->pch_header);
+	builder->pch_header = ape_str_dup(header);
+}
+
 /* Source management */
 
 APEBUILD_DEF void ape_builder_add_source(ApeBuilderHandle handle, const char *path)
@@ -900,9 +1375,7 @@ APEBUILD_DEF void ape_builder_depends_on(ApeBuilderHandle handle, ApeBuilderHand
 	ApeBuilder *builder = ape_builder_get(handle);
 	if (!builder)
 		return;
-	if (builder->deps.count >= APE_MAX_BUILDER_DEPS)
-		return;
-	builder->deps.items[builder->deps.count++] = dep;
+	ape_da_append(&builder->deps, dep);
 }
 
 APEBUILD_DEF void ape_builder_link_with(ApeBuilderHandle handle, ApeBuilderHandle lib_builder_handle)
@@ -995,60 +1468,284 @@ APEBUILD_DEF char *ape_builder_output_path(ApeBuilderHandle handle)
 	return result;
 }
 
-/* Task generation */
+/* ============================================================================
+ * Header Dependencies
+ *
+ * The database holds every path once and refers to paths by index:
+ *
+ *   "APEDEPS1"
+ *   u32 path count, then per path: u32 length, bytes
+ *   u32 record count, then per record: u32 object, u32 header count, u32 headers...
+ *
+ * Integers are in host byte order, the database never leaves the build tree.
+ * ============================================================================ */
 
-APEBUILD_DEF ApeTaskHandle ape_builder_add_compile_task(ApeBuilderHandle handle, const char *source)
+#define APE_DEPS_MAGIC "APEDEPS1"
+
+APEBUILD_DEF ApeStrList ape_depfile_parse(const char *text)
 {
-	ApeBuilder *builder = ape_builder_get(handle);
-	if (!builder)
-		return APE_INVALID_TASK;
+	ApeStrList deps = ape_sl_new();
+	const char *p = text;
+
+	/* Skip the targets, up to the first ':' that isn't part of a path */
+	while (*p && !(*p == ':' && (p[1] == ' ' || p[1] == '\t' || p[1] == '\r' || p[1] == '\n' || p[1] == '\0'))) {
+		if (*p == '\\' && p[1])
+			p++;
+		p++;
+	}
+	if (!*p)
+		return deps;
+	p++;
+
+	ApeStrBuilder path = ape_sb_new();
+	for (;;) {
+		char c = *p;
+		int continuation = c == '\\' && (p[1] == '\n' || (p[1] == '\r' && p[2] == '\n'));
+		if (continuation || c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0') {
+			if (path.count > 0) {
+				ape_sl_append(&deps, ape_sb_to_str_dup(&path));
+				ape_sb_clear(&path);
+			}
+			/* An unescaped newline ends the rule */
+			if (c == '\n' || c == '\0')
+				break;
+			p += continuation ? (p[1] == '\r' ? 3 : 2) : 1;
+			continue;
+		}
+		if ((c == '\\' && (p[1] == ' ' || p[1] == '#')) || (c == '$' && p[1] == '$')) {
+			p++;
+			c = *p;
+		}
+		ape_sb_append_char(&path, c);
+		p++;
+	}
+	ape_sb_free(&path);
+	return deps;
+}
 
-	char *obj_path = ape_build_obj_path(NULL, handle, source);
-	char *base = ape_fs_basename(source);
+/* Prerequisites that are already inputs of the task aren't headers */
+APEBUILD_PRIVATE int ape_task_has_input(const ApeTask *task, const char *path)
+{
+	if (task->input && strcmp(path, task->input) == 0)
+		return APEBUILD_TRUE;
+	for (size_t i = 0; i < task->inputs.count; i++) {
+		if (strcmp(path, task->inputs.items[i]) == 0)
+			return APEBUILD_TRUE;
+	}
+	return APEBUILD_FALSE;
+}
 
-	ApeStrBuilder name_sb = ape_sb_new();
-	ape_sb_append_str(&name_sb, "Compile ");
-	ape_sb_append_str(&name_sb, base);
-	char *task_name = ape_sb_to_str_dup(&name_sb);
-	ape_sb_free(&name_sb);
+/* Replaces the task's headers with the ones from its depfile */
+APEBUILD_PRIVATE int ape_task_read_depfile(ApeTask *task)
+{
+	char *text = ape_fs_read_file(task->depfile, NULL);
+	if (!text)
+		return APEBUILD_FALSE;
 
-	ApeTaskHandle task_handle = ape_task_new(handle, APE_TASK_TYPE_COMPILE, task_name);
-	APEBUILD_FREE(task_name);
-	APEBUILD_FREE(base);
+	ApeStrList deps = ape_depfile_parse(text);
+	APEBUILD_FREE(text);
 
-	ApeTask *task = ape_task_get(task_handle);
-	if (!task) {
-		APEBUILD_FREE(obj_path);
-		return APE_INVALID_TASK;
+	ape_sl_clear(&task->headers);
+	for (size_t i = 0; i < deps.count; i++) {
+		if (ape_task_has_input(task, deps.items[i]))
+			continue;
+		ape_sl_append_dup(&task->headers, deps.items[i]);
 	}
+	ape_sl_free(&deps);
 
-	ape_task_set_input(task_handle, source);
-	ape_task_set_output(task_handle, obj_path);
+	task->deps_known = 1;
+	return APEBUILD_TRUE;
+}
 
-	/* Build compile command */
-	ApeToolchain *tc = ape_toolchain_get(builder->toolchain);
-	if (!tc) {
-		APEBUILD_FREE(obj_path);
-		return APE_INVALID_TASK;
+APEBUILD_PRIVATE char *ape_builder_deps_path(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return NULL;
+
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s/%s.deps", builder->output_dir ? builder->output_dir : "build", builder->name);
+	char *path = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return path;
+}
+
+APEBUILD_PRIVATE int ape_deps_read_u32(const char **p, const char *end, uint32_t *out)
+{
+	if ((size_t)(end - *p) < sizeof(uint32_t))
+		return APEBUILD_FALSE;
+	memcpy(out, *p, sizeof(uint32_t));
+	*p += sizeof(uint32_t);
+	return APEBUILD_TRUE;
+}
+
+/*
+ * Gives the builder's compile tasks their headers: from a depfile
+ * that is still on disk (the build stopped before it was folded in), otherwise
+ * from the database.
+ */
+APEBUILD_PRIVATE void ape_builder_load_deps(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return;
+
+	/* Index compile tasks by object path */
+	ApeStrList objects = ape_sl_new();
+	ApeTaskHandleList compile_tasks = { 0 };
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (!task || !task->depfile || !task->output)
+			continue;
+		if (ape_fs_exists(task->depfile) && ape_task_read_depfile(task))
+			continue;
+		ape_sl_append_dup(&objects, task->output);
+		ape_da_append(&compile_tasks, builder->tasks.items[i]);
 	}
 
-	ApeCmd cmd = ape_cmd_new();
+	char *db_path = ape_builder_deps_path(handle);
+	size_t size = 0;
+	char *data = objects.count > 0 ? ape_fs_read_file(db_path, &size) : NULL;
+	APEBUILD_FREE(db_path);
+	if (!data || size < strlen(APE_DEPS_MAGIC) || memcmp(data, APE_DEPS_MAGIC, strlen(APE_DEPS_MAGIC)) != 0) {
+		APEBUILD_FREE(data);
+		ape_sl_free(&objects);
+		ape_da_free(&compile_tasks);
+		return;
+	}
 
-	/* Compiler */
-	if (ape_str_ends_with(source, ".cpp") || ape_str_ends_with(source, ".cc") || ape_str_ends_with(source, ".cxx")) {
-		ape_cmd_append(&cmd, tc->cxx);
-	} else {
-		ape_cmd_append(&cmd, tc->cc);
+	ApePathIndex index;
+	ape_path_index_build(&index, &objects);
+
+	const char *p = data + strlen(APE_DEPS_MAGIC);
+	const char *end = data + size;
+	ApeStrList paths = ape_sl_new();
+	uint32_t count = 0;
+	int ok = ape_deps_read_u32(&p, end, &count);
+	for (uint32_t i = 0; ok && i < count; i++) {
+		uint32_t len = 0;
+		ok = ape_deps_read_u32(&p, end, &len) && (size_t)(end - p) >= len;
+		if (ok) {
+			ape_sl_append(&paths, ape_str_ndup(p, len));
+			p += len;
+		}
 	}
 
+	uint32_t records = 0;
+	ok = ok && ape_deps_read_u32(&p, end, &records);
+	for (uint32_t r = 0; ok && r < records; r++) {
+		uint32_t object = 0, header_count = 0;
+		ok = ape_deps_read_u32(&p, end, &object) && ape_deps_read_u32(&p, end, &header_count) && object < paths.count &&
+		     (size_t)(end - p) / sizeof(uint32_t) >= header_count;
+		if (!ok)
+			break;
+
+		int64_t pos = ape_path_index_find(&index, &objects, paths.items[object]);
+		ApeTask *task = pos >= 0 ? ape_task_get(compile_tasks.items[pos]) : NULL;
+		if (task)
+			ape_sl_clear(&task->headers);
+		for (uint32_t h = 0; h < header_count; h++) {
+			uint32_t header = 0;
+			ape_deps_read_u32(&p, end, &header);
+			if (header >= paths.count) {
+				ok = APEBUILD_FALSE;
+				break;
+			}
+			if (task && !ape_task_has_input(task, paths.items[header]))
+				ape_sl_append_dup(&task->headers, paths.items[header]);
+		}
+		if (task)
+			task->deps_known = ok;
+	}
+
+	ape_sl_free(&paths);
+	APEBUILD_FREE(index.slots);
+	ape_sl_free(&objects);
+	ape_da_free(&compile_tasks);
+	APEBUILD_FREE(data);
+}
+
+APEBUILD_PRIVATE void ape_deps_write_u32(ApeStrBuilder *sb, uint32_t value)
+{
+	ape_sb_append_strn(sb, (const char *)&value, sizeof(value));
+}
+
+/* Writes the database and removes the depfiles it now covers */
+APEBUILD_PRIVATE void ape_builder_save_deps(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return;
+
+	ApeStrList paths = ape_sl_new();
+	ApePathIndex index;
+	ape_path_index_build(&index, &paths);
+
+	ApeStrBuilder records = ape_sb_new();
+	uint32_t record_count = 0;
+	int has_depfiles = APEBUILD_FALSE;
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (!task || !task->depfile || !task->output || !task->deps_known)
+			continue;
+		ape_deps_write_u32(&records, ape_path_index_intern(&index, &paths, task->output));
+		ape_deps_write_u32(&records, (uint32_t)task->headers.count);
+		for (size_t j = 0; j < task->headers.count; j++) {
+			ape_deps_write_u32(&records, ape_path_index_intern(&index, &paths, task->headers.items[j]));
+		}
+		record_count++;
+		has_depfiles = has_depfiles || ape_fs_exists(task->depfile);
+	}
+
+	/* Nothing was compiled, the database on disk is still current */
+	if (has_depfiles) {
+		ApeStrBuilder sb = ape_sb_new();
+		ape_sb_append_str(&sb, APE_DEPS_MAGIC);
+		ape_deps_write_u32(&sb, (uint32_t)paths.count);
+		for (size_t i = 0; i < paths.count; i++) {
+			ape_deps_write_u32(&sb, (uint32_t)strlen(paths.items[i]));
+			ape_sb_append_str(&sb, paths.items[i]);
+		}
+		ape_deps_write_u32(&sb, record_count);
+		ape_sb_append_sb(&sb, &records);
+
+		char *db_path = ape_builder_deps_path(handle);
+		char *tmp_path = ape_str_concat(db_path, ".tmp");
+		if (ape_fs_write_file(tmp_path, sb.items, sb.count) && ape_fs_rename(tmp_path, db_path)) {
+			for (size_t i = 0; i < builder->tasks.count; i++) {
+				ApeTask *task = ape_task_get(builder->tasks.items[i]);
+				if (task && task->depfile && task->deps_known && ape_fs_exists(task->depfile))
+					ape_fs_remove(task->depfile);
+			}
+		}
+		APEBUILD_FREE(tmp_path);
+		APEBUILD_FREE(db_path);
+		ape_sb_free(&sb);
+	}
+
+	ape_sb_free(&records);
+	APEBUILD_FREE(index.slots);
+	ape_sl_free(&paths);
+}
+
+/* Task generation */
+
+APEBUILD_PRIVATE int ape_source_is_cxx(const char *source)
+{
+	return ape_str_ends_with(source, ".cpp") || ape_str_ends_with(source, ".cc") || ape_str_ends_with(source, ".cxx");
+}
+
+/* Flags shared by every compile of the builder, from the toolchain defaults to -fPIC */
+APEBUILD_PRIVATE void ape_builder_append_cflags(const ApeBuilder *builder, const ApeToolchain *tc, ApeCmd *cmd)
+{
 	/* Default flags from toolchain */
 	for (size_t i = 0; i < tc->default_cflags.count; i++) {
-		ape_cmd_append(&cmd, tc->default_cflags.items[i]);
+		ape_cmd_append(cmd, tc->default_cflags.items[i]);
 	}
 
 	/* Builder-specific flags */
 	for (size_t i = 0; i < builder->cflags.count; i++) {
-		ape_cmd_append(&cmd, builder->cflags.items[i]);
+		ape_cmd_append(cmd, builder->cflags.items[i]);
 	}
 
 	/* Include directories */
@@ -1056,7 +1753,7 @@ APEBUILD_DEF ApeTaskHandle ape_builder_add_compile_task(ApeBuilderHandle handle,
 		ApeStrBuilder inc = ape_sb_new();
 		ape_sb_append_str(&inc, "-I");
 		ape_sb_append_str(&inc, builder->include_dirs.items[i]);
-		ape_cmd_append(&cmd, ape_sb_to_str_dup(&inc));
+		ape_cmd_append(cmd, ape_sb_to_str_dup(&inc));
 		ape_sb_free(&inc);
 	}
 
@@ -1065,27 +1762,77 @@ APEBUILD_DEF ApeTaskHandle ape_builder_add_compile_task(ApeBuilderHandle handle,
 		ApeStrBuilder def = ape_sb_new();
 		ape_sb_append_str(&def, "-D");
 		ape_sb_append_str(&def, builder->defines.items[i]);
-		ape_cmd_append(&cmd, ape_sb_to_str_dup(&def));
+		ape_cmd_append(cmd, ape_sb_to_str_dup(&def));
 		ape_sb_free(&def);
 	}
 
 	/* PIC for shared libraries */
 	if (builder->type == APE_TARGET_SHARED_LIB) {
-		ape_cmd_append(&cmd, "-fPIC");
+		ape_cmd_append(cmd, "-fPIC");
+	}
+}
+
+APEBUILD_DEF ApeTaskHandle ape_builder_add_compile_task(ApeBuilderHandle handle, const char *source)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return APE_INVALID_TASK;
+
+	char *obj_path = ape_build_obj_path(NULL, handle, source);
+	char *base = ape_fs_basename(source);
+
+	ApeStrBuilder name_sb = ape_sb_new();
+	ape_sb_append_str(&name_sb, "Compile ");
+	ape_sb_append_str(&name_sb, base);
+	char *task_name = ape_sb_to_str_dup(&name_sb);
+	ape_sb_free(&name_sb);
+
+	ApeTaskHandle task_handle = ape_task_new(handle, APE_TASK_TYPE_COMPILE, task_name);
+	APEBUILD_FREE(task_name);
+	APEBUILD_FREE(base);
+
+	ApeTask *task = ape_task_get(task_handle);
+	if (!task) {
+		APEBUILD_FREE(obj_path);
+		return APE_INVALID_TASK;
+	}
+
+	ape_task_set_input(task_handle, source);
+	ape_task_set_output(task_handle, obj_path);
+
+	/* Build compile command */
+	ApeToolchain *tc = ape_toolchain_get(builder->toolchain);
+	if (!tc) {
+		APEBUILD_FREE(obj_path);
+		return APE_INVALID_TASK;
+	}
+
+	ApeCmd cmd = ape_cmd_new();
+
+	/* Compiler */
+	if (ape_source_is_cxx(source)) {
+		ape_cmd_append(&cmd, tc->cxx);
+	} else {
+		ape_cmd_append(&cmd, tc->cc);
 	}
+	ape_builder_append_cflags(builder, tc, &cmd);
 
-	/* Compile only */
+	/* Header dependencies, see ape_builder_load_deps() */
+	task->depfile = ape_fs_change_extension(obj_path, ".d");
+	ape_cmd_append(&cmd, "-MMD");
+	ape_cmd_append(&cmd, "-MF");
+	ape_cmd_append(&cmd, task->depfile);
+
+	/* Compile only, naming the task's copy of the source since the caller's may not outlive it */
 	ape_cmd_append(&cmd, "-c");
-	ape_cmd_append(&cmd, source);
+	ape_cmd_append(&cmd, task->input);
 	ape_cmd_append(&cmd, "-o");
 	ape_cmd_append(&cmd, obj_path);
 
 	ape_task_set_cmd(task_handle, cmd);
 
 	/* Add to builder's task list */
-	if (builder->tasks.count < APE_MAX_TASKS) {
-		builder->tasks.items[builder->tasks.count++] = task_handle;
-	}
+	ape_da_append(&builder->tasks, task_handle);
 
 	return task_handle;
 }
@@ -1242,9 +1989,7 @@ APEBUILD_DEF ApeTaskHandle ape_builder_add_link_task(ApeBuilderHandle handle)
 	ape_task_set_cmd(task_handle, cmd);
 
 	/* Add to builder's task list */
-	if (builder->tasks.count < APE_MAX_TASKS) {
-		builder->tasks.items[builder->tasks.count++] = task_handle;
-	}
+	ape_da_append(&builder->tasks, task_handle);
 
 	return task_handle;
 }
@@ -1302,9 +2047,7 @@ APEBUILD_DEF ApeTaskHandle ape_builder_add_archive_task(ApeBuilderHandle handle)
 	ape_task_set_cmd(task_handle, cmd);
 
 	/* Add to builder's task list */
-	if (builder->tasks.count < APE_MAX_TASKS) {
-		builder->tasks.items[builder->tasks.count++] = task_handle;
-	}
+	ape_da_append(&builder->tasks, task_handle);
 
 	return task_handle;
 }
@@ -1319,13 +2062,325 @@ APEBUILD_DEF ApeTaskHandle ape_builder_add_command_task(ApeBuilderHandle handle,
 	ape_task_set_cmd(task_handle, cmd);
 
 	/* Add to builder's task list */
-	if (builder->tasks.count < APE_MAX_TASKS) {
-		builder->tasks.items[builder->tasks.count++] = task_handle;
+	ape_da_append(&builder->tasks, task_handle);
+
+	return task_handle;
+}
+
+/* ============================================================================
+ * Unity Builds
+ *
+ * With unity batches, a builder's sources are compiled through generated
+ * files (<output_dir>/<name>_unity_<k>.c, or .cpp) that #include them, so a
+ * compiler starts and common headers are parsed once per batch rather than
+ * once per source. Sources are grouped by directory and split into batches of
+ * about the same size. A source that changed after its batch was compiled is
+ * left out of the batch and compiled alone, so editing a file doesn't
+ * recompile its whole batch each time. The unity file records the members, and
+ * it is kept as is until one of them changes, so sources compiled alone stay
+ * out and an unchanged build compiles nothing. When a member does change, the
+ * batch is rebuilt anyway, and the sources that were left out rejoin it.
+ * Sources in one batch share a translation unit, so their file-scope names
+ * must not clash.
+ * ============================================================================ */
+
+typedef struct {
+	char *source; /* Owned by the builder */
+	char *dir;
+	size_t index;
+	size_t size;
+} ApeUnityMember;
+
+APEBUILD_PRIVATE char *ape_builder_unity_path(ApeBuilderHandle handle, int batch, int cxx)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s/%s_unity_%d.%s", builder->output_dir ? builder->output_dir : "build", builder->name, batch,
+			  cxx ? "cpp" : "c");
+	char *path = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return path;
+}
+
+/* Directory first, then the order the sources were added in */
+APEBUILD_PRIVATE int ape_unity_member_compare(const void *a, const void *b)
+{
+	const ApeUnityMember *x = (const ApeUnityMember *)a;
+	const ApeUnityMember *y = (const ApeUnityMember *)b;
+	int cmp = strcmp(x->dir, y->dir);
+	if (cmp != 0)
+		return cmp;
+	return x->index < y->index ? -1 : (x->index > y->index ? 1 : 0);
+}
+
+/* Absolute paths of the sources a generated file includes, see ape_build_write_includes() */
+APEBUILD_PRIVATE ApeStrList ape_unity_read_members(const char *path)
+{
+	ApeStrList members = ape_sl_new();
+	char *text = ape_fs_read_file(path, NULL);
+	if (!text)
+		return members;
+	const char *prefix = "#include \"";
+	for (char *line = text; line && *line;) {
+		char *next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		size_t len = strlen(line);
+		if (len > strlen(prefix) && strncmp(line, prefix, strlen(prefix)) == 0 && line[len - 1] == '"')
+			ape_sl_append(&members, ape_str_ndup(line + strlen(prefix), len - strlen(prefix) - 1));
+		line = next;
+	}
+	APEBUILD_FREE(text);
+	return members;
+}
+
+/* Left out of its batch: changed after the batch object was built */
+APEBUILD_PRIVATE int ape_unity_member_is_hot(const char *source, time_t batch_mtime)
+{
+	return batch_mtime != 0 && ape_fs_mtime(source) > batch_mtime;
+}
+
+/*
+ * Marks the sources to leave out of a batch. While none of the current members
+ * changed, the membership recorded in the unity file is kept, otherwise only
+ * the changed sources are left out.
+ */
+APEBUILD_PRIVATE void ape_unity_pick_members(const char *unity_path, time_t batch_mtime, const ApeStrList *sources, int *excluded)
+{
+	ApeStrList current = batch_mtime != 0 ? ape_unity_read_members(unity_path) : ape_sl_new();
+	int keep = current.count > 0;
+	for (size_t i = 0; i < sources->count; i++) {
+		char *abs = ape_fs_absolute(sources->items[i]);
+		int member = APEBUILD_FALSE;
+		for (size_t j = 0; j < current.count && !member; j++)
+			member = strcmp(abs, current.items[j]) == 0;
+		APEBUILD_FREE(abs);
+		excluded[i] = ape_unity_member_is_hot(sources->items[i], batch_mtime);
+		if (member && excluded[i])
+			keep = APEBUILD_FALSE;
+		else if (!member && keep)
+			excluded[i] = APEBUILD_TRUE;
+	}
+	if (!keep) {
+		for (size_t i = 0; i < sources->count; i++)
+			excluded[i] = ape_unity_member_is_hot(sources->items[i], batch_mtime);
+	}
+	ape_sl_free(&current);
+}
+
+/* Writes a generated file including members, leaving it (and its mtime) alone if it already includes them */
+APEBUILD_PRIVATE void ape_build_write_includes(const char *path, const ApeStrList *members)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_str(&sb, "/* Generated by apebuild, do not edit */\n");
+	for (size_t i = 0; i < members->count; i++) {
+		char *abs = ape_fs_absolute(members->items[i]);
+		ape_sb_append_fmt(&sb, "#include \"%s\"\n", abs);
+		APEBUILD_FREE(abs);
+	}
+
+	size_t size = 0;
+	char *old = ape_fs_read_file(path, &size);
+	if (!old || size != sb.count || memcmp(old, sb.items, size) != 0) {
+		char *dir = ape_fs_dirname(path);
+		ape_fs_mkdir_p(dir);
+		APEBUILD_FREE(dir);
+		ape_fs_write_file(path, sb.items, sb.count);
+	}
+	APEBUILD_FREE(old);
+	ape_sb_free(&sb);
+}
+
+/* Adds compile tasks for the builder's C or C++ sources in unity batches */
+APEBUILD_PRIVATE void ape_builder_add_unity_tasks(ApeBuilderHandle handle, int cxx)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	size_t count = 0;
+	size_t total = 0;
+	ApeUnityMember *members = (ApeUnityMember *)APEBUILD_MALLOC((builder->sources.count + 1) * sizeof(ApeUnityMember));
+	for (size_t i = 0; i < builder->sources.count; i++) {
+		char *source = builder->sources.items[i];
+		if (ape_source_is_cxx(source) != cxx)
+			continue;
+		members[count].source = source;
+		members[count].dir = ape_fs_dirname(source);
+		members[count].index = i;
+		members[count].size = ape_fs_size(source) + 1;
+		total += members[count].size;
+		count++;
+	}
+	qsort(members, count, sizeof(ApeUnityMember), ape_unity_member_compare);
+
+	size_t batches = (size_t)builder->unity_batches < count ? (size_t)builder->unity_batches : count;
+	size_t m = 0;
+	size_t done = 0;
+	for (size_t b = 0; b < batches; b++) {
+		/* Fill the batch up to its share of the total size, leaving a source for every later batch */
+		ApeStrList sources = ape_sl_new();
+		size_t target = total / batches * (b + 1);
+		while (m < count - (batches - b - 1) && (sources.count == 0 || b == batches - 1 || done < target)) {
+			ape_sl_append(&sources, members[m].source);
+			done += members[m].size;
+			m++;
+		}
+
+		char *unity_path = ape_builder_unity_path(handle, (int)b, cxx);
+		char *unity_obj = ape_build_obj_path(NULL, handle, unity_path);
+		time_t batch_mtime = unity_obj ? ape_fs_mtime(unity_obj) : 0;
+		int *excluded = (int *)APEBUILD_MALLOC((sources.count + 1) * sizeof(int));
+		ape_unity_pick_members(unity_path, batch_mtime, &sources, excluded);
+		ApeStrList included = ape_sl_new();
+		for (size_t i = 0; i < sources.count; i++) {
+			if (excluded[i])
+				ape_builder_add_compile_task(handle, sources.items[i]);
+			else
+				ape_sl_append(&included, sources.items[i]);
+		}
+		APEBUILD_FREE(excluded);
+
+		/* The membership is recorded even when the batch isn't compiled */
+		if (included.count > 0)
+			ape_build_write_includes(unity_path, &included);
+		if (included.count == 1) {
+			ape_builder_add_compile_task(handle, included.items[0]);
+		} else if (included.count > 1) {
+			ApeTaskHandle task_handle = ape_builder_add_compile_task(handle, unity_path);
+			ApeTask *task = ape_task_get(task_handle);
+			if (task) {
+				char *base = ape_fs_basename(unity_path);
+				ApeStrBuilder name_sb = ape_sb_new();
+				ape_sb_append_fmt(&name_sb, "Compile %s (%zu sources)", base, included.count);
+				APEBUILD_FREE(task->name);
+				task->name = ape_sb_to_str_dup(&name_sb);
+				ape_sb_free(&name_sb);
+				APEBUILD_FREE(base);
+				for (size_t i = 0; i < included.count; i++)
+					ape_task_add_input(task_handle, included.items[i]);
+			}
+		}
+
+		ape_sl_free_shallow(&included);
+		ape_sl_free_shallow(&sources);
+		APEBUILD_FREE(unity_obj);
+		APEBUILD_FREE(unity_path);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		APEBUILD_FREE(members[i].dir);
+	APEBUILD_FREE(members);
+}
+
+/* ============================================================================
+ * Precompiled Headers
+ *
+ * The header is precompiled through a stub in the output directory that
+ * includes it, and every compile of the same language takes it in first:
+ * gcc finds <stub>.gch by itself given -include <stub>, clang is handed
+ * <stub>.pch with -include-pch. The PCH task's depfile tracks the headers
+ * it was built from and compiles depend on it, so editing any of them
+ * rebuilds the PCH and then everything that used it.
+ * ============================================================================ */
+
+APEBUILD_PRIVATE int ape_header_is_cxx(const char *header)
+{
+	return ape_str_ends_with(header, ".hpp") || ape_str_ends_with(header, ".hh") || ape_str_ends_with(header, ".hxx");
+}
+
+APEBUILD_PRIVATE int ape_toolchain_is_clang(const ApeToolchain *tc)
+{
+	return tc->cc && ape_str_contains(tc->cc, "clang");
+}
+
+APEBUILD_PRIVATE char *ape_builder_pch_dir(ApeBuilderHandle handle)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s/%s_pch", builder->output_dir ? builder->output_dir : "build", builder->name);
+	char *dir = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return dir;
+}
+
+/* Adds the task precompiling the builder's header as C or C++ */
+APEBUILD_PRIVATE ApeTaskHandle ape_builder_add_pch_task(ApeBuilderHandle handle, int cxx)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	ApeToolchain *tc = ape_toolchain_get(builder->toolchain);
+	if (!tc)
+		return APE_INVALID_TASK;
+
+	char *dir = ape_builder_pch_dir(handle);
+	char *base = ape_fs_basename(builder->pch_header);
+	char *stub = ape_fs_join(dir, base);
+	ApeStrList members = ape_sl_new();
+	ape_sl_append(&members, builder->pch_header);
+	ape_build_write_includes(stub, &members);
+	ape_sl_free_shallow(&members);
+
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "Precompile %s", base);
+	char *task_name = ape_sb_to_str_dup(&sb);
+	ApeTaskHandle task_handle = ape_task_new(handle, APE_TASK_TYPE_PCH, task_name);
+	APEBUILD_FREE(task_name);
+	ApeTask *task = ape_task_get(task_handle);
+	if (task) {
+		ape_sb_clear(&sb);
+		ape_sb_append_fmt(&sb, "%s%s", stub, ape_toolchain_is_clang(tc) ? ".pch" : ".gch");
+		char *pch_path = ape_sb_to_str_dup(&sb);
+		ape_task_set_input(task_handle, stub);
+		ape_task_set_output(task_handle, pch_path);
+		APEBUILD_FREE(pch_path);
+		ape_task_add_input(task_handle, builder->pch_header);
+		task->depfile = ape_fs_change_extension(task->output, ".d");
+
+		ApeCmd cmd = ape_cmd_new();
+		ape_cmd_append(&cmd, cxx ? tc->cxx : tc->cc);
+		ape_builder_append_cflags(builder, tc, &cmd);
+		ape_cmd_append(&cmd, "-MMD");
+		ape_cmd_append(&cmd, "-MF");
+		ape_cmd_append(&cmd, task->depfile);
+		ape_cmd_append(&cmd, "-x");
+		ape_cmd_append(&cmd, cxx ? "c++-header" : "c-header");
+		ape_cmd_append(&cmd, "-c");
+		ape_cmd_append(&cmd, task->input);
+		ape_cmd_append(&cmd, "-o");
+		ape_cmd_append(&cmd, task->output);
+		ape_task_set_cmd(task_handle, cmd);
+		ape_da_append(&builder->tasks, task_handle);
 	}
 
+	ape_sb_free(&sb);
+	APEBUILD_FREE(stub);
+	APEBUILD_FREE(base);
+	APEBUILD_FREE(dir);
 	return task_handle;
 }
 
+/* Makes the builder's compiles in the PCH's language include it and wait for it */
+APEBUILD_PRIVATE void ape_builder_use_pch(ApeBuilderHandle handle, ApeTaskHandle pch_handle, int cxx)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	ApeTask *pch = ape_task_get(pch_handle);
+	ApeToolchain *tc = ape_toolchain_get(builder->toolchain);
+	if (!pch || !tc)
+		return;
+
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (!task || task->type != APE_TASK_TYPE_COMPILE || ape_source_is_cxx(task->input) != cxx)
+			continue;
+		if (ape_toolchain_is_clang(tc)) {
+			ape_cmd_append(&task->cmd, "-include-pch");
+			ape_cmd_append(&task->cmd, pch->output);
+		} else {
+			ape_cmd_append(&task->cmd, "-include");
+			ape_cmd_append(&task->cmd, pch->input);
+		}
+		ape_task_add_input(builder->tasks.items[i], pch->output);
+		ape_task_add_dep(builder->tasks.items[i], pch_handle);
+	}
+}
+
 APEBUILD_DEF void ape_builder_generate_tasks(ApeBuilderHandle handle)
 {
 	ApeBuilder *builder = ape_builder_get(handle);
@@ -1339,8 +2394,24 @@ APEBUILD_DEF void ape_builder_generate_tasks(ApeBuilderHandle handle)
 	builder->tasks.count = 0;
 
 	/* Create compile tasks for each source */
-	for (size_t i = 0; i < builder->sources.count; i++) {
-		ape_builder_add_compile_task(handle, builder->sources.items[i]);
+	if (builder->unity_batches > 0) {
+		ape_builder_add_unity_tasks(handle, APEBUILD_FALSE);
+		ape_builder_add_unity_tasks(handle, APEBUILD_TRUE);
+	} else {
+		for (size_t i = 0; i < builder->sources.count; i++) {
+			ape_builder_add_compile_task(handle, builder->sources.items[i]);
+		}
+	}
+
+	/* A .h header goes with the C sources unless there are only C++ ones */
+	if (builder->pch_header) {
+		int has_c = APEBUILD_FALSE;
+		for (size_t i = 0; i < builder->sources.count; i++) {
+			if (!ape_source_is_cxx(builder->sources.items[i]))
+				has_c = APEBUILD_TRUE;
+		}
+		int cxx = ape_header_is_cxx(builder->pch_header) || (!has_c && builder->sources.count > 0);
+		ape_builder_use_pch(handle, ape_builder_add_pch_task(handle, cxx), cxx);
 	}
 
 	/* Create link/archive task if not object-only */
@@ -1352,6 +2423,9 @@ APEBUILD_DEF void ape_builder_generate_tasks(ApeBuilderHandle handle)
 			ape_builder_add_link_task(handle);
 		}
 	}
+
+	ape_builder_load_deps(handle);
+	ape_builder_load_log(handle);
 }
 
 /* ============================================================================
@@ -1376,6 +2450,9 @@ APEBUILD_DEF void ape_ctx_cleanup(ApeBuildCtx *ctx)
 
 	/* Note: We don't free the toolchain here since it's in global storage */
 	APEBUILD_FREE(ctx->output_dir);
+	APEBUILD_FREE(ctx->cache_dir);
+	APEBUILD_FREE(ctx->trace_file);
+	APEBUILD_FREE(ctx->compile_commands);
 	memset(ctx, 0, sizeof(ApeBuildCtx));
 }
 
@@ -1415,39 +2492,1280 @@ APEBUILD_DEF void ape_ctx_set_keep_going(ApeBuildCtx *ctx, int keep_going)
 	ctx->keep_going = keep_going;
 }
 
+APEBUILD_DEF void ape_ctx_set_cache_dir(ApeBuildCtx *ctx, const char *dir)
+{
+	APEBUILD_FREE(ctx->cache_dir);
+	ctx->cache_dir = dir ? ape_str_dup(dir) : NULL;
+}
+
+APEBUILD_DEF void ape_ctx_set_max_load(ApeBuildCtx *ctx, double load)
+{
+	ctx->max_load = load > 0 ? load : 0;
+}
+
+APEBUILD_DEF void ape_ctx_set_memory_throttle(ApeBuildCtx *ctx, int enabled)
+{
+	ctx->memory_throttle = enabled;
+}
+
+APEBUILD_DEF void ape_ctx_set_trace_file(ApeBuildCtx *ctx, const char *path)
+{
+	APEBUILD_FREE(ctx->trace_file);
+	ctx->trace_file = path ? ape_str_dup(path) : NULL;
+}
+
+APEBUILD_DEF void ape_ctx_set_compile_commands(ApeBuildCtx *ctx, const char *path)
+{
+	APEBUILD_FREE(ctx->compile_commands);
+	ctx->compile_commands = path ? ape_str_dup(path) : NULL;
+}
+
 APEBUILD_DEF ApeToolchainHandle ape_ctx_get_toolchain(ApeBuildCtx *ctx)
 {
 	return ctx->toolchain;
 }
 
 /* ============================================================================
- * Build Operations
+ * Object Cache
+ *
+ * Entries live at <cache_dir>/<first 2 key digits>/<remaining digits>. Entries
+ * are only ever added (atomically, via rename), never modified in place.
  * ============================================================================ */
 
-APEBUILD_PRIVATE int ape_builder_run_tasks(ApeBuilderHandle handle, ApeBuildCtx *ctx)
+APEBUILD_PRIVATE int ape_cache_compiler_id(const char *compiler, ApeHash *out)
 {
-	ApeBuilder *builder = ape_builder_get(handle);
-	if (!builder)
+	for (size_t i = 0; i < ape_compiler_ids.count; i++) {
+		if (strcmp(ape_compiler_ids.items[i].compiler, compiler) == 0) {
+			*out = ape_compiler_ids.items[i].id;
+			return APEBUILD_TRUE;
+		}
+	}
+
+	ApeCmd cmd = ape_cmd_new();
+	ape_cmd_append(&cmd, compiler);
+	ape_cmd_append(&cmd, "--version");
+	int exit_code = -1;
+	char *version = ape_cmd_run_capture(&cmd, &exit_code);
+	ape_cmd_free(&cmd);
+	if (!version || exit_code != 0) {
+		APEBUILD_FREE(version);
 		return APEBUILD_FALSE;
+	}
 
-	ApeVerbosity verbosity = ctx ? ctx->verbosity : APE_VERBOSE_NORMAL;
-	int max_parallel = ctx ? ctx->parallel_jobs : 0;
-	if (max_parallel <= 0)
-		max_parallel = ape_build_get_cpu_count();
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	ape_hash_update_str(&hc, compiler);
+	ape_hash_update_str(&hc, version);
+	*out = ape_hash_final(&hc);
+	APEBUILD_FREE(version);
 
-	/* Simple task scheduler using handle lists */
-	ApeTaskHandleList pending = { 0 };
-	ApeTaskHandleList running = { 0 };
-	int completed = 0, failed = 0, skipped = 0;
+	ApeCompilerId entry = { ape_str_dup(compiler), *out };
+	ape_da_append(&ape_compiler_ids, entry);
+	return APEBUILD_TRUE;
+}
 
-	/* Add all tasks to pending */
-	for (size_t i = 0; i < builder->tasks.count; i++) {
-		pending.items[pending.count++] = builder->tasks.items[i];
+/*
+ * Starts the preprocessor run whose output keys a compile task in the cache, and
+ * hashes everything else the key depends on into args_hash. Returns an invalid
+ * handle when the task can't be cached.
+ */
+APEBUILD_PRIVATE ApeProcHandle ape_cache_start_preprocess(const ApeTask *task, ApeHash *args_hash)
+{
+	if (task->cmd.count == 0 || !task->output)
+		return APE_INVALID_HANDLE;
+
+	ApeHash compiler_id;
+	if (!ape_cache_compiler_id(task->cmd.items[0], &compiler_id))
+		return APE_INVALID_HANDLE;
+
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	ape_hash_update_str(&hc, "apebuild-object-cache-1");
+	ape_hash_update(&hc, &compiler_id, sizeof(compiler_id));
+
+	/* Same arguments, minus the output path, and -E instead of -c */
+	ApeCmd pre = ape_cmd_new();
+	ape_cmd_append(&pre, task->cmd.items[0]);
+	int debug_info = APEBUILD_FALSE;
+	char *pch_stub = NULL;
+	for (size_t i = 1; i < task->cmd.count; i++) {
+		const char *arg = task->cmd.items[i];
+		if (strcmp(arg, "-o") == 0) {
+			i++;
+			continue;
+		}
+		/* A clang PCH keeps the header's text out of the output, so preprocess its stub instead */
+		if (strcmp(arg, "-include-pch") == 0 && i + 1 < task->cmd.count && !pch_stub) {
+			const char *pch = task->cmd.items[++i];
+			pch_stub = ape_str_ndup(pch, strlen(pch) - strlen(".pch"));
+			ape_hash_update_str(&hc, arg);
+			ape_hash_update_str(&hc, pch);
+			ape_cmd_append(&pre, "-include");
+			ape_cmd_append(&pre, pch_stub);
+			continue;
+		}
+		/* Preprocessing writes the depfile too, so a hit still knows its headers */
+		if (strcmp(arg, "-MF") == 0 && i + 1 < task->cmd.count) {
+			ape_cmd_append(&pre, arg);
+			ape_cmd_append(&pre, task->cmd.items[++i]);
+			continue;
+		}
+		if (ape_str_starts_with(arg, "-g"))
+			debug_info = APEBUILD_TRUE;
+		ape_hash_update_str(&hc, arg);
+		ape_cmd_append(&pre, strcmp(arg, "-c") == 0 ? "-E" : arg);
+	}
+	for (size_t i = 0; i < task->cmd.env.count; i++) {
+		ape_hash_update_str(&hc, task->cmd.env.items[i]);
+	}
+	if (task->cmd.cwd) {
+		ape_hash_update_str(&hc, task->cmd.cwd);
+		ape_cmd_set_cwd(&pre, task->cmd.cwd);
+	}
+	pre.env = ape_sl_clone(&task->cmd.env);
+
+	/* Debug info records the compilation directory */
+	if (debug_info) {
+		char *cwd = ape_fs_cwd();
+		if (cwd)
+			ape_hash_update_str(&hc, cwd);
+		APEBUILD_FREE(cwd);
+	}
+
+	*args_hash = ape_hash_final(&hc);
+	/* Diagnostics end up in the key too, they only depend on the same inputs */
+	ApeProcHandle proc = ape_cmd_start_captured(&pre);
+	ape_cmd_free(&pre);
+	APEBUILD_FREE(pch_stub);
+	return proc;
+}
+
+/*
+ * Computes the cache key of a compile task from its finished preprocessor run.
+ * Returns NULL when preprocessing failed (the real compile then runs and
+ * reports the error).
+ */
+APEBUILD_PRIVATE char *ape_cache_compile_key(const ApeTask *task)
+{
+	ApeProcResult result = ape_proc_result(task->proc);
+	if (result.status != APE_PROC_COMPLETED || result.exit_code != 0)
+		return NULL;
+
+	size_t len;
+	const char *preprocessed = ape_proc_output(task->proc, &len);
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	ape_hash_update(&hc, &task->cache_args_hash, sizeof(task->cache_args_hash));
+	ape_hash_update(&hc, preprocessed, len);
+	return ape_hash_to_hex(ape_hash_final(&hc));
+}
+
+APEBUILD_PRIVATE char *ape_cache_entry_path(const char *cache_dir, const char *key)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s/%.2s/%s", cache_dir, key, key + 2);
+	char *path = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return path;
+}
+
+APEBUILD_PRIVATE int ape_cache_restore(const char *cache_dir, const char *key, const char *output)
+{
+	char *entry = ape_cache_entry_path(cache_dir, key);
+	int ok = ape_fs_is_file(entry) && ape_fs_clone_file(entry, output);
+	APEBUILD_FREE(entry);
+	return ok;
+}
+
+APEBUILD_PRIVATE void ape_cache_store(const char *cache_dir, const char *key, const char *output)
+{
+	char *entry = ape_cache_entry_path(cache_dir, key);
+	char *dir = ape_fs_dirname(entry);
+	ape_fs_mkdir_p(dir);
+
+	/* Builds sharing the cache may store the same entry concurrently */
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_fmt(&sb, "%s.%ld.tmp", entry, (long)getpid());
+	char *tmp = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+
+	if (ape_fs_clone_file(output, tmp) && !ape_fs_rename(tmp, entry))
+		ape_fs_remove(tmp);
+
+	APEBUILD_FREE(tmp);
+	APEBUILD_FREE(dir);
+	APEBUILD_FREE(entry);
+}
+
+/* ============================================================================
+ * Jobserver
+ *
+ * GNU make's jobserver protocol: a pipe or fifo holds one byte per job slot
+ * beyond the first, and every process in the build tree reads a byte before
+ * starting an extra job and writes it back when that job is done. A build
+ * started under make, or by another apebuild, takes its slots from the
+ * parent's jobserver. A top-level build serves its own jobserver through a
+ * fifo in MAKEFLAGS, so sub-builds and make invocations run as tasks share
+ * its budget instead of each starting a full set of jobs.
+ * ============================================================================ */
+
+typedef struct {
+	int active;
+	int read_fd;		/* Non-blocking */
+	int write_fd;		/* The read fd for a fifo, the parent's for a pipe */
+	ApeStrBuilder tokens;	/* Bytes read from the jobserver, written back as they were */
+	char *fifo_dir;		/* Set when serving */
+	char *saved_makeflags;	/* MAKEFLAGS to restore when serving, NULL if it was unset */
+} ApeJobserver;
+
+/* Finds the value of the last --jobserver-auth= (or older --jobserver-fds=) in MAKEFLAGS */
+APEBUILD_PRIVATE char *ape_jobserver_auth(const char *makeflags)
+{
+	const char *value = NULL;
+	for (const char *p = makeflags; *p; p++) {
+		if (strncmp(p, "--jobserver-auth=", 17) == 0)
+			value = p + 17;
+		else if (strncmp(p, "--jobserver-fds=", 16) == 0)
+			value = p + 16;
+	}
+	if (!value)
+		return NULL;
+	size_t len = 0;
+	while (value[len] && value[len] != ' ')
+		len++;
+	return ape_str_ndup(value, len);
+}
+
+/* Attaches to the jobserver in MAKEFLAGS, if there is a usable one */
+APEBUILD_PRIVATE int ape_jobserver_attach(ApeJobserver *js, const char *makeflags)
+{
+	char *auth = ape_jobserver_auth(makeflags);
+	if (!auth)
+		return APEBUILD_FALSE;
+
+	if (ape_str_starts_with(auth, "fifo:")) {
+		js->read_fd = open(auth + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		js->write_fd = js->read_fd;
+	} else {
+		int rfd = -1, wfd = -1;
+		if (sscanf(auth, "%d,%d", &rfd, &wfd) == 2 && rfd >= 0 && wfd >= 0 && fcntl(rfd, F_GETFD) >= 0 &&
+		    fcntl(wfd, F_GETFD) >= 0) {
+			/* A private non-blocking description, the parent's pipe may be read blocking by others */
+			char path[64];
+			snprintf(path, sizeof(path), "/proc/self/fd/%d", rfd);
+			js->read_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			js->write_fd = wfd;
+		} else if (rfd >= 0) {
+			ape_log_warn("jobserver in MAKEFLAGS is not available, mark the rule with '+' to share it");
+		}
 	}
 
-	while (pending.count > 0 || running.count > 0) {
+	if (js->read_fd < 0) {
+		APEBUILD_FREE(auth);
+		return APEBUILD_FALSE;
+	}
+	APEBUILD_FREE(auth);
+	js->active = APEBUILD_TRUE;
+	return APEBUILD_TRUE;
+}
+
+/* Serves a jobserver with jobs slots to everything this build runs */
+APEBUILD_PRIVATE int ape_jobserver_serve(ApeJobserver *js, int jobs)
+{
+	js->fifo_dir = ape_fs_temp_mkdir("apejobs");
+	if (!js->fifo_dir)
+		return APEBUILD_FALSE;
+	char *fifo = ape_fs_join(js->fifo_dir, "fifo");
+	if (mkfifo(fifo, 0600) != 0 || (js->read_fd = open(fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+		APEBUILD_FREE(fifo);
+		ape_fs_rmdir_r(js->fifo_dir);
+		APEBUILD_FREE(js->fifo_dir);
+		js->fifo_dir = NULL;
+		return APEBUILD_FALSE;
+	}
+	js->write_fd = js->read_fd;
+	for (int i = 1; i < jobs; i++) {
+		if (write(js->write_fd, "+", 1) != 1)
+			break;
+	}
+
+	const char *makeflags = getenv("MAKEFLAGS");
+	js->saved_makeflags = makeflags ? ape_str_dup(makeflags) : NULL;
+	ApeStrBuilder sb = ape_sb_new();
+	if (makeflags && *makeflags)
+		ape_sb_append_fmt(&sb, "%s ", makeflags);
+	ape_sb_append_fmt(&sb, "-j%d --jobserver-auth=fifo:%s", jobs, fifo);
+	char *flags = ape_sb_to_str_dup(&sb);
+	setenv("MAKEFLAGS", flags, 1);
+	APEBUILD_FREE(flags);
+	ape_sb_free(&sb);
+	APEBUILD_FREE(fifo);
+	js->active = APEBUILD_TRUE;
+	return APEBUILD_TRUE;
+}
+
+/* Joins the parent's jobserver, or serves one when this build runs jobs in parallel */
+APEBUILD_PRIVATE void ape_jobserver_start(ApeJobserver *js, int jobs)
+{
+	memset(js, 0, sizeof(*js));
+	js->read_fd = -1;
+	js->write_fd = -1;
+
+	const char *makeflags = getenv("MAKEFLAGS");
+	if (makeflags && ape_jobserver_attach(js, makeflags))
+		return;
+	if (jobs > 1)
+		ape_jobserver_serve(js, jobs);
+}
+
+/* Makes sure there are slots for running + 1 jobs, one of them being the one every process has */
+APEBUILD_PRIVATE int ape_jobserver_reserve(ApeJobserver *js, size_t running)
+{
+	if (!js->active)
+		return APEBUILD_TRUE;
+	while (js->tokens.count < running) {
+		char token;
+		ssize_t n = read(js->read_fd, &token, 1);
+		if (n == 1) {
+			ape_sb_append_char(&js->tokens, token);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			return APEBUILD_FALSE;
+		}
+	}
+	return APEBUILD_TRUE;
+}
+
+/* Gives back the slots beyond what running jobs need */
+APEBUILD_PRIVATE void ape_jobserver_release(ApeJobserver *js, size_t running)
+{
+	size_t keep = running > 0 ? running - 1 : 0;
+	while (js->active && js->tokens.count > keep) {
+		char token = js->tokens.items[js->tokens.count - 1];
+		if (write(js->write_fd, &token, 1) < 0 && errno == EINTR)
+			continue;
+		js->tokens.count--;
+	}
+}
+
+APEBUILD_PRIVATE void ape_jobserver_stop(ApeJobserver *js)
+{
+	ape_jobserver_release(js, 0);
+	if (js->read_fd >= 0)
+		close(js->read_fd);
+	if (js->fifo_dir) {
+		if (js->saved_makeflags)
+			setenv("MAKEFLAGS", js->saved_makeflags, 1);
+		else
+			unsetenv("MAKEFLAGS");
+		ape_fs_rmdir_r(js->fifo_dir);
+		APEBUILD_FREE(js->fifo_dir);
+	}
+	APEBUILD_FREE(js->saved_makeflags);
+	ape_sb_free(&js->tokens);
+	memset(js, 0, sizeof(*js));
+}
+
+/* ============================================================================
+ * Scheduler
+ *
+ * Ready tasks start longest remaining path first. A task's priority is its
+ * expected duration plus the highest priority among the tasks waiting on it,
+ * so the chain that ends in the final link is never left for last. Expected
+ * durations come from the build log; a task that never ran is estimated from
+ * the size of its source.
+ * ============================================================================ */
+
+typedef struct {
+	size_t count;
+	ApeTaskHandle *tasks;	    /* Scheduled tasks, referred to by position */
+	uint64_t *priority;	    /* Longest path cost from a task to the end of the build */
+	uint32_t *waiting;	    /* Unfinished scheduled deps of each task */
+	uint32_t *dependents_start; /* Dependents of i are dependents[dependents_start[i] .. dependents_start[i + 1]] */
+	uint32_t *dependents;
+	uint32_t *heap; /* Ready tasks, max-heap on priority */
+	size_t heap_count;
+} ApeSchedule;
+
+APEBUILD_PRIVATE uint64_t ape_task_expected_ms(const ApeTask *task)
+{
+	if (task->duration_ms > 0)
+		return task->duration_ms;
+	/* Roughly a millisecond per KiB of source, linking and archiving are cheap next to that */
+	if (task->type == APE_TASK_TYPE_COMPILE && task->input)
+		return 1 + ape_fs_size(task->input) / 1024;
+	return 1;
+}
+
+/* Position of a task in the schedule, -1 if it isn't part of it */
+APEBUILD_PRIVATE int64_t ape_schedule_find(const ApeSchedule *sched, ApeTaskHandle handle)
+{
+	ApeTask *task = ape_task_get(handle);
+	if (!task || task->sched_index < 0 || (size_t)task->sched_index >= sched->count)
+		return -1;
+	return sched->tasks[task->sched_index] == handle ? task->sched_index : -1;
+}
+
+APEBUILD_PRIVATE int ape_schedule_before(const ApeSchedule *sched, uint32_t a, uint32_t b)
+{
+	if (sched->priority[a] != sched->priority[b])
+		return sched->priority[a] > sched->priority[b];
+	return a < b; /* Equal priorities keep declaration order */
+}
+
+APEBUILD_PRIVATE void ape_schedule_push(ApeSchedule *sched, uint32_t idx)
+{
+	size_t i = sched->heap_count++;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!ape_schedule_before(sched, idx, sched->heap[parent]))
+			break;
+		sched->heap[i] = sched->heap[parent];
+		i = parent;
+	}
+	sched->heap[i] = idx;
+}
+
+/* Removes the most urgent ready task, returns APE_INVALID_TASK when none is ready */
+APEBUILD_PRIVATE ApeTaskHandle ape_schedule_pop(ApeSchedule *sched)
+{
+	if (sched->heap_count == 0)
+		return APE_INVALID_TASK;
+
+	uint32_t top = sched->heap[0];
+	uint32_t last = sched->heap[--sched->heap_count];
+	size_t i = 0;
+	while (sched->heap_count > 0) {
+		size_t child = 2 * i + 1;
+		if (child >= sched->heap_count)
+			break;
+		if (child + 1 < sched->heap_count && ape_schedule_before(sched, sched->heap[child + 1], sched->heap[child]))
+			child++;
+		if (!ape_schedule_before(sched, sched->heap[child], last))
+			break;
+		sched->heap[i] = sched->heap[child];
+		i = child;
+	}
+	if (sched->heap_count > 0)
+		sched->heap[i] = last;
+	return sched->tasks[top];
+}
+
+/* The task ape_schedule_pop() would return next */
+APEBUILD_PRIVATE ApeTaskHandle ape_schedule_peek(const ApeSchedule *sched)
+{
+	return sched->heap_count > 0 ? sched->tasks[sched->heap[0]] : APE_INVALID_TASK;
+}
+
+/* Called when a task completed or was skipped: queues the dependents it was the last dep of */
+APEBUILD_PRIVATE void ape_schedule_finish(ApeSchedule *sched, ApeTaskHandle handle)
+{
+	int64_t i = ape_schedule_find(sched, handle);
+	if (i < 0)
+		return;
+	for (uint32_t e = sched->dependents_start[i]; e < sched->dependents_start[i + 1]; e++) {
+		uint32_t dependent = sched->dependents[e];
+		if (--sched->waiting[dependent] == 0)
+			ape_schedule_push(sched, dependent);
+	}
+}
+
+APEBUILD_PRIVATE void ape_schedule_init(ApeSchedule *sched, const ApeTaskHandle *tasks, size_t count)
+{
+	memset(sched, 0, sizeof(ApeSchedule));
+	sched->count = count;
+	sched->tasks = (ApeTaskHandle *)APEBUILD_MALLOC((count + 1) * sizeof(ApeTaskHandle));
+	sched->priority = (uint64_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint64_t));
+	sched->waiting = (uint32_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint32_t));
+	sched->dependents_start = (uint32_t *)APEBUILD_MALLOC((count + 2) * sizeof(uint32_t));
+	sched->heap = (uint32_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint32_t));
+
+	for (size_t i = 0; i < count; i++) {
+		sched->tasks[i] = tasks[i];
+		sched->waiting[i] = 0;
+		sched->dependents_start[i] = 0;
+		ApeTask *task = ape_task_get(tasks[i]);
+		if (task) {
+			task->sched_index = (int32_t)i;
+			task->slot = -1;
+			task->user_ms = 0;
+			task->sys_ms = 0;
+		}
+	}
+	sched->dependents_start[count] = 0;
+	sched->dependents_start[count + 1] = 0;
+
+	/* Reverse the dep edges, deps outside the schedule are checked with ape_task_ready() when the task starts */
+	for (size_t i = 0; i < count; i++) {
+		ApeTask *task = ape_task_get(tasks[i]);
+		for (size_t d = 0; task && d < task->deps.count; d++) {
+			int64_t dep = ape_schedule_find(sched, task->deps.items[d]);
+			if (dep >= 0) {
+				sched->waiting[i]++;
+				sched->dependents_start[dep + 2]++;
+			}
+		}
+	}
+	for (size_t i = 2; i < count + 2; i++)
+		sched->dependents_start[i] += sched->dependents_start[i - 1];
+	sched->dependents = (uint32_t *)APEBUILD_MALLOC((sched->dependents_start[count + 1] + 1) * sizeof(uint32_t));
+	for (size_t i = 0; i < count; i++) {
+		ApeTask *task = ape_task_get(tasks[i]);
+		for (size_t d = 0; task && d < task->deps.count; d++) {
+			int64_t dep = ape_schedule_find(sched, task->deps.items[d]);
+			if (dep >= 0)
+				sched->dependents[sched->dependents_start[dep + 1]++] = (uint32_t)i;
+		}
+	}
+
+	/* Topological order (tasks on a cycle never get in), then priorities from the last task backwards */
+	uint32_t *order = sched->heap;
+	uint32_t *unfinished = (uint32_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint32_t));
+	size_t ordered = 0;
+	for (size_t i = 0; i < count; i++) {
+		unfinished[i] = sched->waiting[i];
+		ApeTask *task = ape_task_get(tasks[i]);
+		sched->priority[i] = task ? ape_task_expected_ms(task) : 0;
+		if (unfinished[i] == 0)
+			order[ordered++] = (uint32_t)i;
+	}
+	for (size_t k = 0; k < ordered; k++) {
+		uint32_t i = order[k];
+		for (uint32_t e = sched->dependents_start[i]; e < sched->dependents_start[i + 1]; e++) {
+			if (--unfinished[sched->dependents[e]] == 0)
+				order[ordered++] = sched->dependents[e];
+		}
+	}
+	for (size_t k = ordered; k-- > 0;) {
+		uint32_t i = order[k];
+		uint64_t longest = 0;
+		for (uint32_t e = sched->dependents_start[i]; e < sched->dependents_start[i + 1]; e++) {
+			if (sched->priority[sched->dependents[e]] > longest)
+				longest = sched->priority[sched->dependents[e]];
+		}
+		sched->priority[i] += longest;
+	}
+	APEBUILD_FREE(unfinished);
+
+	for (size_t i = 0; i < count; i++) {
+		if (sched->waiting[i] == 0)
+			ape_schedule_push(sched, (uint32_t)i);
+	}
+}
+
+APEBUILD_PRIVATE void ape_schedule_free(ApeSchedule *sched)
+{
+	APEBUILD_FREE(sched->tasks);
+	APEBUILD_FREE(sched->priority);
+	APEBUILD_FREE(sched->waiting);
+	APEBUILD_FREE(sched->dependents_start);
+	APEBUILD_FREE(sched->dependents);
+	APEBUILD_FREE(sched->heap);
+	memset(sched, 0, sizeof(ApeSchedule));
+}
+
+/* Fails the tasks that never got to start, returns how many there were */
+APEBUILD_PRIVATE int ape_schedule_fail_pending(const ApeSchedule *sched)
+{
+	int count = 0;
+	for (size_t i = 0; i < sched->count; i++) {
+		ApeTask *task = ape_task_get(sched->tasks[i]);
+		if (task && task->status == APE_TASK_PENDING) {
+			task->status = APE_TASK_FAILED;
+			count++;
+		}
+	}
+	return count;
+}
+
+/* How long a task ran for in this build, 0 if it didn't run */
+APEBUILD_PRIVATE uint64_t ape_task_run_ms(const ApeTask *task)
+{
+	return task && task->slot >= 0 ? task->duration_ms : 0;
+}
+
+/* Longest chain of run times through the schedule, length gets the number of tasks that ran on it */
+APEBUILD_PRIVATE uint64_t ape_schedule_critical_path(const ApeSchedule *sched, size_t *length)
+{
+	size_t count = sched->count;
+	uint32_t *pending = (uint32_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint32_t));
+	uint32_t *order = (uint32_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint32_t));
+	uint64_t *start = (uint64_t *)APEBUILD_MALLOC((count + 1) * sizeof(uint64_t));
+	size_t *chain = (size_t *)APEBUILD_MALLOC((count + 1) * sizeof(size_t));
+	for (size_t i = 0; i < count; i++) {
+		pending[i] = 0;
+		start[i] = 0;
+		chain[i] = 0;
+	}
+	for (size_t e = 0; e < sched->dependents_start[count]; e++)
+		pending[sched->dependents[e]]++;
+
+	size_t ordered = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (pending[i] == 0)
+			order[ordered++] = (uint32_t)i;
+	}
+
+	uint64_t longest = 0;
+	*length = 0;
+	for (size_t k = 0; k < ordered; k++) {
+		uint32_t i = order[k];
+		ApeTask *task = ape_task_get(sched->tasks[i]);
+		uint64_t finish = start[i] + ape_task_run_ms(task);
+		size_t tasks = chain[i] + (task && task->slot >= 0 ? 1 : 0);
+		if (finish > longest || (finish == longest && tasks > *length)) {
+			longest = finish;
+			*length = tasks;
+		}
+		for (uint32_t e = sched->dependents_start[i]; e < sched->dependents_start[i + 1]; e++) {
+			uint32_t next = sched->dependents[e];
+			if (finish > start[next] || (finish == start[next] && tasks > chain[next])) {
+				start[next] = finish;
+				chain[next] = tasks;
+			}
+			if (--pending[next] == 0)
+				order[ordered++] = next;
+		}
+	}
+
+	APEBUILD_FREE(pending);
+	APEBUILD_FREE(order);
+	APEBUILD_FREE(start);
+	APEBUILD_FREE(chain);
+	return longest;
+}
+
+/* ============================================================================
+ * Throttling
+ *
+ * With a load limit, no task starts while the one minute load average plus
+ * the tasks started since it was read is at or above the limit; the average
+ * trails what was just started. With memory throttling, a task only starts if
+ * MemAvailable covers its expected peak on top of what the running tasks are
+ * still expected to grow by, their expected peaks minus what they use now
+ * (which MemAvailable already left out). Peaks come from the build log, a task
+ * that never ran is expected to need as much as the hungriest task in the
+ * build did. Neither holds a task back while nothing else runs, so the build
+ * always progresses. A held back task is looked at again when a running one
+ * exits, or once the load and memory had time to change.
+ * ============================================================================ */
+
+#define APE_THROTTLE_SAMPLE_MS 1000
+
+typedef struct {
+	double max_load;	 /* 0 = no load limit */
+	int memory;		 /* Throttle on available memory */
+	double load;		 /* One minute load average, < 0 if unknown */
+	uint64_t load_ms;	 /* When load was read */
+	int started;		 /* Tasks started since load was read */
+	uint64_t available_kb;	 /* MemAvailable for this scheduling pass, 0 if unknown */
+	uint32_t unknown_rss_kb; /* Expected peak of a task without history */
+} ApeThrottle;
+
+APEBUILD_PRIVATE double ape_throttle_read_load(void)
+{
+	double load = -1;
+	FILE *fp = fopen("/proc/loadavg", "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%lf", &load) != 1)
+		load = -1;
+	fclose(fp);
+	return load;
+}
+
+APEBUILD_PRIVATE uint64_t ape_throttle_read_available_kb(void)
+{
+	FILE *fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return 0;
+	char line[256];
+	unsigned long long kb = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return (uint64_t)kb;
+}
+
+APEBUILD_PRIVATE void ape_throttle_init(ApeThrottle *throttle, const ApeBuildCtx *ctx, const ApeSchedule *sched)
+{
+	memset(throttle, 0, sizeof(*throttle));
+	throttle->max_load = ctx ? ctx->max_load : 0;
+	throttle->memory = ctx ? ctx->memory_throttle : 0;
+	throttle->load = -1;
+	for (size_t i = 0; throttle->memory && i < sched->count; i++) {
+		ApeTask *task = ape_task_get(sched->tasks[i]);
+		if (task && task->peak_rss_kb > throttle->unknown_rss_kb)
+			throttle->unknown_rss_kb = task->peak_rss_kb;
+	}
+}
+
+/* Rereads memory every scheduling pass, and the load average once it had time to move */
+APEBUILD_PRIVATE void ape_throttle_sample(ApeThrottle *throttle)
+{
+	if (throttle->memory)
+		throttle->available_kb = ape_throttle_read_available_kb();
+	if (throttle->max_load > 0 && (throttle->load_ms == 0 || ape_build_now_ms() - throttle->load_ms >= APE_THROTTLE_SAMPLE_MS)) {
+		throttle->load = ape_throttle_read_load();
+		throttle->load_ms = ape_build_now_ms();
+		throttle->started = 0;
+	}
+}
+
+APEBUILD_PRIVATE uint64_t ape_throttle_expected_kb(const ApeThrottle *throttle, const ApeTask *task)
+{
+	return task->peak_rss_kb > 0 ? task->peak_rss_kb : throttle->unknown_rss_kb;
+}
+
+/* Whether next may start alongside the running tasks */
+APEBUILD_PRIVATE int ape_throttle_allows(const ApeThrottle *throttle, ApeTaskHandle next, const ApeTaskHandleList *running)
+{
+	if (running->count == 0)
+		return APEBUILD_TRUE;
+	if (throttle->max_load > 0 && throttle->load >= 0 && throttle->load + throttle->started >= throttle->max_load)
+		return APEBUILD_FALSE;
+
+	ApeTask *task = ape_task_get(next);
+	if (!throttle->memory || throttle->available_kb == 0 || !task)
+		return APEBUILD_TRUE;
+	uint64_t needed = ape_throttle_expected_kb(throttle, task);
+	for (size_t i = 0; i < running->count; i++) {
+		ApeTask *other = ape_task_get(running->items[i]);
+		if (!other)
+			continue;
+		uint64_t expected = ape_throttle_expected_kb(throttle, other);
+		uint64_t used = ape_proc_rss_kb(other->proc);
+		if (expected > used)
+			needed += expected - used;
+	}
+	return needed <= throttle->available_kb ? APEBUILD_TRUE : APEBUILD_FALSE;
+}
+
+/* ============================================================================
+ * Compilation Database
+ *
+ * compile_commands.json gets one entry per compiled source, one per line. The
+ * members of a unity batch each get the batch's command with their own path
+ * in place of the unity file, and are keyed by the object they would be
+ * compiled to alone, so a source moving in or out of a batch replaces its
+ * entry. Precompiled header flags are left out, since tools parsing the
+ * database can't read the compiler's PCH. Next to it,
+ * <path>.index records each entry's object file, source, command hash and
+ * JSON text, so an update only formats the compiles whose command changed and
+ * keeps the entries of builders that aren't part of this build. Entries whose
+ * source is gone are dropped. Both files are streamed out, and only when
+ * something changed, so tools watching the database don't reload it for
+ * nothing.
+ * ============================================================================ */
+
+#define APE_CDB_MAGIC "APECDB02"
+
+typedef struct {
+	char *source;
+	ApeHash cmd_hash; /* Command and working directory */
+	char *entry;	  /* JSON object, without a trailing comma */
+} ApeCdbEntry;
+
+typedef struct {
+	size_t capacity;
+	size_t count;
+	ApeCdbEntry *items;
+} ApeCdbEntryList;
+
+APEBUILD_PRIVATE ApeHash ape_cdb_task_hash(const ApeTask *task, const char *cwd)
+{
+	ApeHash cmd_hash = ape_task_cmd_hash(task);
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	ape_hash_update(&hc, &cmd_hash, sizeof(cmd_hash));
+	ape_hash_update_str(&hc, task->cmd.cwd ? task->cmd.cwd : cwd);
+	return ape_hash_final(&hc);
+}
+
+/* The precompiled header a compile uses, NULL if none */
+APEBUILD_PRIVATE const ApeTask *ape_task_pch(const ApeTask *task)
+{
+	for (size_t i = 0; i < task->deps.count; i++) {
+		const ApeTask *dep = ape_task_get(task->deps.items[i]);
+		if (dep && dep->type == APE_TASK_TYPE_PCH)
+			return dep;
+	}
+	return NULL;
+}
+
+/* Sources among a compile's inputs are compiled through it, eg. the members of a unity batch */
+APEBUILD_PRIVATE int ape_cdb_is_source(const char *path)
+{
+	return ape_str_ends_with(path, ".c") || ape_source_is_cxx(path);
+}
+
+/* Entry for source compiled by task, which is task->input unless task is a unity batch */
+APEBUILD_PRIVATE char *ape_cdb_format_entry(const ApeTask *task, const char *source, const char *cwd)
+{
+	const ApeTask *pch = ape_task_pch(task);
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_str(&sb, "{\"directory\": ");
+	ape_sb_append_json_str(&sb, task->cmd.cwd ? task->cmd.cwd : cwd);
+	ape_sb_append_str(&sb, ", \"arguments\": [");
+	int first = APEBUILD_TRUE;
+	for (size_t i = 0; i < task->cmd.count; i++) {
+		const char *arg = task->cmd.items[i];
+		const char *next = i + 1 < task->cmd.count ? task->cmd.items[i + 1] : "";
+		if (pch && ((strcmp(arg, "-include") == 0 && strcmp(next, pch->input) == 0) ||
+			    (strcmp(arg, "-include-pch") == 0 && strcmp(next, pch->output) == 0))) {
+			i++;
+			continue;
+		}
+		if (!first)
+			ape_sb_append_str(&sb, ", ");
+		ape_sb_append_json_str(&sb, strcmp(arg, task->input) == 0 ? source : arg);
+		first = APEBUILD_FALSE;
+	}
+	ape_sb_append_str(&sb, "], \"file\": ");
+	ape_sb_append_json_str(&sb, source);
+	ape_sb_append_str(&sb, ", \"output\": ");
+	ape_sb_append_json_str(&sb, task->output);
+	ape_sb_append_str(&sb, "}");
+	char *entry = ape_sb_to_str_dup(&sb);
+	ape_sb_free(&sb);
+	return entry;
+}
+
+APEBUILD_PRIVATE int ape_cdb_read_str(const char **p, const char *end, char **out)
+{
+	uint32_t len = 0;
+	if (!ape_deps_read_u32(p, end, &len) || (size_t)(end - *p) < len)
+		return APEBUILD_FALSE;
+	*out = ape_str_ndup(*p, len);
+	*p += len;
+	return APEBUILD_TRUE;
+}
+
+/* Reads the index into outputs and the entries at the same positions */
+APEBUILD_PRIVATE void ape_cdb_load(const char *index_path, ApeStrList *outputs, ApeCdbEntryList *entries)
+{
+	size_t size = 0;
+	char *data = ape_fs_read_file(index_path, &size);
+	if (!data || size < strlen(APE_CDB_MAGIC) || memcmp(data, APE_CDB_MAGIC, strlen(APE_CDB_MAGIC)) != 0) {
+		APEBUILD_FREE(data);
+		return;
+	}
+
+	const char *p = data + strlen(APE_CDB_MAGIC);
+	const char *end = data + size;
+	while (p < end) {
+		char *output = NULL;
+		ApeCdbEntry entry = { 0 };
+		int ok = ape_cdb_read_str(&p, end, &output) && ape_cdb_read_str(&p, end, &entry.source) &&
+			 (size_t)(end - p) >= sizeof(ApeHash);
+		if (ok) {
+			memcpy(&entry.cmd_hash, p, sizeof(ApeHash));
+			p += sizeof(ApeHash);
+			ok = ape_cdb_read_str(&p, end, &entry.entry);
+		}
+		if (!ok) {
+			APEBUILD_FREE(output);
+			APEBUILD_FREE(entry.source);
+			break;
+		}
+		ape_sl_append(outputs, output);
+		ape_da_append(entries, entry);
+	}
+	APEBUILD_FREE(data);
+}
+
+APEBUILD_PRIVATE int ape_cdb_write_str(FILE *fp, const char *str)
+{
+	uint32_t len = (uint32_t)strlen(str);
+	return fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(str, 1, len, fp) == len;
+}
+
+/* Streams the database and its index out, entry by entry, replacing both files at once */
+APEBUILD_PRIVATE int ape_cdb_save(const char *path, const char *index_path, const ApeStrList *outputs, const ApeCdbEntryList *entries)
+{
+	char *dir = ape_fs_dirname(path);
+	ape_fs_mkdir_p(dir);
+	APEBUILD_FREE(dir);
+
+	char *tmp_path = ape_str_concat(path, ".tmp");
+	char *tmp_index = ape_str_concat(index_path, ".tmp");
+	FILE *db = fopen(tmp_path, "wb");
+	FILE *index = fopen(tmp_index, "wb");
+	int ok = db && index && fputs("[\n", db) >= 0 && fputs(APE_CDB_MAGIC, index) >= 0;
+	int first = APEBUILD_TRUE;
+	for (size_t i = 0; ok && i < entries->count; i++) {
+		const ApeCdbEntry *entry = &entries->items[i];
+		if (!entry->entry)
+			continue;
+		ok = fputs(first ? "" : ",\n", db) >= 0 && fputs(entry->entry, db) >= 0 && ape_cdb_write_str(index, outputs->items[i]) &&
+		     ape_cdb_write_str(index, entry->source) && fwrite(&entry->cmd_hash, sizeof(ApeHash), 1, index) == 1 &&
+		     ape_cdb_write_str(index, entry->entry);
+		first = APEBUILD_FALSE;
+	}
+	ok = ok && fputs(first ? "]\n" : "\n]\n", db) >= 0;
+	if (db && fclose(db) != 0)
+		ok = APEBUILD_FALSE;
+	if (index && fclose(index) != 0)
+		ok = APEBUILD_FALSE;
+
+	ok = ok && ape_fs_rename(tmp_path, path) && ape_fs_rename(tmp_index, index_path);
+	if (!ok) {
+		ape_fs_remove(tmp_path);
+		ape_fs_remove(tmp_index);
+	}
+	APEBUILD_FREE(tmp_index);
+	APEBUILD_FREE(tmp_path);
+	return ok;
+}
+
+/* Brings the database at path up to date with the compile tasks in tasks */
+APEBUILD_PRIVATE int ape_build_update_compile_db(const char *path, const ApeTaskHandleList *tasks)
+{
+	char *index_path = ape_str_concat(path, ".index");
+	ApeStrList outputs = ape_sl_new();
+	ApeCdbEntryList entries = { 0 };
+	ape_cdb_load(index_path, &outputs, &entries);
+	int changed = !ape_fs_exists(path);
+
+	ApePathIndex index;
+	ape_path_index_build(&index, &outputs);
+	char *cwd = ape_fs_cwd();
+	for (size_t i = 0; i < tasks->count; i++) {
+		ApeTask *task = ape_task_get(tasks->items[i]);
+		if (!task || task->type != APE_TASK_TYPE_COMPILE || !task->input || !task->output)
+			continue;
+
+		ApeHash cmd_hash = ape_cdb_task_hash(task, cwd ? cwd : ".");
+		size_t members = 0;
+		for (size_t j = 0; j < task->inputs.count; j++)
+			members += ape_cdb_is_source(task->inputs.items[j]);
+		for (size_t j = 0; j < (members > 0 ? task->inputs.count : 1); j++) {
+			const char *source = members > 0 ? task->inputs.items[j] : task->input;
+			if (members > 0 && !ape_cdb_is_source(source))
+				continue;
+			char *key = members > 0 ? ape_build_obj_path(NULL, task->builder, source) : ape_str_dup(task->output);
+			if (!key)
+				continue;
+			uint32_t pos = ape_path_index_intern(&index, &outputs, key);
+			APEBUILD_FREE(key);
+			if (pos == entries.count) {
+				ApeCdbEntry entry = { 0 };
+				ape_da_append(&entries, entry);
+			} else if (entries.items[pos].cmd_hash == cmd_hash && strcmp(entries.items[pos].source, source) == 0) {
+				continue;
+			}
+
+			ApeCdbEntry *entry = &entries.items[pos];
+			APEBUILD_FREE(entry->source);
+			APEBUILD_FREE(entry->entry);
+			entry->source = ape_str_dup(source);
+			entry->cmd_hash = cmd_hash;
+			entry->entry = ape_cdb_format_entry(task, source, cwd ? cwd : ".");
+			changed = APEBUILD_TRUE;
+		}
+	}
+
+	/* Sources that were deleted since, an entry without JSON isn't written */
+	for (size_t i = 0; i < entries.count; i++) {
+		if (!ape_fs_exists(entries.items[i].source)) {
+			APEBUILD_FREE(entries.items[i].entry);
+			entries.items[i].entry = NULL;
+			changed = APEBUILD_TRUE;
+		}
+	}
+
+	int ok = !changed || ape_cdb_save(path, index_path, &outputs, &entries);
+
+	for (size_t i = 0; i < entries.count; i++) {
+		APEBUILD_FREE(entries.items[i].source);
+		APEBUILD_FREE(entries.items[i].entry);
+	}
+	ape_da_free(&entries);
+	APEBUILD_FREE(index.slots);
+	APEBUILD_FREE(cwd);
+	ape_sl_free(&outputs);
+	APEBUILD_FREE(index_path);
+	return ok;
+}
+
+/* ============================================================================
+ * Build Profile
+ *
+ * Every task that runs records its wall time, CPU time and peak memory, and
+ * the parallel slot it ran in. After a build, the slowest tasks and the
+ * critical path (the longest chain of dependent run times, which no number of
+ * jobs can get below) can be logged, and the tasks written as a Chrome trace
+ * with one row per slot.
+ * ============================================================================ */
+
+#define APE_PROFILE_SLOWEST 5
+
+/* Lowest slot no running task is in */
+APEBUILD_PRIVATE int32_t ape_build_free_slot(const ApeTaskHandleList *running)
+{
+	for (int32_t slot = 0;; slot++) {
+		int used = APEBUILD_FALSE;
+		for (size_t i = 0; i < running->count && !used; i++) {
+			ApeTask *task = ape_task_get(running->items[i]);
+			used = task && task->slot == slot;
+		}
+		if (!used)
+			return slot;
+	}
+}
+
+APEBUILD_PRIVATE const char *ape_task_type_name(ApeTaskType type)
+{
+	switch (type) {
+		case APE_TASK_TYPE_COMPILE:
+			return "compile";
+		case APE_TASK_TYPE_PCH:
+			return "pch";
+		case APE_TASK_TYPE_LINK:
+			return "link";
+		case APE_TASK_TYPE_ARCHIVE:
+			return "archive";
+		case APE_TASK_TYPE_COMMAND:
+			return "command";
+		case APE_TASK_TYPE_COPY:
+			return "copy";
+		case APE_TASK_TYPE_MKDIR:
+			return "mkdir";
+	}
+	return "task";
+}
+
+APEBUILD_PRIVATE void ape_build_log_profile(const ApeSchedule *sched, uint64_t wall_ms)
+{
+	ApeTask *slowest[APE_PROFILE_SLOWEST] = { 0 };
+	size_t ran = 0;
+	for (size_t i = 0; i < sched->count; i++) {
+		ApeTask *task = ape_task_get(sched->tasks[i]);
+		if (!task || task->slot < 0)
+			continue;
+		ran++;
+		/* Insertion into the short list, slowest first */
+		for (size_t k = 0; k < APE_PROFILE_SLOWEST; k++) {
+			if (!slowest[k] || task->duration_ms > slowest[k]->duration_ms) {
+				memmove(&slowest[k + 1], &slowest[k], (APE_PROFILE_SLOWEST - k - 1) * sizeof(ApeTask *));
+				slowest[k] = task;
+				break;
+			}
+		}
+	}
+	if (ran == 0)
+		return;
+
+	size_t length = 0;
+	uint64_t critical = ape_schedule_critical_path(sched, &length);
+	ape_log_info("Critical path: %llu ms over %zu tasks, build took %llu ms", (unsigned long long)critical, length,
+		     (unsigned long long)wall_ms);
+	ape_log_info("Slowest tasks:");
+	for (size_t k = 0; k < APE_PROFILE_SLOWEST && slowest[k]; k++) {
+		ape_log_info("  %6u ms  %s (user %u ms, sys %u ms, %u MiB)", slowest[k]->duration_ms, slowest[k]->name, slowest[k]->user_ms,
+			     slowest[k]->sys_ms, slowest[k]->peak_rss_kb / 1024);
+	}
+}
+
+/* Writes the tasks that ran in Chrome's trace event format */
+APEBUILD_PRIVATE int ape_build_write_trace(const char *path, const ApeSchedule *sched, uint64_t start_ms)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_str(&sb, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	int32_t slots = 0;
+	for (size_t i = 0; i < sched->count; i++) {
+		ApeTask *task = ape_task_get(sched->tasks[i]);
+		if (!task || task->slot < 0)
+			continue;
+		if (task->slot >= slots)
+			slots = task->slot + 1;
+		ApeBuilder *builder = ape_builder_get(task->builder);
+		ape_sb_append_str(&sb, "{\"name\":");
+		ape_sb_append_json_str(&sb, task->name);
+		ape_sb_append_fmt(&sb, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"builder\":",
+				  ape_task_type_name(task->type), task->slot, (unsigned long long)(task->start_ms - start_ms) * 1000,
+				  (unsigned long long)task->duration_ms * 1000);
+		ape_sb_append_json_str(&sb, builder ? builder->name : "");
+		ape_sb_append_fmt(&sb, ",\"exit_code\":%d,\"user_ms\":%u,\"sys_ms\":%u,\"peak_rss_kb\":%u}},\n", task->exit_code,
+				  task->user_ms, task->sys_ms, task->peak_rss_kb);
+	}
+	for (int32_t slot = 0; slot < slots; slot++) {
+		ape_sb_append_fmt(&sb, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,", slot);
+		ape_sb_append_fmt(&sb, "\"args\":{\"name\":\"slot %d\"}},\n", slot);
+	}
+	ape_sb_append_str(&sb, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"apebuild\"}}\n]}\n");
+
+	char *dir = ape_fs_dirname(path);
+	ape_fs_mkdir_p(dir);
+	APEBUILD_FREE(dir);
+	int ok = ape_fs_write_file(path, sb.items, sb.count);
+	ape_sb_free(&sb);
+	return ok;
+}
+
+/* Logs and writes out the profile of the build that just ran, as configured */
+APEBUILD_PRIVATE void ape_build_report_profile(const ApeBuildCtx *ctx, const ApeSchedule *sched, uint64_t start_ms)
+{
+	if (!ctx || ctx->dry_run)
+		return;
+	if (ctx->verbosity >= APE_VERBOSE_VERBOSE || (ctx->trace_file && ctx->verbosity >= APE_VERBOSE_NORMAL))
+		ape_build_log_profile(sched, ape_build_now_ms() - start_ms);
+	if (ctx->trace_file && !ape_build_write_trace(ctx->trace_file, sched, start_ms))
+		ape_log_warn("Could not write build trace %s", ctx->trace_file);
+}
+
+/* ============================================================================
+ * Build Operations
+ * ============================================================================ */
+
+/* A dependency that ran has rewritten an input, even if the mtime (in seconds) didn't change */
+APEBUILD_PRIVATE int ape_task_deps_ran(const ApeTask *task)
+{
+	for (size_t i = 0; i < task->deps.count; i++) {
+		ApeTask *dep = ape_task_get(task->deps.items[i]);
+		if (dep && dep->status == APE_TASK_COMPLETED)
+			return APEBUILD_TRUE;
+	}
+	return APEBUILD_FALSE;
+}
+
+/* Writes a finished task's captured output in one piece, so parallel tasks never interleave */
+APEBUILD_PRIVATE void ape_task_flush_output(const ApeTask *task)
+{
+	size_t len;
+	const char *output = ape_proc_output(task->proc, &len);
+	if (len == 0)
+		return;
+	fwrite(output, 1, len, stderr);
+	fflush(stderr);
+}
+
+/*
+ * Blocks until at least one running task's process has exited or written
+ * output, wake_fd (if >= 0) is readable, or timeout_ms passed
+ */
+APEBUILD_PRIVATE void ape_builder_wait_running(const ApeTaskHandleList *running, int wake_fd, int timeout_ms)
+{
+	ApeProcHandle *procs = (ApeProcHandle *)APEBUILD_MALLOC((running->count + 1) * sizeof(ApeProcHandle));
+	size_t count = 0;
+	for (size_t i = 0; i < running->count; i++) {
+		ApeTask *task = ape_task_get(running->items[i]);
+		if (task)
+			procs[count++] = task->proc;
+	}
+	ape_proc_wait_any_fd(procs, count, wake_fd, timeout_ms);
+	APEBUILD_FREE(procs);
+}
+
+/* Waits for every running task after a failure, without recording results */
+APEBUILD_PRIVATE void ape_builder_drain_running(ApeTaskHandleList *running)
+{
+	while (running->count > 0) {
+		ape_builder_wait_running(running, -1, -1);
+		for (size_t i = 0; i < running->count;) {
+			ApeTask *task = ape_task_get(running->items[i]);
+			if (!task || ape_proc_poll(task->proc) || !ape_proc_handle_valid(task->proc)) {
+				if (task) {
+					if (!task->preprocessing)
+						ape_task_flush_output(task);
+					ape_proc_handle_release(task->proc);
+					task->proc = APE_INVALID_HANDLE;
+					task->preprocessing = APEBUILD_FALSE;
+				}
+				for (size_t j = i; j < running->count - 1; j++)
+					running->items[j] = running->items[j + 1];
+				running->count--;
+			} else {
+				i++;
+			}
+		}
+	}
+}
+
+/* Prints what a task is about to run */
+APEBUILD_PRIVATE void ape_task_log_start(const ApeTask *task, ApeVerbosity verbosity)
+{
+	if (verbosity >= APE_VERBOSE_VERBOSE) {
+		char *cmd_str = ape_cmd_render_quoted(&task->cmd);
+		ape_log_cmd("%s", cmd_str);
+		APEBUILD_FREE(cmd_str);
+	} else if (verbosity >= APE_VERBOSE_NORMAL) {
+		ape_log_info("%s", task->name);
+	}
+}
+
+/* Starts a task's command, a failure to start fails the task */
+APEBUILD_PRIVATE int ape_task_launch(ApeTask *task, ApeVerbosity verbosity)
+{
+	ape_task_log_start(task, verbosity);
+	task->proc = ape_cmd_start_captured(&task->cmd);
+	if (task->proc != APE_INVALID_HANDLE)
+		return APEBUILD_TRUE;
+
+	APEBUILD_FREE(task->cache_key);
+	task->cache_key = NULL;
+	task->status = APE_TASK_FAILED;
+	task->exit_code = -1;
+	if (verbosity >= APE_VERBOSE_NORMAL) {
+		ape_log_failure("%s failed to start", task->name);
+	}
+	return APEBUILD_FALSE;
+}
+
+/* Restores a compile's object if its cache key has an entry, and records it like a finished compile */
+APEBUILD_PRIVATE int ape_task_restore_cached(ApeTask *task, const char *cache_dir, ApeVerbosity verbosity)
+{
+	if (!task->cache_key || !ape_cache_restore(cache_dir, task->cache_key, task->output))
+		return APEBUILD_FALSE;
+
+	APEBUILD_FREE(task->cache_key);
+	task->cache_key = NULL;
+	task->duration_ms = (uint32_t)(ape_build_now_ms() - task->start_ms);
+	if (task->depfile)
+		ape_task_read_depfile(task);
+	ape_builder_log_task(task->builder, task);
+	task->status = APE_TASK_COMPLETED;
+	task->exit_code = 0;
+	if (ape_builder_get(task->builder))
+		ape_builder_get(task->builder)->cache_hits++;
+	if (verbosity >= APE_VERBOSE_NORMAL) {
+		ape_log_info("%s (cached)", task->name);
+	}
+	return APEBUILD_TRUE;
+}
+
+/* Runs tasks of any number of builders as one graph, name labels the summary */
+APEBUILD_PRIVATE int ape_build_run_tasks(const char *name, const ApeTaskHandleList *tasks, ApeBuildCtx *ctx)
+{
+	ApeVerbosity verbosity = ctx ? ctx->verbosity : APE_VERBOSE_NORMAL;
+	int max_parallel = ctx ? ctx->parallel_jobs : 0;
+	int stop_on_failure = !ctx || !ctx->keep_going;
+	if (max_parallel <= 0)
+		max_parallel = ape_build_get_cpu_count();
+	const char *cache_dir = ctx && !ctx->dry_run ? ctx->cache_dir : NULL;
+
+	ApeJobserver js = { 0 };
+	if (!ctx || !ctx->dry_run) {
+		ape_jobserver_start(&js, max_parallel);
+		/* Under a parent's jobserver its slots are the limit unless jobs were set */
+		if (js.active && !js.fifo_dir && (!ctx || ctx->parallel_jobs <= 0))
+			max_parallel = INT_MAX;
+	}
+
+	uint64_t start_ms = ape_build_now_ms();
+	ApeSchedule sched;
+	ape_schedule_init(&sched, tasks->items, tasks->count);
+	ApeThrottle throttle;
+	ape_throttle_init(&throttle, ctx, &sched);
+	ApeTaskHandleList running = { 0 };
+	int completed = 0, failed = 0, skipped = 0, cached = 0;
+
+	while (sched.heap_count > 0 || running.count > 0) {
 		/* Check for completed tasks */
-		for (size_t i = 0; i < running.count;) {
+		for (size_t i = 0; i < running.count && (failed == 0 || !stop_on_failure);) {
 			ApeTask *task = ape_task_get(running.items[i]);
 			if (!task) {
 				/* Remove invalid task */
@@ -1457,13 +3775,45 @@ APEBUILD_PRIVATE int ape_builder_run_tasks(ApeBuilderHandle handle, ApeBuildCtx
 				continue;
 			}
 
-			if (ape_proc_poll(task->proc)) {
+			if (ape_proc_poll(task->proc) && task->preprocessing) {
+				/* The cache key is known, restore the object or compile it in the same slot */
+				task->preprocessing = APEBUILD_FALSE;
+				task->cache_key = ape_cache_compile_key(task);
+				ape_proc_handle_release(task->proc);
+				task->proc = APE_INVALID_HANDLE;
+				int restored = ape_task_restore_cached(task, cache_dir, verbosity);
+				if (!restored && ape_task_launch(task, verbosity)) {
+					i++;
+					continue;
+				}
+				if (restored) {
+					cached++;
+					ape_schedule_finish(&sched, running.items[i]);
+				} else {
+					failed++;
+				}
+				for (size_t j = i; j < running.count - 1; j++)
+					running.items[j] = running.items[j + 1];
+				running.count--;
+			} else if (ape_proc_poll(task->proc)) {
 				ApeProcResult result = ape_proc_result(task->proc);
 				task->exit_code = result.exit_code;
+				task->duration_ms = (uint32_t)(ape_build_now_ms() - task->start_ms);
+				task->user_ms = (uint32_t)(result.user_us / 1000);
+				task->sys_ms = (uint32_t)(result.sys_us / 1000);
+				if (result.peak_rss_kb > 0)
+					task->peak_rss_kb = (uint32_t)result.peak_rss_kb;
+				ape_task_flush_output(task);
 
 				if (result.status == APE_PROC_COMPLETED && result.exit_code == 0) {
 					task->status = APE_TASK_COMPLETED;
 					completed++;
+					if (task->depfile)
+						ape_task_read_depfile(task);
+					ape_builder_log_task(task->builder, task);
+					if (task->cache_key)
+						ape_cache_store(cache_dir, task->cache_key, task->output);
+					ape_schedule_finish(&sched, running.items[i]);
 				} else {
 					task->status = APE_TASK_FAILED;
 					failed++;
@@ -1474,78 +3824,46 @@ APEBUILD_PRIVATE int ape_builder_run_tasks(ApeBuilderHandle handle, ApeBuildCtx
 
 				ape_proc_handle_release(task->proc);
 				task->proc = APE_INVALID_HANDLE;
+				APEBUILD_FREE(task->cache_key);
+				task->cache_key = NULL;
 
 				/* Remove from running */
 				for (size_t j = i; j < running.count - 1; j++)
 					running.items[j] = running.items[j + 1];
 				running.count--;
-
-				/* If not keep_going and a task failed, exit early after draining running tasks */
-				if (failed > 0 && (!ctx || !ctx->keep_going)) {
-					/* Wait for remaining running tasks to complete */
-					while (running.count > 0) {
-						for (size_t k = 0; k < running.count;) {
-							ApeTask *rt = ape_task_get(running.items[k]);
-							if (rt && ape_proc_poll(rt->proc)) {
-								ape_proc_handle_release(rt->proc);
-								for (size_t m = k; m < running.count - 1; m++)
-									running.items[m] = running.items[m + 1];
-								running.count--;
-							} else {
-								k++;
-							}
-						}
-						usleep(10000);
-					}
-					/* Mark all pending tasks as failed */
-					for (size_t p = 0; p < pending.count; p++) {
-						ApeTask *pt = ape_task_get(pending.items[p]);
-						if (pt && pt->status == APE_TASK_PENDING) {
-							pt->status = APE_TASK_FAILED;
-						}
-					}
-					if (verbosity >= APE_VERBOSE_NORMAL) {
-						ape_log_failure("%s: %d failed, %d compiled, %d skipped", builder->name, failed, completed,
-								skipped);
-					}
-					return APEBUILD_FALSE;
-				}
 			} else {
 				i++;
 			}
 		}
 
-		/* Start new tasks */
-		while ((int)running.count < max_parallel && pending.count > 0) {
-			/* Find a ready task */
-			ApeTaskHandle ready_handle = APE_INVALID_TASK;
-			size_t ready_idx = 0;
-			for (size_t i = 0; i < pending.count; i++) {
-				if (ape_task_ready(pending.items[i])) {
-					ready_handle = pending.items[i];
-					ready_idx = i;
-					break;
-				}
-			}
-
-			if (ready_handle == APE_INVALID_TASK)
+		/* Start new tasks, most urgent first, while the machine and the jobserver have room for them */
+		ape_throttle_sample(&throttle);
+		int js_starved = APEBUILD_FALSE;
+		while ((failed == 0 || !stop_on_failure) && (int)running.count < max_parallel && sched.heap_count > 0 &&
+		       ape_throttle_allows(&throttle, ape_schedule_peek(&sched), &running)) {
+			if (!ape_jobserver_reserve(&js, running.count)) {
+				js_starved = APEBUILD_TRUE;
 				break;
-
+			}
+			ApeTaskHandle ready_handle = ape_schedule_pop(&sched);
 			ApeTask *task = ape_task_get(ready_handle);
-			if (!task)
-				break;
+			if (!task) {
+				ape_schedule_finish(&sched, ready_handle);
+				continue;
+			}
+
+			/* A dep from outside this build didn't complete, the task stays pending */
+			if (!ape_task_ready(ready_handle))
+				continue;
 
 			/* Check if rebuild needed */
-			if (!ctx->force_rebuild && !ape_task_needs_rebuild(ready_handle)) {
+			if (!ctx->force_rebuild && !ape_task_deps_ran(task) && !ape_task_needs_rebuild(ready_handle)) {
 				task->status = APE_TASK_SKIPPED;
 				skipped++;
 				if (verbosity >= APE_VERBOSE_VERBOSE) {
 					ape_log_debug("Skipping %s (up to date)", task->name);
 				}
-				/* Remove from pending */
-				for (size_t j = ready_idx; j < pending.count - 1; j++)
-					pending.items[j] = pending.items[j + 1];
-				pending.count--;
+				ape_schedule_finish(&sched, ready_handle);
 				continue;
 			}
 
@@ -1556,82 +3874,170 @@ APEBUILD_PRIVATE int ape_builder_run_tasks(ApeBuilderHandle handle, ApeBuildCtx
 				APEBUILD_FREE(dir);
 			}
 
-			/* Log command */
-			if (verbosity >= APE_VERBOSE_VERBOSE) {
-				char *cmd_str = ape_cmd_render_quoted(&task->cmd);
-				ape_log_cmd("%s", cmd_str);
-				APEBUILD_FREE(cmd_str);
-			} else if (verbosity >= APE_VERBOSE_NORMAL) {
-				ape_log_info("%s", task->name);
-			}
+			task->start_ms = ape_build_now_ms();
 
 			/* Dry run */
 			if (ctx && ctx->dry_run) {
+				ape_task_log_start(task, verbosity);
 				task->status = APE_TASK_COMPLETED;
 				task->exit_code = 0;
 				completed++;
-				/* Remove from pending */
-				for (size_t j = ready_idx; j < pending.count - 1; j++)
-					pending.items[j] = pending.items[j + 1];
-				pending.count--;
+				ape_schedule_finish(&sched, ready_handle);
 				continue;
 			}
 
-			/* Start process */
-			task->proc = ape_cmd_start(&task->cmd);
-			if (task->proc == APE_INVALID_HANDLE) {
-				task->status = APE_TASK_FAILED;
-				task->exit_code = -1;
+			/*
+			 * A cacheable compile runs its preprocessor first, in the slot the compile
+			 * takes over if the object isn't in the cache.
+			 */
+			if (cache_dir && task->type == APE_TASK_TYPE_COMPILE) {
+				/* The old output may be a hard link into the cache, don't let the compiler write through it */
+				if (task->output)
+					ape_fs_remove(task->output);
+				APEBUILD_FREE(task->cache_key);
+				task->cache_key = NULL;
+				task->proc = ape_cache_start_preprocess(task, &task->cache_args_hash);
+				task->preprocessing = task->proc != APE_INVALID_HANDLE;
+			}
+
+			if (!task->preprocessing && !ape_task_launch(task, verbosity)) {
 				failed++;
-				if (verbosity >= APE_VERBOSE_NORMAL) {
-					ape_log_failure("%s failed to start", task->name);
-				}
-				if (!ctx || !ctx->keep_going) {
-					/* Wait for running tasks */
-					while (running.count > 0) {
-						for (size_t i = 0; i < running.count;) {
-							ApeTask *t = ape_task_get(running.items[i]);
-							if (t && ape_proc_poll(t->proc)) {
-								ape_proc_handle_release(t->proc);
-								for (size_t j = i; j < running.count - 1; j++)
-									running.items[j] = running.items[j + 1];
-								running.count--;
-							} else {
-								i++;
-							}
-						}
-						usleep(10000);
-					}
-					return APEBUILD_FALSE;
-				}
-			} else {
-				task->status = APE_TASK_RUNNING;
-				running.items[running.count++] = ready_handle;
+				continue;
 			}
+			task->status = APE_TASK_RUNNING;
+			task->slot = ape_build_free_slot(&running);
+			ape_da_append(&running, ready_handle);
+			throttle.started++;
+		}
 
-			/* Remove from pending */
-			for (size_t j = ready_idx; j < pending.count - 1; j++)
-				pending.items[j] = pending.items[j + 1];
-			pending.count--;
+		/* Without keep_going a failure ends the build once the running tasks exited */
+		if (failed > 0 && stop_on_failure) {
+			ape_builder_drain_running(&running);
+			ape_jobserver_stop(&js);
+			ape_build_report_profile(ctx, &sched, start_ms);
+			ape_schedule_fail_pending(&sched);
+			ape_schedule_free(&sched);
+			ape_da_free(&running);
+			if (verbosity >= APE_VERBOSE_NORMAL) {
+				ape_log_failure("%s: %d failed, %d compiled, %d skipped", name, failed, completed, skipped);
+			}
+			return APEBUILD_FALSE;
 		}
 
-		/* Short sleep if tasks are running */
+		/* Sleep until a process exits, then reap it and fill the freed slot right away */
+		ape_jobserver_release(&js, running.count);
 		if (running.count > 0) {
-			usleep(10000);
+			/* A slot freed elsewhere in the build tree shows up as a token to read */
+			int throttled = !js_starved && (int)running.count < max_parallel && sched.heap_count > 0;
+			ape_builder_wait_running(&running, js_starved ? js.read_fd : -1, throttled ? APE_THROTTLE_SAMPLE_MS : -1);
+		}
+	}
+	ape_jobserver_stop(&js);
+	ape_build_report_profile(ctx, &sched, start_ms);
+
+	/* Whatever is left waits on a failed task or on a dependency cycle */
+	int blocked = ape_schedule_fail_pending(&sched);
+	ape_schedule_free(&sched);
+	ape_da_free(&running);
+	if (blocked > 0 && failed == 0) {
+		failed = blocked;
+		if (verbosity >= APE_VERBOSE_NORMAL) {
+			ape_log_failure("%s: %d tasks have unresolvable dependencies", name, blocked);
 		}
 	}
 
 	if (verbosity >= APE_VERBOSE_NORMAL) {
-		if (failed == 0) {
-			ape_log_success("%s: %d compiled, %d skipped", builder->name, completed, skipped);
+		if (failed == 0 && cached > 0) {
+			ape_log_success("%s: %d compiled, %d cached, %d skipped", name, completed, cached, skipped);
+		} else if (failed == 0) {
+			ape_log_success("%s: %d compiled, %d skipped", name, completed, skipped);
 		} else {
-			ape_log_failure("%s: %d failed, %d compiled, %d skipped", builder->name, failed, completed, skipped);
+			ape_log_failure("%s: %d failed, %d compiled, %d skipped", name, failed, completed, skipped);
 		}
 	}
 
 	return failed == 0 ? APEBUILD_TRUE : APEBUILD_FALSE;
 }
 
+APEBUILD_PRIVATE int ape_builder_list_contains(const ApeBuilderHandleList *list, ApeBuilderHandle handle)
+{
+	for (size_t i = 0; i < list->count; i++) {
+		if (list->items[i] == handle)
+			return APEBUILD_TRUE;
+	}
+	return APEBUILD_FALSE;
+}
+
+/* Appends handle and the builders it depends on that still need building, dependencies first */
+APEBUILD_PRIVATE int ape_builder_collect(ApeBuilderHandle handle, ApeBuilderHandleList *order, ApeBuilderHandleList *stack)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	if (!builder)
+		return APEBUILD_FALSE;
+	if (builder->built)
+		return builder->build_failed ? APEBUILD_FALSE : APEBUILD_TRUE;
+	if (ape_builder_list_contains(order, handle))
+		return APEBUILD_TRUE;
+	if (ape_builder_list_contains(stack, handle)) {
+		ape_log_error("Builder dependency cycle through %s", builder->name);
+		return APEBUILD_FALSE;
+	}
+
+	ape_da_append(stack, handle);
+	for (size_t i = 0; i < builder->deps.count; i++) {
+		if (!ape_builder_collect(builder->deps.items[i], order, stack))
+			return APEBUILD_FALSE;
+	}
+	stack->count--;
+	ape_da_append(order, handle);
+	return APEBUILD_TRUE;
+}
+
+/* Compiles, and the header they precompile, only wait on their own builder */
+APEBUILD_PRIVATE int ape_task_is_final(const ApeTask *task)
+{
+	return task->type != APE_TASK_TYPE_COMPILE && task->type != APE_TASK_TYPE_PCH;
+}
+
+/*
+ * Orders the link or archive step of a builder after the outputs of the
+ * builders it depends on. Compiles have no such edge, so they overlap with
+ * the builds of libraries they are linked against later.
+ */
+APEBUILD_PRIVATE void ape_builder_add_builder_edges(ApeBuilderHandle handle, const ApeBuilderHandleList *building)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	for (size_t d = 0; d < builder->deps.count; d++) {
+		ApeBuilder *dep = ape_builder_get(builder->deps.items[d]);
+		if (!dep || !ape_builder_list_contains(building, builder->deps.items[d]))
+			continue;
+
+		/* The dependency's final tasks, or all of them when it only compiles */
+		int has_final = APEBUILD_FALSE;
+		for (size_t j = 0; j < dep->tasks.count; j++) {
+			ApeTask *dep_task = ape_task_get(dep->tasks.items[j]);
+			if (dep_task && ape_task_is_final(dep_task))
+				has_final = APEBUILD_TRUE;
+		}
+
+		for (size_t i = 0; i < builder->tasks.count; i++) {
+			ApeTask *task = ape_task_get(builder->tasks.items[i]);
+			if (!task || !ape_task_is_final(task))
+				continue;
+			for (size_t j = 0; j < dep->tasks.count; j++) {
+				ApeTask *dep_task = ape_task_get(dep->tasks.items[j]);
+				if (dep_task && (!has_final || ape_task_is_final(dep_task)))
+					ape_task_add_dep(builder->tasks.items[i], dep->tasks.items[j]);
+			}
+		}
+	}
+}
+
+/*
+ * Builds handle and every builder it depends on as a single task graph:
+ * tasks of different builders run side by side, limited only by the
+ * edges between them and the number of jobs.
+ */
 APEBUILD_DEF int ape_builder_build(ApeBuilderHandle handle)
 {
 	ApeBuilder *builder = ape_builder_get(handle);
@@ -1641,82 +4047,109 @@ APEBUILD_DEF int ape_builder_build(ApeBuilderHandle handle)
 	if (builder->built)
 		return builder->build_failed ? APEBUILD_FALSE : APEBUILD_TRUE;
 
-	/* We need a context for output_dir - create a temporary one if builder has no toolchain set */
-	ApeBuildCtx temp_ctx;
-	ApeBuildCtx *ctx = &temp_ctx;
-	ape_ctx_init(ctx);
-
-	/* Use builder's toolchain if set, otherwise use context's default */
-	if (ape_toolchain_valid(builder->toolchain)) {
-		ctx->toolchain = builder->toolchain;
+	ApeBuilderHandleList building = { 0 };
+	ApeBuilderHandleList stack = { 0 };
+	int collected = ape_builder_collect(handle, &building, &stack);
+	ape_da_free(&stack);
+	if (!collected) {
+		ape_da_free(&building);
+		builder->built = 1;
+		builder->build_failed = 1;
+		return APEBUILD_FALSE;
 	}
 
-	/* Use builder's output_dir if set */
-	if (builder->output_dir) {
-		APEBUILD_FREE(ctx->output_dir);
-		ctx->output_dir = ape_str_dup(builder->output_dir);
+	ApeBuildCtx ctx;
+	ape_ctx_init(&ctx);
+
+	/* Inside ape_ctx_build(), run with the caller's settings */
+	if (ape_active_ctx) {
+		ctx.parallel_jobs = ape_active_ctx->parallel_jobs;
+		ctx.verbosity = ape_active_ctx->verbosity;
+		ctx.force_rebuild = ape_active_ctx->force_rebuild;
+		ctx.dry_run = ape_active_ctx->dry_run;
+		ctx.keep_going = ape_active_ctx->keep_going;
+		ctx.max_load = ape_active_ctx->max_load;
+		ctx.memory_throttle = ape_active_ctx->memory_throttle;
+		ape_ctx_set_cache_dir(&ctx, ape_active_ctx->cache_dir);
+		ape_ctx_set_trace_file(&ctx, ape_active_ctx->trace_file);
+		ape_ctx_set_compile_commands(&ctx, ape_active_ctx->compile_commands);
 	}
 
-	ApeVerbosity verbosity = ctx->verbosity;
+	ApeVerbosity verbosity = ctx.verbosity;
+	ApeTaskHandleList tasks = { 0 };
+	for (size_t b = 0; b < building.count; b++) {
+		ApeBuilder *current = ape_builder_get(building.items[b]);
+		current->cache_hits = 0;
 
-	/* Build dependencies first */
-	for (size_t i = 0; i < builder->deps.count; i++) {
-		if (!ape_builder_build(builder->deps.items[i])) {
-			builder->built = 1;
-			builder->build_failed = 1;
-			ape_ctx_cleanup(ctx);
-			return APEBUILD_FALSE;
+		/* Inside ape_ctx_build(), builders without a toolchain or output_dir use the context's */
+		if (ape_active_ctx && !ape_toolchain_valid(current->toolchain)) {
+			current->toolchain = ape_active_ctx->toolchain;
+		}
+		if (ape_active_ctx && !current->output_dir && ape_active_ctx->output_dir) {
+			current->output_dir = ape_str_dup(ape_active_ctx->output_dir);
 		}
-	}
 
-	/* Ensure output directory exists */
-	const char *output_dir = builder->output_dir ? builder->output_dir : ctx->output_dir;
-	if (!output_dir)
-		output_dir = "build";
-	ape_fs_mkdir_p(output_dir);
+		/* Ensure output directory exists */
+		ape_fs_mkdir_p(current->output_dir ? current->output_dir : "build");
 
-	/* Generate tasks */
-	ape_builder_generate_tasks(handle);
+		ape_builder_generate_tasks(building.items[b]);
 
-	if (builder->tasks.count == 0) {
+		if (current->tasks.count == 0) {
+			if (verbosity >= APE_VERBOSE_NORMAL) {
+				ape_log_info("Nothing to build for %s", current->name);
+			}
+			continue;
+		}
 		if (verbosity >= APE_VERBOSE_NORMAL) {
-			ape_log_info("Nothing to build for %s", builder->name);
+			ape_log_build("Building %s...", current->name);
 		}
-		builder->built = 1;
-		ape_ctx_cleanup(ctx);
-		return APEBUILD_TRUE;
+		ape_da_append_many(&tasks, current->tasks.items, current->tasks.count);
 	}
-
-	if (verbosity >= APE_VERBOSE_NORMAL) {
-		ape_log_build("Building %s...", builder->name);
+	for (size_t b = 0; b < building.count; b++)
+		ape_builder_add_builder_edges(building.items[b], &building);
+
+	/* Before running anything, so tools see the commands of a build that fails */
+	if (ctx.compile_commands && !ctx.dry_run && !ape_build_update_compile_db(ctx.compile_commands, &tasks))
+		ape_log_warn("Could not write compilation database %s", ctx.compile_commands);
+
+	int result = APEBUILD_TRUE;
+	if (tasks.count > 0) {
+		ape_mtime_memo_begin();
+		result = ape_build_run_tasks(builder->name, &tasks, &ctx);
+		ape_mtime_memo_end();
 	}
 
-	int result = ape_builder_run_tasks(handle, ctx);
-
-	builder->built = 1;
-	builder->build_failed = !result;
+	for (size_t b = 0; b < building.count; b++) {
+		ApeBuilder *current = ape_builder_get(building.items[b]);
+		if (!ctx.dry_run)
+			ape_builder_save_deps(building.items[b]);
+
+		current->built = 1;
+		current->build_failed = 0;
+		for (size_t i = 0; i < current->tasks.count; i++) {
+			ApeTask *task = ape_task_get(current->tasks.items[i]);
+			if (!task || task->status == APE_TASK_FAILED || task->status == APE_TASK_PENDING)
+				current->build_failed = 1;
+		}
+	}
+	builder->build_failed |= !result;
 
-	ape_ctx_cleanup(ctx);
-	return result;
+	ape_da_free(&tasks);
+	ape_da_free(&building);
+	ape_ctx_cleanup(&ctx);
+	return builder->build_failed ? APEBUILD_FALSE : APEBUILD_TRUE;
 }
 
 APEBUILD_DEF int ape_ctx_build(ApeBuildCtx *ctx, ApeBuilderHandle handle)
 {
-	ApeBuilder *builder = ape_builder_get(handle);
-	if (!builder)
+	if (!ape_builder_get(handle))
 		return APEBUILD_FALSE;
 
-	/* Set builder's toolchain from context if not already set */
-	if (!ape_toolchain_valid(builder->toolchain)) {
-		builder->toolchain = ctx->toolchain;
-	}
-
-	/* Set builder's output_dir from context if not already set */
-	if (!builder->output_dir && ctx->output_dir) {
-		builder->output_dir = ape_str_dup(ctx->output_dir);
-	}
-
-	return ape_builder_build(handle);
+	ApeBuildCtx *prev_ctx = ape_active_ctx;
+	ape_active_ctx = ctx;
+	int result = ape_builder_build(handle);
+	ape_active_ctx = prev_ctx;
+	return result;
 }
 
 APEBUILD_DEF int ape_builder_clean(ApeBuilderHandle handle)
@@ -1732,15 +4165,51 @@ APEBUILD_DEF int ape_builder_clean(ApeBuilderHandle handle)
 	}
 	APEBUILD_FREE(output);
 
+	/* Remove the header dependency database */
+	char *deps_path = ape_builder_deps_path(handle);
+	if (deps_path && ape_fs_exists(deps_path)) {
+		ape_fs_remove(deps_path);
+	}
+	APEBUILD_FREE(deps_path);
+
 	/* Remove object files */
 	for (size_t i = 0; i < builder->sources.count; i++) {
 		char *obj = ape_build_obj_path(NULL, handle, builder->sources.items[i]);
 		if (obj && ape_fs_exists(obj)) {
 			ape_fs_remove(obj);
 		}
+		char *depfile = obj ? ape_fs_change_extension(obj, ".d") : NULL;
+		if (depfile && ape_fs_exists(depfile)) {
+			ape_fs_remove(depfile);
+		}
+		APEBUILD_FREE(depfile);
 		APEBUILD_FREE(obj);
 	}
 
+	/* Remove the precompiled header and its stub */
+	char *pch_dir = ape_builder_pch_dir(handle);
+	if (ape_fs_is_dir(pch_dir)) {
+		ape_fs_rmdir_r(pch_dir);
+	}
+	APEBUILD_FREE(pch_dir);
+
+	/* Remove unity files and their objects */
+	for (int b = 0; b < builder->unity_batches; b++) {
+		for (int cxx = 0; cxx <= 1; cxx++) {
+			char *unity_path = ape_builder_unity_path(handle, b, cxx);
+			char *obj = ape_build_obj_path(NULL, handle, unity_path);
+			char *depfile = obj ? ape_fs_change_extension(obj, ".d") : NULL;
+			const char *paths[] = { unity_path, obj, depfile };
+			for (size_t i = 0; i < 3; i++) {
+				if (paths[i] && ape_fs_exists(paths[i]))
+					ape_fs_remove(paths[i]);
+			}
+			APEBUILD_FREE(depfile);
+			APEBUILD_FREE(obj);
+			APEBUILD_FREE(unity_path);
+		}
+	}
+
 	builder->built = 0;
 	builder->build_failed = 0;
 
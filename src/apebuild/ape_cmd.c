@@ -9,59 +9,144 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <spawn.h>
+
+extern char **environ;
+
+/* posix_spawn can change the child's directory itself since glibc 2.29 */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define APE_SPAWN_HAVE_CHDIR 1
+#ifndef __USE_GNU
+/* Only declared with _GNU_SOURCE, which the includer may not have set */
+extern int posix_spawn_file_actions_addchdir_np(posix_spawn_file_actions_t *actions, const char *path);
+#endif
+#else
+#define APE_SPAWN_HAVE_CHDIR 0
+#endif
+
+#if defined(APEBUILD_LINUX)
+#include <sys/syscall.h>
+#endif
 
 /* ============================================================================
  * Process Handle Management
+ *
+ * Handles are a table index plus the entry's generation, which is bumped on
+ * release so a stale handle never refers to a later process.
  * ============================================================================ */
 
-#define APE_MAX_PROCS 256
+#define APE_PROC_INDEX_BITS 16
+#define APE_PROC_INDEX_MASK ((1u << APE_PROC_INDEX_BITS) - 1)
+#define APE_PROC_GENERATION_MASK ((1u << (31 - APE_PROC_INDEX_BITS)) - 1)
 
 typedef struct {
 	pid_t pid;
 	ApeProcStatus status;
 	int exit_code;
 	int signal;
+	uint64_t peak_rss_kb;
+	uint64_t user_us;
+	uint64_t sys_us;
+	int pidfd; /* Readable once the process exits, -1 if unsupported */
+	int out_fd; /* Non-blocking read end of the output pipe, -1 when not captured or at EOF */
+	ApeStrBuilder output;
+	uint32_t generation;
 	int in_use;
 } ApeProcEntry;
 
-APEBUILD_PRIVATE ApeProcEntry ape_proc_table[APE_MAX_PROCS];
-APEBUILD_PRIVATE int ape_proc_table_initialized = 0;
+APEBUILD_PRIVATE struct {
+	size_t capacity;
+	size_t count;
+	ApeProcEntry *items;
+} ape_proc_table = { 0 };
 
-APEBUILD_PRIVATE void ape_proc_table_init(void)
+APEBUILD_PRIVATE struct {
+	size_t capacity;
+	size_t count;
+	uint32_t *items;
+} ape_proc_free_slots = { 0 };
+
+APEBUILD_PRIVATE int ape_proc_pidfd_open(pid_t pid)
 {
-	if (ape_proc_table_initialized)
-		return;
-	for (int i = 0; i < APE_MAX_PROCS; i++) {
-		ape_proc_table[i].in_use = 0;
-	}
-	ape_proc_table_initialized = 1;
+#if defined(APEBUILD_LINUX) && defined(SYS_pidfd_open)
+	/* The fd is close-on-exec and also works for a child that has already exited */
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	return -1;
+#endif
 }
 
 APEBUILD_PRIVATE ApeProcHandle ape_proc_alloc(pid_t pid)
 {
-	ape_proc_table_init();
-	for (int i = 0; i < APE_MAX_PROCS; i++) {
-		if (!ape_proc_table[i].in_use) {
-			ape_proc_table[i].pid = pid;
-			ape_proc_table[i].status = APE_PROC_RUNNING;
-			ape_proc_table[i].exit_code = 0;
-			ape_proc_table[i].signal = 0;
-			ape_proc_table[i].in_use = 1;
-			return (ApeProcHandle)i;
-		}
+	uint32_t index;
+	if (ape_proc_free_slots.count > 0) {
+		index = ape_da_pop(&ape_proc_free_slots);
+	} else {
+		if (ape_proc_table.count > APE_PROC_INDEX_MASK)
+			return APE_INVALID_HANDLE;
+		ApeProcEntry fresh = { 0 };
+		ape_da_append(&ape_proc_table, fresh);
+		index = (uint32_t)(ape_proc_table.count - 1);
 	}
-	return APE_INVALID_HANDLE;
+
+	ApeProcEntry *entry = &ape_proc_table.items[index];
+	entry->pid = pid;
+	entry->status = APE_PROC_RUNNING;
+	entry->exit_code = 0;
+	entry->signal = 0;
+	entry->peak_rss_kb = 0;
+	entry->user_us = 0;
+	entry->sys_us = 0;
+	entry->pidfd = ape_proc_pidfd_open(pid);
+	entry->out_fd = -1;
+	entry->output.count = 0;
+	entry->in_use = 1;
+	return (ApeProcHandle)(((entry->generation & APE_PROC_GENERATION_MASK) << APE_PROC_INDEX_BITS) | index);
 }
 
 APEBUILD_PRIVATE ApeProcEntry *ape_proc_get(ApeProcHandle handle)
 {
-	if (handle < 0 || handle >= APE_MAX_PROCS)
+	if (handle < 0)
+		return NULL;
+	uint32_t index = (uint32_t)handle & APE_PROC_INDEX_MASK;
+	if (index >= ape_proc_table.count)
 		return NULL;
-	if (!ape_proc_table[handle].in_use)
+	ApeProcEntry *entry = &ape_proc_table.items[index];
+	if (!entry->in_use || (entry->generation & APE_PROC_GENERATION_MASK) != ((uint32_t)handle >> APE_PROC_INDEX_BITS))
 		return NULL;
-	return &ape_proc_table[handle];
+	return entry;
+}
+
+/* Records how a reaped process ended and what it, with the children it waited for, used */
+APEBUILD_PRIVATE void ape_proc_set_exited(ApeProcEntry *entry, int status, const struct rusage *usage)
+{
+#if defined(APEBUILD_APPLE)
+	entry->peak_rss_kb = (uint64_t)usage->ru_maxrss / 1024; /* Bytes there, KiB elsewhere */
+#else
+	entry->peak_rss_kb = (uint64_t)usage->ru_maxrss;
+#endif
+	entry->user_us = (uint64_t)usage->ru_utime.tv_sec * 1000000 + (uint64_t)usage->ru_utime.tv_usec;
+	entry->sys_us = (uint64_t)usage->ru_stime.tv_sec * 1000000 + (uint64_t)usage->ru_stime.tv_usec;
+
+	if (WIFEXITED(status)) {
+		entry->status = APE_PROC_COMPLETED;
+		entry->exit_code = WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		entry->status = APE_PROC_SIGNALED;
+		entry->signal = WTERMSIG(status);
+	} else {
+		entry->status = APE_PROC_UNKNOWN;
+	}
+	if (entry->pidfd >= 0) {
+		close(entry->pidfd);
+		entry->pidfd = -1;
+	}
 }
 
 /* ============================================================================
@@ -214,6 +299,169 @@ APEBUILD_DEF void ape_cmd_log(const ApeCmd *cmd, const char *prefix)
 	APEBUILD_FREE(rendered);
 }
 
+/* ============================================================================
+ * Process Launch
+ *
+ * Children are started with posix_spawn, which doesn't copy the parent's page
+ * tables the way fork() does, so spawning stays cheap however large the build
+ * driver's heap gets. fork() remains as a fallback for what posix_spawn can't
+ * express on this platform.
+ * ============================================================================ */
+
+/* Length of the NAME part of a NAME=VALUE entry */
+APEBUILD_PRIVATE size_t ape_cmd_env_name_len(const char *entry)
+{
+	const char *eq = strchr(entry, '=');
+	return eq ? (size_t)(eq - entry) : strlen(entry);
+}
+
+APEBUILD_PRIVATE int ape_cmd_env_overrides(const char *a, const char *b)
+{
+	size_t len = ape_cmd_env_name_len(a);
+	return len == ape_cmd_env_name_len(b) && strncmp(a, b, len) == 0;
+}
+
+/* The parent's environment with the command's variables set on top, as putenv() in the child would leave it */
+APEBUILD_PRIVATE char **ape_cmd_build_envp(const ApeCmd *cmd)
+{
+	size_t environ_count = 0;
+	while (environ && environ[environ_count])
+		environ_count++;
+
+	char **envp = (char **)APEBUILD_MALLOC((environ_count + cmd->env.count + 1) * sizeof(char *));
+	size_t count = 0;
+	for (size_t i = 0; i < environ_count; i++) {
+		int overridden = APEBUILD_FALSE;
+		for (size_t j = 0; j < cmd->env.count && !overridden; j++)
+			overridden = ape_cmd_env_overrides(environ[i], cmd->env.items[j]);
+		if (!overridden)
+			envp[count++] = environ[i];
+	}
+	for (size_t j = 0; j < cmd->env.count; j++) {
+		/* The last setting of a variable wins */
+		int overridden = APEBUILD_FALSE;
+		for (size_t k = j + 1; k < cmd->env.count && !overridden; k++)
+			overridden = ape_cmd_env_overrides(cmd->env.items[j], cmd->env.items[k]);
+		if (!overridden)
+			envp[count++] = cmd->env.items[j];
+	}
+	envp[count] = NULL;
+	return envp;
+}
+
+/* posix_spawnp() searches the parent's PATH, so a command that sets its own needs fork() */
+APEBUILD_PRIVATE int ape_cmd_can_spawn(const ApeCmd *cmd)
+{
+	if (cmd->cwd && !APE_SPAWN_HAVE_CHDIR)
+		return APEBUILD_FALSE;
+	for (size_t i = 0; i < cmd->env.count; i++) {
+		if (ape_cmd_env_overrides(cmd->env.items[i], "PATH="))
+			return APEBUILD_FALSE;
+	}
+	return APEBUILD_TRUE;
+}
+
+APEBUILD_PRIVATE pid_t ape_cmd_fork_exec(const ApeCmd *cmd, char *const *argv, int stdout_fd, int merge_stderr)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+
+	/* Child process, stdout_fd is close-on-exec so only the dup survives */
+	if (stdout_fd >= 0) {
+		dup2(stdout_fd, STDOUT_FILENO);
+		if (merge_stderr)
+			dup2(stdout_fd, STDERR_FILENO);
+	}
+
+	if (cmd->cwd) {
+		if (chdir(cmd->cwd) != 0) {
+			_exit(127);
+		}
+	}
+
+	/* Set environment variables */
+	for (size_t i = 0; i < cmd->env.count; i++) {
+		putenv(cmd->env.items[i]);
+	}
+
+	execvp(argv[0], argv);
+	_exit(127);
+}
+
+/*
+ * Starts cmd, with the close-on-exec stdout_fd as its stdout if it is >= 0,
+ * and as its stderr too when merge_stderr is set. Returns -1 if the process
+ * couldn't be started, which includes the program not being found.
+ */
+APEBUILD_PRIVATE pid_t ape_cmd_launch(const ApeCmd *cmd, int stdout_fd, int merge_stderr)
+{
+	char **argv = (char **)APEBUILD_MALLOC((cmd->count + 1) * sizeof(char *));
+	for (size_t i = 0; i < cmd->count; i++) {
+		argv[i] = (char *)cmd->items[i];
+	}
+	argv[cmd->count] = NULL;
+
+	if (!ape_cmd_can_spawn(cmd)) {
+		pid_t pid = ape_cmd_fork_exec(cmd, argv, stdout_fd, merge_stderr);
+		APEBUILD_FREE(argv);
+		return pid < 0 ? -1 : pid;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (stdout_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+		if (merge_stderr)
+			posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDERR_FILENO);
+	}
+#if APE_SPAWN_HAVE_CHDIR
+	if (cmd->cwd)
+		posix_spawn_file_actions_addchdir_np(&actions, cmd->cwd);
+#endif
+
+	char **envp = cmd->env.count > 0 ? ape_cmd_build_envp(cmd) : environ;
+	pid_t pid;
+	int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	if (envp != environ)
+		APEBUILD_FREE(envp);
+	APEBUILD_FREE(argv);
+	return err == 0 ? pid : -1;
+}
+
+/*
+ * Starts cmd with its stdout, and its stderr when merge_stderr is set, going
+ * to a pipe that is drained into the handle's output buffer while it runs.
+ */
+APEBUILD_PRIVATE ApeProcHandle ape_cmd_start_piped(const ApeCmd *cmd, int merge_stderr)
+{
+	int pipefd[2];
+	if (pipe(pipefd) == -1)
+		return APE_INVALID_HANDLE;
+	/* Other children must not inherit the write end or we'd never see EOF */
+	fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+	fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+
+	pid_t pid = ape_cmd_launch(cmd, pipefd[1], merge_stderr);
+	close(pipefd[1]);
+	if (pid < 0) {
+		close(pipefd[0]);
+		return APE_INVALID_HANDLE;
+	}
+
+	ApeProcHandle handle = ape_proc_alloc(pid);
+	ApeProcEntry *entry = ape_proc_get(handle);
+	if (!entry) {
+		close(pipefd[0]);
+		return APE_INVALID_HANDLE;
+	}
+	entry->out_fd = pipefd[0];
+	return handle;
+}
+
 /* ============================================================================
  * Synchronous Execution
  * ============================================================================ */
@@ -246,71 +494,33 @@ APEBUILD_DEF char *ape_cmd_run_capture(ApeCmd *cmd, int *exit_code)
 	char *rendered = ape_cmd_render(cmd);
 	APEBUILD_FREE(rendered);
 
-	int pipefd[2];
-	if (pipe(pipefd) == -1)
-		return NULL;
-
-	pid_t pid = fork();
-	if (pid < 0) {
-		close(pipefd[0]);
-		close(pipefd[1]);
-		return NULL;
-	}
-
-	if (pid == 0) {
-		/* Child process */
-		close(pipefd[0]);
-		dup2(pipefd[1], STDOUT_FILENO);
-		close(pipefd[1]);
-
-		if (cmd->cwd) {
-			if (chdir(cmd->cwd) != 0) {
-				_exit(127);
-			}
-		}
-
-		/* Set environment variables */
-		for (size_t i = 0; i < cmd->env.count; i++) {
-			putenv(cmd->env.items[i]);
-		}
-
-		/* Build argv with NULL terminator */
-		const char **argv = (const char **)APEBUILD_MALLOC((cmd->count + 1) * sizeof(char *));
-		for (size_t i = 0; i < cmd->count; i++) {
-			argv[i] = cmd->items[i];
-		}
-		argv[cmd->count] = NULL;
-
-		execvp(argv[0], (char *const *)argv);
-		_exit(127);
-	}
-
-	/* Parent process */
-	close(pipefd[1]);
-
-	ApeStrBuilder sb = ape_sb_new();
-	char buf[4096];
-	ssize_t n;
-	while ((n = read(pipefd[0], buf, sizeof(buf))) > 0) {
-		ape_sb_append_strn(&sb, buf, n);
+	/* Only stdout is captured, stderr still goes to ours */
+	ApeProcHandle handle = ape_cmd_start_piped(cmd, APEBUILD_FALSE);
+	if (handle == APE_INVALID_HANDLE) {
+		/* Same result as a child that couldn't exec */
+		if (exit_code)
+			*exit_code = 127;
+		return ape_str_dup("");
 	}
-	close(pipefd[0]);
-
-	int status;
-	waitpid(pid, &status, 0);
 
+	ape_proc_wait(handle);
+	ApeProcResult status = ape_proc_result(handle);
 	if (exit_code) {
-		if (WIFEXITED(status)) {
-			*exit_code = WEXITSTATUS(status);
-		} else if (WIFSIGNALED(status)) {
-			*exit_code = 128 + WTERMSIG(status);
+		if (status.status == APE_PROC_COMPLETED) {
+			*exit_code = status.exit_code;
+		} else if (status.status == APE_PROC_SIGNALED) {
+			*exit_code = 128 + status.signal;
 		} else {
 			*exit_code = -1;
 		}
 	}
 
-	char *result = ape_sb_to_str_dup(&sb);
-	ape_sb_free(&sb);
+	size_t len;
+	const char *output = ape_proc_output(handle, &len);
+	char *result = (char *)APEBUILD_MALLOC(len + 1);
+	memcpy(result, output, len);
+	result[len] = '\0';
+	ape_proc_handle_release(handle);
 	return result;
 }
 
@@ -347,36 +557,55 @@ APEBUILD_DEF ApeProcHandle ape_cmd_start(ApeCmd *cmd)
 	char *rendered = ape_cmd_render(cmd);
 	APEBUILD_FREE(rendered);
 
-	pid_t pid = fork();
+	pid_t pid = ape_cmd_launch(cmd, -1, APEBUILD_FALSE);
 	if (pid < 0) {
 		return APE_INVALID_HANDLE;
 	}
 
-	if (pid == 0) {
-		/* Child process */
-		if (cmd->cwd) {
-			if (chdir(cmd->cwd) != 0) {
-				_exit(127);
-			}
-		}
+	return ape_proc_alloc(pid);
+}
 
-		/* Set environment variables */
-		for (size_t i = 0; i < cmd->env.count; i++) {
-			putenv(cmd->env.items[i]);
-		}
+APEBUILD_DEF ApeProcHandle ape_cmd_start_captured(ApeCmd *cmd)
+{
+	if (cmd->count == 0)
+		return APE_INVALID_HANDLE;
 
-		/* Build argv with NULL terminator */
-		const char **argv = (const char **)APEBUILD_MALLOC((cmd->count + 1) * sizeof(char *));
-		for (size_t i = 0; i < cmd->count; i++) {
-			argv[i] = cmd->items[i];
-		}
-		argv[cmd->count] = NULL;
+	char *rendered = ape_cmd_render(cmd);
+	APEBUILD_FREE(rendered);
+
+	return ape_cmd_start_piped(cmd, APEBUILD_TRUE);
+}
 
-		execvp(argv[0], (char *const *)argv);
-		_exit(127);
+/* Appends whatever the process has written so far, closing the pipe at EOF */
+APEBUILD_PRIVATE void ape_proc_drain(ApeProcEntry *entry)
+{
+	char buf[16384];
+	while (entry->out_fd >= 0) {
+		ssize_t n = read(entry->out_fd, buf, sizeof(buf));
+		if (n > 0) {
+			ape_sb_append_strn(&entry->output, buf, (size_t)n);
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		close(entry->out_fd);
+		entry->out_fd = -1;
 	}
+}
 
-	return ape_proc_alloc(pid);
+APEBUILD_DEF const char *ape_proc_output(ApeProcHandle handle, size_t *len)
+{
+	ApeProcEntry *entry = ape_proc_get(handle);
+	if (!entry || entry->output.count == 0) {
+		if (len)
+			*len = 0;
+		return "";
+	}
+	if (len)
+		*len = entry->output.count;
+	return entry->output.items;
 }
 
 APEBUILD_DEF int ape_proc_poll(ApeProcHandle handle)
@@ -388,8 +617,11 @@ APEBUILD_DEF int ape_proc_poll(ApeProcHandle handle)
 	if (entry->status != APE_PROC_RUNNING)
 		return APEBUILD_TRUE;
 
+	ape_proc_drain(entry);
+
 	int status;
-	pid_t result = waitpid(entry->pid, &status, WNOHANG);
+	struct rusage usage;
+	pid_t result = wait4(entry->pid, &status, WNOHANG, &usage);
 
 	if (result == 0) {
 		/* Still running */
@@ -401,16 +633,9 @@ APEBUILD_DEF int ape_proc_poll(ApeProcHandle handle)
 		return APEBUILD_TRUE;
 	}
 
-	if (WIFEXITED(status)) {
-		entry->status = APE_PROC_COMPLETED;
-		entry->exit_code = WEXITSTATUS(status);
-	} else if (WIFSIGNALED(status)) {
-		entry->status = APE_PROC_SIGNALED;
-		entry->signal = WTERMSIG(status);
-	} else {
-		entry->status = APE_PROC_UNKNOWN;
-	}
-
+	/* Pick up what was written between the first drain and the exit */
+	ape_proc_drain(entry);
+	ape_proc_set_exited(entry, status, &usage);
 	return APEBUILD_TRUE;
 }
 
@@ -423,24 +648,22 @@ APEBUILD_DEF int ape_proc_wait(ApeProcHandle handle)
 	if (entry->status != APE_PROC_RUNNING)
 		return APEBUILD_TRUE;
 
+	if (entry->out_fd >= 0) {
+		/* Keep draining the pipe, a child blocked on a full one would never exit */
+		ape_proc_wait_any(&handle, 1, -1);
+		return entry->status == APE_PROC_COMPLETED && entry->exit_code == 0 ? APEBUILD_TRUE : APEBUILD_FALSE;
+	}
+
 	int status;
-	pid_t result = waitpid(entry->pid, &status, 0);
+	struct rusage usage;
+	pid_t result = wait4(entry->pid, &status, 0, &usage);
 
 	if (result < 0) {
 		entry->status = APE_PROC_FAILED;
 		return APEBUILD_FALSE;
 	}
 
-	if (WIFEXITED(status)) {
-		entry->status = APE_PROC_COMPLETED;
-		entry->exit_code = WEXITSTATUS(status);
-	} else if (WIFSIGNALED(status)) {
-		entry->status = APE_PROC_SIGNALED;
-		entry->signal = WTERMSIG(status);
-	} else {
-		entry->status = APE_PROC_UNKNOWN;
-	}
-
+	ape_proc_set_exited(entry, status, &usage);
 	return entry->exit_code == 0 ? APEBUILD_TRUE : APEBUILD_FALSE;
 }
 
@@ -453,19 +676,122 @@ APEBUILD_DEF int ape_proc_wait_timeout(ApeProcHandle handle, int timeout_ms)
 	if (entry->status != APE_PROC_RUNNING)
 		return APEBUILD_TRUE;
 
-	/* Simple polling implementation */
-	int elapsed = 0;
-	int sleep_interval = 10; /* 10ms */
+	return ape_proc_wait_any(&handle, 1, timeout_ms) == handle ? APEBUILD_TRUE : APEBUILD_FALSE;
+}
 
-	while (elapsed < timeout_ms) {
-		if (ape_proc_poll(handle)) {
-			return APEBUILD_TRUE;
+APEBUILD_PRIVATE int64_t ape_proc_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Blocks until some child exits or has output to drain, or fd (if >= 0) is
+ * readable, without reaping the child, so it can still be collected through
+ * its handle
+ */
+APEBUILD_PRIVATE int ape_proc_block_until_exit(const ApeProcHandle *handles, size_t count, int fd, int timeout_ms)
+{
+	struct pollfd *fds = (struct pollfd *)APEBUILD_MALLOC((2 * count + 1) * sizeof(struct pollfd));
+	nfds_t nfds = 0;
+	int unwatched = APEBUILD_FALSE;
+	if (fd >= 0) {
+		fds[nfds].fd = fd;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
+	}
+	for (size_t i = 0; i < count; i++) {
+		ApeProcEntry *entry = ape_proc_get(handles[i]);
+		if (!entry || entry->status != APE_PROC_RUNNING)
+			continue;
+		if (entry->out_fd >= 0) {
+			fds[nfds].fd = entry->out_fd;
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+		if (entry->pidfd < 0) {
+			unwatched = APEBUILD_TRUE;
+			continue;
 		}
-		usleep(sleep_interval * 1000);
-		elapsed += sleep_interval;
+		fds[nfds].fd = entry->pidfd;
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		nfds++;
 	}
 
-	return APEBUILD_FALSE; /* Timeout */
+	if (nfds > 0 && unwatched) {
+		/* Some exits can't be waited on alongside the pipes, so check back soon */
+		if (timeout_ms < 0 || timeout_ms > 10)
+			timeout_ms = 10;
+	} else if (unwatched) {
+		nfds = 0;
+	}
+
+	if (nfds > 0) {
+		int ok = poll(fds, nfds, timeout_ms) >= 0 || errno == EINTR;
+		APEBUILD_FREE(fds);
+		return ok;
+	}
+	APEBUILD_FREE(fds);
+
+	if (timeout_ms < 0) {
+		siginfo_t info;
+		memset(&info, 0, sizeof(info));
+		if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0)
+			return errno == EINTR;
+		for (size_t i = 0; i < count; i++) {
+			ApeProcEntry *entry = ape_proc_get(handles[i]);
+			if (entry && entry->pid == info.si_pid)
+				return APEBUILD_TRUE;
+		}
+		/* Someone else's zombie stays waitable, don't spin on it */
+		usleep(1000);
+		return APEBUILD_TRUE;
+	}
+
+	/* No pidfds and a deadline: fall back to short naps */
+	usleep(1000);
+	return APEBUILD_TRUE;
+}
+
+APEBUILD_DEF ApeProcHandle ape_proc_wait_any(const ApeProcHandle *handles, size_t count, int timeout_ms)
+{
+	return ape_proc_wait_any_fd(handles, count, -1, timeout_ms);
+}
+
+APEBUILD_DEF ApeProcHandle ape_proc_wait_any_fd(const ApeProcHandle *handles, size_t count, int fd, int timeout_ms)
+{
+	int64_t deadline = timeout_ms >= 0 ? ape_proc_now_ms() + timeout_ms : -1;
+
+	while (1) {
+		int any_valid = APEBUILD_FALSE;
+		for (size_t i = 0; i < count; i++) {
+			if (!ape_proc_get(handles[i]))
+				continue;
+			any_valid = APEBUILD_TRUE;
+			if (ape_proc_poll(handles[i]))
+				return handles[i];
+		}
+		if (!any_valid)
+			return APE_INVALID_HANDLE;
+		if (fd >= 0) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+			if (poll(&pfd, 1, 0) > 0)
+				return APE_INVALID_HANDLE;
+		}
+
+		int remaining = -1;
+		if (deadline >= 0) {
+			remaining = (int)(deadline - ape_proc_now_ms());
+			if (remaining <= 0)
+				return APE_INVALID_HANDLE;
+		}
+		if (!ape_proc_block_until_exit(handles, count, fd, remaining))
+			return APE_INVALID_HANDLE;
+	}
 }
 
 APEBUILD_DEF ApeProcStatus ape_proc_status(ApeProcHandle handle)
@@ -484,7 +810,7 @@ APEBUILD_DEF ApeProcStatus ape_proc_status(ApeProcHandle handle)
 
 APEBUILD_DEF ApeProcResult ape_proc_result(ApeProcHandle handle)
 {
-	ApeProcResult result = { .status = APE_PROC_UNKNOWN, .exit_code = -1, .signal = 0 };
+	ApeProcResult result = { .status = APE_PROC_UNKNOWN, .exit_code = -1, .signal = 0, .peak_rss_kb = 0, .user_us = 0, .sys_us = 0 };
 
 	ApeProcEntry *entry = ape_proc_get(handle);
 	if (!entry)
@@ -493,9 +819,53 @@ APEBUILD_DEF ApeProcResult ape_proc_result(ApeProcHandle handle)
 	result.status = entry->status;
 	result.exit_code = entry->exit_code;
 	result.signal = entry->signal;
+	result.peak_rss_kb = entry->peak_rss_kb;
+	result.user_us = entry->user_us;
+	result.sys_us = entry->sys_us;
 	return result;
 }
 
+/* Resident memory of pid and its descendants in KiB, as far as /proc lists them */
+APEBUILD_PRIVATE uint64_t ape_proc_tree_rss_kb(pid_t pid, int depth)
+{
+	char path[64];
+	uint64_t total = 0;
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *fp = fopen(path, "r");
+	if (fp) {
+		char line[256];
+		unsigned long long kb = 0;
+		while (fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "VmRSS: %llu kB", &kb) == 1) {
+				total += kb;
+				break;
+			}
+		}
+		fclose(fp);
+	}
+
+	/* A compiler driver is small, the memory is in the cc1 it waits for */
+	if (depth >= 8)
+		return total;
+	snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, (int)pid);
+	fp = fopen(path, "r");
+	if (fp) {
+		int child;
+		while (fscanf(fp, "%d", &child) == 1)
+			total += ape_proc_tree_rss_kb((pid_t)child, depth + 1);
+		fclose(fp);
+	}
+	return total;
+}
+
+APEBUILD_DEF uint64_t ape_proc_rss_kb(ApeProcHandle handle)
+{
+	ApeProcEntry *entry = ape_proc_get(handle);
+	if (!entry || entry->status != APE_PROC_RUNNING)
+		return 0;
+	return ape_proc_tree_rss_kb(entry->pid, 0);
+}
+
 APEBUILD_DEF int ape_proc_kill(ApeProcHandle handle)
 {
 	ApeProcEntry *entry = ape_proc_get(handle);
@@ -507,8 +877,7 @@ APEBUILD_DEF int ape_proc_kill(ApeProcHandle handle)
 
 	if (kill(entry->pid, SIGTERM) == 0) {
 		/* Give it a moment to terminate gracefully */
-		usleep(100000); /* 100ms */
-		if (ape_proc_poll(handle)) {
+		if (ape_proc_wait_timeout(handle, 100)) {
 			return APEBUILD_TRUE;
 		}
 		/* Force kill */
@@ -529,7 +898,16 @@ APEBUILD_DEF void ape_proc_handle_release(ApeProcHandle handle)
 {
 	ApeProcEntry *entry = ape_proc_get(handle);
 	if (entry) {
+		if (entry->pidfd >= 0)
+			close(entry->pidfd);
+		entry->pidfd = -1;
+		if (entry->out_fd >= 0)
+			close(entry->out_fd);
+		entry->out_fd = -1;
+		ape_sb_free(&entry->output);
 		entry->in_use = 0;
+		entry->generation++;
+		ape_da_append(&ape_proc_free_slots, (uint32_t)(entry - ape_proc_table.items));
 	}
 }
 
@@ -577,20 +955,23 @@ APEBUILD_DEF ApeProcHandle ape_pool_wait_any(ApeProcPool *pool)
 	if (pool->count == 0)
 		return APE_INVALID_HANDLE;
 
-	while (1) {
-		for (int i = 0; i < pool->count; i++) {
-			if (ape_proc_poll(pool->handles[i])) {
-				ApeProcHandle handle = pool->handles[i];
-				/* Remove from pool */
-				for (int j = i; j < pool->count - 1; j++) {
-					pool->handles[j] = pool->handles[j + 1];
-				}
-				pool->count--;
-				return handle;
+	ApeProcHandle handle = ape_proc_wait_any(pool->handles, (size_t)pool->count, -1);
+	if (handle == APE_INVALID_HANDLE) {
+		/* None of the handles can finish anymore */
+		pool->count = 0;
+		return handle;
+	}
+	for (int i = 0; i < pool->count; i++) {
+		if (pool->handles[i] == handle) {
+			/* Remove from pool */
+			for (int j = i; j < pool->count - 1; j++) {
+				pool->handles[j] = pool->handles[j + 1];
 			}
+			pool->count--;
+			break;
 		}
-		usleep(10000); /* 10ms */
 	}
+	return handle;
 }
 
 APEBUILD_DEF int ape_pool_wait_all(ApeProcPool *pool)
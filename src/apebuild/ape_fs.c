@@ -13,6 +13,14 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#if defined(APEBUILD_LINUX)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 
 /* Directory handle structure */
 struct ApeDir {
@@ -102,6 +110,42 @@ APEBUILD_DEF int ape_fs_copy_file(const char *src, const char *dst)
 	return result;
 }
 
+/* Shares the data blocks of src with dst on copy-on-write filesystems (btrfs, xfs) */
+APEBUILD_PRIVATE int ape_fs_reflink(const char *src, const char *dst)
+{
+#if defined(APEBUILD_LINUX) && defined(FICLONE)
+	int in = open(src, O_RDONLY);
+	if (in < 0)
+		return APEBUILD_FALSE;
+	int out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out < 0) {
+		close(in);
+		return APEBUILD_FALSE;
+	}
+	int ok = ioctl(out, FICLONE, in) == 0;
+	close(in);
+	close(out);
+	if (!ok)
+		unlink(dst);
+	return ok ? APEBUILD_TRUE : APEBUILD_FALSE;
+#else
+	(void)src;
+	(void)dst;
+	return APEBUILD_FALSE;
+#endif
+}
+
+APEBUILD_DEF int ape_fs_clone_file(const char *src, const char *dst)
+{
+	/* Replace rather than write through dst, it may be a hard link to something else */
+	unlink(dst);
+	if (ape_fs_reflink(src, dst))
+		return APEBUILD_TRUE;
+	if (link(src, dst) == 0)
+		return APEBUILD_TRUE;
+	return ape_fs_copy_file(src, dst);
+}
+
 APEBUILD_DEF int ape_fs_rename(const char *oldpath, const char *newpath)
 {
 	return rename(oldpath, newpath) == 0 ? APEBUILD_TRUE : APEBUILD_FALSE;
@@ -213,6 +257,21 @@ APEBUILD_DEF ApeDir *ape_fs_opendir(const char *path)
 	return ape_dir;
 }
 
+/* Fills in the entry's type from d_type, only falling back to lstat() when the filesystem doesn't report it */
+APEBUILD_PRIVATE void ape_fs_entry_type(int dir_fd, const char *name, unsigned char d_type, ApeDirEntry *out)
+{
+	out->is_dir = d_type == DT_DIR;
+	out->is_file = d_type == DT_REG;
+	out->is_symlink = d_type == DT_LNK;
+
+	struct stat st;
+	if (d_type == DT_UNKNOWN && fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		out->is_dir = S_ISDIR(st.st_mode) ? 1 : 0;
+		out->is_file = S_ISREG(st.st_mode) ? 1 : 0;
+		out->is_symlink = S_ISLNK(st.st_mode) ? 1 : 0;
+	}
+}
+
 APEBUILD_DEF ApeDirEntry *ape_fs_readdir(ApeDir *dir)
 {
 	if (!dir || !dir->dir)
@@ -227,21 +286,7 @@ APEBUILD_DEF ApeDirEntry *ape_fs_readdir(ApeDir *dir)
 
 		ApeDirEntry *result = (ApeDirEntry *)APEBUILD_MALLOC(sizeof(ApeDirEntry));
 		result->name = ape_str_dup(entry->d_name);
-
-		/* Get file type */
-		char *fullpath = ape_fs_join(dir->path, entry->d_name);
-		struct stat st;
-		if (lstat(fullpath, &st) == 0) {
-			result->is_dir = S_ISDIR(st.st_mode) ? 1 : 0;
-			result->is_file = S_ISREG(st.st_mode) ? 1 : 0;
-			result->is_symlink = S_ISLNK(st.st_mode) ? 1 : 0;
-		} else {
-			result->is_dir = 0;
-			result->is_file = 0;
-			result->is_symlink = 0;
-		}
-		APEBUILD_FREE(fullpath);
-
+		ape_fs_entry_type(dirfd(dir->dir), entry->d_name, entry->d_type, result);
 		return result;
 	}
 
@@ -282,59 +327,375 @@ APEBUILD_DEF int ape_fs_iterdir(const char *path, ApeDirCallback callback, void
 	return APEBUILD_TRUE;
 }
 
-APEBUILD_PRIVATE int ape_fs_iterdir_r_helper(const char *path, ApeDirCallback callback, void *userdata)
+/* ============================================================================
+ * Parallel Directory Walk
+ *
+ * ape_fs_iterdir_r() and ape_fs_glob() read the tree with a few threads
+ * before calling back. Each thread has a deque of directories still to read:
+ * it pushes the subdirectories it finds onto its own and pops from the back,
+ * staying depth first, and takes from the front of another thread's deque
+ * when its own runs dry. Directories are opened with openat() relative to the
+ * root and read with getdents64(), whose d_type saves a stat per entry.
+ *
+ * Callbacks still run on the calling thread, once the whole tree has been
+ * read, in the order a depth-first walk would visit it. Threads allocate
+ * through APEBUILD_MALLOC, which has to be thread-safe (malloc is).
+ * ============================================================================ */
+
+#define APE_WALK_MAX_THREADS 8
+
+typedef struct ApeWalkDir ApeWalkDir;
+
+typedef struct {
+	ApeDirEntry entry;
+	ApeWalkDir *child; /* Set when the walk descended into it */
+} ApeWalkEntry;
+
+struct ApeWalkDir {
+	char *rel; /* Path from the root, "." for the root itself */
+	size_t depth;
+	size_t capacity;
+	size_t count;
+	ApeWalkEntry *items;
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	size_t capacity;
+	size_t head; /* Other threads take from here */
+	size_t count;
+	ApeWalkDir **items;
+} ApeWalkQueue;
+
+/* Decides whether an entry is kept, a directory that isn't is not descended */
+typedef int (*ApeWalkFilter)(size_t depth, const char *name, int is_dir, void *userdata);
+
+typedef struct {
+	int root_fd;
+	size_t max_depth; /* Directories at this depth are listed but not read */
+	ApeWalkFilter filter;
+	void *userdata;
+	ApeWalkQueue queues[APE_WALK_MAX_THREADS];
+	size_t queue_count;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	size_t pending; /* Directories queued or being read */
+	size_t idle;
+} ApeWalk;
+
+typedef struct {
+	ApeWalk *walk;
+	size_t index;
+} ApeWalkWorker;
+
+#if defined(APEBUILD_LINUX)
+struct ape_linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+APEBUILD_PRIVATE void ape_walk_push(ApeWalkQueue *queue, ApeWalkDir *dir)
 {
-	ApeDir *dir = ape_fs_opendir(path);
-	if (!dir)
-		return APEBUILD_FALSE;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->head + queue->count == queue->capacity) {
+		if (queue->head > 0) {
+			memmove(queue->items, queue->items + queue->head, queue->count * sizeof(ApeWalkDir *));
+			queue->head = 0;
+		} else {
+			queue->capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+			queue->items = (ApeWalkDir **)APEBUILD_REALLOC(queue->items, queue->capacity * sizeof(ApeWalkDir *));
+		}
+	}
+	queue->items[queue->head + queue->count++] = dir;
+	pthread_mutex_unlock(&queue->lock);
+}
 
-	ApeDirEntry *entry;
-	while ((entry = ape_fs_readdir(dir)) != NULL) {
-		callback(path, entry, userdata);
+APEBUILD_PRIVATE ApeWalkDir *ape_walk_take(ApeWalkQueue *queue, int steal)
+{
+	ApeWalkDir *dir = NULL;
+	pthread_mutex_lock(&queue->lock);
+	if (queue->count > 0) {
+		dir = steal ? queue->items[queue->head++] : queue->items[queue->head + queue->count - 1];
+		queue->count--;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return dir;
+}
 
-		if (entry->is_dir && !entry->is_symlink) {
-			char *subpath = ape_fs_join(path, entry->name);
-			ape_fs_iterdir_r_helper(subpath, callback, userdata);
-			APEBUILD_FREE(subpath);
+/* Records one entry of dir, queueing it on queue if it is a directory to read */
+APEBUILD_PRIVATE size_t ape_walk_add(ApeWalk *walk, ApeWalkQueue *queue, ApeWalkDir *dir, int fd, const char *name, unsigned char d_type)
+{
+	if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		return 0;
+
+	ApeWalkEntry item = { 0 };
+	ape_fs_entry_type(fd, name, d_type, &item.entry);
+	if (walk->filter && !walk->filter(dir->depth, name, item.entry.is_dir, walk->userdata))
+		return 0;
+
+	item.entry.name = ape_str_dup(name);
+	if (item.entry.is_dir && !item.entry.is_symlink && dir->depth + 1 < walk->max_depth) {
+		item.child = (ApeWalkDir *)APEBUILD_MALLOC(sizeof(ApeWalkDir));
+		memset(item.child, 0, sizeof(ApeWalkDir));
+		item.child->rel = strcmp(dir->rel, ".") == 0 ? ape_str_dup(name) : ape_fs_join(dir->rel, name);
+		item.child->depth = dir->depth + 1;
+	}
+
+	if (dir->count == dir->capacity) {
+		dir->capacity = dir->capacity == 0 ? 16 : dir->capacity * 2;
+		dir->items = (ApeWalkEntry *)APEBUILD_REALLOC(dir->items, dir->capacity * sizeof(ApeWalkEntry));
+	}
+	dir->items[dir->count++] = item;
+
+	if (!item.child)
+		return 0;
+	ape_walk_push(queue, item.child);
+	return 1;
+}
+
+/* Reads dir's entries, returning how many subdirectories were queued */
+APEBUILD_PRIVATE size_t ape_walk_read(ApeWalk *walk, ApeWalkQueue *queue, ApeWalkDir *dir)
+{
+	int fd = openat(walk->root_fd, dir->rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+
+	size_t queued = 0;
+#if defined(APEBUILD_LINUX)
+	uint64_t buf[4096];
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (long off = 0; off < n;) {
+			const struct ape_linux_dirent64 *d = (const struct ape_linux_dirent64 *)((const char *)buf + off);
+			queued += ape_walk_add(walk, queue, dir, fd, d->d_name, d->d_type);
+			off += d->d_reclen;
+		}
+	}
+	close(fd);
+#else
+	DIR *d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return 0;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		queued += ape_walk_add(walk, queue, dir, fd, entry->d_name, entry->d_type);
+	}
+	closedir(d);
+#endif
+	return queued;
+}
+
+APEBUILD_PRIVATE void *ape_walk_worker(void *arg)
+{
+	ApeWalkWorker *worker = (ApeWalkWorker *)arg;
+	ApeWalk *walk = worker->walk;
+	ApeWalkQueue *own = &walk->queues[worker->index];
+
+	for (;;) {
+		ApeWalkDir *dir = ape_walk_take(own, APEBUILD_FALSE);
+		for (size_t i = 1; !dir && i < walk->queue_count; i++) {
+			dir = ape_walk_take(&walk->queues[(worker->index + i) % walk->queue_count], APEBUILD_TRUE);
 		}
 
-		ape_fs_direntry_free(entry);
+		if (dir) {
+			size_t queued = ape_walk_read(walk, own, dir);
+			pthread_mutex_lock(&walk->lock);
+			walk->pending += queued;
+			walk->pending--;
+			if ((queued > 0 && walk->idle > 0) || walk->pending == 0)
+				pthread_cond_broadcast(&walk->wake);
+			pthread_mutex_unlock(&walk->lock);
+			continue;
+		}
+
+		/* Nothing to take: done once no directory is left anywhere, otherwise wait for more */
+		pthread_mutex_lock(&walk->lock);
+		int done = walk->pending == 0;
+		if (!done) {
+			walk->idle++;
+			pthread_cond_wait(&walk->wake, &walk->lock);
+			walk->idle--;
+		}
+		pthread_mutex_unlock(&walk->lock);
+		if (done)
+			break;
 	}
+	return NULL;
+}
 
-	ape_fs_closedir(dir);
-	return APEBUILD_TRUE;
+APEBUILD_PRIVATE void ape_walk_free(ApeWalkDir *dir)
+{
+	for (size_t i = 0; i < dir->count; i++) {
+		APEBUILD_FREE(dir->items[i].entry.name);
+		if (dir->items[i].child)
+			ape_walk_free(dir->items[i].child);
+	}
+	APEBUILD_FREE(dir->items);
+	APEBUILD_FREE(dir->rel);
+	APEBUILD_FREE(dir);
+}
+
+/* Reads the tree under path, NULL if path can't be opened as a directory */
+APEBUILD_PRIVATE ApeWalkDir *ape_walk(const char *path, size_t max_depth, ApeWalkFilter filter, void *userdata)
+{
+	ApeWalk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.root_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (walk.root_fd < 0)
+		return NULL;
+	walk.max_depth = max_depth;
+	walk.filter = filter;
+	walk.userdata = userdata;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	walk.queue_count = cpus < 1 ? 1 : (cpus > APE_WALK_MAX_THREADS ? APE_WALK_MAX_THREADS : (size_t)cpus);
+	pthread_mutex_init(&walk.lock, NULL);
+	pthread_cond_init(&walk.wake, NULL);
+	for (size_t i = 0; i < walk.queue_count; i++) {
+		pthread_mutex_init(&walk.queues[i].lock, NULL);
+	}
+
+	ApeWalkDir *root = (ApeWalkDir *)APEBUILD_MALLOC(sizeof(ApeWalkDir));
+	memset(root, 0, sizeof(ApeWalkDir));
+	root->rel = ape_str_dup(".");
+	walk.pending = 1;
+	ape_walk_push(&walk.queues[0], root);
+
+	/* The calling thread is worker 0, a thread that fails to start leaves its share to the others */
+	ApeWalkWorker workers[APE_WALK_MAX_THREADS];
+	pthread_t threads[APE_WALK_MAX_THREADS];
+	int started[APE_WALK_MAX_THREADS] = { 0 };
+	for (size_t i = 0; i < walk.queue_count; i++) {
+		workers[i].walk = &walk;
+		workers[i].index = i;
+		if (i > 0)
+			started[i] = pthread_create(&threads[i], NULL, ape_walk_worker, &workers[i]) == 0;
+	}
+	ape_walk_worker(&workers[0]);
+	for (size_t i = 1; i < walk.queue_count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	for (size_t i = 0; i < walk.queue_count; i++) {
+		pthread_mutex_destroy(&walk.queues[i].lock);
+		APEBUILD_FREE(walk.queues[i].items);
+	}
+	pthread_cond_destroy(&walk.wake);
+	pthread_mutex_destroy(&walk.lock);
+	close(walk.root_fd);
+	return root;
+}
+
+/* Calls back for the walked entries in depth-first order, only for those at depth if it isn't SIZE_MAX */
+APEBUILD_PRIVATE void ape_walk_visit(const ApeWalkDir *dir, const char *path, size_t depth, ApeDirCallback callback, void *userdata)
+{
+	for (size_t i = 0; i < dir->count; i++) {
+		const ApeWalkEntry *item = &dir->items[i];
+		if (depth == SIZE_MAX || depth == dir->depth)
+			callback(path, &item->entry, userdata);
+		if (item->child) {
+			char *subpath = ape_fs_join(path, item->entry.name);
+			ape_walk_visit(item->child, subpath, depth, callback, userdata);
+			APEBUILD_FREE(subpath);
+		}
+	}
 }
 
 APEBUILD_DEF int ape_fs_iterdir_r(const char *path, ApeDirCallback callback, void *userdata)
 {
-	return ape_fs_iterdir_r_helper(path, callback, userdata);
+	ApeWalkDir *root = ape_walk(path, SIZE_MAX, NULL, NULL);
+	if (!root)
+		return APEBUILD_FALSE;
+	ape_walk_visit(root, path, SIZE_MAX, callback, userdata);
+	ape_walk_free(root);
+	return APEBUILD_TRUE;
 }
 
+/* ============================================================================
+ * Glob
+ *
+ * A pattern is split once into the directory before its first wildcard and
+ * one fnmatch() pattern per path component below it. The walk drops entries
+ * whose component doesn't match as it reads them, so subtrees that can't
+ * match are never read, and doesn't go deeper than the pattern does.
+ * ============================================================================ */
+
 typedef struct {
-	const char *pattern;
-	const char *base_path;
-	ApeStrList *results;
-} GlobContext;
+	char *base;
+	ApeStrList segments;
+	int *literal; /* Segment has no wildcard, compared with strcmp() */
+} ApeGlob;
 
-APEBUILD_PRIVATE void ape_fs_glob_callback(const char *path, const ApeDirEntry *entry, void *userdata)
+APEBUILD_PRIVATE int ape_glob_has_wildcard(const char *str)
 {
-	GlobContext *ctx = (GlobContext *)userdata;
-	char *fullpath = ape_fs_join(path, entry->name);
+	return strpbrk(str, "*?[") != NULL;
+}
 
-	/* Get path relative to base for matching */
-	const char *rel_path = fullpath;
-	size_t base_len = strlen(ctx->base_path);
-	if (strncmp(fullpath, ctx->base_path, base_len) == 0) {
-		rel_path = fullpath + base_len;
-		if (*rel_path == '/')
-			rel_path++;
-	}
+/* Compiles pattern, FALSE if it has no wildcard */
+APEBUILD_PRIVATE int ape_glob_compile(ApeGlob *glob, const char *pattern)
+{
+	memset(glob, 0, sizeof(ApeGlob));
+	const char *wildcard = strpbrk(pattern, "*?[");
+	if (!wildcard)
+		return APEBUILD_FALSE;
 
-	if (fnmatch(ctx->pattern, rel_path, FNM_PATHNAME) == 0) {
-		ape_sl_append(ctx->results, fullpath);
+	/* Base directory: everything before the last slash before the wildcard */
+	const char *rest = pattern;
+	const char *last_slash = wildcard;
+	while (last_slash > pattern && *last_slash != '/')
+		last_slash--;
+	if (*last_slash == '/') {
+		glob->base = last_slash == pattern ? ape_str_dup("/") : ape_str_ndup(pattern, (size_t)(last_slash - pattern));
+		rest = last_slash + 1;
 	} else {
-		APEBUILD_FREE(fullpath);
+		glob->base = ape_str_dup(".");
 	}
+
+	ApeStrList parts = ape_str_split(rest, "/");
+	glob->segments = ape_sl_new();
+	for (size_t i = 0; i < parts.count; i++) {
+		if (*parts.items[i] != '\0')
+			ape_sl_append_dup(&glob->segments, parts.items[i]);
+	}
+	ape_sl_free(&parts);
+
+	glob->literal = (int *)APEBUILD_MALLOC((glob->segments.count + 1) * sizeof(int));
+	for (size_t i = 0; i < glob->segments.count; i++) {
+		glob->literal[i] = !ape_glob_has_wildcard(glob->segments.items[i]);
+	}
+	return APEBUILD_TRUE;
+}
+
+APEBUILD_PRIVATE void ape_glob_free(ApeGlob *glob)
+{
+	APEBUILD_FREE(glob->base);
+	ape_sl_free(&glob->segments);
+	APEBUILD_FREE(glob->literal);
+}
+
+/* Keeps an entry if its name matches the component at its depth, and leads somewhere unless it's the last */
+APEBUILD_PRIVATE int ape_glob_filter(size_t depth, const char *name, int is_dir, void *userdata)
+{
+	const ApeGlob *glob = (const ApeGlob *)userdata;
+	if (depth >= glob->segments.count)
+		return APEBUILD_FALSE;
+	if (depth + 1 < glob->segments.count && !is_dir)
+		return APEBUILD_FALSE;
+	const char *segment = glob->segments.items[depth];
+	return glob->literal[depth] ? strcmp(segment, name) == 0 : fnmatch(segment, name, 0) == 0;
+}
+
+APEBUILD_PRIVATE void ape_fs_glob_callback(const char *path, const ApeDirEntry *entry, void *userdata)
+{
+	ApeStrList *results = (ApeStrList *)userdata;
+	ape_sl_append(results, ape_fs_join(path, entry->name));
 }
 
 APEBUILD_DEF ApeStrList ape_fs_glob(const char *pattern)
@@ -343,32 +704,21 @@ APEBUILD_DEF ApeStrList ape_fs_glob(const char *pattern)
 	if (!pattern)
 		return results;
 
-	/* Find base directory (everything before first wildcard) */
-	char *base_path = ape_str_dup(pattern);
-	char *wildcard = strpbrk(base_path, "*?[");
-	if (wildcard) {
-		/* Find last slash before wildcard */
-		char *last_slash = wildcard;
-		while (last_slash > base_path && *last_slash != '/')
-			last_slash--;
-		if (*last_slash == '/') {
-			*last_slash = '\0';
-		} else {
-			APEBUILD_FREE(base_path);
-			base_path = ape_str_dup(".");
-		}
-	}
-
-	if (!ape_fs_is_dir(base_path)) {
-		APEBUILD_FREE(base_path);
+	/* Without a wildcard the pattern matches just itself */
+	ApeGlob glob;
+	if (!ape_glob_compile(&glob, pattern)) {
+		if (ape_fs_exists(pattern))
+			ape_sl_append_dup(&results, pattern);
 		return results;
 	}
 
-	GlobContext ctx = { .pattern = pattern, .base_path = base_path, .results = &results };
-
-	ape_fs_iterdir_r(base_path, ape_fs_glob_callback, &ctx);
+	ApeWalkDir *root = glob.segments.count > 0 ? ape_walk(glob.base, glob.segments.count, ape_glob_filter, &glob) : NULL;
+	if (root) {
+		ape_walk_visit(root, glob.base, glob.segments.count - 1, ape_fs_glob_callback, &results);
+		ape_walk_free(root);
+	}
 
-	APEBUILD_FREE(base_path);
+	ape_glob_free(&glob);
 	return results;
 }
 
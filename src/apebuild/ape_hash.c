@@ -0,0 +1,205 @@
+/*
+ * ape_hash.c - Hash module implementation
+ *
+ * xxHash64 over buffers, strings and files. It is fast and non-cryptographic:
+ * good for detecting content changes, not for anything adversarial.
+ */
+
+#include "apebuild_internal.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#define APE_XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define APE_XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define APE_XXH_PRIME3 0x165667B19E3779F9ULL
+#define APE_XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define APE_XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+/* ============================================================================
+ * xxHash64 Primitives
+ * ============================================================================ */
+
+APEBUILD_PRIVATE uint64_t ape_hash_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* Little-endian loads, independent of the host byte order */
+APEBUILD_PRIVATE uint64_t ape_hash_read64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+	       (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+APEBUILD_PRIVATE uint32_t ape_hash_read32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+APEBUILD_PRIVATE uint64_t ape_hash_round(uint64_t acc, uint64_t input)
+{
+	acc += input * APE_XXH_PRIME2;
+	acc = ape_hash_rotl(acc, 31);
+	return acc * APE_XXH_PRIME1;
+}
+
+APEBUILD_PRIVATE uint64_t ape_hash_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= ape_hash_round(0, val);
+	return acc * APE_XXH_PRIME1 + APE_XXH_PRIME4;
+}
+
+/* Consumes one 32 byte stripe */
+APEBUILD_PRIVATE void ape_hash_stripe(uint64_t *v, const unsigned char *p)
+{
+	v[0] = ape_hash_round(v[0], ape_hash_read64(p));
+	v[1] = ape_hash_round(v[1], ape_hash_read64(p + 8));
+	v[2] = ape_hash_round(v[2], ape_hash_read64(p + 16));
+	v[3] = ape_hash_round(v[3], ape_hash_read64(p + 24));
+}
+
+/* ============================================================================
+ * Incremental Hashing
+ * ============================================================================ */
+
+APEBUILD_DEF void ape_hash_init(ApeHashContext *ctx)
+{
+	memset(ctx, 0, sizeof(ApeHashContext));
+	ctx->v[0] = APE_XXH_PRIME1 + APE_XXH_PRIME2;
+	ctx->v[1] = APE_XXH_PRIME2;
+	ctx->v[2] = 0;
+	ctx->v[3] = 0 - APE_XXH_PRIME1;
+}
+
+APEBUILD_DEF void ape_hash_update(ApeHashContext *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+	ctx->total_len += len;
+
+	if (ctx->buf_len + len < sizeof(ctx->buf)) {
+		memcpy(ctx->buf + ctx->buf_len, p, len);
+		ctx->buf_len += len;
+		return;
+	}
+
+	if (ctx->buf_len > 0) {
+		size_t fill = sizeof(ctx->buf) - ctx->buf_len;
+		memcpy(ctx->buf + ctx->buf_len, p, fill);
+		ape_hash_stripe(ctx->v, ctx->buf);
+		p += fill;
+		ctx->buf_len = 0;
+	}
+
+	while (end - p >= 32) {
+		ape_hash_stripe(ctx->v, p);
+		p += 32;
+	}
+
+	ctx->buf_len = (size_t)(end - p);
+	memcpy(ctx->buf, p, ctx->buf_len);
+}
+
+APEBUILD_DEF void ape_hash_update_str(ApeHashContext *ctx, const char *str)
+{
+	/* The terminator keeps consecutive strings from running together ("ab" "c" != "a" "bc") */
+	ape_hash_update(ctx, str, strlen(str) + 1);
+}
+
+APEBUILD_DEF ApeHash ape_hash_final(const ApeHashContext *ctx)
+{
+	uint64_t h;
+	if (ctx->total_len >= 32) {
+		h = ape_hash_rotl(ctx->v[0], 1) + ape_hash_rotl(ctx->v[1], 7) + ape_hash_rotl(ctx->v[2], 12) + ape_hash_rotl(ctx->v[3], 18);
+		h = ape_hash_merge_round(h, ctx->v[0]);
+		h = ape_hash_merge_round(h, ctx->v[1]);
+		h = ape_hash_merge_round(h, ctx->v[2]);
+		h = ape_hash_merge_round(h, ctx->v[3]);
+	} else {
+		h = ctx->v[2] + APE_XXH_PRIME5;
+	}
+	h += ctx->total_len;
+
+	const unsigned char *p = ctx->buf;
+	const unsigned char *end = p + ctx->buf_len;
+	while (end - p >= 8) {
+		h ^= ape_hash_round(0, ape_hash_read64(p));
+		h = ape_hash_rotl(h, 27) * APE_XXH_PRIME1 + APE_XXH_PRIME4;
+		p += 8;
+	}
+	if (end - p >= 4) {
+		h ^= (uint64_t)ape_hash_read32(p) * APE_XXH_PRIME1;
+		h = ape_hash_rotl(h, 23) * APE_XXH_PRIME2 + APE_XXH_PRIME3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (uint64_t)*p * APE_XXH_PRIME5;
+		h = ape_hash_rotl(h, 11) * APE_XXH_PRIME1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= APE_XXH_PRIME2;
+	h ^= h >> 29;
+	h *= APE_XXH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+/* ============================================================================
+ * Buffer and File Hashing
+ * ============================================================================ */
+
+APEBUILD_DEF ApeHash ape_hash_buffer(const void *data, size_t len)
+{
+	ApeHashContext ctx;
+	ape_hash_init(&ctx);
+	ape_hash_update(&ctx, data, len);
+	return ape_hash_final(&ctx);
+}
+
+APEBUILD_DEF ApeHash ape_hash_string(const char *str)
+{
+	return ape_hash_buffer(str, strlen(str));
+}
+
+APEBUILD_DEF int ape_hash_file(const char *path, ApeHash *out)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return APEBUILD_FALSE;
+
+	ApeHashContext ctx;
+	ape_hash_init(&ctx);
+
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		ape_hash_update(&ctx, buf, n);
+	}
+
+	int ok = !ferror(fp);
+	fclose(fp);
+	if (!ok)
+		return APEBUILD_FALSE;
+
+	*out = ape_hash_final(&ctx);
+	return APEBUILD_TRUE;
+}
+
+/* ============================================================================
+ * Utility
+ * ============================================================================ */
+
+APEBUILD_DEF char *ape_hash_to_hex(ApeHash hash)
+{
+	static const char digits[] = "0123456789abcdef";
+	char *hex = (char *)APEBUILD_MALLOC(17);
+	for (int i = 15; i >= 0; i--) {
+		hex[i] = digits[hash & 0xF];
+		hash >>= 4;
+	}
+	hex[16] = '\0';
+	return hex;
+}
@@ -96,6 +96,33 @@ APEBUILD_DEF void ape_sb_append_fmt(ApeStrBuilder *sb, const char *fmt, ...)
 	va_end(args);
 }
 
+APEBUILD_DEF void ape_sb_append_json_str(ApeStrBuilder *sb, const char *str)
+{
+	ape_sb_append_char(sb, '"');
+	for (const unsigned char *p = (const unsigned char *)(str ? str : ""); *p; p++) {
+		switch (*p) {
+			case '"':
+				ape_sb_append_str(sb, "\\\"");
+				break;
+			case '\\':
+				ape_sb_append_str(sb, "\\\\");
+				break;
+			case '\n':
+				ape_sb_append_str(sb, "\\n");
+				break;
+			case '\t':
+				ape_sb_append_str(sb, "\\t");
+				break;
+			default:
+				if (*p < 0x20)
+					ape_sb_append_fmt(sb, "\\u%04x", *p);
+				else
+					ape_sb_append_char(sb, (char)*p);
+		}
+	}
+	ape_sb_append_char(sb, '"');
+}
+
 APEBUILD_DEF void ape_sb_prepend_str(ApeStrBuilder *sb, const char *str)
 {
 	if (!str)
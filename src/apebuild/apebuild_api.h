@@ -178,6 +178,7 @@ void ape_sb_append_strn(ApeStrBuilder *sb, const char *str, size_t n);
 void ape_sb_append_sb(ApeStrBuilder *sb, const ApeStrBuilder *other);
 void ape_sb_append_fmt(ApeStrBuilder *sb, const char *fmt, ...);
 void ape_sb_append_fmtv(ApeStrBuilder *sb, const char *fmt, va_list args);
+void ape_sb_append_json_str(ApeStrBuilder *sb, const char *str); /* Quoted and escaped as a JSON string */
 void ape_sb_prepend_str(ApeStrBuilder *sb, const char *str);
 void ape_sb_insert(ApeStrBuilder *sb, size_t pos, const char *str);
 const char *ape_sb_to_str(ApeStrBuilder *sb);
@@ -338,6 +339,7 @@ ApeStrList ape_fs_read_file_lines(const char *path);
 int ape_fs_write_file(const char *path, const char *data, size_t size);
 int ape_fs_append_file(const char *path, const char *data, size_t size);
 int ape_fs_copy_file(const char *src, const char *dst);
+int ape_fs_clone_file(const char *src, const char *dst); /* Reflink, hard link or copy, cheapest first */
 int ape_fs_rename(const char *oldpath, const char *newpath);
 
 /* Directory operations */
@@ -358,7 +360,7 @@ void ape_fs_direntry_free(ApeDirEntry *entry);
 
 typedef void (*ApeDirCallback)(const char *path, const ApeDirEntry *entry, void *userdata);
 int ape_fs_iterdir(const char *path, ApeDirCallback callback, void *userdata);
-int ape_fs_iterdir_r(const char *path, ApeDirCallback callback, void *userdata);
+int ape_fs_iterdir_r(const char *path, ApeDirCallback callback, void *userdata); /* Reads the tree in parallel, then calls back */
 ApeStrList ape_fs_glob(const char *pattern);
 
 /* File metadata */
@@ -403,6 +405,10 @@ typedef struct {
 	ApeProcStatus status;
 	int exit_code;
 	int signal;
+	/* Resources used by the process and the children it waited for */
+	uint64_t peak_rss_kb;
+	uint64_t user_us;
+	uint64_t sys_us;
 } ApeProcResult;
 
 /* Process handle (opaque integer, not pointer) */
@@ -451,11 +457,16 @@ int ape_cmds_run_all(ApeCmdList *cmds);
 
 /* Asynchronous execution */
 ApeProcHandle ape_cmd_start(ApeCmd *cmd);
+ApeProcHandle ape_cmd_start_captured(ApeCmd *cmd); /* stdout and stderr go to the handle's output */
 int ape_proc_poll(ApeProcHandle handle);
 int ape_proc_wait(ApeProcHandle handle);
 int ape_proc_wait_timeout(ApeProcHandle handle, int timeout_ms);
+ApeProcHandle ape_proc_wait_any(const ApeProcHandle *handles, size_t count, int timeout_ms); /* < 0 blocks, invalid on timeout */
+ApeProcHandle ape_proc_wait_any_fd(const ApeProcHandle *handles, size_t count, int fd, int timeout_ms); /* Or fd readable */
 ApeProcStatus ape_proc_status(ApeProcHandle handle);
 ApeProcResult ape_proc_result(ApeProcHandle handle);
+uint64_t ape_proc_rss_kb(ApeProcHandle handle); /* Resident memory now, with its children, 0 if unknown */
+const char *ape_proc_output(ApeProcHandle handle, size_t *len); /* Not NUL-terminated, valid until release */
 int ape_proc_kill(ApeProcHandle handle);
 int ape_proc_handle_valid(ApeProcHandle handle);
 void ape_proc_handle_release(ApeProcHandle handle);
@@ -488,68 +499,83 @@ void ape_cmdlist_free(ApeCmdList *list);
 	} while (0)
 
 /* ============================================================================
- * Core Build Module (ape_build)
- * ============================================================================ */
-
-/* ----------------------------------------------------------------------------
- * Handle Types and Storage Configuration
+ * Hash Module (ape_hash)
  *
- * All build objects (toolchains, builders, tasks) are stored in fixed-size
- * internal arrays and referenced by handles (integer IDs) rather than pointers.
- * This simplifies memory management and avoids dangling pointer issues.
- *
- * Users can override the maximum counts by defining these macros before
- * including this header.
- * ---------------------------------------------------------------------------- */
+ * xxHash64, used for content-based rebuild detection. Not cryptographic.
+ * ============================================================================ */
 
-#ifndef APE_MAX_TOOLCHAINS
-#define APE_MAX_TOOLCHAINS 16
-#endif
+typedef uint64_t ApeHash;
 
-#ifndef APE_MAX_BUILDERS
-#define APE_MAX_BUILDERS 64
-#endif
+/* Incremental hash context */
+typedef struct {
+	uint64_t v[4];
+	uint64_t total_len;
+	unsigned char buf[32];
+	size_t buf_len;
+} ApeHashContext;
+
+/* Incremental hashing */
+void ape_hash_init(ApeHashContext *ctx);
+void ape_hash_update(ApeHashContext *ctx, const void *data, size_t len);
+void ape_hash_update_str(ApeHashContext *ctx, const char *str); /* Includes the terminator */
+ApeHash ape_hash_final(const ApeHashContext *ctx);
+
+/* One-shot hashing */
+ApeHash ape_hash_buffer(const void *data, size_t len);
+ApeHash ape_hash_string(const char *str);
+int ape_hash_file(const char *path, ApeHash *out);
 
-#ifndef APE_MAX_TASKS
-#define APE_MAX_TASKS 1024
-#endif
+/* Utility */
+char *ape_hash_to_hex(ApeHash hash); /* 16 lowercase hex digits, caller frees */
 
-#ifndef APE_MAX_TASK_DEPS
-#define APE_MAX_TASK_DEPS 64
-#endif
+/* ============================================================================
+ * Core Build Module (ape_build)
+ * ============================================================================ */
 
-#ifndef APE_MAX_BUILDER_DEPS
-#define APE_MAX_BUILDER_DEPS 32
-#endif
+/* ----------------------------------------------------------------------------
+ * Handle Types and Storage
+ *
+ * All build objects (toolchains, builders, tasks) are stored in growable
+ * internal slot maps and referenced by handles (integer IDs) rather than
+ * pointers. A handle carries its slot's generation: once an object is freed,
+ * its handles stay invalid even after the slot is reused. Pointers returned
+ * by the *_get() functions stay valid until the object is freed.
+ * ---------------------------------------------------------------------------- */
 
-/* Handle types - all are int32_t indices into internal arrays */
+/* Handle types - slot index in the low APE_HANDLE_INDEX_BITS, generation above */
 typedef int32_t ApeToolchainHandle;
 typedef int32_t ApeBuilderHandle;
 typedef int32_t ApeTaskHandle;
 
+#define APE_HANDLE_INDEX_BITS 20 /* Up to about a million live objects of each kind */
+
 #define APE_INVALID_TOOLCHAIN ((ApeToolchainHandle) - 1)
 #define APE_INVALID_BUILDER ((ApeBuilderHandle) - 1)
 #define APE_INVALID_TASK ((ApeTaskHandle) - 1)
 
 /* Handle list types for dependencies */
 typedef struct {
+	size_t capacity;
 	size_t count;
-	ApeTaskHandle items[APE_MAX_TASK_DEPS];
+	ApeTaskHandle *items;
 } ApeTaskDepList;
 
 typedef struct {
+	size_t capacity;
 	size_t count;
-	ApeBuilderHandle items[APE_MAX_BUILDER_DEPS];
+	ApeBuilderHandle *items;
 } ApeBuilderDepList;
 
 typedef struct {
+	size_t capacity;
 	size_t count;
-	ApeTaskHandle items[APE_MAX_TASKS];
+	ApeTaskHandle *items;
 } ApeTaskHandleList;
 
 typedef struct {
+	size_t capacity;
 	size_t count;
-	ApeBuilderHandle items[APE_MAX_BUILDERS];
+	ApeBuilderHandle *items;
 } ApeBuilderHandleList;
 
 /* Verbosity levels */
@@ -572,6 +598,7 @@ typedef enum {
 /* Task types */
 typedef enum {
 	APE_TASK_TYPE_COMPILE, /* Compile source to object */
+	APE_TASK_TYPE_PCH,     /* Precompile a header */
 	APE_TASK_TYPE_LINK,    /* Link objects to target */
 	APE_TASK_TYPE_ARCHIVE, /* Create static library */
 	APE_TASK_TYPE_COMMAND, /* Run arbitrary command */
@@ -643,6 +670,24 @@ typedef struct {
 	ApeProcHandle proc;	  /* Process handle when running */
 	int exit_code;		  /* Exit code after completion */
 	ApeBuilderHandle builder; /* Parent builder handle */
+	char *cache_key;	  /* Object cache key while a cacheable compile runs */
+	ApeHash cache_args_hash;  /* Cache key inputs other than the preprocessed source */
+	int preprocessing;	  /* proc is the preprocessor run computing cache_key */
+	char *depfile;		  /* Header dependencies written by the compiler (-MMD -MF) */
+	ApeStrList headers;	  /* Headers seen by the last compile, checked like inputs */
+	int deps_known;		  /* headers is up to date */
+
+	/* Build log state (<output_dir>/<name>.buildlog) */
+	int logged;		    /* The build log has a record for output */
+	ApeHash logged_cmd_hash;    /* Command output was last built with */
+	ApeHash logged_inputs_hash; /* Input mtimes output was last built from */
+	uint32_t duration_ms;	    /* Duration of the last run (0 = unknown) */
+	uint32_t peak_rss_kb;	    /* Peak resident memory of the last run in KiB (0 = unknown) */
+	uint32_t user_ms;	    /* CPU time of the last run in this process */
+	uint32_t sys_ms;
+	int32_t slot;		    /* Parallel slot it ran in, -1 if it didn't run in this process */
+	uint64_t start_ms;	    /* Start time while running */
+	int32_t sched_index;	    /* Position in the schedule of the running build */
 } ApeTask;
 
 /* Task management */
@@ -686,6 +731,8 @@ typedef struct {
 	/* Output configuration */
 	char *output_dir;
 	char *output_name; /* Override default output name */
+	int unity_batches; /* Compile sources as this many unity files per language (0 = off) */
+	char *pch_header;  /* Header precompiled once and included by every compile (NULL = none) */
 
 	/* Emscripten/WASM configuration */
 	char *shell_file;	       /* Path to custom shell HTML file (NULL = use default) */
@@ -705,6 +752,7 @@ typedef struct {
 	/* State */
 	int built; /* Has been built this session */
 	int build_failed;
+	int cache_hits; /* Objects restored from the object cache by the last build */
 } ApeBuilder;
 
 /* Builder management */
@@ -718,6 +766,8 @@ void ape_builder_set_type(ApeBuilderHandle handle, ApeTargetType type);
 void ape_builder_set_toolchain(ApeBuilderHandle handle, ApeToolchainHandle tc);
 void ape_builder_set_output_dir(ApeBuilderHandle handle, const char *dir);
 void ape_builder_set_output_name(ApeBuilderHandle handle, const char *name);
+void ape_builder_set_unity(ApeBuilderHandle handle, int batches);
+void ape_builder_set_pch(ApeBuilderHandle handle, const char *header);
 
 /* Source management */
 void ape_builder_add_source(ApeBuilderHandle handle, const char *path);
@@ -758,6 +808,15 @@ void ape_builder_set_wasm_memory(ApeBuilderHandle handle, int initial_mb, int ma
 /* Get default Emscripten shell HTML (embedded in source, returned as static string) */
 const char *ape_emcc_default_shell(void);
 
+/*
+ * Header dependencies: compile tasks have the compiler write a depfile, and the
+ * headers it lists are checked along with the task's own inputs. After a build
+ * the depfiles are folded into <output_dir>/<name>.deps, which
+ * ape_builder_generate_tasks() reads back. An object whose headers aren't known
+ * is always recompiled.
+ */
+ApeStrList ape_depfile_parse(const char *text); /* Prerequisites of the first rule in a make-style depfile */
+
 /* Task generation (internal, but exposed for flexibility) */
 ApeTaskHandle ape_builder_add_compile_task(ApeBuilderHandle handle, const char *source);
 ApeTaskHandle ape_builder_add_link_task(ApeBuilderHandle handle);
@@ -770,6 +829,25 @@ void ape_builder_generate_tasks(ApeBuilderHandle handle);
  *
  * The build context is now a simple configuration struct. Builders and
  * toolchains are stored in global arrays, not inside the context.
+ *
+ * Setting a cache directory enables the object cache: a compile is keyed by
+ * its preprocessed source, the compiler's --version output and its arguments,
+ * and a compile that was seen before is restored from the cache instead of
+ * being run. The cache can be shared between build directories and branches.
+ *
+ * A load limit and memory throttling hold new tasks back, on top of
+ * parallel_jobs, while the machine is busy or short on memory. Memory
+ * throttling compares MemAvailable with the peak memory each task used the
+ * last time it ran.
+ *
+ * A trace file receives each build's tasks in Chrome's trace event format,
+ * one row per parallel slot, for chrome://tracing or Perfetto. With a trace
+ * or verbose output, the slowest tasks and the critical path are logged too.
+ *
+ * A compile_commands.json path makes every build bring that compilation
+ * database up to date for clangd and other tools. Entries are kept per object
+ * file, so builders sharing a database don't drop each other's, and the file
+ * is only rewritten when a command was added or changed.
  * ---------------------------------------------------------------------------- */
 
 typedef struct {
@@ -777,9 +855,14 @@ typedef struct {
 	char *output_dir;	      /* Default output directory */
 	int parallel_jobs;	      /* Max parallel tasks (0 = auto) */
 	ApeVerbosity verbosity;
-	int force_rebuild; /* Ignore timestamps */
-	int dry_run;	   /* Don't actually run commands */
-	int keep_going;	   /* Continue on errors */
+	int force_rebuild;	/* Ignore timestamps */
+	int dry_run;		/* Don't actually run commands */
+	int keep_going;		/* Continue on errors */
+	char *cache_dir;	/* Object cache directory (NULL = no cache) */
+	double max_load;	/* Don't start tasks at this load average (0 = no limit) */
+	int memory_throttle;	/* Don't start tasks memory can't hold */
+	char *trace_file;	/* Chrome trace of each build (NULL = none) */
+	char *compile_commands;	/* compile_commands.json to keep up to date (NULL = none) */
 } ApeBuildCtx;
 
 /* Global context - there's one active context at a time */
@@ -792,6 +875,11 @@ void ape_ctx_set_verbosity(ApeBuildCtx *ctx, ApeVerbosity level);
 void ape_ctx_set_force_rebuild(ApeBuildCtx *ctx, int force);
 void ape_ctx_set_dry_run(ApeBuildCtx *ctx, int dry_run);
 void ape_ctx_set_keep_going(ApeBuildCtx *ctx, int keep_going);
+void ape_ctx_set_cache_dir(ApeBuildCtx *ctx, const char *dir);
+void ape_ctx_set_max_load(ApeBuildCtx *ctx, double load);
+void ape_ctx_set_memory_throttle(ApeBuildCtx *ctx, int enabled);
+void ape_ctx_set_trace_file(ApeBuildCtx *ctx, const char *path);
+void ape_ctx_set_compile_commands(ApeBuildCtx *ctx, const char *path);
 ApeToolchainHandle ape_ctx_get_toolchain(ApeBuildCtx *ctx);
 
 /* Build operations using context */
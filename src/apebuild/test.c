@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <utime.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /* Simple test framework */
 static int tests_run = 0;
@@ -241,6 +244,17 @@ TEST(sb_fmt)
 	return PASSED;
 }
 
+TEST(sb_json_str)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	ape_sb_append_json_str(&sb, "a \"b\"\\c\n\x01");
+
+	ASSERT_STR_EQ(ape_sb_to_str(&sb), "\"a \\\"b\\\"\\\\c\\n\\u0001\"");
+
+	ape_sb_free(&sb);
+	return PASSED;
+}
+
 TEST(sb_prepend)
 {
 	ApeStrBuilder sb = ape_sb_new();
@@ -461,6 +475,111 @@ TEST(fs_write_read)
 	return PASSED;
 }
 
+/* dir/d<i>/{a.c,b.h,sub/c.c} for i < count, plus a symlink to d0 */
+static char *write_test_tree(int count)
+{
+	char *dir = ape_fs_temp_mkdir("ape_fs_test");
+	if (!dir)
+		return NULL;
+	for (int i = 0; i < count; i++) {
+		char name[64];
+		const char *files[] = { "a.c", "b.h", "sub/c.c" };
+		for (size_t f = 0; f < 3; f++) {
+			snprintf(name, sizeof(name), "d%d/%s", i, files[f]);
+			char *path = ape_fs_join(dir, name);
+			char *parent = ape_fs_dirname(path);
+			ape_fs_mkdir_p(parent);
+			ape_fs_write_file(path, "", 0);
+			APEBUILD_FREE(parent);
+			APEBUILD_FREE(path);
+		}
+	}
+	char *link = ape_fs_join(dir, "link");
+	if (symlink("d0", link) != 0) {
+		APEBUILD_FREE(link);
+		APEBUILD_FREE(dir);
+		return NULL;
+	}
+	APEBUILD_FREE(link);
+	return dir;
+}
+
+static void collect_test_paths(const char *path, const ApeDirEntry *entry, void *userdata)
+{
+	ApeStrList *paths = (ApeStrList *)userdata;
+	char *full = ape_fs_join(path, entry->name);
+	ape_sl_append(paths, ape_str_concat(full, entry->is_dir ? "/" : (entry->is_symlink ? "@" : "")));
+	APEBUILD_FREE(full);
+}
+
+TEST(fs_iterdir_r)
+{
+	char *dir = write_test_tree(40);
+	ASSERT_NOT_NULL(dir);
+
+	ApeStrList paths = ape_sl_new();
+	ASSERT(ape_fs_iterdir_r(dir, collect_test_paths, &paths));
+	/* Per directory: itself, a.c, b.h, sub and sub/c.c; the symlink is listed but not followed */
+	ASSERT_EQ(paths.count, (size_t)(40 * 5 + 1));
+
+	/* Depth first: a directory's entries come right after it */
+	for (size_t i = 0; i < paths.count; i++) {
+		if (!ape_str_ends_with(paths.items[i], "/sub/"))
+			continue;
+		ASSERT(i + 1 < paths.count);
+		ASSERT(ape_str_starts_with(paths.items[i + 1], paths.items[i]));
+		ASSERT(ape_str_ends_with(paths.items[i + 1], "c.c"));
+	}
+	char *link = ape_fs_join(dir, "link@");
+	ASSERT(ape_sl_contains(&paths, link));
+	APEBUILD_FREE(link);
+	ASSERT(!ape_fs_iterdir_r("/nonexistent/path/that/should/not/exist", collect_test_paths, &paths));
+
+	ape_sl_free(&paths);
+	ape_fs_rmdir_r(dir);
+	APEBUILD_FREE(dir);
+	return PASSED;
+}
+
+TEST(fs_glob)
+{
+	char *dir = write_test_tree(3);
+	ASSERT_NOT_NULL(dir);
+	char *pattern = ape_fs_join(dir, "*/*.c");
+	ApeStrList files = ape_fs_glob(pattern);
+	ASSERT_EQ(files.count, (size_t)3);
+	for (size_t i = 0; i < files.count; i++) {
+		ASSERT(ape_str_ends_with(files.items[i], "/a.c"));
+	}
+	ape_sl_free(&files);
+	APEBUILD_FREE(pattern);
+
+	/* Literal and wildcard components, at any depth */
+	pattern = ape_fs_join(dir, "d?/sub/*");
+	files = ape_fs_glob(pattern);
+	ASSERT_EQ(files.count, (size_t)3);
+	ape_sl_free(&files);
+	APEBUILD_FREE(pattern);
+
+	/* A pattern without wildcards matches just the path, if it exists */
+	pattern = ape_fs_join(dir, "d1/b.h");
+	files = ape_fs_glob(pattern);
+	ASSERT_EQ(files.count, (size_t)1);
+	ASSERT_STR_EQ(files.items[0], pattern);
+	ape_sl_free(&files);
+	APEBUILD_FREE(pattern);
+
+	pattern = ape_fs_join(dir, "d9/*.c");
+	files = ape_fs_glob(pattern);
+	ASSERT_EQ(files.count, (size_t)0);
+	ape_sl_free(&files);
+	APEBUILD_FREE(pattern);
+
+	ape_fs_rmdir_r(dir);
+	APEBUILD_FREE(dir);
+	return PASSED;
+}
+
 TEST(fs_needs_rebuild)
 {
 	/* Create two temp files */
@@ -584,6 +703,74 @@ TEST(cmd_async)
 	return PASSED;
 }
 
+TEST(cmd_wait_any)
+{
+	ApeCmd slow = ape_cmd_from("sleep");
+	ape_cmd_append(&slow, "5");
+	ApeCmd fast = ape_cmd_from("true");
+
+	ApeProcHandle handles[2];
+	handles[0] = ape_cmd_start(&slow);
+	handles[1] = ape_cmd_start(&fast);
+	ASSERT_NE(handles[0], APE_INVALID_HANDLE);
+	ASSERT_NE(handles[1], APE_INVALID_HANDLE);
+
+	/* Returns as soon as the fast process exits, without waiting on the slow one */
+	ASSERT_EQ(ape_proc_wait_any(handles, 2, -1), handles[1]);
+	ASSERT_EQ(ape_proc_result(handles[1]).exit_code, 0);
+	ASSERT_EQ(ape_proc_status(handles[0]), APE_PROC_RUNNING);
+
+	/* Only a running process has resident memory to report */
+	if (ape_fs_exists("/proc/self/status"))
+		ASSERT(ape_proc_rss_kb(handles[0]) > 0);
+	ASSERT_EQ(ape_proc_rss_kb(handles[1]), 0);
+
+	/* Times out while only the slow process is left */
+	ASSERT_EQ(ape_proc_wait_any(handles, 1, 20), APE_INVALID_HANDLE);
+
+	/* A readable fd ends the wait too, even without a timeout */
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	ASSERT_EQ(write(fds[1], "+", 1), 1);
+	ASSERT_EQ(ape_proc_wait_any_fd(handles, 1, fds[0], -1), APE_INVALID_HANDLE);
+	ASSERT_EQ(ape_proc_status(handles[0]), APE_PROC_RUNNING);
+	close(fds[0]);
+	close(fds[1]);
+
+	ASSERT(ape_proc_kill(handles[0]));
+	ape_proc_handle_release(handles[0]);
+	ape_proc_handle_release(handles[1]);
+	ape_cmd_free(&slow);
+	ape_cmd_free(&fast);
+	return PASSED;
+}
+
+TEST(cmd_captured)
+{
+	/* Far more than a pipe holds, so the child only finishes if we keep reading */
+	ApeCmd cmd = ape_cmd_from("sh");
+	ape_cmd_append(&cmd, "-c");
+	ape_cmd_append(&cmd, "head -c 300000 /dev/zero | tr '\\0' x; echo err >&2; exit 3");
+
+	ApeProcHandle handle = ape_cmd_start_captured(&cmd);
+	ASSERT_NE(handle, APE_INVALID_HANDLE);
+	ASSERT(!ape_proc_wait(handle));
+	ASSERT_EQ(ape_proc_result(handle).exit_code, 3);
+
+	/* stdout and stderr both end up in the buffer */
+	size_t len;
+	const char *output = ape_proc_output(handle, &len);
+	ASSERT_EQ(len, (size_t)300004);
+	ASSERT_EQ(output[0], 'x');
+	ASSERT(memcmp(output + 300000, "err\n", 4) == 0);
+
+	ape_proc_handle_release(handle);
+	ASSERT_EQ(ape_proc_output(handle, &len)[0], '\0');
+	ASSERT_EQ(len, (size_t)0);
+	ape_cmd_free(&cmd);
+	return PASSED;
+}
+
 TEST(cmd_cwd)
 {
 	ApeCmd cmd = ape_cmd_from("pwd");
@@ -600,6 +787,37 @@ TEST(cmd_cwd)
 	return PASSED;
 }
 
+TEST(cmd_env)
+{
+	ApeCmd cmd = ape_cmd_from("sh");
+	ape_cmd_append(&cmd, "-c");
+	ape_cmd_append(&cmd, "echo \"$APE_TEST_A:$APE_TEST_B:$HOME\"");
+	setenv("APE_TEST_A", "parent", 1);
+	ape_cmd_set_env(&cmd, "APE_TEST_A", "first");
+	ape_cmd_set_env(&cmd, "APE_TEST_B", "b");
+	ape_cmd_set_env(&cmd, "APE_TEST_A", "last");
+
+	/* Later settings win and the rest of the environment is inherited */
+	int exit_code = -1;
+	char *output = ape_cmd_run_capture(&cmd, &exit_code);
+	ASSERT_EQ(exit_code, 0);
+	char *expected = ape_str_concat("last:b:", getenv("HOME") ? getenv("HOME") : "");
+	ASSERT(ape_str_starts_with(output, expected));
+	APEBUILD_FREE(expected);
+	APEBUILD_FREE(output);
+	unsetenv("APE_TEST_A");
+	ape_cmd_free(&cmd);
+
+	/* A program that can't be executed reports 127 */
+	ApeCmd missing = ape_cmd_from("ape-no-such-program");
+	output = ape_cmd_run_capture(&missing, &exit_code);
+	ASSERT_NOT_NULL(output);
+	ASSERT_EQ(exit_code, 127);
+	APEBUILD_FREE(output);
+	ape_cmd_free(&missing);
+	return PASSED;
+}
+
 /* ============================================================================
  * Logging Module Tests
  * ============================================================================ */
@@ -901,6 +1119,739 @@ TEST(emcc_js_only_output)
 	return PASSED;
 }
 
+/* ============================================================================
+ * Hash Module Tests
+ * ============================================================================ */
+
+TEST(hash_xxh64)
+{
+	/* Reference values from the xxHash test suite */
+	ASSERT_EQ(ape_hash_string(""), 0xEF46DB3751D8E999ULL);
+	ASSERT_EQ(ape_hash_string("abc"), 0x44BC2CF5AD770999ULL);
+	ASSERT_EQ(ape_hash_string("Nobody inspects the spammish repetition"), 0xFBCEA83C8A378BF1ULL);
+
+	char *hex = ape_hash_to_hex(0x44BC2CF5AD770999ULL);
+	ASSERT_STR_EQ(hex, "44bc2cf5ad770999");
+	APEBUILD_FREE(hex);
+	return PASSED;
+}
+
+TEST(hash_incremental)
+{
+	char data[1000];
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = (char)(i * 7);
+
+	/* Uneven chunks straddle the 32 byte stripes */
+	ApeHashContext hc;
+	ape_hash_init(&hc);
+	for (size_t pos = 0, chunk = 1; pos < sizeof(data); chunk = chunk % 37 + 5) {
+		size_t n = pos + chunk > sizeof(data) ? sizeof(data) - pos : chunk;
+		ape_hash_update(&hc, data + pos, n);
+		pos += n;
+	}
+	ASSERT_EQ(ape_hash_final(&hc), ape_hash_buffer(data, sizeof(data)));
+
+	char *path = ape_fs_temp_file("hash");
+	ASSERT(ape_fs_write_file(path, data, sizeof(data)));
+	ApeHash file_hash = 0;
+	ASSERT(ape_hash_file(path, &file_hash));
+	ASSERT_EQ(file_hash, ape_hash_buffer(data, sizeof(data)));
+	ape_fs_remove(path);
+	ASSERT(!ape_hash_file(path, &file_hash));
+	APEBUILD_FREE(path);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Build Module Tests
+ * ============================================================================ */
+
+/* Writes a small C program (main.c and util.h) into a fresh temp directory */
+static char *write_test_project(void)
+{
+	char *dir = ape_fs_temp_mkdir("ape_build_test");
+	if (!dir)
+		return NULL;
+
+	const char *main_src = "#include \"util.h\"\nint main(void) { return util(); }\n";
+	const char *util_src = "static inline int util(void) { return 0; }\n";
+	char *main_path = ape_fs_join(dir, "main.c");
+	char *util_path = ape_fs_join(dir, "util.h");
+	ape_fs_write_file(main_path, main_src, strlen(main_src));
+	ape_fs_write_file(util_path, util_src, strlen(util_src));
+	APEBUILD_FREE(main_path);
+	APEBUILD_FREE(util_path);
+	return dir;
+}
+
+static ApeBuilderHandle new_test_builder(const char *dir)
+{
+	ApeBuilderHandle app = ape_builder_new("app");
+	char *main_path = ape_fs_join(dir, "main.c");
+	ape_builder_add_source(app, main_path);
+	ape_builder_add_include(app, dir);
+	APEBUILD_FREE(main_path);
+	return app;
+}
+
+/*
+ * What build tests start from: the test project, a context building it
+ * quietly into <dir>/build, and an app builder for main.c. Strings handed to
+ * fixture_keep() are freed along with the rest by fixture_free().
+ */
+typedef struct {
+	char *dir;
+	char *out_dir;
+	ApeBuildCtx ctx;
+	ApeBuilderHandle app;
+	ApeStrList kept;
+} BuildFixture;
+
+static int fixture_init(BuildFixture *fx)
+{
+	ape_build_reset();
+	memset(fx, 0, sizeof(*fx));
+	fx->dir = write_test_project();
+	if (!fx->dir)
+		return 0;
+	fx->out_dir = ape_fs_join(fx->dir, "build");
+	ape_ctx_init(&fx->ctx);
+	ape_ctx_set_output_dir(&fx->ctx, fx->out_dir);
+	ape_ctx_set_verbosity(&fx->ctx, APE_VERBOSE_QUIET);
+	fx->app = new_test_builder(fx->dir);
+	return 1;
+}
+
+static void fixture_free(BuildFixture *fx)
+{
+	ape_ctx_cleanup(&fx->ctx);
+	ape_fs_rmdir_r(fx->dir);
+	ape_sl_free(&fx->kept);
+	APEBUILD_FREE(fx->out_dir);
+	APEBUILD_FREE(fx->dir);
+	ape_build_reset();
+}
+
+static char *fixture_keep(BuildFixture *fx, char *str)
+{
+	ape_sl_append(&fx->kept, str);
+	return str;
+}
+
+/* Path of name in the project, written with content unless it's NULL */
+static char *fixture_path(BuildFixture *fx, const char *name, const char *content)
+{
+	char *path = fixture_keep(fx, ape_fs_join(fx->dir, name));
+	if (content)
+		ape_fs_write_file(path, content, strlen(content));
+	return path;
+}
+
+static char *fixture_out_path(BuildFixture *fx, const char *name)
+{
+	return fixture_keep(fx, ape_fs_join(fx->out_dir, name));
+}
+
+TEST(build_cache_hit)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	char *cache_dir = fixture_path(&fx, "cache", NULL);
+	ape_ctx_set_cache_dir(&fx.ctx, cache_dir);
+
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(ape_builder_get(fx.app)->cache_hits, 0);
+	ASSERT(ape_fs_is_dir(cache_dir));
+
+	/* A clean build of the same sources restores the object */
+	ASSERT(ape_ctx_rebuild(&fx.ctx, fx.app));
+	ASSERT_EQ(ape_builder_get(fx.app)->cache_hits, 1);
+	ApeCmd run = ape_cmd_from(fixture_keep(&fx, ape_builder_output_path(fx.app)));
+	ASSERT(ape_cmd_run(&run));
+	ape_cmd_free(&run);
+
+	/* Different flags give a different object */
+	ape_builder_add_cflag(fx.app, "-O2");
+	ASSERT(ape_ctx_rebuild(&fx.ctx, fx.app));
+	ASSERT_EQ(ape_builder_get(fx.app)->cache_hits, 0);
+
+	/* So do header changes, which only show up in the preprocessed source */
+	fixture_path(&fx, "util.h", "static inline int util(void) { return 1 - 1; }\n");
+	ASSERT(ape_ctx_rebuild(&fx.ctx, fx.app));
+	ASSERT_EQ(ape_builder_get(fx.app)->cache_hits, 0);
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(depfile_parse)
+{
+	ApeStrList deps = ape_depfile_parse("build/main.o: src/main.c src/my\\ file.h \\\n  /opt/a$$b.h\nsrc/util.h:\n");
+	ASSERT_EQ(deps.count, 3);
+	ASSERT_STR_EQ(deps.items[0], "src/main.c");
+	ASSERT_STR_EQ(deps.items[1], "src/my file.h");
+	ASSERT_STR_EQ(deps.items[2], "/opt/a$b.h");
+	ape_sl_free(&deps);
+
+	deps = ape_depfile_parse("garbage without a rule");
+	ASSERT_EQ(deps.count, 0);
+	ape_sl_free(&deps);
+	return PASSED;
+}
+
+/* Builds the test project the way a fresh build script run would, returns the compile task's status */
+static ApeTaskStatus build_test_project(const char *dir, const char *out_dir, const char *cflag)
+{
+	ape_build_reset();
+	ApeBuildCtx ctx;
+	ape_ctx_init(&ctx);
+	ape_ctx_set_output_dir(&ctx, out_dir);
+	ape_ctx_set_verbosity(&ctx, APE_VERBOSE_QUIET);
+
+	ApeBuilderHandle app = new_test_builder(dir);
+	if (cflag)
+		ape_builder_add_cflag(app, cflag);
+	ApeTaskStatus status = APE_TASK_FAILED;
+	if (ape_ctx_build(&ctx, app))
+		status = ape_task_get(ape_builder_get(app)->tasks.items[0])->status;
+
+	ape_ctx_cleanup(&ctx);
+	return status;
+}
+
+TEST(build_header_deps)
+{
+	char *dir = write_test_project();
+	ASSERT_NOT_NULL(dir);
+	char *out_dir = ape_fs_join(dir, "build");
+	char *db_path = ape_fs_join(out_dir, "app.deps");
+	char *util_path = ape_fs_join(dir, "util.h");
+
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_COMPLETED);
+	ASSERT_FILE_EXISTS(db_path);
+
+	/* Depfiles are folded into the database */
+	char *pattern = ape_fs_join(out_dir, "*.d");
+	ApeStrList depfiles = ape_fs_glob(pattern);
+	ASSERT_EQ(depfiles.count, 0);
+	ape_sl_free(&depfiles);
+	APEBUILD_FREE(pattern);
+
+	/* The next run knows the object only depends on main.c and util.h */
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_SKIPPED);
+
+	sleep(1); /* mtimes have a one second resolution */
+	const char *util_src = "static inline int util(void) { return 1 - 1; }\n";
+	ASSERT(ape_fs_write_file(util_path, util_src, strlen(util_src)));
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_COMPLETED);
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_SKIPPED);
+
+	/* Without the database nothing is known about the headers */
+	ape_fs_remove(db_path);
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_COMPLETED);
+
+	ape_fs_rmdir_r(dir);
+	APEBUILD_FREE(util_path);
+	APEBUILD_FREE(db_path);
+	APEBUILD_FREE(out_dir);
+	APEBUILD_FREE(dir);
+	ape_build_reset();
+	return PASSED;
+}
+
+TEST(build_log)
+{
+	char *dir = write_test_project();
+	ASSERT_NOT_NULL(dir);
+	char *out_dir = ape_fs_join(dir, "build");
+	char *log_path = ape_fs_join(out_dir, "app.buildlog");
+	char *util_path = ape_fs_join(dir, "util.h");
+
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_COMPLETED);
+	ASSERT_FILE_EXISTS(log_path);
+	ASSERT_EQ(build_test_project(dir, out_dir, NULL), APE_TASK_SKIPPED);
+
+	/* Changed flags rebuild, even though no file changed */
+	ASSERT_EQ(build_test_project(dir, out_dir, "-O2"), APE_TASK_COMPLETED);
+	ASSERT_EQ(build_test_project(dir, out_dir, "-O2"), APE_TASK_SKIPPED);
+
+	/* So does an input going back in time, eg. restored from a backup */
+	struct utimbuf old_times = { .actime = 1000000000, .modtime = 1000000000 };
+	ASSERT_EQ(utime(util_path, &old_times), 0);
+	ASSERT_EQ(build_test_project(dir, out_dir, "-O2"), APE_TASK_COMPLETED);
+	ASSERT_EQ(build_test_project(dir, out_dir, "-O2"), APE_TASK_SKIPPED);
+
+	/* Durations and memory peaks are available to the next build */
+	ape_build_reset();
+	ApeBuilderHandle app = new_test_builder(dir);
+	ape_builder_set_toolchain(app, ape_toolchain_gcc());
+	ape_builder_set_output_dir(app, out_dir);
+	ape_builder_generate_tasks(app);
+	ApeTask *compile = ape_task_get(ape_builder_get(app)->tasks.items[0]);
+	ASSERT(compile->logged);
+	ASSERT(compile->duration_ms > 0);
+	ASSERT(compile->peak_rss_kb > 0);
+
+	ape_fs_rmdir_r(dir);
+	APEBUILD_FREE(util_path);
+	APEBUILD_FREE(log_path);
+	APEBUILD_FREE(out_dir);
+	APEBUILD_FREE(dir);
+	ape_build_reset();
+	return PASSED;
+}
+
+TEST(build_handles)
+{
+	ape_build_reset();
+	ApeBuilderHandle app = ape_builder_new("app");
+
+	/* Storage grows past what used to be fixed limits */
+	ApeTaskHandle link = ape_task_new(app, APE_TASK_TYPE_LINK, "link");
+	for (int i = 0; i < 5000; i++) {
+		ApeTaskHandle task = ape_task_new(app, APE_TASK_TYPE_COMPILE, "compile");
+		ASSERT(ape_task_valid(task));
+		ape_task_add_dep(link, task);
+	}
+	ASSERT_EQ(ape_task_get(link)->deps.count, 5000);
+
+	/* A freed slot is reused, but handles to the old task stay invalid */
+	ApeTaskHandle old = ape_task_get(link)->deps.items[0];
+	ApeTask *old_ptr = ape_task_get(old);
+	ape_task_free(old);
+	ASSERT(!ape_task_valid(old));
+	ApeTaskHandle reused = ape_task_new(app, APE_TASK_TYPE_COMPILE, "reused");
+	ASSERT_NE(reused, old);
+	ASSERT(ape_task_get(reused) == old_ptr);
+	ASSERT_NULL(ape_task_get(old));
+
+	/* Process handles work the same way */
+	ApeCmd cmd = ape_cmd_from("true");
+	ApeProcHandle proc = ape_cmd_start(&cmd);
+	ASSERT(ape_proc_wait(proc));
+	ape_proc_handle_release(proc);
+	ASSERT(!ape_proc_handle_valid(proc));
+	ApeProcHandle next = ape_cmd_start(&cmd);
+	ASSERT_NE(next, proc);
+	ASSERT(ape_proc_wait(next));
+	ASSERT(!ape_proc_handle_valid(proc));
+	ape_proc_handle_release(next);
+	ape_cmd_free(&cmd);
+
+	ape_build_reset();
+	return PASSED;
+}
+
+/* Writes big.c, a source that takes much longer to compile than main.c */
+static char *write_big_source(const char *dir)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	for (int i = 0; i < 2000; i++)
+		ape_sb_append_fmt(&sb, "int big_%d(int x) { return x * %d + (x >> 3); }\n", i, i);
+	char *big_path = ape_fs_join(dir, "big.c");
+	ape_fs_write_file(big_path, sb.items, sb.count);
+	ape_sb_free(&sb);
+	return big_path;
+}
+
+/* Finds the task of builder whose input or output ends with suffix */
+static ApeTask *find_test_task(ApeBuilderHandle handle, const char *suffix)
+{
+	ApeBuilder *builder = ape_builder_get(handle);
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if ((task->input && ape_str_ends_with(task->input, suffix)) || (task->output && ape_str_ends_with(task->output, suffix)))
+			return task;
+	}
+	return NULL;
+}
+
+TEST(build_schedule)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	ape_ctx_set_parallel(&fx.ctx, 1);
+
+	/* A much larger source, declared last */
+	char *big_path = fixture_keep(&fx, write_big_source(fx.dir));
+	ape_builder_add_source(fx.app, big_path);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+
+	/* The expensive compile starts first even with a single job */
+	ApeTask *main_task = find_test_task(fx.app, "main.c");
+	ApeTask *big_task = find_test_task(fx.app, "big.c");
+	ASSERT_NOT_NULL(main_task);
+	ASSERT_NOT_NULL(big_task);
+	ASSERT(big_task->start_ms < main_task->start_ms);
+
+	/* With keep going, a failed compile fails the link instead of stalling the build */
+	fixture_path(&fx, "big.c", "int broken(void) { return }\n");
+	ape_ctx_set_keep_going(&fx.ctx, 1);
+	ASSERT(!ape_ctx_rebuild(&fx.ctx, fx.app));
+	ApeBuilder *builder = ape_builder_get(fx.app);
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (task->type != APE_TASK_TYPE_COMPILE)
+			ASSERT_EQ(task->status, APE_TASK_FAILED);
+		else if (ape_str_ends_with(task->input, "main.c"))
+			ASSERT_EQ(task->status, APE_TASK_COMPLETED);
+	}
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_across_builders)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	ape_ctx_set_parallel(&fx.ctx, 2);
+
+	ApeBuilderHandle lib = ape_builder_new("big");
+	ape_builder_set_type(lib, APE_TARGET_STATIC_LIB);
+	ape_builder_set_output_dir(lib, fx.out_dir);
+	ape_builder_add_source(lib, fixture_keep(&fx, write_big_source(fx.dir)));
+	ape_builder_link_with(fx.app, lib);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT(ape_builder_get(lib)->built);
+
+	/* The app compiles alongside the library, only its link waits for the archive */
+	ApeTask *app_compile = find_test_task(fx.app, "main.c");
+	ApeTask *app_link = find_test_task(fx.app, "app");
+	ApeTask *lib_archive = find_test_task(lib, ".a");
+	ASSERT_NOT_NULL(app_compile);
+	ASSERT_NOT_NULL(app_link);
+	ASSERT_NOT_NULL(lib_archive);
+	ASSERT(app_compile->start_ms < lib_archive->start_ms);
+	ASSERT(app_link->start_ms >= lib_archive->start_ms + lib_archive->duration_ms);
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_jobserver)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	ape_ctx_set_parallel(&fx.ctx, 4);
+	ape_builder_add_source(fx.app, fixture_keep(&fx, write_big_source(fx.dir)));
+
+	/* A parent jobserver with one slot besides the implicit one */
+	char *fifo = fixture_path(&fx, "jobs", NULL);
+	ASSERT_EQ(mkfifo(fifo, 0600), 0);
+	int fd = open(fifo, O_RDWR | O_NONBLOCK);
+	ASSERT(fd >= 0);
+	ASSERT_EQ(write(fd, "+", 1), 1);
+	char *makeflags = fixture_keep(&fx, ape_str_concat("--jobserver-auth=fifo:", fifo));
+	setenv("MAKEFLAGS", makeflags, 1);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+
+	/* Every slot taken from the parent was handed back */
+	char tokens[8];
+	ASSERT_EQ(read(fd, tokens, sizeof(tokens)), 1);
+	ASSERT_STR_EQ(getenv("MAKEFLAGS"), makeflags);
+	close(fd);
+
+	/* A top-level build serves its own jobserver only while it runs */
+	unsetenv("MAKEFLAGS");
+	ASSERT(ape_ctx_rebuild(&fx.ctx, fx.app));
+	ASSERT_NULL(getenv("MAKEFLAGS"));
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_throttle)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	ape_ctx_set_parallel(&fx.ctx, 4);
+	ape_ctx_set_memory_throttle(&fx.ctx, 1);
+
+	/* Any load is too much, so tasks run one at a time but the build still finishes */
+	ape_ctx_set_max_load(&fx.ctx, 0.000001);
+	ape_builder_add_source(fx.app, fixture_keep(&fx, write_big_source(fx.dir)));
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+
+	ApeTask *main_task = find_test_task(fx.app, "main.c");
+	ApeTask *big_task = find_test_task(fx.app, "big.c");
+	ASSERT_NOT_NULL(main_task);
+	ASSERT_NOT_NULL(big_task);
+	ASSERT(big_task->peak_rss_kb > 0);
+	if (ape_fs_exists("/proc/loadavg"))
+		ASSERT(main_task->start_ms >= big_task->start_ms + big_task->duration_ms);
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_trace)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	char *trace_path = fixture_out_path(&fx, "trace.json");
+	ape_ctx_set_parallel(&fx.ctx, 2);
+	ape_ctx_set_trace_file(&fx.ctx, trace_path);
+	ape_builder_add_source(fx.app, fixture_keep(&fx, write_big_source(fx.dir)));
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+
+	/* Tasks that ran have their resources and a slot */
+	ApeTask *big_task = find_test_task(fx.app, "big.c");
+	ASSERT_NOT_NULL(big_task);
+	ASSERT(big_task->slot >= 0);
+	ASSERT(big_task->user_ms + big_task->sys_ms > 0);
+
+	char *trace = fixture_keep(&fx, ape_fs_read_file(trace_path, NULL));
+	ASSERT_NOT_NULL(trace);
+	ASSERT(ape_str_starts_with(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	ASSERT(strstr(trace, "\"cat\":\"compile\",\"ph\":\"X\"") != NULL);
+	ASSERT(strstr(trace, "\"cat\":\"link\"") != NULL);
+	ASSERT(strstr(trace, "{\"name\":\"slot 0\"}") != NULL);
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+/* Statuses of the app builder's compile tasks after a build, sources counts the ones in a unity batch */
+static int count_compiles(ApeBuilderHandle app, ApeTaskStatus status, size_t *sources)
+{
+	int count = 0;
+	ApeBuilder *builder = ape_builder_get(app);
+	for (size_t i = 0; i < builder->tasks.count; i++) {
+		ApeTask *task = ape_task_get(builder->tasks.items[i]);
+		if (task->type != APE_TASK_TYPE_COMPILE || task->status != status)
+			continue;
+		count++;
+		if (strstr(task->input, "_unity_"))
+			sscanf(strchr(task->name, '('), "(%zu", sources);
+	}
+	return count;
+}
+
+TEST(build_unity)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	char *main_path = fixture_path(&fx, "main.c", NULL);
+	char *a_path = fixture_path(&fx, "a.c", "static int local(void) { return 1; }\nint a(void) { return local(); }\n");
+	char *b_path = fixture_path(&fx, "b.c", "int b(void) { return 2; }\n");
+
+	/* All three sources go through one compile */
+	ape_builder_add_source(fx.app, a_path);
+	ape_builder_add_source(fx.app, b_path);
+	ape_builder_set_unity(fx.app, 1);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	size_t sources = 0;
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 1);
+	ASSERT_EQ(sources, (size_t)3);
+	ASSERT_FILE_EXISTS(fixture_out_path(&fx, "app_unity_0.c"));
+
+	/* A source edited after the batch was compiled leaves it and compiles alone */
+	ApeTask *batch = find_test_task(fx.app, "app_unity_0.c");
+	ASSERT_NOT_NULL(batch);
+	struct utimbuf compiled = { .actime = 1000000000, .modtime = 1000000000 };
+	struct utimbuf edited = { .actime = 1000000100, .modtime = 1000000100 };
+	struct utimbuf untouched = { .actime = 999999900, .modtime = 999999900 };
+	ASSERT_EQ(utime(main_path, &untouched), 0);
+	ASSERT_EQ(utime(b_path, &untouched), 0);
+	ASSERT_EQ(utime(batch->output, &compiled), 0);
+	ASSERT_EQ(utime(a_path, &edited), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 2);
+	ASSERT_EQ(sources, (size_t)2);
+
+	/* and stays out, so the next edit only recompiles it */
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_SKIPPED, &sources), 2);
+
+	/* Editing another member swaps the two, after which nothing is compiled */
+	struct utimbuf later = { .actime = time(NULL) + 100, .modtime = time(NULL) + 100 };
+	ASSERT_EQ(utime(b_path, &later), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 2);
+	ASSERT_EQ(sources, (size_t)2);
+	ASSERT_NOT_NULL(find_test_task(fx.app, "b.c"));
+	ASSERT(find_test_task(fx.app, "a.c") == NULL);
+	for (int run = 0; run < 2; run++) {
+		ape_builder_get(fx.app)->built = 0;
+		ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+		ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 0);
+	}
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_pch)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	char *common_path =
+		fixture_path(&fx, "common.h", "#ifndef COMMON_H\n#define COMMON_H\nstatic inline int common(void) { return 0; }\n#endif\n");
+
+	/* a.c never includes common.h, it compiles only because the PCH comes first */
+	ape_builder_add_source(fx.app, fixture_path(&fx, "a.c", "int a(void) { return common(); }\n"));
+	ape_builder_add_cflag(fx.app, "-Winvalid-pch");
+	ape_builder_add_cflag(fx.app, "-Werror");
+	ape_builder_set_pch(fx.app, common_path);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ApeTask *pch = find_test_task(fx.app, "common.h.gch");
+	ASSERT_NOT_NULL(pch);
+	ASSERT_EQ(pch->type, APE_TASK_TYPE_PCH);
+	ASSERT_FILE_EXISTS(pch->output);
+	size_t sources = 0;
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 2);
+	ApeTask *compile = find_test_task(fx.app, "a.c");
+	ASSERT_NOT_NULL(compile);
+	ASSERT_EQ(compile->deps.count, (size_t)1);
+	ASSERT_EQ(ape_task_get(compile->deps.items[0]), pch);
+
+	/* Nothing changed */
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(find_test_task(fx.app, "common.h.gch")->status, APE_TASK_SKIPPED);
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_SKIPPED, &sources), 2);
+
+	/* Headers read back from the database don't replace the PCH input */
+	compile = find_test_task(fx.app, "a.c");
+	ASSERT(compile->deps_known);
+	ASSERT_EQ(compile->inputs.count, (size_t)1);
+	ASSERT_STR_EQ(compile->inputs.items[0], find_test_task(fx.app, "common.h.gch")->output);
+
+	/* Editing the header rebuilds the PCH and every compile that used it */
+	struct utimbuf edited = { .actime = time(NULL) + 100, .modtime = time(NULL) + 100 };
+	ASSERT_EQ(utime(common_path, &edited), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(find_test_task(fx.app, "common.h.gch")->status, APE_TASK_COMPLETED);
+	ASSERT_EQ(count_compiles(fx.app, APE_TASK_COMPLETED, &sources), 2);
+
+	/* Clean takes the PCH with it */
+	char *pch_dir = fixture_out_path(&fx, "app_pch");
+	ASSERT(ape_fs_is_dir(pch_dir));
+	ASSERT(ape_ctx_clean(&fx.ctx, fx.app));
+	ASSERT(!ape_fs_exists(pch_dir));
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
+/* Writes an a.c large enough to be scheduled before the other sources */
+static void write_pch_source(const char *path, const char *body)
+{
+	ApeStrBuilder sb = ape_sb_new();
+	for (int i = 0; i < 2000; i++)
+		ape_sb_append_fmt(&sb, "int a_%d(int x) { return x * %d + VAL; }\n", i, i);
+	ape_sb_append_str(&sb, body);
+	ape_fs_write_file(path, sb.items, sb.count);
+	ape_sb_free(&sb);
+}
+
+TEST(build_pch_failed_compile)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	ape_ctx_set_parallel(&fx.ctx, 1);
+	char *common_path = fixture_path(&fx, "common.h", "#ifndef COMMON_H\n#define COMMON_H\n#define VAL 1\n#endif\n");
+	fixture_path(&fx, "main.c", "int a(void);\nint b(void);\nint main(void) { return a() == b() ? 0 : 1; }\n");
+	char *a_path = fixture_path(&fx, "a.c", NULL);
+	write_pch_source(a_path, "int a(void) { return VAL; }\n");
+
+	ape_builder_add_source(fx.app, a_path);
+	ape_builder_add_source(fx.app, fixture_path(&fx, "b.c", "int b(void) { return VAL; }\n"));
+	ape_builder_set_pch(fx.app, common_path);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ApeCmd run = ape_cmd_from(fixture_keep(&fx, ape_builder_output_path(fx.app)));
+	ASSERT(ape_cmd_run(&run));
+
+	/* The header changes while a.c is broken: the PCH is rebuilt, a.c fails before b.c runs */
+	sleep(1); /* the rebuilt PCH needs a different mtime */
+	fixture_path(&fx, "common.h", "#ifndef COMMON_H\n#define COMMON_H\n#define VAL 2\n#endif\n");
+	write_pch_source(a_path, "int a(void) { return }\n");
+	struct utimbuf edited = { .actime = time(NULL) + 100, .modtime = time(NULL) + 100 };
+	ASSERT_EQ(utime(common_path, &edited), 0);
+	ASSERT_EQ(utime(a_path, &edited), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(!ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(find_test_task(fx.app, "common.h.gch")->status, APE_TASK_COMPLETED);
+	ASSERT(find_test_task(fx.app, "b.c")->status != APE_TASK_COMPLETED);
+
+	/* Fixing a.c also rebuilds b.c, which still has to pick up the new PCH */
+	write_pch_source(a_path, "int a(void) { return VAL; }\n");
+	struct utimbuf fixed = { .actime = time(NULL) + 200, .modtime = time(NULL) + 200 };
+	ASSERT_EQ(utime(a_path, &fixed), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(find_test_task(fx.app, "b.c")->status, APE_TASK_COMPLETED);
+	ASSERT(ape_cmd_run(&run));
+
+	ape_cmd_free(&run);
+	fixture_free(&fx);
+	return PASSED;
+}
+
+TEST(build_compile_commands)
+{
+	BuildFixture fx;
+	ASSERT(fixture_init(&fx));
+	char *db_path = fixture_path(&fx, "compile_commands.json", NULL);
+	char *b_path = fixture_path(&fx, "b.c", "int b(void) { return 2; }\n");
+	ape_ctx_set_compile_commands(&fx.ctx, db_path);
+
+	ApeBuilderHandle lib = ape_builder_new("lib");
+	ape_builder_set_type(lib, APE_TARGET_STATIC_LIB);
+	ape_builder_add_source(lib, b_path);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	char *db = fixture_keep(&fx, ape_fs_read_file(db_path, NULL));
+	ASSERT_NOT_NULL(db);
+	ASSERT(strstr(db, "\"arguments\": [\"gcc\"") != NULL);
+	ASSERT(strstr(db, "main.c\", \"output\": ") != NULL);
+	ASSERT(strstr(db, "b.c") == NULL);
+
+	/* Unchanged commands leave the file alone */
+	struct utimbuf old = { .actime = 1000000000, .modtime = 1000000000 };
+	ASSERT_EQ(utime(db_path, &old), 0);
+	ape_builder_get(fx.app)->built = 0;
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	ASSERT_EQ(ape_fs_mtime(db_path), (time_t)1000000000);
+
+	/* Another builder adds its entries next to the first one's */
+	ASSERT(ape_ctx_build(&fx.ctx, lib));
+	db = fixture_keep(&fx, ape_fs_read_file(db_path, NULL));
+	ASSERT(strstr(db, "main.c\", \"output\": ") != NULL);
+	ASSERT(strstr(db, "b.c\", \"output\": ") != NULL);
+
+	/* A changed command is rewritten, a deleted source is dropped */
+	ape_builder_add_define(fx.app, "APE_CDB_TEST");
+	ape_builder_get(fx.app)->built = 0;
+	ape_fs_remove(b_path);
+	ASSERT(ape_ctx_build(&fx.ctx, fx.app));
+	db = fixture_keep(&fx, ape_fs_read_file(db_path, NULL));
+	ASSERT(strstr(db, "\"-DAPE_CDB_TEST\"") != NULL);
+	ASSERT(strstr(db, "b.c") == NULL);
+
+	/* Unity batch members get an entry each, without the precompiled header */
+	ApeBuilderHandle uni = ape_builder_new("uni");
+	ape_builder_set_type(uni, APE_TARGET_STATIC_LIB);
+	ape_builder_add_source(uni, fixture_path(&fx, "c.c", "int c(void) { return util(); }\n"));
+	ape_builder_add_source(uni, fixture_path(&fx, "d.c", "int d(void) { return util(); }\n"));
+	ape_builder_set_unity(uni, 1);
+	ape_builder_set_pch(uni, fixture_path(&fx, "util.h", NULL));
+	ASSERT(ape_ctx_build(&fx.ctx, uni));
+	db = fixture_keep(&fx, ape_fs_read_file(db_path, NULL));
+	ASSERT(strstr(db, "c.c\", \"output\": ") != NULL);
+	ASSERT(strstr(db, "d.c\", \"output\": ") != NULL);
+	ASSERT(strstr(db, "_unity_0.c\"") == NULL);
+	ASSERT(strstr(db, "\"-include") == NULL);
+
+	fixture_free(&fx);
+	return PASSED;
+}
+
 /* ============================================================================
  * Test Runner
  * ============================================================================ */
@@ -934,6 +1885,7 @@ static void run_sb_tests(void)
 	printf("String builder tests:\n");
 	RUN_TEST(sb_basic);
 	RUN_TEST(sb_fmt);
+	RUN_TEST(sb_json_str);
 	RUN_TEST(sb_prepend);
 	printf("\n");
 }
@@ -963,6 +1915,8 @@ static void run_fs_tests(void)
 	RUN_TEST(fs_is_dir);
 	RUN_TEST(fs_write_read);
 	RUN_TEST(fs_needs_rebuild);
+	RUN_TEST(fs_iterdir_r);
+	RUN_TEST(fs_glob);
 	printf("\n");
 }
 
@@ -975,7 +1929,10 @@ static void run_cmd_tests(void)
 	RUN_TEST(cmd_run);
 	RUN_TEST(cmd_run_capture);
 	RUN_TEST(cmd_async);
+	RUN_TEST(cmd_wait_any);
+	RUN_TEST(cmd_captured);
 	RUN_TEST(cmd_cwd);
+	RUN_TEST(cmd_env);
 	printf("\n");
 }
 
@@ -1004,6 +1961,34 @@ static void run_emcc_tests(void)
 	printf("\n");
 }
 
+static void run_hash_tests(void)
+{
+	printf("Hash module tests:\n");
+	RUN_TEST(hash_xxh64);
+	RUN_TEST(hash_incremental);
+	printf("\n");
+}
+
+static void run_build_tests(void)
+{
+	printf("Build module tests:\n");
+	RUN_TEST(build_cache_hit);
+	RUN_TEST(depfile_parse);
+	RUN_TEST(build_header_deps);
+	RUN_TEST(build_log);
+	RUN_TEST(build_handles);
+	RUN_TEST(build_schedule);
+	RUN_TEST(build_across_builders);
+	RUN_TEST(build_jobserver);
+	RUN_TEST(build_throttle);
+	RUN_TEST(build_trace);
+	RUN_TEST(build_unity);
+	RUN_TEST(build_pch);
+	RUN_TEST(build_pch_failed_compile);
+	RUN_TEST(build_compile_commands);
+	printf("\n");
+}
+
 int main(void)
 {
 	ape_log_init();
@@ -1017,6 +2002,8 @@ int main(void)
 	run_cmd_tests();
 	run_log_tests();
 	run_emcc_tests();
+	run_hash_tests();
+	run_build_tests();
 
 	ape_log_info("Tests finished");
 	ape_log_info("%d Total", tests_run);
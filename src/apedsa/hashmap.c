@@ -665,10 +665,12 @@ void *__apedsa_hashmap_free_internal(void *a, size_t kv_size)
 	char *da = a;
 	a = (char *)a - kv_size;
 	ApedsaHashIndex *table = (ApedsaHashIndex *)apedsa_da_header(a)->aux;
-	if (table != NULL)
+	if (table != NULL) {
+		apedsa_string_arena_reset(&table->string);
 		APEDSA_FREE(table);
-	APEDSA_FREE(a);
-	return a;
+	}
+	APEDSA_FREE(apedsa_da_header(a));
+	return NULL;
 }
 
 float apedsa_hashmap_load_factor(void *a, size_t kv_size)
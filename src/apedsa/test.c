@@ -129,6 +129,18 @@ TEST(da_delete_middle)
 	return PASSED;
 }
 
+TEST(da_free)
+{
+	int *arr = NULL;
+	for (int i = 0; i < 100; i++) {
+		apedsa_da_push(arr, i);
+	}
+	apedsa_da_free(arr);
+	ASSERT_TRUE(arr == NULL);
+	ASSERT_EQ(apedsa_da_count(arr), 0);
+	return PASSED;
+}
+
 static void run_da_tests(void)
 {
 	LOG_INFO("DA tests:");
@@ -140,6 +152,7 @@ static void run_da_tests(void)
 	RUN_TEST(da_delete_first);
 	RUN_TEST(da_delete_last);
 	RUN_TEST(da_delete_middle);
+	RUN_TEST(da_free);
 }
 
 typedef struct {
@@ -535,6 +548,20 @@ TEST(hm_stats)
 	return PASSED;
 }
 
+TEST(shm_free)
+{
+	Kv *map = NULL;
+	char key[16];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		apedsa_shm_put(map, key, i);
+	}
+	apedsa_shm_free(map);
+	ASSERT_TRUE(map == NULL);
+	ASSERT_EQ(apedsa_shm_len(map), 0);
+	return PASSED;
+}
+
 static void run_hm_tests(void)
 {
 	LOG_INFO("HM tests:");
@@ -563,6 +590,7 @@ static void run_hm_tests(void)
 	RUN_TEST(shm_string_values);
 	RUN_TEST(hm_custom_hash);
 	RUN_TEST(hm_stats);
+	RUN_TEST(shm_free);
 }
 
 int main(void)
@@ -0,0 +1,308 @@
+#ifndef APELEXER_INCLUDED
+#define APELEXER_INCLUDED
+
+#define APELEXER_VERSION_MAJOR 0
+#define APELEXER_VERSION_MINOR 4
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#define APELEXER_WINDOWS
+#if defined(_WIN64)
+#define APELEXER_WINDOWS_X64
+#endif
+#elif defined(__linux__) || defined(__unix__)
+#define APELEXER_LINUX
+#elif defined(__APPLE__)
+#define APELEXER_APPLE
+#endif
+
+#ifndef APELEXER_MALLOC
+#if defined(APELEXER_REALLOC) || defined(APELEXER_FREE)
+#pragma GCC error "Need to define MALLOC, REALLOC and FREE or none of them"
+#else
+#include <stdlib.h>
+#define APELEXER_MALLOC malloc
+#define APELEXER_REALLOC realloc
+#define APELEXER_FREE free
+#endif
+#else
+#if !defined(APELEXER_REALLOC) || !defined(APELEXER_FREE)
+#pragma GCC error "Need to define MALLOC, REALLOC and FREE or none of them"
+#endif
+#endif
+
+#ifndef APELEXER_ASSERT
+#ifdef APELEXER_USE_STDLIB_ASSERT
+#include <assert.h>
+#define APELEXER_ASSERT(c) assert(c)
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#define APELEXER_ASSERT(c)                                                                 \
+	if (!(c)) {                                                                        \
+		fprintf(stderr, "%s:%d Assertion '%s' failed\n", __FILE__, __LINE__, ##c); \
+		exit(1);                                                                   \
+	}
+#endif
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+	APELEXER_TOKEN_NONE,
+	APELEXER_TOKEN_KEYWORD,
+	APELEXER_TOKEN_IDENTIFIER,
+	APELEXER_TOKEN_INT,
+	APELEXER_TOKEN_FLOAT,
+	APELEXER_TOKEN_CHAR,
+	APELEXER_TOKEN_STRING,
+	APELEXER_TOKEN_OPERATOR,
+	APELEXER_TOKEN_PREPROCESSOR,
+	APELEXER_TOKEN_OPEN_PAREN,
+	APELEXER_TOKEN_CLOSE_PAREN,
+	APELEXER_TOKEN_OPEN_BRACKET,
+	APELEXER_TOKEN_CLOSE_BRACKET,
+	APELEXER_TOKEN_OPEN_BRACE,
+	APELEXER_TOKEN_CLOSE_BRACE,
+	APELEXER_TOKEN_COMMA,
+	APELEXER_TOKEN_SEMICOLON,
+	APELEXER_TOKEN_COLON,
+	APELEXER_TOKEN_DOT,
+	APELEXER_TOKEN_ARROW,
+	APELEXER_TOKEN_EOF,
+} ApelexerTokenType;
+
+typedef struct ApelexerToken {
+	ApelexerTokenType type;
+	char *value;
+	size_t length;
+	size_t start_line;
+	size_t start_column;
+	size_t end_line;
+	size_t end_column;
+} ApelexerToken;
+
+/* Decoded value of an INT or FLOAT token */
+typedef union ApelexerNumber {
+	uint64_t i;
+	double f;
+} ApelexerNumber;
+
+/*
+ * Language definitions
+ *
+ * The lexer is driven by a compiled language: a character class table, an operator
+ * trie and a perfect hash of the keywords, all built once by apelexer_language_compile().
+ * Every function taking a language accepts NULL for the built-in C language
+ * (C99 keywords, C operators, // and block comments, '#' preprocessor lines).
+ */
+typedef struct {
+	const char *text;
+	ApelexerTokenType type;
+} ApelexerOperatorDef;
+
+typedef struct ApelexerLanguageSpec {
+	const char *const *keywords;
+	size_t keyword_count;
+	const ApelexerOperatorDef *operators; /* ASCII only, the longest match wins */
+	size_t operator_count;
+	const char *line_comment;	/* NULL if the language has no line comments */
+	const char *block_comment_open; /* NULL if the language has no block comments */
+	const char *block_comment_close;
+	char string_quote;	      /* 0 if the language has no strings */
+	char char_quote;	      /* 0 if the language has no character literals */
+	int escapes;		      /* Backslash escapes in strings and character literals */
+	int preprocessor;	      /* '#' in the first column starts a preprocessor line */
+	int number_prefixes;	      /* 0x, 0b and 0o integer prefixes */
+	int number_floats;	      /* Fractions and exponents */
+	int decode_numbers;	      /* Decode INT and FLOAT tokens while lexing, see apelexer_token_number() */
+	const char *identifier_chars; /* Allowed after the first character of an identifier besides [A-Za-z0-9_] */
+} ApelexerLanguageSpec;
+
+typedef struct ApelexerLanguage ApelexerLanguage;
+
+/* Returns NULL if the spec is invalid, e.g. lists a keyword twice. The strings in spec are not copied and must outlive the language */
+extern ApelexerLanguage *apelexer_language_compile(const ApelexerLanguageSpec *spec);
+extern void apelexer_language_free(ApelexerLanguage *lang);
+/* The built-in C language, compiled on first use */
+extern const ApelexerLanguage *apelexer_language_c(void);
+
+/*
+ * DFA lexer generator
+ *
+ * Token rules are regex-like patterns compiled into a single minimized DFA. Patterns support
+ * literal bytes, '.' (any byte but a newline), [a-z] and [^...] classes, the \d \w \s \n \r \t
+ * escapes (any other escaped byte is literal), grouping, '|', '*', '+' and '?'. The longest
+ * match wins and ties go to the earliest rule. Rules of type APELEXER_TOKEN_NONE are matched
+ * but not emitted, which is how whitespace and comments are skipped.
+ */
+typedef struct ApelexerRule {
+	const char *pattern;
+	ApelexerTokenType type;
+} ApelexerRule;
+
+typedef struct ApelexerDfa ApelexerDfa;
+
+typedef enum {
+	APELEXER_DFA_EMIT_TABLES, /* Transition tables driven by a loop */
+	APELEXER_DFA_EMIT_DIRECT, /* A label per state with a switch on the next byte (re2c style) */
+} ApelexerDfaEmitStyle;
+
+/* Returns NULL if a pattern is invalid or matches the empty string */
+extern ApelexerDfa *apelexer_dfa_compile(const ApelexerRule *rules, size_t rule_count);
+extern void apelexer_dfa_free(ApelexerDfa *dfa);
+/* Number of states, including the dead state */
+extern size_t apelexer_dfa_state_count(const ApelexerDfa *dfa);
+/* Length of the longest match at input[0, len) (0 if none), the index of the matching rule is stored in rule */
+extern size_t apelexer_dfa_match(const ApelexerDfa *dfa, const char *input, size_t len, int *rule);
+extern ApelexerToken *apelexer_dfa_tokenize(const ApelexerDfa *dfa, const char *input, size_t len, size_t *token_count);
+/* Writes a standalone C matcher `static int name(const char *s, size_t n, size_t *len)` which returns
+ * the index of the rule with the longest match at s (-1 if none) and stores the match length in len */
+extern void apelexer_dfa_emit_c(const ApelexerDfa *dfa, FILE *out, const char *name, ApelexerDfaEmitStyle style);
+
+/*
+ * Identifier interning
+ *
+ * A symbol table maps every distinct identifier to a dense ID starting at 1, so later passes
+ * can compare and hash names as integers. The value of an interned token points to the name
+ * stored in the table (shared by every occurrence) and stays valid until the table is freed.
+ */
+#define APELEXER_NO_SYMBOL 0
+
+typedef struct ApelexerSymbols ApelexerSymbols;
+
+extern ApelexerSymbols *apelexer_symbols_new(void);
+extern void apelexer_symbols_free(ApelexerSymbols *symbols);
+/* ID of name[0, len), interning it if it's new */
+extern uint32_t apelexer_symbols_intern(ApelexerSymbols *symbols, const char *name, size_t len);
+/* NUL-terminated name of a symbol, NULL if the ID is invalid */
+extern const char *apelexer_symbols_name(const ApelexerSymbols *symbols, uint32_t id);
+extern size_t apelexer_symbols_count(const ApelexerSymbols *symbols);
+
+/*
+ * Token arrays returned by the tokenize functions own the values of their tokens, they are
+ * allocated in a few large blocks and released together with apelexer_free_tokens().
+ */
+extern ApelexerToken *apelexer_tokenize(const char *input, size_t *token_count);
+extern ApelexerToken *apelexer_tokenize_lang(const ApelexerLanguage *lang, const char *input, size_t *token_count);
+/* Like apelexer_tokenize_lang(), identifiers are interned into symbols */
+extern ApelexerToken *apelexer_tokenize_interned(const ApelexerLanguage *lang, ApelexerSymbols *symbols, const char *input,
+						 size_t *token_count);
+extern void apelexer_free_tokens(ApelexerToken *tokens);
+extern char *apelexer_token_type_to_string(ApelexerTokenType type);
+/* Symbol ID of tokens[index] of a returned token array, APELEXER_NO_SYMBOL if it wasn't interned */
+extern uint32_t apelexer_token_symbol(const ApelexerToken *tokens, size_t index);
+/* Value of tokens[index] if it is a number of a language with decode_numbers set, 0 otherwise */
+extern ApelexerNumber apelexer_token_number(const ApelexerToken *tokens, size_t index);
+
+/*
+ * Number decoding, used by languages with decode_numbers set and usable on any token value
+ * (eg. from a compact token list). Integers are decimal unless they start with 0x, 0b or 0o.
+ * Floats are decoded exactly with a fast path for up to 15-16 significant digits and
+ * strtod() (which follows LC_NUMERIC) otherwise. Both return APELEXER_FALSE if s[0, len)
+ * isn't a valid literal or an integer doesn't fit in 64 bits
+ */
+extern int apelexer_parse_int(const char *s, size_t len, uint64_t *value);
+extern int apelexer_parse_float(const char *s, size_t len, double *value);
+
+/*
+ * Tokenize input[0, len) on up to `threads` worker threads (0 = one per CPU).
+ * The input is split at newlines that can't be inside a token, each chunk is lexed
+ * independently and the results are concatenated with line numbers fixed up, so the
+ * output is identical to apelexer_tokenize(). Small inputs are lexed on the calling thread.
+ */
+extern ApelexerToken *apelexer_tokenize_parallel(const ApelexerLanguage *lang, const char *input, size_t len, size_t *token_count,
+						 int threads);
+
+/*
+ * Compact (struct-of-arrays) token output
+ *
+ * Stores 9 bytes per token instead of a full ApelexerToken and doesn't copy values:
+ * token i's value is input[offsets[i], offsets[i] + lengths[i]). Positions are computed
+ * on demand from an index of line start offsets. Input must be smaller than 4 GiB.
+ */
+typedef struct ApelexerTokenList {
+	uint8_t *types; /* ApelexerTokenType */
+	uint32_t *offsets;
+	uint32_t *lengths;
+	size_t count;
+	size_t capacity;
+	uint32_t *line_starts; /* Offset of the first byte of every line */
+	size_t line_count;
+} ApelexerTokenList;
+
+/* Returns APELEXER_FALSE if the input is too large */
+extern int apelexer_tokenize_compact(const ApelexerLanguage *lang, const char *input, size_t len, ApelexerTokenList *list);
+/* 1-based line and column of the first byte of token index's value */
+extern void apelexer_token_list_position(const ApelexerTokenList *list, size_t index, size_t *line, size_t *column);
+extern void apelexer_token_list_free(ApelexerTokenList *list);
+
+/*
+ * Pull-based tokenizer
+ *
+ * Input is either pushed with apelexer_feed() (and closed with apelexer_finish())
+ * or pulled through a reader callback set with apelexer_set_reader(). Tokens never
+ * span an unescaped newline, so only complete lines are lexed; the trailing partial
+ * line of a chunk is carried over until more input arrives.
+ *
+ * Tokens returned by apelexer_next() point into lexer-owned memory and stay valid
+ * until the next call to apelexer_next() or apelexer_free().
+ */
+
+/* Reads up to cap bytes into buf, returns the number of bytes read (0 = end of input) */
+typedef size_t (*ApelexerReadFn)(void *user, char *buf, size_t cap);
+
+typedef enum {
+	APELEXER_NEXT_TOKEN,	  /* A token was written to tok */
+	APELEXER_NEXT_NEED_INPUT, /* More input is required, call apelexer_feed() or apelexer_finish() */
+	APELEXER_NEXT_DONE,	  /* All input was consumed */
+} ApelexerNextResult;
+
+typedef struct ApelexerCtx {
+	ApelexerReadFn read;
+	void *read_user;
+	char *buf; /* Buffered input, always NUL-terminated */
+	size_t buf_len;
+	size_t buf_cap;
+	size_t pos;   /* Scan position inside buf */
+	size_t limit; /* End of the region that can be lexed without more input */
+	size_t line;
+	size_t column;
+	int eof;
+	const ApelexerLanguage *lang;
+	ApelexerSymbols *symbols; /* Identifiers are interned if set */
+	ApelexerToken *tokens;	  /* Result of apelexer_tokenize_ctx(), reused by the next run */
+	char *value;		  /* NUL-terminated copy of the last token's value */
+	size_t value_cap;
+	uint32_t symbol;       /* Symbol ID of the last token returned by apelexer_next() */
+	ApelexerNumber number; /* Decoded value of the last token returned by apelexer_next() */
+} ApelexerCtx;
+
+extern void apelexer_init(ApelexerCtx *ctx);
+extern void apelexer_set_reader(ApelexerCtx *ctx, ApelexerReadFn read, void *user);
+extern void apelexer_set_language(ApelexerCtx *ctx, const ApelexerLanguage *lang);
+extern void apelexer_set_symbols(ApelexerCtx *ctx, ApelexerSymbols *symbols);
+extern void apelexer_feed(ApelexerCtx *ctx, const char *data, size_t len);
+extern void apelexer_finish(ApelexerCtx *ctx);
+extern ApelexerNextResult apelexer_next(ApelexerCtx *ctx, ApelexerToken *tok);
+/* Tokenizes input[0, len) with ctx's language and symbols into memory owned by ctx. The tokens
+ * stay valid until the next apelexer_tokenize_ctx(), apelexer_reset() or apelexer_free() */
+extern ApelexerToken *apelexer_tokenize_ctx(ApelexerCtx *ctx, const char *input, size_t len, size_t *token_count);
+/* Discards the input and tokens of ctx but keeps its memory (and settings) for the next run */
+extern void apelexer_reset(ApelexerCtx *ctx);
+extern void apelexer_free(ApelexerCtx *ctx);
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#if defined(APELEXER_STRIP_PREFIX)
+
+#endif
+
+#endif
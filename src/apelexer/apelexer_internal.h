@@ -0,0 +1,170 @@
+#include "apelexer_api.h"
+#ifndef APELEXER_IMPLEMENTATION_INCLUDED
+#define APELEXER_IMPLEMENTATION_INCLUDED
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <float.h>
+
+/* Define APELEXER_NO_THREADS to make apelexer_tokenize_parallel always run on the calling thread */
+#if !defined(APELEXER_NO_THREADS) && (defined(APELEXER_LINUX) || defined(APELEXER_APPLE))
+#define APELEXER_HAS_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* User can define a custom function prefix (eg. static) */
+#ifndef APELEXER_DEF
+#define APELEXER_DEF
+#endif
+
+/* Can also define custom private function prefix */
+#ifndef APELEXER_PRIVATE
+#define APELEXER_PRIVATE static
+#endif
+
+#ifndef APELEXER_TRUE
+#define APELEXER_TRUE (1)
+#define APELEXER_FALSE (0)
+#else
+#if !defined(APELEXER_FALSE)
+#pragma GCC error "Need to define both APELEXER_TRUE and APELEXER_FALSE or neither"
+#endif
+#endif
+
+typedef enum {
+	APELEXER_ERROR_NONE,
+	APELEXER_ERROR_UNEXPECTED_CHAR,
+	APELEXER_ERROR_UNEXPECTED_EOF,
+	APELEXER_ERROR_QUOTED_QUOTE,
+	APELEXER_ERROR_UNEXPECTED_NEWLINE,
+	APELEXER_ERROR_UNTERMINATED_STRING,
+	APELEXER_ERROR_CHAR_TOO_LONG,
+	APELEXER_ERROR_INVALID_FLOAT,
+	APELEXER_ERROR_INVALID_NUMBER,
+	APELEXER_ERROR_INVALID_CHAR,
+	APELEXER_ERROR_UNTERMINATED_COMMENT,
+	APELEXER_ERROR_NUMBER_TOO_LARGE,
+	APELEXER_ERROR_MALFORMED_NUMBER,
+} ApelexerErrorType;
+
+/* Prints the error and exits */
+APELEXER_DEF void apelexer_error(ApelexerErrorType type, size_t line, size_t column);
+
+/* Character classes of a compiled language */
+#define APELEXER_CLASS_NEWLINE (1 << 0)
+#define APELEXER_CLASS_SPACE (1 << 1)
+#define APELEXER_CLASS_DIGIT (1 << 2)
+#define APELEXER_CLASS_IDENT_START (1 << 3)
+#define APELEXER_CLASS_IDENT (1 << 4)
+#define APELEXER_CLASS_OPERATOR (1 << 5) /* First character of an operator */
+#define APELEXER_CLASS_COMMENT (1 << 6)	 /* First character of a comment delimiter */
+
+struct ApelexerLanguage {
+	ApelexerLanguageSpec spec;
+	uint8_t char_class[256];
+	size_t line_comment_len; /* 0 if disabled */
+	size_t block_open_len;	 /* 0 if disabled */
+	size_t block_close_len;
+	uint16_t (*op_next)[128]; /* Operator trie transitions, 0 = no edge */
+	uint8_t *op_accept;	  /* Token type accepted in each trie state, APELEXER_TOKEN_NONE if none */
+	size_t op_states;
+	int32_t *kw_slots; /* Perfect hash slot -> keyword index, -1 if empty */
+	uint32_t kw_mask;
+	uint32_t kw_seed;
+};
+
+typedef struct ApelexerArenaBlock {
+	struct ApelexerArenaBlock *next;
+	size_t size;
+	size_t used;
+	char data[];
+} ApelexerArenaBlock;
+
+/* Storage for token values. Resetting keeps the blocks so the next run reuses them */
+typedef struct {
+	ApelexerArenaBlock *head;
+	ApelexerArenaBlock *current; /* Blocks after the current one are free */
+} ApelexerArena;
+
+/* NUL-terminated copy of s[0, len) */
+APELEXER_DEF char *apelexer_arena_strdup(ApelexerArena *arena, const char *s, size_t len);
+APELEXER_DEF void apelexer_arena_reset(ApelexerArena *arena);
+APELEXER_DEF void apelexer_arena_release(ApelexerArena *arena);
+/* Moves all of from's blocks into to */
+APELEXER_DEF void apelexer_arena_append(ApelexerArena *to, ApelexerArena *from);
+
+/* Token arrays handed out to the user are preceded by this header, their values live in its arena.
+ * Symbols and numbers are kept in side arrays so tokens that don't need them stay small */
+typedef struct {
+	ApelexerArena arena;
+	size_t capacity;
+	uint32_t *symbols;	 /* NULL until a token is interned */
+	ApelexerNumber *numbers; /* NULL until a number is decoded */
+} ApelexerTokensHeader;
+
+#define APELEXER_TOKENS_HEADER(tokens) ((ApelexerTokensHeader *)(tokens) - 1)
+
+/* Grows tokens (a header array or NULL) to hold at least capacity tokens */
+APELEXER_DEF ApelexerToken *apelexer_tokens_reserve(ApelexerToken *tokens, size_t capacity);
+/* Stores tok at tokens[count], its value is copied into the array's arena unless it is interned */
+APELEXER_DEF ApelexerToken *apelexer_tokens_push(ApelexerToken *tokens, size_t count, ApelexerToken tok, uint32_t symbol,
+						 ApelexerNumber number);
+/* Moves the count tokens of from (a header array, freed) to tokens[at], which must have room for them */
+APELEXER_DEF void apelexer_tokens_move(ApelexerToken *tokens, size_t at, ApelexerToken *from, size_t count);
+
+/* Appends the tokens of input[0, len) to tokens (a header array or NULL) and returns the array */
+APELEXER_DEF ApelexerToken *apelexer_tokenize_into(ApelexerToken *tokens, const ApelexerLanguage *lang, ApelexerSymbols *symbols,
+						  const char *input, size_t len, size_t *token_count);
+
+typedef struct {
+	char *key;
+	uint32_t value;
+} ApelexerSymbolEntry;
+
+struct ApelexerSymbols {
+	ApelexerSymbolEntry *map; /* apedsa string hashmap, name -> ID */
+	char **names;		  /* apedsa dynamic array, ID -> name owned by the map (0 is unused) */
+	char *scratch;		  /* NUL-terminated copy of the name being looked up */
+	size_t scratch_cap;
+};
+
+struct ApelexerDfa {
+	uint8_t byte_class[256]; /* Bytes that no pattern tells apart share a class */
+	size_t class_count;
+	size_t state_count;	  /* State 0 is the dead state and 1 the start state */
+	uint16_t *next;		  /* state_count * class_count transitions */
+	int16_t *accept;	  /* Rule accepted in each state, -1 if none */
+	ApelexerTokenType *types; /* Token type of each rule */
+	size_t rule_count;
+};
+
+APELEXER_DEF int apelexer_language_is_keyword(const ApelexerLanguage *lang, const char *s, size_t n);
+/* Length of the longest operator at s (0 if none), its token type is stored in type */
+APELEXER_DEF size_t apelexer_language_match_operator(const ApelexerLanguage *lang, const char *s, size_t n, ApelexerTokenType *type);
+
+/* Scans input[i, len), tokens never extend past len */
+typedef struct {
+	const char *input;
+	size_t len;
+	size_t i;
+	size_t line;
+	size_t column;
+	const ApelexerLanguage *lang;
+	int partial;	       /* More input may follow len, a block comment reaching len is left unscanned */
+	ApelexerNumber number; /* Decoded value of the last scanned token, 0 unless the language decodes numbers */
+} ApelexerScanner;
+
+/* Scans the next token, value points into the input and is not NUL-terminated.
+ * Returns APELEXER_FALSE when the end of the scanned region is reached, in partial mode
+ * s->i may then stop short of len at the start of an unterminated block comment. */
+APELEXER_DEF int apelexer_scan(ApelexerScanner *s, ApelexerToken *tok);
+
+/* True if input[k - 1] ends a line that no token continues past: the line break isn't
+ * escaped with a backslash and isn't the \r of a (possibly incomplete) \r\n pair */
+APELEXER_DEF int apelexer_is_line_end(const char *input, size_t len, size_t k);
+
+#define REPLACED_WITH_PRIVATE_CODE_DO_NOT_MODIFY
+
+#endif
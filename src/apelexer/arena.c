@@ -0,0 +1,184 @@
+#include "apelexer_internal.h"
+
+#define APELEXER_ARENA_BLOCK_MIN (4096 - sizeof(ApelexerArenaBlock))
+#define APELEXER_ARENA_BLOCK_MAX (1 << 20)
+
+APELEXER_DEF char *apelexer_arena_strdup(ApelexerArena *arena, const char *s, size_t len)
+{
+	size_t n = len + 1;
+	ApelexerArenaBlock *b = arena->current;
+	if (!b || b->used + n > b->size) {
+		// Move on to the next free block that is large enough, or add one after the current block
+		ApelexerArenaBlock *next = b ? b->next : arena->head;
+		while (next && next->size < n) {
+			next = next->next;
+		}
+		if (!next) {
+			size_t size = b ? b->size * 2 : APELEXER_ARENA_BLOCK_MIN;
+			if (size > APELEXER_ARENA_BLOCK_MAX)
+				size = APELEXER_ARENA_BLOCK_MAX;
+			if (size < n)
+				size = n;
+			next = APELEXER_MALLOC(sizeof(ApelexerArenaBlock) + size);
+			next->size = size;
+			if (b) {
+				next->next = b->next;
+				b->next = next;
+			} else {
+				next->next = arena->head;
+				arena->head = next;
+			}
+		}
+		next->used = 0;
+		arena->current = b = next;
+	}
+	char *p = b->data + b->used;
+	b->used += n;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+APELEXER_DEF void apelexer_arena_reset(ApelexerArena *arena)
+{
+	arena->current = arena->head;
+	if (arena->head)
+		arena->head->used = 0;
+}
+
+APELEXER_DEF void apelexer_arena_release(ApelexerArena *arena)
+{
+	ApelexerArenaBlock *b = arena->head;
+	while (b) {
+		ApelexerArenaBlock *next = b->next;
+		APELEXER_FREE(b);
+		b = next;
+	}
+	arena->head = NULL;
+	arena->current = NULL;
+}
+
+APELEXER_DEF void apelexer_arena_append(ApelexerArena *to, ApelexerArena *from)
+{
+	if (!from->head)
+		return;
+	// from's blocks go right after to's current block, so all free blocks stay behind the new current one
+	ApelexerArenaBlock *last = from->head;
+	while (last->next) {
+		last = last->next;
+	}
+	if (to->current) {
+		last->next = to->current->next;
+		to->current->next = from->head;
+	} else {
+		last->next = to->head;
+		to->head = from->head;
+	}
+	to->current = from->current ? from->current : from->head;
+	from->head = NULL;
+	from->current = NULL;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokens_reserve(ApelexerToken *tokens, size_t capacity)
+{
+	ApelexerTokensHeader *h = tokens ? APELEXER_TOKENS_HEADER(tokens) : NULL;
+	if (h && h->capacity >= capacity)
+		return tokens;
+	size_t cap = h ? h->capacity : 32;
+	while (cap < capacity) {
+		cap *= 2;
+	}
+	size_t old_cap = h ? h->capacity : 0;
+	h = APELEXER_REALLOC(h, sizeof(ApelexerTokensHeader) + sizeof(ApelexerToken) * cap);
+	if (!tokens) {
+		memset(&h->arena, 0, sizeof(h->arena));
+		h->symbols = NULL;
+		h->numbers = NULL;
+	}
+	if (h->symbols) {
+		h->symbols = APELEXER_REALLOC(h->symbols, sizeof(uint32_t) * cap);
+		memset(h->symbols + old_cap, 0, sizeof(uint32_t) * (cap - old_cap));
+	}
+	if (h->numbers) {
+		h->numbers = APELEXER_REALLOC(h->numbers, sizeof(ApelexerNumber) * cap);
+		memset(h->numbers + old_cap, 0, sizeof(ApelexerNumber) * (cap - old_cap));
+	}
+	h->capacity = cap;
+	return (ApelexerToken *)(h + 1);
+}
+
+APELEXER_PRIVATE void *apelexer_tokens_side_array(size_t capacity, size_t size)
+{
+	void *a = APELEXER_MALLOC(size * capacity);
+	memset(a, 0, size * capacity);
+	return a;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokens_push(ApelexerToken *tokens, size_t count, ApelexerToken tok, uint32_t symbol,
+						 ApelexerNumber number)
+{
+	tokens = apelexer_tokens_reserve(tokens, count + 1);
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	if (symbol == APELEXER_NO_SYMBOL)
+		tok.value = apelexer_arena_strdup(&h->arena, tok.value, tok.length);
+	tokens[count] = tok;
+	// A reused array may hold values of an earlier run, so once allocated every slot is written
+	if (symbol != APELEXER_NO_SYMBOL && !h->symbols)
+		h->symbols = apelexer_tokens_side_array(h->capacity, sizeof(uint32_t));
+	if (h->symbols)
+		h->symbols[count] = symbol;
+	if (number.i != 0 && !h->numbers)
+		h->numbers = apelexer_tokens_side_array(h->capacity, sizeof(ApelexerNumber));
+	if (h->numbers)
+		h->numbers[count] = number;
+	return tokens;
+}
+
+APELEXER_DEF void apelexer_tokens_move(ApelexerToken *tokens, size_t at, ApelexerToken *from, size_t count)
+{
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	ApelexerTokensHeader *f = APELEXER_TOKENS_HEADER(from);
+	memcpy(&tokens[at], from, sizeof(ApelexerToken) * count);
+	if (f->symbols && !h->symbols)
+		h->symbols = apelexer_tokens_side_array(h->capacity, sizeof(uint32_t));
+	if (h->symbols) {
+		if (f->symbols)
+			memcpy(&h->symbols[at], f->symbols, sizeof(uint32_t) * count);
+		else
+			memset(&h->symbols[at], 0, sizeof(uint32_t) * count);
+	}
+	if (f->numbers && !h->numbers)
+		h->numbers = apelexer_tokens_side_array(h->capacity, sizeof(ApelexerNumber));
+	if (h->numbers) {
+		if (f->numbers)
+			memcpy(&h->numbers[at], f->numbers, sizeof(ApelexerNumber) * count);
+		else
+			memset(&h->numbers[at], 0, sizeof(ApelexerNumber) * count);
+	}
+	apelexer_arena_append(&h->arena, &f->arena);
+	apelexer_free_tokens(from);
+}
+
+APELEXER_DEF uint32_t apelexer_token_symbol(const ApelexerToken *tokens, size_t index)
+{
+	const ApelexerTokensHeader *h = (const ApelexerTokensHeader *)tokens - 1;
+	return h->symbols ? h->symbols[index] : APELEXER_NO_SYMBOL;
+}
+
+APELEXER_DEF ApelexerNumber apelexer_token_number(const ApelexerToken *tokens, size_t index)
+{
+	const ApelexerTokensHeader *h = (const ApelexerTokensHeader *)tokens - 1;
+	ApelexerNumber zero = { 0 };
+	return h->numbers ? h->numbers[index] : zero;
+}
+
+APELEXER_DEF void apelexer_free_tokens(ApelexerToken *tokens)
+{
+	if (!tokens)
+		return;
+	ApelexerTokensHeader *h = APELEXER_TOKENS_HEADER(tokens);
+	apelexer_arena_release(&h->arena);
+	APELEXER_FREE(h->symbols);
+	APELEXER_FREE(h->numbers);
+	APELEXER_FREE(h);
+}
@@ -0,0 +1,565 @@
+/*
+ * apelexer throughput benchmark
+ *
+ * Lexes a generated C corpus, apelexer.h itself and every header in include/ concatenated with each
+ * tokenizer entry point, and reports throughput, allocations and memory use. Every mode has to
+ * produce the same token stream as apelexer_tokenize(), and the generated corpus has to match a
+ * golden checksum, so fast-path rewrites can be measured and kept correct.
+ *
+ * Build and run from the repository root:
+ *     ./tools/build_bench.sh apelexer && ./bin/apelexer_bench
+ *
+ * Options:
+ *     --quick         Smaller generated corpus and fewer runs
+ *     --print-golden  Print the checksum of the generated corpus instead of checking it
+ *     FILE...         Lex these files instead of the default corpora
+ *
+ * Exits with 1 if a token stream doesn't match.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+/* Every allocation of the library goes through these so they can be counted */
+static void *bench_malloc(size_t size);
+static void *bench_realloc(void *p, size_t size);
+static void bench_free(void *p);
+
+#define APELEXER_MALLOC bench_malloc
+#define APELEXER_REALLOC bench_realloc
+#define APELEXER_FREE bench_free
+#define APEDSA_MALLOC bench_malloc
+#define APEDSA_REALLOC bench_realloc
+#define APEDSA_FREE bench_free
+#define APELEXER_IMPLEMENTATION
+#include "apelexer.h"
+
+/* Checksums of the token stream of the generated corpus (full and --quick), update them with
+ * --print-golden when a change to the lexer is meant to change its output */
+#define BENCH_GOLDEN_GENERATED 0xe4d7aebf8a050d76ull
+#define BENCH_GOLDEN_GENERATED_QUICK 0xd24278a6111a08d1ull
+
+#define BENCH_GENERATED_SIZE (16 << 20)
+#define BENCH_STREAM_CHUNK (64 << 10)
+
+/* ============================================================================
+ * Allocation accounting
+ * ============================================================================ */
+
+typedef union {
+	size_t size;
+	long double align;
+} BenchAllocHeader;
+
+static size_t bench_allocs;
+static size_t bench_live;
+static size_t bench_peak;
+
+static void bench_account(size_t add, size_t sub)
+{
+	size_t live = __atomic_add_fetch(&bench_live, add - sub, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&bench_peak, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&bench_peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+static void *bench_malloc(size_t size)
+{
+	BenchAllocHeader *h = malloc(sizeof(BenchAllocHeader) + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	bench_account(size, 0);
+	return h + 1;
+}
+
+static void *bench_realloc(void *p, size_t size)
+{
+	if (!p)
+		return bench_malloc(size);
+	BenchAllocHeader *h = (BenchAllocHeader *)p - 1;
+	size_t old = h->size;
+	h = realloc(h, sizeof(BenchAllocHeader) + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	__atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+	bench_account(size, old);
+	return h + 1;
+}
+
+static void bench_free(void *p)
+{
+	if (!p)
+		return;
+	BenchAllocHeader *h = (BenchAllocHeader *)p - 1;
+	bench_account(0, h->size);
+	free(h);
+}
+
+/* ============================================================================
+ * Corpora
+ * ============================================================================ */
+
+typedef struct {
+	char name[64];
+	char *data; /* NUL-terminated */
+	size_t len;
+	size_t cap;
+	uint64_t golden; /* Expected checksum, 0 if there is none */
+} BenchCorpus;
+
+static void corpus_append(BenchCorpus *c, const char *s, size_t n)
+{
+	if (c->len + n + 1 > c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 1 << 16;
+		while (c->len + n + 1 > c->cap) {
+			c->cap *= 2;
+		}
+		c->data = realloc(c->data, c->cap);
+	}
+	memcpy(c->data + c->len, s, n);
+	c->len += n;
+	c->data[c->len] = '\0';
+}
+
+static void corpus_printf(BenchCorpus *c, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void corpus_printf(BenchCorpus *c, const char *fmt, ...)
+{
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	corpus_append(c, buf, (size_t)n);
+}
+
+static int corpus_append_file(BenchCorpus *c, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	char buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		corpus_append(c, buf, n);
+	}
+	fclose(f);
+	// Keep the next file from continuing the last line of this one
+	if (c->len > 0 && c->data[c->len - 1] != '\n')
+		corpus_append(c, "\n", 1);
+	return 1;
+}
+
+static uint64_t bench_rng = 0x9E3779B97F4A7C15ull;
+
+static uint32_t bench_rand(uint32_t n)
+{
+	bench_rng ^= bench_rng << 13;
+	bench_rng ^= bench_rng >> 7;
+	bench_rng ^= bench_rng << 17;
+	return (uint32_t)(bench_rng >> 32) % n;
+}
+
+static const char *bench_names[] = { "count", "buffer", "node", "next", "value", "length", "ctx", "result",
+				     "index", "items", "flags", "offset", "state", "table", "entry", "size" };
+static const char *bench_types[] = { "int", "unsigned", "long", "char *", "const char *", "size_t", "double", "float" };
+static const char *bench_ops[] = { "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "&&", "||", "==", "!=", "<", ">=" };
+
+#define BENCH_PICK(a) a[bench_rand(sizeof(a) / sizeof(a[0]))]
+
+static void corpus_ident(BenchCorpus *c)
+{
+	corpus_printf(c, "%s%u", BENCH_PICK(bench_names), bench_rand(8));
+}
+
+static void corpus_expr(BenchCorpus *c, int depth)
+{
+	switch (depth > 2 ? bench_rand(4) : bench_rand(8)) {
+		case 0: corpus_ident(c); break;
+		case 1: corpus_printf(c, "%u", bench_rand(100000)); break;
+		case 2: corpus_printf(c, "0x%X", bench_rand(1u << 31)); break;
+		case 3: corpus_printf(c, "%u.%ue%u", bench_rand(1000), bench_rand(1000), bench_rand(30)); break;
+		case 4:
+			corpus_ident(c);
+			corpus_append(c, "->", 2);
+			corpus_ident(c);
+			break;
+		case 5:
+			corpus_ident(c);
+			corpus_append(c, "(", 1);
+			corpus_expr(c, depth + 1);
+			corpus_append(c, ", ", 2);
+			corpus_expr(c, depth + 1);
+			corpus_append(c, ")", 1);
+			break;
+		default:
+			corpus_append(c, "(", 1);
+			corpus_expr(c, depth + 1);
+			corpus_printf(c, " %s ", BENCH_PICK(bench_ops));
+			corpus_expr(c, depth + 1);
+			corpus_append(c, ")", 1);
+			break;
+	}
+}
+
+static void corpus_statement(BenchCorpus *c, int indent)
+{
+	for (int i = 0; i < indent; i++) {
+		corpus_append(c, "\t", 1);
+	}
+	switch (bench_rand(10)) {
+		case 0:
+			corpus_printf(c, "%s ", BENCH_PICK(bench_types));
+			corpus_ident(c);
+			corpus_append(c, " = ", 3);
+			corpus_expr(c, 0);
+			corpus_append(c, ";\n", 2);
+			break;
+		case 1: corpus_printf(c, "const char *msg%u = \"%s \\\"%u\\\" item\\n\";\n", bench_rand(8), BENCH_PICK(bench_names), bench_rand(100)); break;
+		case 2: corpus_printf(c, "char ch%u = '%c';\n", bench_rand(8), 'a' + bench_rand(26)); break;
+		case 3: corpus_printf(c, "// %s %s is updated here\n", BENCH_PICK(bench_names), BENCH_PICK(bench_names)); break;
+		case 4:
+			corpus_append(c, "if (", 4);
+			corpus_expr(c, 0);
+			corpus_append(c, ") {\n", 4);
+			if (indent < 3)
+				corpus_statement(c, indent + 1);
+			for (int i = 0; i < indent; i++) {
+				corpus_append(c, "\t", 1);
+			}
+			corpus_append(c, "}\n", 2);
+			break;
+		case 5:
+			corpus_ident(c);
+			corpus_append(c, "[", 1);
+			corpus_ident(c);
+			corpus_append(c, "] += ", 5);
+			corpus_expr(c, 0);
+			corpus_append(c, ";\n", 2);
+			break;
+		default:
+			corpus_ident(c);
+			corpus_append(c, " = ", 3);
+			corpus_expr(c, 0);
+			corpus_append(c, ";\n", 2);
+			break;
+	}
+}
+
+static void corpus_generate(BenchCorpus *c, size_t size, uint64_t golden)
+{
+	snprintf(c->name, sizeof(c->name), "generated");
+	c->golden = golden;
+	for (unsigned f = 0; c->len < size; f++) {
+		if (f % 8 == 0)
+			corpus_printf(c, "#define %s_MAX_%u %u\n\n", "BENCH", f, bench_rand(4096));
+		if (f % 3 == 0)
+			corpus_printf(c, "/*\n * %s helper %u\n */\n", BENCH_PICK(bench_names), f);
+		corpus_printf(c, "static %s %s_fn%u(%s a, %s b)\n{\n", BENCH_PICK(bench_types), BENCH_PICK(bench_names), f, BENCH_PICK(bench_types),
+			      BENCH_PICK(bench_types));
+		unsigned statements = 4 + bench_rand(12);
+		for (unsigned s = 0; s < statements; s++) {
+			corpus_statement(c, 1);
+		}
+		corpus_append(c, "\treturn 0;\n}\n\n", 14);
+	}
+}
+
+static int bench_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int corpus_headers(BenchCorpus *c)
+{
+	snprintf(c->name, sizeof(c->name), "include/*.h");
+	DIR *dir = opendir("include");
+	if (!dir)
+		return 0;
+	char *names[256];
+	size_t count = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) && count < 256) {
+		size_t n = strlen(ent->d_name);
+		if (n > 2 && strcmp(ent->d_name + n - 2, ".h") == 0)
+			names[count++] = strdup(ent->d_name);
+	}
+	closedir(dir);
+	qsort(names, count, sizeof(char *), bench_compare_names);
+	for (size_t i = 0; i < count; i++) {
+		char path[512];
+		snprintf(path, sizeof(path), "include/%s", names[i]);
+		corpus_append_file(c, path);
+		free(names[i]);
+	}
+	return count > 0;
+}
+
+/* ============================================================================
+ * Modes
+ * ============================================================================ */
+
+/* FNV-1a over the type, value and line of every token */
+static uint64_t hash_token(uint64_t h, int type, const char *value, size_t length, size_t line)
+{
+	uint64_t words[3] = { (uint64_t)type, (uint64_t)length, (uint64_t)line };
+	const unsigned char *p = (const unsigned char *)words;
+	for (size_t i = 0; i < sizeof(words); i++) {
+		h = (h ^ p[i]) * 0x100000001B3ull;
+	}
+	for (size_t i = 0; i < length; i++) {
+		h = (h ^ (unsigned char)value[i]) * 0x100000001B3ull;
+	}
+	return h;
+}
+
+#define BENCH_HASH_SEED 0xCBF29CE484222325ull
+
+static uint64_t hash_tokens(const ApelexerToken *tokens, size_t count)
+{
+	uint64_t h = BENCH_HASH_SEED;
+	for (size_t i = 0; i < count; i++) {
+		h = hash_token(h, tokens[i].type, tokens[i].value, tokens[i].length, tokens[i].start_line);
+	}
+	return h;
+}
+
+/* Lexes c once and returns the number of tokens, the checksum is only computed if hash isn't NULL */
+typedef size_t (*BenchModeFn)(BenchCorpus *c, uint64_t *hash);
+
+static size_t mode_tokenize(BenchCorpus *c, uint64_t *hash)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize(c->data, &count);
+	if (hash)
+		*hash = hash_tokens(tokens, count);
+	apelexer_free_tokens(tokens);
+	return count;
+}
+
+static ApelexerCtx bench_ctx;
+
+static size_t mode_tokenize_ctx(BenchCorpus *c, uint64_t *hash)
+{
+	size_t count = 0;
+	apelexer_reset(&bench_ctx);
+	ApelexerToken *tokens = apelexer_tokenize_ctx(&bench_ctx, c->data, c->len, &count);
+	if (hash)
+		*hash = hash_tokens(tokens, count);
+	return count;
+}
+
+static size_t mode_interned(BenchCorpus *c, uint64_t *hash)
+{
+	size_t count = 0;
+	ApelexerSymbols *symbols = apelexer_symbols_new();
+	ApelexerToken *tokens = apelexer_tokenize_interned(NULL, symbols, c->data, &count);
+	if (hash)
+		*hash = hash_tokens(tokens, count);
+	apelexer_free_tokens(tokens);
+	apelexer_symbols_free(symbols);
+	return count;
+}
+
+static size_t mode_stream(BenchCorpus *c, uint64_t *hash)
+{
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	size_t fed = 0;
+	size_t count = 0;
+	uint64_t h = BENCH_HASH_SEED;
+	ApelexerToken tok;
+	for (;;) {
+		ApelexerNextResult r = apelexer_next(&ctx, &tok);
+		if (r == APELEXER_NEXT_DONE)
+			break;
+		if (r == APELEXER_NEXT_NEED_INPUT) {
+			if (fed < c->len) {
+				size_t n = c->len - fed < BENCH_STREAM_CHUNK ? c->len - fed : BENCH_STREAM_CHUNK;
+				apelexer_feed(&ctx, c->data + fed, n);
+				fed += n;
+			} else {
+				apelexer_finish(&ctx);
+			}
+			continue;
+		}
+		if (hash)
+			h = hash_token(h, tok.type, tok.value, tok.length, tok.start_line);
+		count++;
+	}
+	apelexer_free(&ctx);
+	if (hash)
+		*hash = h;
+	return count;
+}
+
+static size_t mode_parallel(BenchCorpus *c, uint64_t *hash)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_parallel(NULL, c->data, c->len, &count, 0);
+	if (hash)
+		*hash = hash_tokens(tokens, count);
+	apelexer_free_tokens(tokens);
+	return count;
+}
+
+static ApelexerLanguage *bench_decode_lang;
+
+/* The C language with number decoding, so the cost of decoding shows up next to tokenize */
+static size_t mode_decode(BenchCorpus *c, uint64_t *hash)
+{
+	if (!bench_decode_lang) {
+		ApelexerLanguageSpec spec = apelexer_language_c()->spec;
+		spec.decode_numbers = 1;
+		bench_decode_lang = apelexer_language_compile(&spec);
+	}
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_lang(bench_decode_lang, c->data, &count);
+	if (hash)
+		*hash = hash_tokens(tokens, count);
+	apelexer_free_tokens(tokens);
+	return count;
+}
+
+static size_t mode_compact(BenchCorpus *c, uint64_t *hash)
+{
+	ApelexerTokenList list;
+	apelexer_tokenize_compact(NULL, c->data, c->len, &list);
+	if (hash) {
+		uint64_t h = BENCH_HASH_SEED;
+		for (size_t i = 0; i < list.count; i++) {
+			size_t line, column;
+			apelexer_token_list_position(&list, i, &line, &column);
+			h = hash_token(h, list.types[i], c->data + list.offsets[i], list.lengths[i], line);
+		}
+		*hash = h;
+	}
+	size_t count = list.count;
+	apelexer_token_list_free(&list);
+	return count;
+}
+
+static const struct {
+	const char *name;
+	BenchModeFn fn;
+} bench_modes[] = {
+	{ "tokenize", mode_tokenize }, { "tokenize_ctx", mode_tokenize_ctx }, { "interned", mode_interned },
+	{ "stream", mode_stream },     { "parallel", mode_parallel },	      { "compact", mode_compact },
+	{ "decode", mode_decode },
+};
+
+/* ============================================================================
+ * Driver
+ * ============================================================================ */
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int bench_corpus(BenchCorpus *c, int quick, int print_golden)
+{
+	int ok = 1;
+	uint64_t expected = 0;
+	size_t expected_count = mode_tokenize(c, &expected);
+	printf("%s: %.2f MiB, %zu tokens, checksum %016llx", c->name, (double)c->len / (1 << 20), expected_count,
+	       (unsigned long long)expected);
+	if (c->golden && print_golden) {
+		printf(" (golden)\n");
+	} else if (c->golden && expected != c->golden) {
+		printf(" GOLDEN MISMATCH, expected %016llx\n", (unsigned long long)c->golden);
+		ok = 0;
+	} else {
+		printf("\n");
+	}
+	printf("  %-14s %10s %10s %12s %12s\n", "mode", "MB/s", "Mtok/s", "allocs/run", "peak heap");
+
+	double min_time = quick ? 0.05 : 0.5;
+	int min_runs = quick ? 1 : 3;
+	for (size_t m = 0; m < sizeof(bench_modes) / sizeof(bench_modes[0]); m++) {
+		uint64_t hash = 0;
+		size_t count = bench_modes[m].fn(c, &hash); // also warms up
+		int same = hash == expected && count == expected_count;
+		ok &= same;
+
+		size_t live = __atomic_load_n(&bench_live, __ATOMIC_RELAXED);
+		__atomic_store_n(&bench_peak, live, __ATOMIC_RELAXED);
+		size_t allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+		double best = 1e30, total = 0;
+		int runs = 0;
+		while (runs < min_runs || total < min_time) {
+			double start = bench_now();
+			bench_modes[m].fn(c, NULL);
+			double elapsed = bench_now() - start;
+			total += elapsed;
+			if (elapsed < best)
+				best = elapsed;
+			runs++;
+		}
+		allocs = (__atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - allocs) / runs;
+		size_t peak = __atomic_load_n(&bench_peak, __ATOMIC_RELAXED) - live;
+		printf("  %-14s %10.1f %10.2f %12zu %9.2f MiB%s\n", bench_modes[m].name, (double)c->len / best / 1e6,
+		       (double)count / best / 1e6, allocs, (double)peak / (1 << 20), same ? "" : "  TOKEN MISMATCH");
+	}
+	apelexer_free(&bench_ctx);
+	printf("\n");
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int quick = 0, print_golden = 0;
+	BenchCorpus corpora[64];
+	size_t ncorpora = 0;
+	memset(corpora, 0, sizeof(corpora));
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			quick = 1;
+		} else if (strcmp(argv[i], "--print-golden") == 0) {
+			print_golden = 1;
+		} else if (ncorpora < 64) {
+			BenchCorpus *c = &corpora[ncorpora++];
+			snprintf(c->name, sizeof(c->name), "%s", argv[i]);
+			if (!corpus_append_file(c, argv[i])) {
+				fprintf(stderr, "Could not read %s\n", argv[i]);
+				return 1;
+			}
+		}
+	}
+	if (ncorpora == 0) {
+		if (quick)
+			corpus_generate(&corpora[ncorpora++], BENCH_GENERATED_SIZE / 16, BENCH_GOLDEN_GENERATED_QUICK);
+		else
+			corpus_generate(&corpora[ncorpora++], BENCH_GENERATED_SIZE, BENCH_GOLDEN_GENERATED);
+		BenchCorpus *self = &corpora[ncorpora];
+		snprintf(self->name, sizeof(self->name), "include/apelexer.h");
+		if (corpus_append_file(self, "include/apelexer.h"))
+			ncorpora++;
+		if (corpus_headers(&corpora[ncorpora]))
+			ncorpora++;
+	}
+
+	int ok = 1;
+	for (size_t i = 0; i < ncorpora; i++) {
+		ok &= bench_corpus(&corpora[i], quick, print_golden);
+		free(corpora[i].data);
+	}
+	apelexer_language_free(bench_decode_lang);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak RSS: %.1f MiB\n", (double)usage.ru_maxrss / 1024);
+	if (!ok)
+		printf("FAILED: token streams don't match\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include "apelexer_internal.h"
+
+APELEXER_PRIVATE void apelexer_token_list_push(ApelexerTokenList *list, uint8_t type, uint32_t offset, uint32_t length)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 1024;
+		list->types = APELEXER_REALLOC(list->types, sizeof(uint8_t) * list->capacity);
+		list->offsets = APELEXER_REALLOC(list->offsets, sizeof(uint32_t) * list->capacity);
+		list->lengths = APELEXER_REALLOC(list->lengths, sizeof(uint32_t) * list->capacity);
+	}
+	list->types[list->count] = type;
+	list->offsets[list->count] = offset;
+	list->lengths[list->count] = length;
+	list->count++;
+}
+
+/* Line breaks are counted the same way the scanner counts them, \r\n is one break */
+APELEXER_PRIVATE void apelexer_token_list_index_lines(ApelexerTokenList *list, const char *input, size_t len)
+{
+	size_t cap = 256;
+	list->line_starts = APELEXER_MALLOC(sizeof(uint32_t) * cap);
+	list->line_starts[0] = 0;
+	list->line_count = 1;
+	for (size_t i = 0; i < len; i++) {
+		if (input[i] != '\n' && input[i] != '\r')
+			continue;
+		if (input[i] == '\r' && i + 1 < len && input[i + 1] == '\n')
+			i++;
+		if (list->line_count == cap) {
+			cap *= 2;
+			list->line_starts = APELEXER_REALLOC(list->line_starts, sizeof(uint32_t) * cap);
+		}
+		list->line_starts[list->line_count++] = (uint32_t)(i + 1);
+	}
+}
+
+APELEXER_DEF int apelexer_tokenize_compact(const ApelexerLanguage *lang, const char *input, size_t len, ApelexerTokenList *list)
+{
+	memset(list, 0, sizeof(*list));
+	if (len > UINT32_MAX)
+		return APELEXER_FALSE;
+	ApelexerScanner s = { input, len, 0, 1, 1, lang, APELEXER_FALSE, { 0 } };
+	ApelexerToken tok;
+	while (apelexer_scan(&s, &tok)) {
+		apelexer_token_list_push(list, (uint8_t)tok.type, (uint32_t)(tok.value - input), (uint32_t)tok.length);
+	}
+	apelexer_token_list_index_lines(list, input, len);
+	return APELEXER_TRUE;
+}
+
+APELEXER_DEF void apelexer_token_list_position(const ApelexerTokenList *list, size_t index, size_t *line, size_t *column)
+{
+	uint32_t offset = list->offsets[index];
+	size_t lo = 0;
+	size_t hi = list->line_count;
+	// find the last line that starts at or before offset
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (list->line_starts[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*line = lo + 1;
+	*column = offset - list->line_starts[lo] + 1;
+}
+
+APELEXER_DEF void apelexer_token_list_free(ApelexerTokenList *list)
+{
+	APELEXER_FREE(list->types);
+	APELEXER_FREE(list->offsets);
+	APELEXER_FREE(list->lengths);
+	APELEXER_FREE(list->line_starts);
+	memset(list, 0, sizeof(*list));
+}
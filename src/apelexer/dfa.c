@@ -0,0 +1,717 @@
+#include "apelexer_internal.h"
+
+/*
+ * DFA lexer generator
+ *
+ * Every rule is parsed into a Thompson NFA, all rules share one start set and the subset
+ * construction turns them into a DFA over byte classes (bytes no pattern tells apart),
+ * which is then minimized with Moore's partition refinement.
+ */
+
+typedef enum {
+	APELEXER_NFA_EPSILON,
+	APELEXER_NFA_SET,
+	APELEXER_NFA_ACCEPT,
+} ApelexerNfaKind;
+
+typedef struct {
+	ApelexerNfaKind kind;
+	int32_t out;  /* -1 if none */
+	int32_t out2; /* Second epsilon edge, -1 if none */
+	int32_t rule; /* Rule of an accept node */
+	uint8_t set[32];
+} ApelexerNfaNode;
+
+typedef struct {
+	ApelexerNfaNode *nodes;
+	size_t count;
+	size_t capacity;
+	const char *p; /* Parse position in the current pattern */
+	int error;
+} ApelexerNfa;
+
+/* Nodes are referenced by index since the node array moves as it grows */
+typedef struct {
+	int32_t start;
+	int32_t end; /* Epsilon node with no out edge yet */
+} ApelexerNfaFrag;
+
+#define APELEXER_SET_HAS(set, c) ((set)[(uint8_t)(c) >> 3] & (1u << ((uint8_t)(c) & 7)))
+#define APELEXER_SET_ADD(set, c) ((set)[(uint8_t)(c) >> 3] |= (uint8_t)(1u << ((uint8_t)(c) & 7)))
+
+APELEXER_PRIVATE int32_t apelexer_nfa_node(ApelexerNfa *nfa, ApelexerNfaKind kind)
+{
+	if (nfa->count == nfa->capacity) {
+		nfa->capacity = nfa->capacity ? nfa->capacity * 2 : 64;
+		nfa->nodes = APELEXER_REALLOC(nfa->nodes, sizeof(ApelexerNfaNode) * nfa->capacity);
+	}
+	ApelexerNfaNode *node = &nfa->nodes[nfa->count];
+	memset(node, 0, sizeof(*node));
+	node->kind = kind;
+	node->out = -1;
+	node->out2 = -1;
+	node->rule = -1;
+	return (int32_t)nfa->count++;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_set(ApelexerNfa *nfa, const uint8_t *set)
+{
+	int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+	int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_SET);
+	memcpy(nfa->nodes[start].set, set, sizeof(nfa->nodes[start].set));
+	nfa->nodes[start].out = end;
+	return (ApelexerNfaFrag){ start, end };
+}
+
+/* Adds the bytes matched by the escape after a backslash to set */
+APELEXER_PRIVATE void apelexer_nfa_escape(ApelexerNfa *nfa, uint8_t *set)
+{
+	char c = *nfa->p;
+	if (!c) {
+		nfa->error = APELEXER_TRUE;
+		return;
+	}
+	nfa->p++;
+	switch (c) {
+		case 'd':
+			for (int b = '0'; b <= '9'; b++) {
+				APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 'w':
+			for (int b = 0; b < 256; b++) {
+				if (isalnum(b) || b == '_')
+					APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 's':
+			for (int b = 0; b < 256; b++) {
+				if (isspace(b))
+					APELEXER_SET_ADD(set, b);
+			}
+			break;
+		case 'n': APELEXER_SET_ADD(set, '\n'); break;
+		case 'r': APELEXER_SET_ADD(set, '\r'); break;
+		case 't': APELEXER_SET_ADD(set, '\t'); break;
+		default: APELEXER_SET_ADD(set, c); break;
+	}
+}
+
+/* Parses a bracket expression after the opening '[' */
+APELEXER_PRIVATE void apelexer_nfa_class(ApelexerNfa *nfa, uint8_t *set)
+{
+	int negate = APELEXER_FALSE;
+	if (*nfa->p == '^') {
+		negate = APELEXER_TRUE;
+		nfa->p++;
+	}
+	const char *first = nfa->p;
+	while (*nfa->p && !nfa->error && (*nfa->p != ']' || nfa->p == first)) {
+		if (*nfa->p == '\\') {
+			nfa->p++;
+			apelexer_nfa_escape(nfa, set);
+			continue;
+		}
+		uint8_t lo = (uint8_t)*nfa->p++;
+		if (nfa->p[0] == '-' && nfa->p[1] && nfa->p[1] != ']') {
+			uint8_t hi = (uint8_t)nfa->p[1];
+			nfa->p += 2;
+			if (hi < lo) {
+				nfa->error = APELEXER_TRUE;
+				return;
+			}
+			for (int b = lo; b <= hi; b++) {
+				APELEXER_SET_ADD(set, b);
+			}
+		} else {
+			APELEXER_SET_ADD(set, lo);
+		}
+	}
+	if (*nfa->p != ']') {
+		nfa->error = APELEXER_TRUE;
+		return;
+	}
+	nfa->p++;
+	if (negate) {
+		for (int k = 0; k < 32; k++) {
+			set[k] = (uint8_t)~set[k];
+		}
+	}
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_alternation(ApelexerNfa *nfa);
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_atom(ApelexerNfa *nfa)
+{
+	uint8_t set[32] = { 0 };
+	char c = *nfa->p++;
+	switch (c) {
+		case '(': {
+			ApelexerNfaFrag frag = apelexer_nfa_alternation(nfa);
+			if (*nfa->p != ')') {
+				nfa->error = APELEXER_TRUE;
+				return frag;
+			}
+			nfa->p++;
+			return frag;
+		}
+		case '[': apelexer_nfa_class(nfa, set); break;
+		case '.':
+			memset(set, 0xff, sizeof(set));
+			set['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+			break;
+		case '\\': apelexer_nfa_escape(nfa, set); break;
+		case '*':
+		case '+':
+		case '?': nfa->error = APELEXER_TRUE; break;
+		default: APELEXER_SET_ADD(set, c); break;
+	}
+	return apelexer_nfa_set(nfa, set);
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_repeat(ApelexerNfa *nfa)
+{
+	ApelexerNfaFrag frag = apelexer_nfa_atom(nfa);
+	while (!nfa->error && (*nfa->p == '*' || *nfa->p == '+' || *nfa->p == '?')) {
+		char op = *nfa->p++;
+		int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		if (op == '+') {
+			nfa->nodes[frag.end].out = frag.start;
+			nfa->nodes[frag.end].out2 = end;
+		} else {
+			int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+			nfa->nodes[start].out = frag.start;
+			nfa->nodes[start].out2 = end;
+			nfa->nodes[frag.end].out = op == '*' ? frag.start : end;
+			if (op == '*')
+				nfa->nodes[frag.end].out2 = end;
+			frag.start = start;
+		}
+		frag.end = end;
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_concat(ApelexerNfa *nfa)
+{
+	int32_t empty = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+	ApelexerNfaFrag frag = { empty, empty };
+	while (!nfa->error && *nfa->p && *nfa->p != '|' && *nfa->p != ')') {
+		ApelexerNfaFrag next = apelexer_nfa_repeat(nfa);
+		nfa->nodes[frag.end].out = next.start;
+		frag.end = next.end;
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE ApelexerNfaFrag apelexer_nfa_alternation(ApelexerNfa *nfa)
+{
+	ApelexerNfaFrag frag = apelexer_nfa_concat(nfa);
+	while (!nfa->error && *nfa->p == '|') {
+		nfa->p++;
+		ApelexerNfaFrag other = apelexer_nfa_concat(nfa);
+		int32_t start = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		int32_t end = apelexer_nfa_node(nfa, APELEXER_NFA_EPSILON);
+		nfa->nodes[start].out = frag.start;
+		nfa->nodes[start].out2 = other.start;
+		nfa->nodes[frag.end].out = end;
+		nfa->nodes[other.end].out = end;
+		frag = (ApelexerNfaFrag){ start, end };
+	}
+	return frag;
+}
+
+APELEXER_PRIVATE int apelexer_nfa_compare(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Epsilon closure of the depth nodes on stack, only set and accept nodes are kept, sorted, in out */
+APELEXER_PRIVATE size_t apelexer_nfa_closure(const ApelexerNfa *nfa, int32_t *stack, size_t depth, uint32_t *mark, uint32_t stamp, int32_t *out)
+{
+	size_t n = 0;
+	while (depth > 0) {
+		int32_t k = stack[--depth];
+		if (k < 0 || mark[k] == stamp)
+			continue;
+		mark[k] = stamp;
+		const ApelexerNfaNode *node = &nfa->nodes[k];
+		if (node->kind == APELEXER_NFA_EPSILON) {
+			stack[depth++] = node->out;
+			stack[depth++] = node->out2;
+		} else {
+			out[n++] = k;
+		}
+	}
+	qsort(out, n, sizeof(int32_t), apelexer_nfa_compare);
+	return n;
+}
+
+APELEXER_PRIVATE uint32_t apelexer_dfa_hash(const uint32_t *words, size_t n)
+{
+	uint32_t h = 2166136261u;
+	for (size_t k = 0; k < n; k++) {
+		h = (h ^ words[k]) * 16777619u;
+	}
+	return h;
+}
+
+/* DFA states are deduplicated by their NFA node sets (subset construction) or by their
+ * signatures (minimization) through an open addressing table of state indices */
+typedef struct {
+	uint32_t *slots; /* State index + 1, 0 = empty */
+	uint32_t mask;
+} ApelexerDfaTable;
+
+APELEXER_PRIVATE void apelexer_dfa_table_init(ApelexerDfaTable *t, size_t max_states)
+{
+	size_t cap = 64;
+	while (cap < max_states * 2) {
+		cap *= 2;
+	}
+	t->slots = APELEXER_MALLOC(sizeof(uint32_t) * cap);
+	memset(t->slots, 0, sizeof(uint32_t) * cap);
+	t->mask = (uint32_t)(cap - 1);
+}
+
+typedef struct {
+	uint32_t *items; /* NFA node sets of all states, back to back */
+	size_t items_len;
+	size_t items_cap;
+	size_t *offsets;
+	size_t *lengths;
+	uint32_t *next; /* count * class_count transitions */
+	size_t count;
+	size_t capacity;
+	size_t class_count;
+	ApelexerDfaTable table;
+} ApelexerDfaBuilder;
+
+#define APELEXER_DFA_MAX_STATES 65535
+
+/* Index of the state with the given node set, adds it if it's new. Returns -1 if there are too many states */
+APELEXER_PRIVATE int64_t apelexer_dfa_builder_state(ApelexerDfaBuilder *b, const int32_t *set, size_t n)
+{
+	uint32_t h = apelexer_dfa_hash((const uint32_t *)set, n);
+	uint32_t slot = h & b->table.mask;
+	while (b->table.slots[slot]) {
+		size_t s = b->table.slots[slot] - 1;
+		if (b->lengths[s] == n && memcmp(&b->items[b->offsets[s]], set, n * sizeof(int32_t)) == 0)
+			return (int64_t)s;
+		slot = (slot + 1) & b->table.mask;
+	}
+	if (b->count == APELEXER_DFA_MAX_STATES)
+		return -1;
+	if (b->count == b->capacity) {
+		b->capacity *= 2;
+		b->offsets = APELEXER_REALLOC(b->offsets, sizeof(size_t) * b->capacity);
+		b->lengths = APELEXER_REALLOC(b->lengths, sizeof(size_t) * b->capacity);
+		b->next = APELEXER_REALLOC(b->next, sizeof(uint32_t) * b->capacity * b->class_count);
+	}
+	while (b->items_len + n > b->items_cap) {
+		b->items_cap *= 2;
+		b->items = APELEXER_REALLOC(b->items, sizeof(uint32_t) * b->items_cap);
+	}
+	memcpy(&b->items[b->items_len], set, n * sizeof(int32_t));
+	b->offsets[b->count] = b->items_len;
+	b->lengths[b->count] = n;
+	b->items_len += n;
+	b->table.slots[slot] = (uint32_t)b->count + 1;
+	return (int64_t)b->count++;
+}
+
+/* Merges equivalent states of the subset construction and writes the result to dfa */
+APELEXER_PRIVATE int apelexer_dfa_minimize(ApelexerDfa *dfa, const uint32_t *next, const int16_t *accept, size_t count)
+{
+	size_t k = dfa->class_count;
+	uint32_t *group = APELEXER_MALLOC(sizeof(uint32_t) * count);
+	uint32_t *new_group = APELEXER_MALLOC(sizeof(uint32_t) * count);
+	uint32_t *sig = APELEXER_MALLOC(sizeof(uint32_t) * (k + 1));
+	uint32_t *other = APELEXER_MALLOC(sizeof(uint32_t) * (k + 1));
+	ApelexerDfaTable table;
+	apelexer_dfa_table_init(&table, count);
+
+	// Start with one group per accepted rule and one for the non-accepting states
+	size_t groups = 0;
+	uint32_t *rule_group = APELEXER_MALLOC(sizeof(uint32_t) * (dfa->rule_count + 1));
+	memset(rule_group, 0xff, sizeof(uint32_t) * (dfa->rule_count + 1));
+	for (size_t s = 0; s < count; s++) {
+		uint32_t *g = &rule_group[accept[s] + 1];
+		if (*g == UINT32_MAX)
+			*g = (uint32_t)groups++;
+		group[s] = *g;
+	}
+	APELEXER_FREE(rule_group);
+
+	// Split groups by the groups their transitions lead to until nothing changes
+	for (;;) {
+		memset(table.slots, 0, sizeof(uint32_t) * ((size_t)table.mask + 1));
+		size_t new_groups = 0;
+		for (size_t s = 0; s < count; s++) {
+			sig[0] = group[s];
+			for (size_t c = 0; c < k; c++) {
+				sig[c + 1] = group[next[s * k + c]];
+			}
+			uint32_t slot = apelexer_dfa_hash(sig, k + 1) & table.mask;
+			for (;;) {
+				if (!table.slots[slot]) {
+					table.slots[slot] = (uint32_t)s + 1;
+					new_group[s] = (uint32_t)new_groups++;
+					break;
+				}
+				size_t r = table.slots[slot] - 1;
+				other[0] = group[r];
+				for (size_t c = 0; c < k; c++) {
+					other[c + 1] = group[next[r * k + c]];
+				}
+				if (memcmp(sig, other, sizeof(uint32_t) * (k + 1)) == 0) {
+					new_group[s] = new_group[r];
+					break;
+				}
+				slot = (slot + 1) & table.mask;
+			}
+		}
+		uint32_t *tmp = group;
+		group = new_group;
+		new_group = tmp;
+		if (new_groups == groups)
+			break;
+		groups = new_groups;
+	}
+
+	int ok = group[1] != group[0]; // A start state equivalent to the dead state matches nothing
+	if (ok) {
+		// Number the groups so the dead state is 0 and the start state 1
+		uint32_t *id = new_group;
+		memset(id, 0xff, sizeof(uint32_t) * count);
+		uint32_t *rep = APELEXER_MALLOC(sizeof(uint32_t) * groups);
+		size_t n = 0;
+		for (size_t s = 0; s < count; s++) {
+			if (id[group[s]] == UINT32_MAX) {
+				id[group[s]] = (uint32_t)n;
+				rep[n++] = (uint32_t)s;
+			}
+		}
+		dfa->state_count = n;
+		dfa->next = APELEXER_MALLOC(sizeof(uint16_t) * n * k);
+		dfa->accept = APELEXER_MALLOC(sizeof(int16_t) * n);
+		for (size_t d = 0; d < n; d++) {
+			for (size_t c = 0; c < k; c++) {
+				dfa->next[d * k + c] = (uint16_t)id[group[next[rep[d] * k + c]]];
+			}
+			dfa->accept[d] = accept[rep[d]];
+		}
+		APELEXER_FREE(rep);
+	}
+
+	APELEXER_FREE(table.slots);
+	APELEXER_FREE(other);
+	APELEXER_FREE(sig);
+	APELEXER_FREE(new_group);
+	APELEXER_FREE(group);
+	return ok;
+}
+
+APELEXER_PRIVATE int apelexer_dfa_build(ApelexerDfa *dfa, ApelexerNfa *nfa, int32_t *starts)
+{
+	// Split the bytes into classes that every set node either fully contains or excludes
+	size_t classes = 1;
+	int map[512];
+	for (size_t n = 0; n < nfa->count; n++) {
+		if (nfa->nodes[n].kind != APELEXER_NFA_SET)
+			continue;
+		memset(map, 0xff, sizeof(map));
+		size_t new_classes = 0;
+		for (int b = 0; b < 256; b++) {
+			int key = dfa->byte_class[b] * 2 + (APELEXER_SET_HAS(nfa->nodes[n].set, b) ? 1 : 0);
+			if (map[key] < 0)
+				map[key] = (int)new_classes++;
+			dfa->byte_class[b] = (uint8_t)map[key];
+		}
+		classes = new_classes;
+	}
+	dfa->class_count = classes;
+	uint8_t rep[256];
+	for (int b = 255; b >= 0; b--) {
+		rep[dfa->byte_class[b]] = (uint8_t)b;
+	}
+
+	ApelexerDfaBuilder b = { 0 };
+	b.capacity = 64;
+	b.class_count = classes;
+	b.offsets = APELEXER_MALLOC(sizeof(size_t) * b.capacity);
+	b.lengths = APELEXER_MALLOC(sizeof(size_t) * b.capacity);
+	b.next = APELEXER_MALLOC(sizeof(uint32_t) * b.capacity * classes);
+	b.items_cap = 256;
+	b.items = APELEXER_MALLOC(sizeof(uint32_t) * b.items_cap);
+	apelexer_dfa_table_init(&b.table, APELEXER_DFA_MAX_STATES);
+
+	uint32_t *mark = APELEXER_MALLOC(sizeof(uint32_t) * nfa->count);
+	memset(mark, 0, sizeof(uint32_t) * nfa->count);
+	uint32_t stamp = 0;
+	int32_t *stack = APELEXER_MALLOC(sizeof(int32_t) * (nfa->count * 3 + dfa->rule_count));
+	int32_t *set = APELEXER_MALLOC(sizeof(int32_t) * nfa->count);
+
+	apelexer_dfa_builder_state(&b, set, 0); // Dead state
+	memcpy(stack, starts, sizeof(int32_t) * dfa->rule_count);
+	size_t n = apelexer_nfa_closure(nfa, stack, dfa->rule_count, mark, ++stamp, set);
+	apelexer_dfa_builder_state(&b, set, n);
+
+	int ok = APELEXER_TRUE;
+	for (size_t s = 0; s < b.count && ok; s++) {
+		for (size_t c = 0; c < classes; c++) {
+			size_t depth = 0;
+			for (size_t k = 0; k < b.lengths[s]; k++) {
+				const ApelexerNfaNode *node = &nfa->nodes[b.items[b.offsets[s] + k]];
+				if (node->kind == APELEXER_NFA_SET && APELEXER_SET_HAS(node->set, rep[c]))
+					stack[depth++] = node->out;
+			}
+			n = apelexer_nfa_closure(nfa, stack, depth, mark, ++stamp, set);
+			int64_t target = apelexer_dfa_builder_state(&b, set, n);
+			if (target < 0) {
+				ok = APELEXER_FALSE;
+				break;
+			}
+			b.next[s * classes + c] = (uint32_t)target;
+		}
+	}
+
+	int16_t *accept = NULL;
+	if (ok) {
+		// Ties go to the earliest rule, accept nodes are numbered in rule order
+		accept = APELEXER_MALLOC(sizeof(int16_t) * b.count);
+		for (size_t s = 0; s < b.count; s++) {
+			accept[s] = -1;
+			for (size_t k = 0; k < b.lengths[s]; k++) {
+				const ApelexerNfaNode *node = &nfa->nodes[b.items[b.offsets[s] + k]];
+				if (node->kind == APELEXER_NFA_ACCEPT && (accept[s] < 0 || node->rule < accept[s]))
+					accept[s] = (int16_t)node->rule;
+			}
+		}
+		ok = accept[1] < 0 && apelexer_dfa_minimize(dfa, b.next, accept, b.count);
+	}
+
+	APELEXER_FREE(accept);
+	APELEXER_FREE(set);
+	APELEXER_FREE(stack);
+	APELEXER_FREE(mark);
+	APELEXER_FREE(b.table.slots);
+	APELEXER_FREE(b.items);
+	APELEXER_FREE(b.next);
+	APELEXER_FREE(b.lengths);
+	APELEXER_FREE(b.offsets);
+	return ok;
+}
+
+APELEXER_DEF ApelexerDfa *apelexer_dfa_compile(const ApelexerRule *rules, size_t rule_count)
+{
+	if (rule_count == 0 || rule_count > INT16_MAX)
+		return NULL;
+	ApelexerNfa nfa = { 0 };
+	int32_t *starts = APELEXER_MALLOC(sizeof(int32_t) * rule_count);
+	for (size_t r = 0; r < rule_count && !nfa.error; r++) {
+		nfa.p = rules[r].pattern;
+		if (!nfa.p) {
+			nfa.error = APELEXER_TRUE;
+			break;
+		}
+		ApelexerNfaFrag frag = apelexer_nfa_alternation(&nfa);
+		if (*nfa.p)
+			nfa.error = APELEXER_TRUE; // Unbalanced ')'
+		int32_t accept = apelexer_nfa_node(&nfa, APELEXER_NFA_ACCEPT);
+		nfa.nodes[accept].rule = (int32_t)r;
+		nfa.nodes[frag.end].out = accept;
+		starts[r] = frag.start;
+	}
+
+	ApelexerDfa *dfa = NULL;
+	if (!nfa.error) {
+		dfa = APELEXER_MALLOC(sizeof(ApelexerDfa));
+		memset(dfa, 0, sizeof(*dfa));
+		dfa->rule_count = rule_count;
+		dfa->types = APELEXER_MALLOC(sizeof(ApelexerTokenType) * rule_count);
+		for (size_t r = 0; r < rule_count; r++) {
+			dfa->types[r] = rules[r].type;
+		}
+		if (!apelexer_dfa_build(dfa, &nfa, starts)) {
+			apelexer_dfa_free(dfa);
+			dfa = NULL;
+		}
+	}
+	APELEXER_FREE(starts);
+	APELEXER_FREE(nfa.nodes);
+	return dfa;
+}
+
+APELEXER_DEF void apelexer_dfa_free(ApelexerDfa *dfa)
+{
+	if (!dfa)
+		return;
+	APELEXER_FREE(dfa->next);
+	APELEXER_FREE(dfa->accept);
+	APELEXER_FREE(dfa->types);
+	APELEXER_FREE(dfa);
+}
+
+APELEXER_DEF size_t apelexer_dfa_state_count(const ApelexerDfa *dfa)
+{
+	return dfa->state_count;
+}
+
+APELEXER_DEF size_t apelexer_dfa_match(const ApelexerDfa *dfa, const char *input, size_t len, int *rule)
+{
+	const uint16_t *next = dfa->next;
+	const uint8_t *byte_class = dfa->byte_class;
+	size_t k = dfa->class_count;
+	size_t state = 1;
+	size_t match = 0;
+	*rule = -1;
+	for (size_t i = 0; i < len; i++) {
+		state = next[state * k + byte_class[(uint8_t)input[i]]];
+		if (!state)
+			break;
+		if (dfa->accept[state] >= 0) {
+			*rule = dfa->accept[state];
+			match = i + 1;
+		}
+	}
+	return match;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_dfa_tokenize(const ApelexerDfa *dfa, const char *input, size_t len, size_t *token_count)
+{
+	ApelexerToken *tokens = NULL;
+	size_t line = 1, column = 1;
+	size_t i = 0;
+	*token_count = 0;
+	while (i < len) {
+		int rule;
+		size_t n = apelexer_dfa_match(dfa, input + i, len - i, &rule);
+		if (n == 0)
+			apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
+		ApelexerToken tok;
+		tok.type = dfa->types[rule];
+		tok.length = n;
+		tok.start_line = line;
+		tok.start_column = column;
+		for (size_t k = i; k < i + n; k++) {
+			if (input[k] == '\n' || (input[k] == '\r' && (k + 1 >= len || input[k + 1] != '\n'))) {
+				line++;
+				column = 1;
+			} else {
+				column++;
+			}
+		}
+		tok.end_line = line;
+		tok.end_column = column;
+		if (tok.type != APELEXER_TOKEN_NONE) {
+			tok.value = (char *)input + i;
+			tokens = apelexer_tokens_push(tokens, (*token_count)++, tok, APELEXER_NO_SYMBOL, (ApelexerNumber){ 0 });
+		}
+		i += n;
+	}
+	return tokens;
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_byte(FILE *out, int b)
+{
+	if (b == '\'' || b == '\\')
+		fprintf(out, "'\\%c'", b);
+	else if (isprint(b))
+		fprintf(out, "'%c'", b);
+	else
+		fprintf(out, "0x%02x", b);
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_tables(const ApelexerDfa *dfa, FILE *out, const char *name)
+{
+	size_t k = dfa->class_count;
+	fprintf(out, "static const unsigned char %s_class[256] = {", name);
+	for (int b = 0; b < 256; b++) {
+		fprintf(out, "%s%d,", b % 16 ? " " : "\n\t", dfa->byte_class[b]);
+	}
+	fprintf(out, "\n};\n\nstatic const unsigned short %s_next[%zu][%zu] = {\n", name, dfa->state_count, k);
+	for (size_t s = 0; s < dfa->state_count; s++) {
+		fprintf(out, "\t{");
+		for (size_t c = 0; c < k; c++) {
+			fprintf(out, "%s%u,", c % 16 ? " " : c ? "\n\t " : " ", dfa->next[s * k + c]);
+		}
+		fprintf(out, " },\n");
+	}
+	fprintf(out, "};\n\nstatic const short %s_accept[%zu] = {", name, dfa->state_count);
+	for (size_t s = 0; s < dfa->state_count; s++) {
+		fprintf(out, "%s%d,", s % 16 ? " " : "\n\t", dfa->accept[s]);
+	}
+	fprintf(out, "\n};\n\n");
+	fprintf(out, "static int %s(const char *s, size_t n, size_t *len)\n{\n", name);
+	fprintf(out, "\tunsigned state = 1;\n\tint rule = -1;\n\t*len = 0;\n");
+	fprintf(out, "\tfor (size_t i = 0; i < n; i++) {\n");
+	fprintf(out, "\t\tstate = %s_next[state][%s_class[(unsigned char)s[i]]];\n", name, name);
+	fprintf(out, "\t\tif (!state)\n\t\t\tbreak;\n");
+	fprintf(out, "\t\tif (%s_accept[state] >= 0) {\n\t\t\trule = %s_accept[state];\n\t\t\t*len = i + 1;\n\t\t}\n", name, name);
+	fprintf(out, "\t}\n\treturn rule;\n}\n");
+}
+
+APELEXER_PRIVATE void apelexer_dfa_emit_direct(const ApelexerDfa *dfa, FILE *out, const char *name)
+{
+	size_t k = dfa->class_count;
+	uint8_t *targeted = APELEXER_MALLOC(dfa->state_count);
+	memset(targeted, 0, dfa->state_count);
+	for (size_t t = 0; t < dfa->state_count * k; t++) {
+		targeted[dfa->next[t]] = APELEXER_TRUE;
+	}
+
+	fprintf(out, "static int %s(const char *s, size_t n, size_t *len)\n{\n", name);
+	fprintf(out, "\tsize_t i = 0;\n\tint rule = -1;\n\t*len = 0;\n");
+	for (size_t s = 1; s < dfa->state_count; s++) {
+		if (targeted[s])
+			fprintf(out, "s%zu:\n", s);
+		if (dfa->accept[s] >= 0)
+			fprintf(out, "\trule = %d;\n\t*len = i;\n", dfa->accept[s]);
+		int live = APELEXER_FALSE;
+		for (size_t c = 0; c < k; c++) {
+			live |= dfa->next[s * k + c] != 0;
+		}
+		if (!live) {
+			fprintf(out, "\treturn rule;\n");
+			continue;
+		}
+		fprintf(out, "\tif (i == n)\n\t\treturn rule;\n\tswitch ((unsigned char)s[i++]) {\n");
+		// One case list per target state, bytes leading to the dead state fall through to default
+		for (size_t t = 1; t < dfa->state_count; t++) {
+			int cases = 0;
+			for (int b = 0; b < 256; b++) {
+				if (dfa->next[s * k + dfa->byte_class[b]] != t)
+					continue;
+				fprintf(out, "%s", cases % 8 ? " " : cases ? "\n\t\t" : "\t\t");
+				fprintf(out, "case ");
+				apelexer_dfa_emit_byte(out, b);
+				fprintf(out, ":");
+				cases++;
+			}
+			if (cases)
+				fprintf(out, "\n\t\t\tgoto s%zu;\n", t);
+		}
+		fprintf(out, "\t\tdefault:\n\t\t\treturn rule;\n\t}\n");
+	}
+	fprintf(out, "}\n");
+	APELEXER_FREE(targeted);
+}
+
+APELEXER_DEF void apelexer_dfa_emit_c(const ApelexerDfa *dfa, FILE *out, const char *name, ApelexerDfaEmitStyle style)
+{
+	fprintf(out, "/* Generated by apelexer: %zu states, %zu byte classes */\n", dfa->state_count, dfa->class_count);
+	fprintf(out, "/* Rule token types:");
+	for (size_t r = 0; r < dfa->rule_count; r++) {
+		fprintf(out, " %zu=%s", r, apelexer_token_type_to_string(dfa->types[r]));
+	}
+	fprintf(out, " */\n");
+	switch (style) {
+		case APELEXER_DFA_EMIT_TABLES: apelexer_dfa_emit_tables(dfa, out, name); break;
+		case APELEXER_DFA_EMIT_DIRECT: apelexer_dfa_emit_direct(dfa, out, name); break;
+	}
+}
+
+#undef APELEXER_SET_HAS
+#undef APELEXER_SET_ADD
@@ -0,0 +1,322 @@
+#include "apelexer_internal.h"
+
+static const char *const apelexer_keywords[] = {
+	// only keywords defined in C99
+	// clang-format off
+    "break",
+    "case",
+    "char",
+    "const",
+    "continue",
+    "default",
+    "do",
+    "double",
+    "else",
+    "enum",
+    "extern",
+    "float",
+    "for",
+    "goto",
+    "if",
+    "inline",
+    "int",
+    "long",
+    "register",
+    "return",
+    "short",
+    "signed",
+    "sizeof",
+    "static",
+    "struct",
+    "switch",
+    "typedef",
+    "union",
+    "unsigned",
+    "void",
+    "volatile",
+    "while",
+	// clang-format on
+};
+
+static const ApelexerOperatorDef apelexer_operators[] = {
+	// clang-format off
+    { "+", APELEXER_TOKEN_OPERATOR },
+    { "-", APELEXER_TOKEN_OPERATOR },
+    { "*", APELEXER_TOKEN_OPERATOR },
+    { "/", APELEXER_TOKEN_OPERATOR },
+    { "%", APELEXER_TOKEN_OPERATOR },
+    { "&", APELEXER_TOKEN_OPERATOR },
+    { "|", APELEXER_TOKEN_OPERATOR },
+    { "^", APELEXER_TOKEN_OPERATOR },
+    { "~", APELEXER_TOKEN_OPERATOR },
+    { "!", APELEXER_TOKEN_OPERATOR },
+    { "<<", APELEXER_TOKEN_OPERATOR },
+    { ">>", APELEXER_TOKEN_OPERATOR },
+    { "++", APELEXER_TOKEN_OPERATOR },
+    { "--", APELEXER_TOKEN_OPERATOR },
+    { "<", APELEXER_TOKEN_OPERATOR },
+    { ">", APELEXER_TOKEN_OPERATOR },
+    { "<=", APELEXER_TOKEN_OPERATOR },
+    { ">=", APELEXER_TOKEN_OPERATOR },
+    { "==", APELEXER_TOKEN_OPERATOR },
+    { "!=", APELEXER_TOKEN_OPERATOR },
+    { "&&", APELEXER_TOKEN_OPERATOR },
+    { "||", APELEXER_TOKEN_OPERATOR },
+    { "?", APELEXER_TOKEN_OPERATOR },
+    { "=", APELEXER_TOKEN_OPERATOR },
+    { "+=", APELEXER_TOKEN_OPERATOR },
+    { "-=", APELEXER_TOKEN_OPERATOR },
+    { "*=", APELEXER_TOKEN_OPERATOR },
+    { "/=", APELEXER_TOKEN_OPERATOR },
+    { "%=", APELEXER_TOKEN_OPERATOR },
+    { "&=", APELEXER_TOKEN_OPERATOR },
+    { "|=", APELEXER_TOKEN_OPERATOR },
+    { "^=", APELEXER_TOKEN_OPERATOR },
+    { "<<=", APELEXER_TOKEN_OPERATOR },
+    { ">>=", APELEXER_TOKEN_OPERATOR },
+    { "->", APELEXER_TOKEN_ARROW },
+    { "(", APELEXER_TOKEN_OPEN_PAREN },
+    { ")", APELEXER_TOKEN_CLOSE_PAREN },
+    { "[", APELEXER_TOKEN_OPEN_BRACKET },
+    { "]", APELEXER_TOKEN_CLOSE_BRACKET },
+    { "{", APELEXER_TOKEN_OPEN_BRACE },
+    { "}", APELEXER_TOKEN_CLOSE_BRACE },
+    { ",", APELEXER_TOKEN_COMMA },
+    { ";", APELEXER_TOKEN_SEMICOLON },
+    { ":", APELEXER_TOKEN_COLON },
+    { ".", APELEXER_TOKEN_DOT },
+	// clang-format on
+};
+
+static const ApelexerLanguageSpec apelexer_c_spec = {
+	.keywords = apelexer_keywords,
+	.keyword_count = sizeof(apelexer_keywords) / sizeof(apelexer_keywords[0]),
+	.operators = apelexer_operators,
+	.operator_count = sizeof(apelexer_operators) / sizeof(apelexer_operators[0]),
+	.line_comment = "//",
+	.block_comment_open = "/*",
+	.block_comment_close = "*/",
+	.string_quote = '"',
+	.char_quote = '\'',
+	.escapes = APELEXER_TRUE,
+	.preprocessor = APELEXER_TRUE,
+	.number_prefixes = APELEXER_TRUE,
+	.number_floats = APELEXER_TRUE,
+	.decode_numbers = APELEXER_FALSE,
+	.identifier_chars = NULL,
+};
+
+/* Seeded FNV-1a, the seed is picked at compile time so that no two keywords share a slot */
+APELEXER_PRIVATE uint32_t apelexer_keyword_hash(const char *s, size_t n, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	for (size_t i = 0; i < n; i++) {
+		h ^= (uint8_t)s[i];
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+/* Duplicates collide under every seed, so they are rejected before searching */
+APELEXER_PRIVATE int apelexer_language_has_duplicate_keywords(const ApelexerLanguageSpec *spec)
+{
+	for (size_t a = 0; a < spec->keyword_count; a++) {
+		for (size_t b = a + 1; b < spec->keyword_count; b++) {
+			if (strcmp(spec->keywords[a], spec->keywords[b]) == 0)
+				return APELEXER_TRUE;
+		}
+	}
+	return APELEXER_FALSE;
+}
+
+APELEXER_PRIVATE int apelexer_language_build_keywords(ApelexerLanguage *lang)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	if (spec->keyword_count == 0)
+		return APELEXER_TRUE;
+	if (apelexer_language_has_duplicate_keywords(spec))
+		return APELEXER_FALSE;
+	// A table of n^2 slots is collision free for about half of all seeds, larger ones don't help
+	size_t size = 16;
+	while (size < spec->keyword_count * 2)
+		size *= 2;
+	size_t max_size = 16;
+	while (max_size < spec->keyword_count * spec->keyword_count && max_size < (1u << 20))
+		max_size *= 2;
+	if (max_size < size)
+		max_size = size;
+	lang->kw_slots = APELEXER_MALLOC(sizeof(int32_t) * max_size);
+	for (; size <= max_size; size *= 2) {
+		memset(lang->kw_slots, 0xff, sizeof(int32_t) * size);
+		for (uint32_t seed = 0; seed < 4096; seed++) {
+			size_t k = 0;
+			for (; k < spec->keyword_count; k++) {
+				const char *kw = spec->keywords[k];
+				uint32_t slot = apelexer_keyword_hash(kw, strlen(kw), seed) & (uint32_t)(size - 1);
+				if (lang->kw_slots[slot] >= 0)
+					break;
+				lang->kw_slots[slot] = (int32_t)k;
+			}
+			if (k == spec->keyword_count) {
+				lang->kw_mask = (uint32_t)(size - 1);
+				lang->kw_seed = seed;
+				return APELEXER_TRUE;
+			}
+			// Only clear the slots this seed filled, so a failed seed costs O(keywords)
+			while (k-- > 0) {
+				const char *kw = spec->keywords[k];
+				lang->kw_slots[apelexer_keyword_hash(kw, strlen(kw), seed) & (uint32_t)(size - 1)] = -1;
+			}
+		}
+	}
+	return APELEXER_FALSE;
+}
+
+APELEXER_PRIVATE int apelexer_language_build_operators(ApelexerLanguage *lang)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	size_t cap = 16;
+	lang->op_next = APELEXER_MALLOC(sizeof(*lang->op_next) * cap);
+	lang->op_accept = APELEXER_MALLOC(sizeof(uint8_t) * cap);
+	memset(lang->op_next[0], 0, sizeof(lang->op_next[0]));
+	lang->op_accept[0] = APELEXER_TOKEN_NONE;
+	lang->op_states = 1;
+	for (size_t k = 0; k < spec->operator_count; k++) {
+		const unsigned char *text = (const unsigned char *)spec->operators[k].text;
+		if (!text || !text[0] || spec->operators[k].type == APELEXER_TOKEN_NONE)
+			return APELEXER_FALSE;
+		uint16_t state = 0;
+		for (; *text; text++) {
+			if (*text >= 128)
+				return APELEXER_FALSE;
+			if (lang->op_next[state][*text] == 0) {
+				if (lang->op_states == UINT16_MAX)
+					return APELEXER_FALSE;
+				if (lang->op_states == cap) {
+					cap *= 2;
+					lang->op_next = APELEXER_REALLOC(lang->op_next, sizeof(*lang->op_next) * cap);
+					lang->op_accept = APELEXER_REALLOC(lang->op_accept, sizeof(uint8_t) * cap);
+				}
+				memset(lang->op_next[lang->op_states], 0, sizeof(lang->op_next[0]));
+				lang->op_accept[lang->op_states] = APELEXER_TOKEN_NONE;
+				lang->op_next[state][*text] = (uint16_t)lang->op_states++;
+			}
+			state = lang->op_next[state][*text];
+		}
+		lang->op_accept[state] = (uint8_t)spec->operators[k].type;
+		lang->char_class[(unsigned char)spec->operators[k].text[0]] |= APELEXER_CLASS_OPERATOR;
+	}
+	return APELEXER_TRUE;
+}
+
+APELEXER_PRIVATE int apelexer_language_init(ApelexerLanguage *lang, const ApelexerLanguageSpec *spec)
+{
+	memset(lang, 0, sizeof(*lang));
+	lang->spec = *spec;
+	if ((spec->block_comment_open == NULL) != (spec->block_comment_close == NULL))
+		return APELEXER_FALSE;
+	if ((spec->line_comment && !spec->line_comment[0]) || (spec->block_comment_open && !spec->block_comment_open[0]) ||
+	    (spec->block_comment_close && !spec->block_comment_close[0]))
+		return APELEXER_FALSE;
+	for (int c = 0; c < 256; c++) {
+		uint8_t cls = 0;
+		if (c == '\n' || c == '\r')
+			cls |= APELEXER_CLASS_NEWLINE;
+		else if (isspace(c))
+			cls |= APELEXER_CLASS_SPACE;
+		if (isdigit(c))
+			cls |= APELEXER_CLASS_DIGIT | APELEXER_CLASS_IDENT;
+		if (isalpha(c) || c == '_')
+			cls |= APELEXER_CLASS_IDENT_START | APELEXER_CLASS_IDENT;
+		lang->char_class[c] = cls;
+	}
+	for (const char *p = spec->identifier_chars; p && *p; p++) {
+		lang->char_class[(unsigned char)*p] |= APELEXER_CLASS_IDENT;
+	}
+	if (spec->line_comment) {
+		lang->line_comment_len = strlen(spec->line_comment);
+		lang->char_class[(unsigned char)spec->line_comment[0]] |= APELEXER_CLASS_COMMENT;
+	}
+	if (spec->block_comment_open) {
+		lang->block_open_len = strlen(spec->block_comment_open);
+		lang->block_close_len = strlen(spec->block_comment_close);
+		lang->char_class[(unsigned char)spec->block_comment_open[0]] |= APELEXER_CLASS_COMMENT;
+	}
+	return apelexer_language_build_operators(lang) && apelexer_language_build_keywords(lang);
+}
+
+APELEXER_PRIVATE void apelexer_language_release(ApelexerLanguage *lang)
+{
+	APELEXER_FREE(lang->op_next);
+	APELEXER_FREE(lang->op_accept);
+	APELEXER_FREE(lang->kw_slots);
+}
+
+APELEXER_DEF ApelexerLanguage *apelexer_language_compile(const ApelexerLanguageSpec *spec)
+{
+	ApelexerLanguage *lang = APELEXER_MALLOC(sizeof(ApelexerLanguage));
+	if (!apelexer_language_init(lang, spec)) {
+		apelexer_language_release(lang);
+		APELEXER_FREE(lang);
+		return NULL;
+	}
+	return lang;
+}
+
+APELEXER_DEF void apelexer_language_free(ApelexerLanguage *lang)
+{
+	if (!lang)
+		return;
+	apelexer_language_release(lang);
+	APELEXER_FREE(lang);
+}
+
+APELEXER_PRIVATE ApelexerLanguage apelexer_c_language;
+
+APELEXER_PRIVATE void apelexer_c_language_init(void)
+{
+	apelexer_language_init(&apelexer_c_language, &apelexer_c_spec);
+}
+
+APELEXER_DEF const ApelexerLanguage *apelexer_language_c(void)
+{
+#ifdef APELEXER_HAS_THREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, apelexer_c_language_init);
+#else
+	static int initialized = APELEXER_FALSE;
+	if (!initialized) {
+		apelexer_c_language_init();
+		initialized = APELEXER_TRUE;
+	}
+#endif
+	return &apelexer_c_language;
+}
+
+APELEXER_DEF int apelexer_language_is_keyword(const ApelexerLanguage *lang, const char *s, size_t n)
+{
+	if (!lang->kw_slots)
+		return APELEXER_FALSE;
+	int32_t k = lang->kw_slots[apelexer_keyword_hash(s, n, lang->kw_seed) & lang->kw_mask];
+	if (k < 0)
+		return APELEXER_FALSE;
+	const char *kw = lang->spec.keywords[k];
+	return strncmp(kw, s, n) == 0 && kw[n] == '\0';
+}
+
+APELEXER_DEF size_t apelexer_language_match_operator(const ApelexerLanguage *lang, const char *s, size_t n, ApelexerTokenType *type)
+{
+	uint16_t state = 0;
+	size_t match = 0;
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = (unsigned char)s[i];
+		if (c >= 128 || lang->op_next[state][c] == 0)
+			break;
+		state = lang->op_next[state][c];
+		if (lang->op_accept[state] != APELEXER_TOKEN_NONE) {
+			match = i + 1;
+			*type = (ApelexerTokenType)lang->op_accept[state];
+		}
+	}
+	return match;
+}
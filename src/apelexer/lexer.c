@@ -0,0 +1,410 @@
+#include "apelexer_internal.h"
+
+#define APELEXER_MAX_TOKEN_LENGTH 128
+
+APELEXER_PRIVATE const char *apelexer_error_type_to_string(ApelexerErrorType type)
+{
+	switch (type) {
+		case APELEXER_ERROR_NONE: return "none";
+		case APELEXER_ERROR_UNEXPECTED_CHAR: return "unexpected char";
+		case APELEXER_ERROR_UNEXPECTED_EOF: return "unexpected eof";
+		case APELEXER_ERROR_QUOTED_QUOTE: return "quoted quote";
+		case APELEXER_ERROR_UNEXPECTED_NEWLINE: return "unexpected newline";
+		case APELEXER_ERROR_UNTERMINATED_STRING: return "unterminated string";
+		case APELEXER_ERROR_CHAR_TOO_LONG: return "char too long";
+		case APELEXER_ERROR_INVALID_FLOAT: return "invalid float";
+		case APELEXER_ERROR_INVALID_NUMBER: return "invalid number";
+		case APELEXER_ERROR_INVALID_CHAR: return "invalid char";
+		case APELEXER_ERROR_UNTERMINATED_COMMENT: return "unterminated comment";
+		case APELEXER_ERROR_NUMBER_TOO_LARGE: return "number too large";
+		case APELEXER_ERROR_MALFORMED_NUMBER: return "malformed number";
+	}
+	return "unknown";
+}
+
+APELEXER_DEF void apelexer_error(ApelexerErrorType type, size_t line, size_t column)
+{
+	fprintf(stderr, "apelexer error: %s, at %zu:%zu\n", apelexer_error_type_to_string(type), line, column);
+	exit(1);
+}
+
+APELEXER_DEF char *apelexer_token_type_to_string(ApelexerTokenType type)
+{
+	switch (type) {
+		case APELEXER_TOKEN_NONE: return "none";
+		case APELEXER_TOKEN_KEYWORD: return "keyword";
+		case APELEXER_TOKEN_IDENTIFIER: return "identifier";
+		case APELEXER_TOKEN_INT: return "int";
+		case APELEXER_TOKEN_FLOAT: return "float";
+		case APELEXER_TOKEN_CHAR: return "char";
+		case APELEXER_TOKEN_STRING: return "string";
+		case APELEXER_TOKEN_OPERATOR: return "operator";
+		case APELEXER_TOKEN_PREPROCESSOR: return "preprocessor";
+		case APELEXER_TOKEN_OPEN_PAREN: return "open paren";
+		case APELEXER_TOKEN_CLOSE_PAREN: return "close paren";
+		case APELEXER_TOKEN_OPEN_BRACKET: return "open bracket";
+		case APELEXER_TOKEN_CLOSE_BRACKET: return "close bracket";
+		case APELEXER_TOKEN_OPEN_BRACE: return "open brace";
+		case APELEXER_TOKEN_CLOSE_BRACE: return "close brace";
+		case APELEXER_TOKEN_COMMA: return "comma";
+		case APELEXER_TOKEN_SEMICOLON: return "semicolon";
+		case APELEXER_TOKEN_COLON: return "colon";
+		case APELEXER_TOKEN_DOT: return "dot";
+		case APELEXER_TOKEN_ARROW: return "arrow";
+		case APELEXER_TOKEN_EOF: return "eof";
+	}
+	return "unknown";
+}
+
+APELEXER_DEF int apelexer_is_line_end(const char *input, size_t len, size_t k)
+{
+	if (k == 0 || k > len)
+		return APELEXER_FALSE;
+	size_t nl = k - 1;
+	if (input[nl] == '\r') {
+		if (k == len || input[k] == '\n')
+			return APELEXER_FALSE;
+	} else if (input[nl] == '\n') {
+		if (nl > 0 && input[nl - 1] == '\r')
+			nl--;
+	} else {
+		return APELEXER_FALSE;
+	}
+	return nl == 0 || input[nl - 1] != '\\';
+}
+
+APELEXER_DEF int apelexer_scan(ApelexerScanner *s, ApelexerToken *tok)
+{
+	const char *input = s->input;
+	size_t len = s->len;
+	size_t i = s->i;
+	size_t line = s->line;
+	size_t column = s->column;
+	const ApelexerLanguage *lang = s->lang ? s->lang : apelexer_language_c();
+	const ApelexerLanguageSpec *spec = &lang->spec;
+#define APELEXER_PEEK_AT(p) ((p) < len ? input[p] : '\0')
+#define APELEXER_PEEK(n) APELEXER_PEEK_AT(i + (n))
+#define APELEXER_STARTS_WITH(str, n) (len - i >= (n) && memcmp(&input[i], (str), (n)) == 0)
+/* \r\n counts as a single line break */
+#define APELEXER_SCAN_NEWLINE()                                              \
+	do {                                                                 \
+		i += (input[i] == '\r' && APELEXER_PEEK(1) == '\n') ? 2 : 1; \
+		line++, column = 1;                                          \
+	} while (0)
+#define APELEXER_SCAN_SET_VALUE(t, start, end)        \
+	do {                                          \
+		tok->type = (t);                      \
+		tok->value = (char *)&input[(start)]; \
+		tok->length = (end) - (start);        \
+		s->number.i = 0;                      \
+	} while (0)
+
+	while (i < len) {
+		char c = input[i];
+		uint8_t cls = lang->char_class[(unsigned char)c];
+		if (cls & APELEXER_CLASS_NEWLINE) {
+			APELEXER_SCAN_NEWLINE();
+			continue;
+		}
+		if (cls & APELEXER_CLASS_SPACE) {
+			column++;
+			i++;
+			continue;
+		}
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->line_comment_len && APELEXER_STARTS_WITH(spec->line_comment, lang->line_comment_len)) {
+			while (i < len && input[i] != '\n' && input[i] != '\r') {
+				i++, column++;
+			}
+			continue;
+		}
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->block_open_len &&
+		    APELEXER_STARTS_WITH(spec->block_comment_open, lang->block_open_len)) {
+			size_t start = i;
+			size_t start_line = line;
+			size_t start_column = column;
+			i += lang->block_open_len, column += lang->block_open_len;
+			while (i < len && !APELEXER_STARTS_WITH(spec->block_comment_close, lang->block_close_len)) {
+				if (input[i] == '\n' || input[i] == '\r') {
+					APELEXER_SCAN_NEWLINE();
+					continue;
+				}
+				i++, column++;
+			}
+			if (i >= len) {
+				if (s->partial) {
+					// wait for the rest of the comment
+					i = start, line = start_line, column = start_column;
+					break;
+				}
+				apelexer_error(APELEXER_ERROR_UNTERMINATED_COMMENT, start_line, start_column);
+			}
+			i += lang->block_close_len, column += lang->block_close_len;
+			continue;
+		}
+		if (spec->string_quote && c == spec->string_quote) {
+			i++, column++;
+			size_t start_line = line;
+			size_t start_column = column;
+			size_t start = i;
+			while (i < len) {
+				if (input[i] == '\n' || input[i] == '\r') {
+					apelexer_error(APELEXER_ERROR_UNTERMINATED_STRING, line, column);
+				}
+				if (input[i] == spec->string_quote) {
+					break;
+				}
+				if (spec->escapes && input[i] == '\\') {
+					i++, column++;
+					if (i < len && input[i] == 'x') {
+						i += 2, column += 2;
+					} else if (i < len && (input[i] == 'u' || input[i] == 'U')) {
+						// the hex digits follow the u/U, i ends on the last one
+						size_t esc = i;
+						size_t digits = input[i] == 'u' ? 4 : 8;
+						for (size_t j = 1; j <= digits; j++) {
+							if (!isxdigit((unsigned char)APELEXER_PEEK_AT(esc + j))) {
+								apelexer_error(APELEXER_ERROR_INVALID_CHAR, line, column);
+							}
+							i++, column++;
+						}
+					} else if (i < len && (input[i] == '\n' || input[i] == '\r')) {
+						APELEXER_SCAN_NEWLINE();
+						continue;
+					}
+				}
+				i++, column++;
+			}
+			if (i >= len || input[i] != spec->string_quote) {
+				apelexer_error(APELEXER_ERROR_UNTERMINATED_STRING, line, column);
+			}
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_STRING, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			i++, column++;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (spec->char_quote && c == spec->char_quote) {
+			size_t start_line = line;
+			size_t start_column = column;
+			i++, column++;
+			if (spec->escapes && APELEXER_PEEK(0) == '\\')
+				i++, column++;
+			i++, column++;
+			if (APELEXER_PEEK(0) != spec->char_quote) {
+				apelexer_error(APELEXER_ERROR_CHAR_TOO_LONG, line, column);
+			}
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_CHAR, i - 1, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			i++, column++;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (cls & APELEXER_CLASS_DIGIT) {
+			size_t start_line = line;
+			size_t start_column = column;
+			int base = 10;
+			size_t start = i;
+			size_t end = i;
+			int dots = 0;
+			int exponent = 0;
+			int is_float = 0;
+			char prefix = spec->number_prefixes && c == '0' ? APELEXER_PEEK(1) : '\0';
+			if (prefix == 'x') {
+				i += 2;
+				column += 2;
+				base = 16;
+			} else if (prefix == 'b') {
+				i += 2;
+				column += 2;
+				base = 2;
+			} else if (prefix == 'o') {
+				i += 2;
+				column += 2;
+				base = 8;
+			}
+			while (i < len) {
+				if (input[i] == '.') {
+					if (!spec->number_floats) {
+						break;
+					}
+					if (base != 10 || exponent) {
+						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+					}
+					dots++;
+					if (dots > 1) {
+						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+					}
+					is_float = 1;
+					i++, column++;
+					end = i;
+					continue;
+				}
+				if ((input[i] == 'e' || input[i] == 'E') && spec->number_floats && base != 16) {
+					if (base != 10 || exponent) {
+						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+					}
+					if (end - start < 1) {
+						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+					}
+					i++, column++;
+					if (APELEXER_PEEK(0) == '+' || APELEXER_PEEK(0) == '-')
+						i++, column++;
+					if (!isdigit((unsigned char)APELEXER_PEEK(0))) {
+						apelexer_error(APELEXER_ERROR_MALFORMED_NUMBER, line, column);
+					}
+					end = i;
+					exponent = 1;
+					is_float = 1;
+					continue;
+				}
+				if (isdigit((unsigned char)input[i])) {
+					if (base == 8) {
+						if (input[i] > '7') {
+							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+						}
+					} else if (base == 2) {
+						if (input[i] > '1') {
+							apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+						}
+					}
+					i++, column++;
+					end = i;
+					continue;
+				}
+				if (isxdigit((unsigned char)input[i])) {
+					if (base != 16) {
+						apelexer_error(APELEXER_ERROR_INVALID_NUMBER, line, column);
+					}
+					i++, column++;
+					end = i;
+					continue;
+				}
+				break;
+			}
+			if (input[i - 1] == '.') {
+				apelexer_error(APELEXER_ERROR_INVALID_FLOAT, line, column);
+			}
+			if (end == start) {
+				// a 0x, 0b or 0o prefix without digits
+				apelexer_error(APELEXER_ERROR_MALFORMED_NUMBER, start_line, start_column);
+			}
+			APELEXER_SCAN_SET_VALUE(is_float ? APELEXER_TOKEN_FLOAT : APELEXER_TOKEN_INT, start, end);
+			if (spec->decode_numbers) {
+				int ok = is_float ? apelexer_parse_float(tok->value, tok->length, &s->number.f)
+						  : apelexer_parse_int(tok->value, tok->length, &s->number.i);
+				if (!ok) {
+					apelexer_error(APELEXER_ERROR_NUMBER_TOO_LARGE, start_line, start_column);
+				}
+			}
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (c == '#' && spec->preprocessor) {
+			if (column != 1) {
+				apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
+			}
+			size_t start_line = line;
+			size_t start_column = column;
+			size_t start = i;
+			i++, column++;
+			while (i < len) {
+				if (input[i] == '\n' || input[i] == '\r') {
+					if (input[i - 1] != '\\')
+						break;
+					APELEXER_SCAN_NEWLINE();
+					continue;
+				}
+				i++, column++;
+			}
+			APELEXER_SCAN_SET_VALUE(APELEXER_TOKEN_PREPROCESSOR, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (cls & APELEXER_CLASS_IDENT_START) {
+			size_t start_line = line;
+			size_t start_column = column;
+			size_t start = i;
+			while (i < len && (lang->char_class[(unsigned char)input[i]] & APELEXER_CLASS_IDENT)) {
+				i++, column++;
+			}
+			int is_keyword = apelexer_language_is_keyword(lang, &input[start], i - start);
+			APELEXER_SCAN_SET_VALUE(is_keyword ? APELEXER_TOKEN_KEYWORD : APELEXER_TOKEN_IDENTIFIER, start, i);
+			tok->start_line = start_line;
+			tok->start_column = start_column;
+			tok->end_line = line;
+			tok->end_column = column;
+			goto emit;
+		}
+		if (cls & APELEXER_CLASS_OPERATOR) {
+			ApelexerTokenType type = APELEXER_TOKEN_NONE;
+			size_t n = apelexer_language_match_operator(lang, &input[i], len - i, &type);
+			if (n > 0) {
+				APELEXER_SCAN_SET_VALUE(type, i, i + n);
+				tok->start_line = line;
+				tok->start_column = column;
+				i += n, column += n;
+				tok->end_line = line;
+				tok->end_column = column;
+				goto emit;
+			}
+		}
+		apelexer_error(APELEXER_ERROR_UNEXPECTED_CHAR, line, column);
+	}
+	s->i = i;
+	s->line = line;
+	s->column = column;
+	return APELEXER_FALSE;
+emit:
+	s->i = i;
+	s->line = line;
+	s->column = column;
+	return APELEXER_TRUE;
+#undef APELEXER_SCAN_SET_VALUE
+#undef APELEXER_SCAN_NEWLINE
+#undef APELEXER_STARTS_WITH
+#undef APELEXER_PEEK
+#undef APELEXER_PEEK_AT
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_into(ApelexerToken *tokens, const ApelexerLanguage *lang, ApelexerSymbols *symbols,
+						  const char *input, size_t len, size_t *token_count)
+{
+	ApelexerScanner s = { input, len, 0, 1, 1, lang, APELEXER_FALSE, { 0 } };
+	ApelexerToken tok;
+	*token_count = 0;
+	while (apelexer_scan(&s, &tok)) {
+		uint32_t symbol = APELEXER_NO_SYMBOL;
+		if (symbols && tok.type == APELEXER_TOKEN_IDENTIFIER) {
+			symbol = apelexer_symbols_intern(symbols, tok.value, tok.length);
+			tok.value = (char *)apelexer_symbols_name(symbols, symbol);
+		}
+		tokens = apelexer_tokens_push(tokens, (*token_count)++, tok, symbol, s.number);
+	}
+	return tokens;
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_interned(const ApelexerLanguage *lang, ApelexerSymbols *symbols, const char *input,
+						       size_t *token_count)
+{
+	return apelexer_tokenize_into(NULL, lang, symbols, input, strlen(input), token_count);
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_lang(const ApelexerLanguage *lang, const char *input, size_t *token_count)
+{
+	return apelexer_tokenize_interned(lang, NULL, input, token_count);
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize(const char *input, size_t *token_count)
+{
+	return apelexer_tokenize_lang(NULL, input, token_count);
+}
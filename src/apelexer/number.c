@@ -0,0 +1,201 @@
+#include "apelexer_internal.h"
+
+/* Significant decimal digits that always fit in a uint64_t */
+#define APELEXER_MAX_MANTISSA_DIGITS 19
+/* Integers up to 2^53 are exactly representable as doubles */
+#define APELEXER_MAX_EXACT_INT ((uint64_t)1 << 53)
+/* Largest power of ten that is exactly representable as a double */
+#define APELEXER_MAX_EXACT_POW10 22
+
+static const double apelexer_pow10[APELEXER_MAX_EXACT_POW10 + 1] = {
+	1e0,  1e1,  1e2,  1e3,	1e4,  1e5,  1e6,  1e7,	1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define APELEXER_SWAR_DIGITS
+#endif
+
+#ifdef APELEXER_SWAR_DIGITS
+/* Loads 8 bytes so that p[0] is the lowest byte */
+APELEXER_PRIVATE uint64_t apelexer_load8(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* All 8 bytes are '0'..'9': the high nibble of every byte is 3 and adding 6 doesn't carry into it */
+APELEXER_PRIVATE int apelexer_is_eight_digits(uint64_t v)
+{
+	return (((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+/* Combines 8 ASCII digits into their value, pairwise: 8 x 1 digit -> 4 x 2 -> 2 x 4 -> 1 x 8 */
+APELEXER_PRIVATE uint32_t apelexer_parse_eight_digits(uint64_t v)
+{
+	v = (v & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+	v = (v & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+	return (uint32_t)((v & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+}
+#endif
+
+/*
+ * Accumulates the decimal digits at p into m, counting significant digits in nd. Stops at the
+ * first non-digit, or before a digit that would overflow APELEXER_MAX_MANTISSA_DIGITS
+ */
+APELEXER_PRIVATE const char *apelexer_parse_digits(const char *p, const char *end, uint64_t *m, int *nd)
+{
+	while (p < end) {
+#ifdef APELEXER_SWAR_DIGITS
+		if (end - p >= 8 && *m != 0 && *nd + 8 <= APELEXER_MAX_MANTISSA_DIGITS) {
+			uint64_t v = apelexer_load8(p);
+			if (apelexer_is_eight_digits(v)) {
+				*m = *m * 100000000 + apelexer_parse_eight_digits(v);
+				*nd += 8;
+				p += 8;
+				continue;
+			}
+		}
+#endif
+		if (!isdigit((unsigned char)*p) || *nd == APELEXER_MAX_MANTISSA_DIGITS)
+			break;
+		*m = *m * 10 + (uint64_t)(*p - '0');
+		if (*m != 0)
+			(*nd)++; // leading zeros aren't significant
+		p++;
+	}
+	return p;
+}
+
+APELEXER_PRIVATE int apelexer_digit_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 16;
+}
+
+APELEXER_DEF int apelexer_parse_int(const char *s, size_t len, uint64_t *value)
+{
+	const char *p = s;
+	const char *end = s + len;
+	int bits = 0;
+	if (len > 2 && p[0] == '0') {
+		bits = p[1] == 'x' ? 4 : p[1] == 'o' ? 3 : p[1] == 'b' ? 1 : 0;
+		if (bits)
+			p += 2;
+	}
+	if (p == end)
+		return APELEXER_FALSE;
+	uint64_t v = 0;
+	if (bits) {
+		for (; p < end; p++) {
+			int d = apelexer_digit_value(*p);
+			if (d >> bits || v >> (64 - bits))
+				return APELEXER_FALSE;
+			v = v << bits | (uint64_t)d;
+		}
+		*value = v;
+		return APELEXER_TRUE;
+	}
+	int nd = 0;
+	p = apelexer_parse_digits(p, end, &v, &nd);
+	if (p < end) {
+		// Only a 20th digit can still fit
+		if (!isdigit((unsigned char)*p) || p + 1 < end || v > (UINT64_MAX - (uint64_t)(*p - '0')) / 10)
+			return APELEXER_FALSE;
+		v = v * 10 + (uint64_t)(*p - '0');
+	}
+	*value = v;
+	return APELEXER_TRUE;
+}
+
+/* Correctly rounded conversion for everything the fast paths can't prove exact */
+APELEXER_PRIVATE double apelexer_parse_float_slow(const char *s, size_t len)
+{
+	char small[128];
+	char *buf = len < sizeof(small) ? small : APELEXER_MALLOC(len + 1);
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	double d = strtod(buf, NULL);
+	if (buf != small)
+		APELEXER_FREE(buf);
+	return d;
+}
+
+APELEXER_DEF int apelexer_parse_float(const char *s, size_t len, double *value)
+{
+	const char *p = s;
+	const char *end = s + len;
+	uint64_t m = 0;
+	int nd = 0;
+	p = apelexer_parse_digits(p, end, &m, &nd);
+	if (p == s)
+		return APELEXER_FALSE;
+	long exp10 = 0;
+	int truncated = p < end && isdigit((unsigned char)*p);
+	while (p < end && isdigit((unsigned char)*p)) {
+		p++;
+	}
+	if (p < end && *p == '.') {
+		const char *frac = ++p;
+		if (!truncated) {
+			p = apelexer_parse_digits(p, end, &m, &nd);
+			exp10 = -(long)(p - frac);
+			truncated = p < end && isdigit((unsigned char)*p);
+		}
+		while (p < end && isdigit((unsigned char)*p)) {
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		int negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+'))
+			p++;
+		if (p == end)
+			return APELEXER_FALSE;
+		long e = 0;
+		for (; p < end && isdigit((unsigned char)*p); p++) {
+			if (e < 100000)
+				e = e * 10 + (*p - '0');
+		}
+		exp10 += negative ? -e : e;
+	}
+	if (p != end)
+		return APELEXER_FALSE;
+
+	// Clinger's fast path: the mantissa and the power of ten are both exact doubles, so a
+	// single correctly rounded multiplication or division gives the correctly rounded result.
+	// It needs doubles to be evaluated at double precision (not on the x87 stack)
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+	if (!truncated && m <= APELEXER_MAX_EXACT_INT) {
+		if (m == 0) {
+			*value = 0.0;
+			return APELEXER_TRUE;
+		}
+		if (exp10 >= -APELEXER_MAX_EXACT_POW10 && exp10 <= APELEXER_MAX_EXACT_POW10) {
+			double d = (double)m;
+			*value = exp10 < 0 ? d / apelexer_pow10[-exp10] : d * apelexer_pow10[exp10];
+			return APELEXER_TRUE;
+		}
+		// 123e25 = 123000e22: move zeros into the mantissa while it stays exact
+		if (exp10 > APELEXER_MAX_EXACT_POW10 && exp10 <= APELEXER_MAX_EXACT_POW10 + 15) {
+			uint64_t scaled = m;
+			for (long k = exp10; k > APELEXER_MAX_EXACT_POW10 && scaled <= APELEXER_MAX_EXACT_INT; k--) {
+				scaled *= 10;
+			}
+			if (scaled <= APELEXER_MAX_EXACT_INT) {
+				*value = (double)scaled * apelexer_pow10[APELEXER_MAX_EXACT_POW10];
+				return APELEXER_TRUE;
+			}
+		}
+	}
+#endif
+	*value = apelexer_parse_float_slow(s, len);
+	return APELEXER_TRUE;
+}
@@ -0,0 +1,175 @@
+#include "apelexer_internal.h"
+
+/* Inputs smaller than this per thread are not worth splitting */
+#define APELEXER_PARALLEL_MIN_CHUNK (256 * 1024)
+
+typedef struct {
+	ApelexerScanner scanner;
+	ApelexerToken *tokens; /* Token array with its own arena, the first chunk's becomes the result */
+	size_t count;
+} ApelexerChunk;
+
+APELEXER_PRIVATE void *apelexer_lex_chunk(void *arg)
+{
+	ApelexerChunk *chunk = arg;
+	ApelexerToken tok;
+	while (apelexer_scan(&chunk->scanner, &tok)) {
+		chunk->tokens = apelexer_tokens_push(chunk->tokens, chunk->count++, tok, APELEXER_NO_SYMBOL, chunk->scanner.number);
+	}
+	return NULL;
+}
+
+/* First line start at or after pos that no token spans */
+APELEXER_PRIVATE size_t apelexer_find_split(const char *input, size_t len, size_t pos)
+{
+	while (pos < len) {
+		const char *nl = memchr(input + pos, '\n', len - pos);
+		if (!nl)
+			return len;
+		pos = (size_t)(nl - input) + 1;
+		if (apelexer_is_line_end(input, len, pos))
+			return pos;
+	}
+	return len;
+}
+
+/* Block comments can span lines, so a line start is only safe if it isn't inside one. This walks
+ * the input once, skipping comments, strings, chars and preprocessor lines the way the scanner
+ * does, and stores the first safe line start at or after each target in splits */
+APELEXER_PRIVATE void apelexer_prescan_splits(const ApelexerLanguage *lang, const char *input, size_t len, size_t *splits, int nsplits)
+{
+	const ApelexerLanguageSpec *spec = &lang->spec;
+	size_t i = 0;
+	int k = 0;
+	while (k < nsplits) {
+		size_t target = len / (nsplits + 1) * (k + 1);
+		if (i >= len) {
+			splits[k++] = len;
+			continue;
+		}
+		if (i >= target && apelexer_is_line_end(input, len, i)) {
+			splits[k++] = i;
+			continue;
+		}
+		char c = input[i];
+		uint8_t cls = lang->char_class[(unsigned char)c];
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->line_comment_len && len - i >= lang->line_comment_len &&
+		    memcmp(&input[i], spec->line_comment, lang->line_comment_len) == 0) {
+			while (i < len && input[i] != '\n' && input[i] != '\r')
+				i++;
+			continue;
+		}
+		if ((cls & APELEXER_CLASS_COMMENT) && lang->block_open_len && len - i >= lang->block_open_len &&
+		    memcmp(&input[i], spec->block_comment_open, lang->block_open_len) == 0) {
+			i += lang->block_open_len;
+			while (i < len && !(len - i >= lang->block_close_len && memcmp(&input[i], spec->block_comment_close, lang->block_close_len) == 0))
+				i++;
+			i = i + lang->block_close_len < len ? i + lang->block_close_len : len;
+			continue;
+		}
+		if ((spec->string_quote && c == spec->string_quote) || (spec->char_quote && c == spec->char_quote)) {
+			i++;
+			while (i < len && input[i] != c && input[i] != '\n' && input[i] != '\r')
+				i += spec->escapes && input[i] == '\\' ? 2 : 1;
+			i++;
+			continue;
+		}
+		if (c == '#' && spec->preprocessor && (i == 0 || input[i - 1] == '\n' || input[i - 1] == '\r')) {
+			while (i < len && !((input[i] == '\n' || input[i] == '\r') && input[i - 1] != '\\'))
+				i++;
+			continue;
+		}
+		i++;
+	}
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_parallel(const ApelexerLanguage *lang, const char *input, size_t len, size_t *token_count,
+						      int threads)
+{
+#ifdef APELEXER_HAS_THREADS
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int)cpus : 1;
+	}
+#else
+	threads = 1;
+#endif
+	if ((size_t)threads > len / APELEXER_PARALLEL_MIN_CHUNK)
+		threads = (int)(len / APELEXER_PARALLEL_MIN_CHUNK);
+	if (threads <= 1)
+		return apelexer_tokenize_into(NULL, lang, NULL, input, len, token_count);
+
+	if (!lang)
+		lang = apelexer_language_c();
+
+	size_t *splits = APELEXER_MALLOC(sizeof(size_t) * threads);
+	if (lang->block_open_len) {
+		apelexer_prescan_splits(lang, input, len, splits, threads - 1);
+	} else {
+		for (int k = 0; k < threads - 1; k++) {
+			splits[k] = apelexer_find_split(input, len, len / threads * (k + 1));
+		}
+	}
+	splits[threads - 1] = len;
+
+	ApelexerChunk *chunks = APELEXER_MALLOC(sizeof(ApelexerChunk) * threads);
+	int nchunks = 0;
+	size_t start = 0;
+	for (int k = 0; k < threads && start < len; k++) {
+		size_t end = splits[k] < start ? start : splits[k];
+		ApelexerChunk *c = &chunks[nchunks++];
+		memset(c, 0, sizeof(*c));
+		c->scanner = (ApelexerScanner){ input, end, start, 1, 1, lang, APELEXER_FALSE, { 0 } };
+		start = end;
+	}
+	APELEXER_FREE(splits);
+
+#ifdef APELEXER_HAS_THREADS
+	pthread_t *workers = APELEXER_MALLOC(sizeof(pthread_t) * nchunks);
+	int *started = APELEXER_MALLOC(sizeof(int) * nchunks);
+	for (int k = 1; k < nchunks; k++) {
+		started[k] = pthread_create(&workers[k], NULL, apelexer_lex_chunk, &chunks[k]) == 0;
+	}
+	if (nchunks > 0)
+		apelexer_lex_chunk(&chunks[0]);
+	for (int k = 1; k < nchunks; k++) {
+		if (started[k])
+			pthread_join(workers[k], NULL);
+		else
+			apelexer_lex_chunk(&chunks[k]);
+	}
+	APELEXER_FREE(workers);
+	APELEXER_FREE(started);
+#else
+	for (int k = 0; k < nchunks; k++) {
+		apelexer_lex_chunk(&chunks[k]);
+	}
+#endif
+
+	// The first chunk's array is grown in place and the others are appended to it
+	size_t total = 0;
+	for (int k = 0; k < nchunks; k++) {
+		total += chunks[k].count;
+	}
+	ApelexerToken *tokens = nchunks > 0 ? chunks[0].tokens : NULL;
+	if (total > 0) {
+		tokens = apelexer_tokens_reserve(tokens, total);
+	}
+	size_t n = nchunks > 0 ? chunks[0].count : 0;
+	size_t line_base = nchunks > 0 ? chunks[0].scanner.line - 1 : 0;
+	for (int k = 1; k < nchunks; k++) {
+		ApelexerChunk *c = &chunks[k];
+		if (c->tokens) {
+			for (size_t j = 0; j < c->count; j++) {
+				c->tokens[j].start_line += line_base;
+				c->tokens[j].end_line += line_base;
+			}
+			apelexer_tokens_move(tokens, n, c->tokens, c->count);
+			n += c->count;
+		}
+		line_base += c->scanner.line - 1;
+	}
+	APELEXER_FREE(chunks);
+	*token_count = total;
+	return tokens;
+}
@@ -0,0 +1,165 @@
+#include "apelexer_internal.h"
+
+#define APELEXER_STREAM_READ_SIZE 4096
+
+APELEXER_PRIVATE void apelexer_stream_reserve(ApelexerCtx *ctx, size_t extra)
+{
+	if (ctx->buf_len + extra + 1 <= ctx->buf_cap)
+		return;
+	size_t cap = ctx->buf_cap ? ctx->buf_cap : APELEXER_STREAM_READ_SIZE;
+	while (cap < ctx->buf_len + extra + 1)
+		cap *= 2;
+	ctx->buf = APELEXER_REALLOC(ctx->buf, cap);
+	ctx->buf_cap = cap;
+}
+
+/* Drop the already lexed part of the buffer so it doesn't grow with the input */
+APELEXER_PRIVATE void apelexer_stream_compact(ApelexerCtx *ctx)
+{
+	if (ctx->pos == 0)
+		return;
+	memmove(ctx->buf, ctx->buf + ctx->pos, ctx->buf_len - ctx->pos);
+	ctx->buf_len -= ctx->pos;
+	ctx->limit -= ctx->pos;
+	ctx->pos = 0;
+	ctx->buf[ctx->buf_len] = '\0';
+}
+
+/* Tokens never cross an unescaped newline, so everything up to the last one can be lexed */
+APELEXER_PRIVATE void apelexer_stream_update_limit(ApelexerCtx *ctx)
+{
+	if (ctx->eof) {
+		ctx->limit = ctx->buf_len;
+		return;
+	}
+	for (size_t k = ctx->buf_len; k > ctx->limit; k--) {
+		if (apelexer_is_line_end(ctx->buf, ctx->buf_len, k)) {
+			ctx->limit = k;
+			return;
+		}
+	}
+}
+
+APELEXER_DEF void apelexer_init(ApelexerCtx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->line = 1;
+	ctx->column = 1;
+}
+
+APELEXER_DEF void apelexer_set_reader(ApelexerCtx *ctx, ApelexerReadFn read, void *user)
+{
+	ctx->read = read;
+	ctx->read_user = user;
+}
+
+APELEXER_DEF void apelexer_set_language(ApelexerCtx *ctx, const ApelexerLanguage *lang)
+{
+	ctx->lang = lang;
+}
+
+APELEXER_DEF void apelexer_set_symbols(ApelexerCtx *ctx, ApelexerSymbols *symbols)
+{
+	ctx->symbols = symbols;
+}
+
+APELEXER_DEF void apelexer_feed(ApelexerCtx *ctx, const char *data, size_t len)
+{
+	apelexer_stream_compact(ctx);
+	apelexer_stream_reserve(ctx, len);
+	memcpy(ctx->buf + ctx->buf_len, data, len);
+	ctx->buf_len += len;
+	ctx->buf[ctx->buf_len] = '\0';
+	apelexer_stream_update_limit(ctx);
+}
+
+APELEXER_DEF void apelexer_finish(ApelexerCtx *ctx)
+{
+	ctx->eof = APELEXER_TRUE;
+	apelexer_stream_update_limit(ctx);
+}
+
+APELEXER_PRIVATE int apelexer_stream_fill(ApelexerCtx *ctx)
+{
+	if (!ctx->read) {
+		return APELEXER_FALSE;
+	}
+	apelexer_stream_compact(ctx);
+	apelexer_stream_reserve(ctx, APELEXER_STREAM_READ_SIZE);
+	size_t n = ctx->read(ctx->read_user, ctx->buf + ctx->buf_len, ctx->buf_cap - ctx->buf_len - 1);
+	if (n == 0) {
+		apelexer_finish(ctx);
+		return APELEXER_TRUE;
+	}
+	ctx->buf_len += n;
+	ctx->buf[ctx->buf_len] = '\0';
+	apelexer_stream_update_limit(ctx);
+	return APELEXER_TRUE;
+}
+
+APELEXER_DEF ApelexerNextResult apelexer_next(ApelexerCtx *ctx, ApelexerToken *tok)
+{
+	for (;;) {
+		if (ctx->buf) {
+			ApelexerScanner s = { ctx->buf, ctx->limit, ctx->pos, ctx->line, ctx->column, ctx->lang, !ctx->eof, { 0 } };
+			int found = apelexer_scan(&s, tok);
+			ctx->pos = s.i;
+			ctx->line = s.line;
+			ctx->column = s.column;
+			ctx->symbol = APELEXER_NO_SYMBOL;
+			ctx->number = s.number;
+			if (found && ctx->symbols && tok->type == APELEXER_TOKEN_IDENTIFIER) {
+				ctx->symbol = apelexer_symbols_intern(ctx->symbols, tok->value, tok->length);
+				tok->value = (char *)apelexer_symbols_name(ctx->symbols, ctx->symbol);
+				return APELEXER_NEXT_TOKEN;
+			}
+			if (found) {
+				if (tok->length + 1 > ctx->value_cap) {
+					ctx->value_cap = tok->length + 1 > 64 ? tok->length + 1 : 64;
+					ctx->value = APELEXER_REALLOC(ctx->value, ctx->value_cap);
+				}
+				memcpy(ctx->value, tok->value, tok->length);
+				ctx->value[tok->length] = '\0';
+				tok->value = ctx->value;
+				return APELEXER_NEXT_TOKEN;
+			}
+		}
+		// a block comment that isn't closed yet leaves pos short of the limit
+		if (ctx->eof && ctx->pos >= ctx->buf_len) {
+			return APELEXER_NEXT_DONE;
+		}
+		if (!apelexer_stream_fill(ctx)) {
+			return APELEXER_NEXT_NEED_INPUT;
+		}
+	}
+}
+
+APELEXER_DEF ApelexerToken *apelexer_tokenize_ctx(ApelexerCtx *ctx, const char *input, size_t len, size_t *token_count)
+{
+	if (ctx->tokens)
+		apelexer_arena_reset(&APELEXER_TOKENS_HEADER(ctx->tokens)->arena);
+	ctx->tokens = apelexer_tokenize_into(ctx->tokens, ctx->lang, ctx->symbols, input, len, token_count);
+	return ctx->tokens;
+}
+
+APELEXER_DEF void apelexer_reset(ApelexerCtx *ctx)
+{
+	ctx->buf_len = 0;
+	if (ctx->buf)
+		ctx->buf[0] = '\0';
+	ctx->pos = 0;
+	ctx->limit = 0;
+	ctx->line = 1;
+	ctx->column = 1;
+	ctx->eof = APELEXER_FALSE;
+	if (ctx->tokens)
+		apelexer_arena_reset(&APELEXER_TOKENS_HEADER(ctx->tokens)->arena);
+}
+
+APELEXER_DEF void apelexer_free(ApelexerCtx *ctx)
+{
+	APELEXER_FREE(ctx->buf);
+	APELEXER_FREE(ctx->value);
+	apelexer_free_tokens(ctx->tokens);
+	apelexer_init(ctx);
+}
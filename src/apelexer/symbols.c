@@ -0,0 +1,52 @@
+#include "apelexer_internal.h"
+#include "apedsa_api.h"
+
+APELEXER_DEF ApelexerSymbols *apelexer_symbols_new(void)
+{
+	ApelexerSymbols *symbols = APELEXER_MALLOC(sizeof(ApelexerSymbols));
+	memset(symbols, 0, sizeof(*symbols));
+	apedsa_da_push(symbols->names, NULL); // ID 0 is APELEXER_NO_SYMBOL
+	return symbols;
+}
+
+APELEXER_DEF void apelexer_symbols_free(ApelexerSymbols *symbols)
+{
+	if (!symbols)
+		return;
+	apedsa_shm_free(symbols->map);
+	apedsa_da_free(symbols->names);
+	APELEXER_FREE(symbols->scratch);
+	APELEXER_FREE(symbols);
+}
+
+APELEXER_DEF uint32_t apelexer_symbols_intern(ApelexerSymbols *symbols, const char *name, size_t len)
+{
+	// The map wants NUL-terminated keys and token values point into the input
+	if (len + 1 > symbols->scratch_cap) {
+		symbols->scratch_cap = len + 1 > 64 ? len + 1 : 64;
+		symbols->scratch = APELEXER_REALLOC(symbols->scratch, symbols->scratch_cap);
+	}
+	memcpy(symbols->scratch, name, len);
+	symbols->scratch[len] = '\0';
+	ptrdiff_t i = apedsa_shm_geti(symbols->map, symbols->scratch);
+	if (i >= 0)
+		return symbols->map[i].value;
+	uint32_t id = (uint32_t)apedsa_da_count(symbols->names);
+	apedsa_shm_put(symbols->map, symbols->scratch, id);
+	// Nothing is ever deleted, so the new entry is the last one. Its key was copied into the
+	// map's string arena, which never moves
+	apedsa_da_push(symbols->names, symbols->map[apedsa_shm_len(symbols->map) - 1].key);
+	return id;
+}
+
+APELEXER_DEF const char *apelexer_symbols_name(const ApelexerSymbols *symbols, uint32_t id)
+{
+	if (id == APELEXER_NO_SYMBOL || id >= apedsa_da_count(symbols->names))
+		return NULL;
+	return symbols->names[id];
+}
+
+APELEXER_DEF size_t apelexer_symbols_count(const ApelexerSymbols *symbols)
+{
+	return apedsa_da_count(symbols->names) - 1;
+}
@@ -0,0 +1,831 @@
+#include "test.h"
+#include "apelexer_api.h"
+
+#include <string.h>
+
+static const char *sample_source = "#include <stdio.h>\n"
+				   "\n"
+				   "static int counter = 0x1F;\n"
+				   "int main(void)\n"
+				   "{\n"
+				   "\tconst char *msg = \"hello, world\";\n"
+				   "\tfloat f = 1.5e3;\n"
+				   "\tif (counter <<= 2 && f >= 0.5) {\n"
+				   "\t\tcounter->next = 'a';\n"
+				   "\t}\n"
+				   "\treturn counter++;\n"
+				   "}\n";
+
+static int tokens_equal(const ApelexerToken *a, const ApelexerToken *b)
+{
+	return a->type == b->type && a->length == b->length && strcmp(a->value, b->value) == 0 && a->start_line == b->start_line &&
+	       a->start_column == b->start_column && a->end_line == b->end_line && a->end_column == b->end_column;
+}
+
+/* ============================================================================
+ * Tokenize Tests
+ * ============================================================================ */
+
+TEST(tokenize_basic)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("int x = 42;", &count);
+	ASSERT_EQ(count, 5);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_KEYWORD);
+	ASSERT_STR_EQ(tokens[0].value, "int");
+	ASSERT_EQ(tokens[1].type, APELEXER_TOKEN_IDENTIFIER);
+	ASSERT_STR_EQ(tokens[1].value, "x");
+	ASSERT_EQ(tokens[2].type, APELEXER_TOKEN_OPERATOR);
+	ASSERT_STR_EQ(tokens[2].value, "=");
+	ASSERT_EQ(tokens[3].type, APELEXER_TOKEN_INT);
+	ASSERT_STR_EQ(tokens[3].value, "42");
+	ASSERT_EQ(tokens[3].start_column, 9);
+	ASSERT_EQ(tokens[3].end_column, 11);
+	ASSERT_EQ(tokens[4].type, APELEXER_TOKEN_SEMICOLON);
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+TEST(tokenize_operators)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("a <<= b->c - -d >> 1", &count);
+	ASSERT_EQ(count, 10);
+	ASSERT_STR_EQ(tokens[1].value, "<<=");
+	ASSERT_EQ(tokens[3].type, APELEXER_TOKEN_ARROW);
+	ASSERT_STR_EQ(tokens[5].value, "-");
+	ASSERT_EQ(tokens[5].start_column, 12);
+	ASSERT_STR_EQ(tokens[8].value, ">>");
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+TEST(tokenize_literals)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("\"a\\\\\" 'b' 0b101 3.25 '\\'' x", &count);
+	ASSERT_EQ(count, 6);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_STRING);
+	ASSERT_STR_EQ(tokens[0].value, "a\\\\");
+	ASSERT_EQ(tokens[1].type, APELEXER_TOKEN_CHAR);
+	ASSERT_STR_EQ(tokens[1].value, "b");
+	ASSERT_EQ(tokens[2].type, APELEXER_TOKEN_INT);
+	ASSERT_STR_EQ(tokens[2].value, "0b101");
+	ASSERT_EQ(tokens[3].type, APELEXER_TOKEN_FLOAT);
+	ASSERT_EQ(tokens[4].type, APELEXER_TOKEN_CHAR);
+	ASSERT_STR_EQ(tokens[4].value, "'");
+	ASSERT_EQ(tokens[5].start_column, 27);
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+TEST(tokenize_unicode_escapes)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("\"\\u00e9\" \"\\U0001F600\" x", &count);
+	ASSERT_EQ(count, 3);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_STRING);
+	ASSERT_STR_EQ(tokens[0].value, "\\u00e9");
+	ASSERT_EQ(tokens[1].type, APELEXER_TOKEN_STRING);
+	ASSERT_STR_EQ(tokens[1].value, "\\U0001F600");
+	ASSERT_EQ(tokens[2].start_column, 23);
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Streaming Tests
+ * ============================================================================ */
+
+static int stream_matches_tokenize(size_t chunk_size)
+{
+	size_t count = 0;
+	ApelexerToken *expected = apelexer_tokenize(sample_source, &count);
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	size_t src_len = strlen(sample_source);
+	size_t fed = 0;
+	size_t n = 0;
+	ApelexerToken tok;
+	for (;;) {
+		ApelexerNextResult r = apelexer_next(&ctx, &tok);
+		if (r == APELEXER_NEXT_DONE)
+			break;
+		if (r == APELEXER_NEXT_NEED_INPUT) {
+			if (fed < src_len) {
+				size_t len = src_len - fed < chunk_size ? src_len - fed : chunk_size;
+				apelexer_feed(&ctx, sample_source + fed, len);
+				fed += len;
+			} else {
+				apelexer_finish(&ctx);
+			}
+			continue;
+		}
+		if (n >= count || !tokens_equal(&tok, &expected[n])) {
+			apelexer_free(&ctx);
+			apelexer_free_tokens(expected);
+			return FAILED;
+		}
+		n++;
+	}
+	apelexer_free(&ctx);
+	apelexer_free_tokens(expected);
+	return n == count ? PASSED : FAILED;
+}
+
+TEST(stream_single_chunk)
+{
+	return stream_matches_tokenize(1 << 20);
+}
+
+TEST(stream_small_chunks)
+{
+	for (size_t chunk = 1; chunk <= 7; chunk++) {
+		ASSERT_EQ(stream_matches_tokenize(chunk), PASSED);
+	}
+	return PASSED;
+}
+
+typedef struct {
+	const char *data;
+	size_t len;
+	size_t pos;
+} StringReader;
+
+static size_t string_read(void *user, char *buf, size_t cap)
+{
+	StringReader *r = user;
+	size_t n = r->len - r->pos;
+	if (n > cap)
+		n = cap;
+	if (n > 3)
+		n = 3; // force tokens to be split across reads
+	memcpy(buf, r->data + r->pos, n);
+	r->pos += n;
+	return n;
+}
+
+TEST(stream_reader)
+{
+	StringReader reader = { "x += foo(12, \"s t\");\ny", 0, 0 };
+	reader.len = strlen(reader.data);
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	apelexer_set_reader(&ctx, string_read, &reader);
+	const char *expected[] = { "x", "+=", "foo", "(", "12", ",", "s t", ")", ";", "y" };
+	size_t n = 0;
+	ApelexerToken tok;
+	while (apelexer_next(&ctx, &tok) == APELEXER_NEXT_TOKEN) {
+		ASSERT_LT(n, sizeof(expected) / sizeof(expected[0]));
+		ASSERT_STR_EQ(tok.value, expected[n]);
+		n++;
+	}
+	ASSERT_EQ(n, sizeof(expected) / sizeof(expected[0]));
+	ASSERT_EQ(tok.start_line, 2);
+	apelexer_free(&ctx);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Parallel Tests
+ * ============================================================================ */
+
+static char *repeat_source(const char *src, size_t times, size_t *out_len)
+{
+	size_t len = strlen(src);
+	char *buf = APELEXER_MALLOC(len * times + 1);
+	for (size_t i = 0; i < times; i++) {
+		memcpy(buf + i * len, src, len);
+	}
+	buf[len * times] = '\0';
+	*out_len = len * times;
+	return buf;
+}
+
+TEST(parallel_matches_tokenize)
+{
+	size_t len = 0;
+	char *src = repeat_source(sample_source, 8192, &len);
+	size_t expected_count = 0;
+	ApelexerToken *expected = apelexer_tokenize(src, &expected_count);
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		size_t count = 0;
+		ApelexerToken *tokens = apelexer_tokenize_parallel(NULL, src, len, &count, threads);
+		ASSERT_EQ(count, expected_count);
+		for (size_t i = 0; i < count; i++) {
+			ASSERT_TRUE(tokens_equal(&tokens[i], &expected[i]));
+		}
+		apelexer_free_tokens(tokens);
+	}
+	apelexer_free_tokens(expected);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+TEST(parallel_continued_lines)
+{
+	size_t len = 0;
+	char *src = repeat_source("#define A(x) \\\n\t(x + 1)\nA(\"a\\\nb\");\n", 65536, &len);
+	size_t expected_count = 0;
+	ApelexerToken *expected = apelexer_tokenize(src, &expected_count);
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_parallel(NULL, src, len, &count, 4);
+	ASSERT_EQ(count, expected_count);
+	for (size_t i = 0; i < count; i++) {
+		ASSERT_TRUE(tokens_equal(&tokens[i], &expected[i]));
+	}
+	apelexer_free_tokens(tokens);
+	apelexer_free_tokens(expected);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Compact Output Tests
+ * ============================================================================ */
+
+static int compact_matches_tokenize(const char *src)
+{
+	size_t count = 0;
+	ApelexerToken *expected = apelexer_tokenize(src, &count);
+	ApelexerTokenList list;
+	ASSERT_TRUE(apelexer_tokenize_compact(NULL, src, strlen(src), &list));
+	ASSERT_EQ(list.count, count);
+	for (size_t i = 0; i < count; i++) {
+		ASSERT_EQ(list.types[i], expected[i].type);
+		ASSERT_EQ(list.lengths[i], expected[i].length);
+		ASSERT_MEM_EQ(src + list.offsets[i], expected[i].value, list.lengths[i]);
+		if (expected[i].type == APELEXER_TOKEN_CHAR)
+			continue; // the value of a char starts after the quote, the token at it
+		size_t line = 0, column = 0;
+		apelexer_token_list_position(&list, i, &line, &column);
+		ASSERT_EQ(line, expected[i].start_line);
+		ASSERT_EQ(column, expected[i].start_column);
+	}
+	apelexer_token_list_free(&list);
+	apelexer_free_tokens(expected);
+	return PASSED;
+}
+
+TEST(compact_matches_tokenize)
+{
+	return compact_matches_tokenize(sample_source);
+}
+
+TEST(compact_line_breaks)
+{
+	return compact_matches_tokenize("#define X \\\r\n  1\r\nint x;\r\rchar *s = \"a\\\nb\"; y\n");
+}
+
+/* ============================================================================
+ * Language Tests
+ * ============================================================================ */
+
+static const char *const dsl_keywords[] = { "let", "fn", "end" };
+static const ApelexerOperatorDef dsl_operators[] = {
+	{ "=", APELEXER_TOKEN_OPERATOR }, { "=>", APELEXER_TOKEN_ARROW }, { "(", APELEXER_TOKEN_OPEN_PAREN },
+	{ ")", APELEXER_TOKEN_CLOSE_PAREN }, { ",", APELEXER_TOKEN_COMMA },
+};
+
+static const ApelexerLanguageSpec dsl_spec = {
+	.keywords = dsl_keywords,
+	.keyword_count = sizeof(dsl_keywords) / sizeof(dsl_keywords[0]),
+	.operators = dsl_operators,
+	.operator_count = sizeof(dsl_operators) / sizeof(dsl_operators[0]),
+	.line_comment = "#",
+	.string_quote = '"',
+	.identifier_chars = "-?",
+};
+
+TEST(language_custom)
+{
+	ApelexerLanguage *lang = apelexer_language_compile(&dsl_spec);
+	ASSERT_TRUE(lang != NULL);
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_lang(lang, "let empty? = fn(a-b) => \"x\" # comment\nend", &count);
+	ASSERT_EQ(count, 10);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_KEYWORD);
+	ASSERT_EQ(tokens[1].type, APELEXER_TOKEN_IDENTIFIER);
+	ASSERT_STR_EQ(tokens[1].value, "empty?");
+	ASSERT_EQ(tokens[4].type, APELEXER_TOKEN_OPEN_PAREN);
+	ASSERT_STR_EQ(tokens[5].value, "a-b");
+	ASSERT_EQ(tokens[7].type, APELEXER_TOKEN_ARROW);
+	ASSERT_EQ(tokens[8].type, APELEXER_TOKEN_STRING);
+	ASSERT_EQ(tokens[9].type, APELEXER_TOKEN_KEYWORD);
+	ASSERT_EQ(tokens[9].start_line, 2);
+	apelexer_free_tokens(tokens);
+	apelexer_language_free(lang);
+	return PASSED;
+}
+
+TEST(language_c_comments)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("a /* b\n c */ // d\ne", &count);
+	ASSERT_EQ(count, 2);
+	ASSERT_STR_EQ(tokens[0].value, "a");
+	ASSERT_STR_EQ(tokens[1].value, "e");
+	ASSERT_EQ(tokens[1].start_line, 3);
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+TEST(language_stream_block_comment)
+{
+	const char *src = "x /* one\ntwo\nthree */ y\n";
+	const char *expected[] = { "x", "y" };
+	for (size_t chunk = 1; chunk <= 5; chunk++) {
+		ApelexerCtx ctx;
+		apelexer_init(&ctx);
+		size_t src_len = strlen(src), fed = 0, n = 0;
+		ApelexerToken tok;
+		for (;;) {
+			ApelexerNextResult r = apelexer_next(&ctx, &tok);
+			if (r == APELEXER_NEXT_DONE)
+				break;
+			if (r == APELEXER_NEXT_NEED_INPUT) {
+				if (fed < src_len) {
+					size_t len = src_len - fed < chunk ? src_len - fed : chunk;
+					apelexer_feed(&ctx, src + fed, len);
+					fed += len;
+				} else {
+					apelexer_finish(&ctx);
+				}
+				continue;
+			}
+			ASSERT_LT(n, 2);
+			ASSERT_STR_EQ(tok.value, expected[n]);
+			n++;
+		}
+		ASSERT_EQ(n, 2);
+		ASSERT_EQ(tok.start_line, 3);
+		apelexer_free(&ctx);
+	}
+	return PASSED;
+}
+
+TEST(language_parallel_block_comment)
+{
+	size_t len = 0;
+	char *src = repeat_source("int a; /* x\n\"y\n*/ int b = 1;\n// \"\nchar c = '\"';\n", 32768, &len);
+	size_t expected_count = 0;
+	ApelexerToken *expected = apelexer_tokenize(src, &expected_count);
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_parallel(NULL, src, len, &count, 4);
+	ASSERT_EQ(count, expected_count);
+	for (size_t i = 0; i < count; i++) {
+		ASSERT_TRUE(tokens_equal(&tokens[i], &expected[i]));
+	}
+	apelexer_free_tokens(tokens);
+	apelexer_free_tokens(expected);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+TEST(language_invalid_spec)
+{
+	static const ApelexerOperatorDef bad_operators[] = { { "", APELEXER_TOKEN_OPERATOR } };
+	ApelexerLanguageSpec spec = dsl_spec;
+	spec.operators = bad_operators;
+	spec.operator_count = 1;
+	ASSERT_TRUE(apelexer_language_compile(&spec) == NULL);
+	spec = dsl_spec;
+	spec.block_comment_open = "(*";
+	ASSERT_TRUE(apelexer_language_compile(&spec) == NULL);
+	static const char *const duplicate_keywords[] = { "let", "fn", "let" };
+	spec = dsl_spec;
+	spec.keywords = duplicate_keywords;
+	spec.keyword_count = 3;
+	ASSERT_TRUE(apelexer_language_compile(&spec) == NULL);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Token Ownership Tests
+ * ============================================================================ */
+
+TEST(tokens_large_values)
+{
+	size_t len = 0;
+	char *src = repeat_source("x", 20000, &len); // one identifier larger than an arena block
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize(src, &count);
+	ASSERT_EQ(count, 1);
+	ASSERT_EQ(tokens[0].length, 20000);
+	ASSERT_STR_EQ(tokens[0].value, src);
+	apelexer_free_tokens(tokens);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+TEST(tokens_ctx_reuse)
+{
+	size_t len = 0;
+	char *src = repeat_source(sample_source, 64, &len);
+	size_t expected_count = 0;
+	ApelexerToken *expected = apelexer_tokenize(src, &expected_count);
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	const char *first_value = NULL;
+	for (int run = 0; run < 3; run++) {
+		size_t count = 0;
+		ApelexerToken *tokens = apelexer_tokenize_ctx(&ctx, src, len, &count);
+		ASSERT_EQ(count, expected_count);
+		for (size_t i = 0; i < count; i++) {
+			ASSERT_TRUE(tokens_equal(&tokens[i], &expected[i]));
+		}
+		if (run == 0)
+			first_value = tokens[0].value;
+		ASSERT_TRUE(tokens[0].value == first_value); // the arena is reused, not reallocated
+		apelexer_reset(&ctx);
+	}
+	apelexer_free(&ctx);
+	apelexer_free_tokens(expected);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+TEST(tokens_side_values)
+{
+	ApelexerLanguageSpec spec = dsl_spec;
+	spec.decode_numbers = 1;
+	ApelexerLanguage *lang = apelexer_language_compile(&spec);
+	size_t len = 0;
+	char *src = repeat_source("let x = 7 # y\n", 65536, &len);
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_parallel(lang, src, len, &count, 4);
+	ASSERT_EQ(count, 65536 * 4);
+	for (size_t i = 3; i < count; i += 4) {
+		ASSERT_TRUE(apelexer_token_number(tokens, i).i == 7);
+	}
+	apelexer_free_tokens(tokens);
+	// A reused array doesn't keep the symbols of the previous run
+	ApelexerSymbols *symbols = apelexer_symbols_new();
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	apelexer_set_symbols(&ctx, symbols);
+	tokens = apelexer_tokenize_ctx(&ctx, "a b", 3, &count);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 1), 2);
+	apelexer_set_symbols(&ctx, NULL);
+	tokens = apelexer_tokenize_ctx(&ctx, "a b", 3, &count);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 1), APELEXER_NO_SYMBOL);
+	apelexer_free(&ctx);
+	apelexer_symbols_free(symbols);
+	apelexer_language_free(lang);
+	APELEXER_FREE(src);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Symbol Tests
+ * ============================================================================ */
+
+TEST(symbols_tokenize)
+{
+	ApelexerSymbols *symbols = apelexer_symbols_new();
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_interned(NULL, symbols, "int foo = bar(foo, baz) + bar;", &count);
+	ASSERT_EQ(count, 12);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 0), APELEXER_NO_SYMBOL); // keywords aren't interned
+	ASSERT_EQ(apelexer_token_symbol(tokens, 1), 1);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 3), 2);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 5), 1);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 7), 3);
+	ASSERT_EQ(apelexer_token_symbol(tokens, 10), 2);
+	ASSERT_TRUE(tokens[1].value == tokens[5].value);
+	ASSERT_STR_EQ(tokens[7].value, "baz");
+	ASSERT_EQ(apelexer_symbols_count(symbols), 3);
+	ASSERT_STR_EQ(apelexer_symbols_name(symbols, 2), "bar");
+	ASSERT_TRUE(apelexer_symbols_name(symbols, APELEXER_NO_SYMBOL) == NULL);
+	ASSERT_TRUE(apelexer_symbols_name(symbols, 4) == NULL);
+	apelexer_free_tokens(tokens);
+	apelexer_symbols_free(symbols);
+	return PASSED;
+}
+
+TEST(symbols_stream)
+{
+	ApelexerSymbols *symbols = apelexer_symbols_new();
+	ASSERT_EQ(apelexer_symbols_intern(symbols, "counterX", 7), 1);
+	ApelexerCtx ctx;
+	apelexer_init(&ctx);
+	apelexer_set_symbols(&ctx, symbols);
+	apelexer_feed(&ctx, sample_source, strlen(sample_source));
+	apelexer_finish(&ctx);
+	ApelexerToken tok;
+	size_t counters = 0;
+	while (apelexer_next(&ctx, &tok) == APELEXER_NEXT_TOKEN) {
+		if (tok.type != APELEXER_TOKEN_IDENTIFIER) {
+			ASSERT_EQ(ctx.symbol, APELEXER_NO_SYMBOL);
+			continue;
+		}
+		ASSERT_STR_EQ(apelexer_symbols_name(symbols, ctx.symbol), tok.value);
+		counters += ctx.symbol == 1;
+	}
+	ASSERT_EQ(counters, 4);
+	apelexer_free(&ctx);
+	apelexer_symbols_free(symbols);
+	return PASSED;
+}
+
+/* ============================================================================
+ * DFA Generator Tests
+ * ============================================================================ */
+
+static const ApelexerRule dfa_rules[] = {
+	{ "[ \t\r\n]+", APELEXER_TOKEN_NONE },
+	{ "//[^\n]*", APELEXER_TOKEN_NONE },
+	{ "if|else|while", APELEXER_TOKEN_KEYWORD },
+	{ "[A-Za-z_]\\w*", APELEXER_TOKEN_IDENTIFIER },
+	{ "\\d+\\.\\d+([eE][+\\-]?\\d+)?", APELEXER_TOKEN_FLOAT },
+	{ "\\d+", APELEXER_TOKEN_INT },
+	{ "\"([^\"\\\\\n]|\\\\.)*\"", APELEXER_TOKEN_STRING },
+	{ "==|=|\\+|-|<=?", APELEXER_TOKEN_OPERATOR },
+	{ "\\(", APELEXER_TOKEN_OPEN_PAREN },
+	{ "\\)", APELEXER_TOKEN_CLOSE_PAREN },
+	{ ";", APELEXER_TOKEN_SEMICOLON },
+};
+
+TEST(dfa_tokenize)
+{
+	ApelexerDfa *dfa = apelexer_dfa_compile(dfa_rules, sizeof(dfa_rules) / sizeof(dfa_rules[0]));
+	ASSERT_TRUE(dfa != NULL);
+	const char *src = "if (iffy <= 2.5e-3) // c\n  y = \"a\\\"b\";";
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_dfa_tokenize(dfa, src, strlen(src), &count);
+	ASSERT_EQ(count, 10);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_KEYWORD);
+	ASSERT_EQ(tokens[1].type, APELEXER_TOKEN_OPEN_PAREN);
+	ASSERT_EQ(tokens[2].type, APELEXER_TOKEN_IDENTIFIER);
+	ASSERT_STR_EQ(tokens[2].value, "iffy");
+	ASSERT_STR_EQ(tokens[3].value, "<=");
+	ASSERT_EQ(tokens[4].type, APELEXER_TOKEN_FLOAT);
+	ASSERT_STR_EQ(tokens[4].value, "2.5e-3");
+	ASSERT_EQ(tokens[6].type, APELEXER_TOKEN_IDENTIFIER);
+	ASSERT_EQ(tokens[6].start_line, 2);
+	ASSERT_EQ(tokens[6].start_column, 3);
+	ASSERT_EQ(tokens[8].type, APELEXER_TOKEN_STRING);
+	ASSERT_STR_EQ(tokens[8].value, "\"a\\\"b\"");
+	ASSERT_EQ(tokens[8].end_column, 13);
+	ASSERT_EQ(tokens[9].type, APELEXER_TOKEN_SEMICOLON);
+	apelexer_free_tokens(tokens);
+	apelexer_dfa_free(dfa);
+	return PASSED;
+}
+
+TEST(dfa_minimized)
+{
+	ApelexerRule rule = { "(a|b)*abb", APELEXER_TOKEN_IDENTIFIER };
+	ApelexerDfa *dfa = apelexer_dfa_compile(&rule, 1);
+	ASSERT_TRUE(dfa != NULL);
+	ASSERT_EQ(apelexer_dfa_state_count(dfa), 5); // The textbook 4 states plus the dead state
+	int matched = -1;
+	ASSERT_EQ(apelexer_dfa_match(dfa, "babbabbx", 8, &matched), 7);
+	ASSERT_EQ(matched, 0);
+	ASSERT_EQ(apelexer_dfa_match(dfa, "abab", 4, &matched), 0);
+	ASSERT_EQ(matched, -1);
+	apelexer_dfa_free(dfa);
+	return PASSED;
+}
+
+TEST(dfa_invalid)
+{
+	const char *patterns[] = { "a(", "a)", "*a", "[b-a]", "[ab", "a\\", "a*|b" };
+	for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		ApelexerRule rule = { patterns[i], APELEXER_TOKEN_IDENTIFIER };
+		ASSERT_TRUE(apelexer_dfa_compile(&rule, 1) == NULL);
+	}
+	return PASSED;
+}
+
+TEST(dfa_emit)
+{
+	ApelexerDfa *dfa = apelexer_dfa_compile(dfa_rules, sizeof(dfa_rules) / sizeof(dfa_rules[0]));
+	ASSERT_TRUE(dfa != NULL);
+	char buf[1 << 16];
+	for (int style = APELEXER_DFA_EMIT_TABLES; style <= APELEXER_DFA_EMIT_DIRECT; style++) {
+		FILE *f = tmpfile();
+		ASSERT_TRUE(f != NULL);
+		apelexer_dfa_emit_c(dfa, f, "lex_match", (ApelexerDfaEmitStyle)style);
+		rewind(f);
+		size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+		buf[n] = '\0';
+		fclose(f);
+		ASSERT_TRUE(strstr(buf, "static int lex_match(const char *s, size_t n, size_t *len)") != NULL);
+		const char *marker = style == APELEXER_DFA_EMIT_DIRECT ? "goto s" : "lex_match_next";
+		ASSERT_TRUE(strstr(buf, marker) != NULL);
+	}
+	apelexer_dfa_free(dfa);
+	return PASSED;
+}
+
+/* ============================================================================
+ * Number Tests
+ * ============================================================================ */
+
+TEST(number_exponents)
+{
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize("1e-5 2.5E+3 3e4-x", &count);
+	ASSERT_EQ(count, 5);
+	ASSERT_EQ(tokens[0].type, APELEXER_TOKEN_FLOAT);
+	ASSERT_STR_EQ(tokens[0].value, "1e-5");
+	ASSERT_STR_EQ(tokens[1].value, "2.5E+3");
+	ASSERT_STR_EQ(tokens[2].value, "3e4");
+	ASSERT_STR_EQ(tokens[3].value, "-");
+	apelexer_free_tokens(tokens);
+	return PASSED;
+}
+
+TEST(number_decode)
+{
+	ApelexerLanguageSpec spec = dsl_spec;
+	spec.number_prefixes = 1;
+	spec.number_floats = 1;
+	spec.decode_numbers = 1;
+	ApelexerLanguage *lang = apelexer_language_compile(&spec);
+	ASSERT_TRUE(lang != NULL);
+	size_t count = 0;
+	ApelexerToken *tokens = apelexer_tokenize_lang(
+		lang, "0 42 0xfF 0b101 0o17 12345678901234567 18446744073709551615 0.1 1e-5 2.5e+3 123e25 1.7976931348623157e308", &count);
+	ASSERT_EQ(count, 12);
+	uint64_t ints[] = { 0, 42, 0xff, 5, 017, 12345678901234567ull, UINT64_MAX };
+	for (size_t i = 0; i < 7; i++) {
+		ASSERT_EQ(tokens[i].type, APELEXER_TOKEN_INT);
+		ASSERT_TRUE(apelexer_token_number(tokens, i).i == ints[i]);
+	}
+	for (size_t i = 7; i < count; i++) {
+		ASSERT_EQ(tokens[i].type, APELEXER_TOKEN_FLOAT);
+		ASSERT_TRUE(apelexer_token_number(tokens, i).f == strtod(tokens[i].value, NULL));
+	}
+	apelexer_free_tokens(tokens);
+	// Numbers are only decoded if the language asks for it
+	tokens = apelexer_tokenize("42", &count);
+	ASSERT_TRUE(apelexer_token_number(tokens, 0).i == 0);
+	apelexer_free_tokens(tokens);
+	apelexer_language_free(lang);
+	return PASSED;
+}
+
+TEST(number_parse_int)
+{
+	uint64_t v = 0;
+	ASSERT_TRUE(apelexer_parse_int("000000000000000000000000000123", 30, &v));
+	ASSERT_EQ(v, 123);
+	ASSERT_TRUE(apelexer_parse_int("0xFFFFFFFFFFFFFFFF", 18, &v));
+	ASSERT_TRUE(v == UINT64_MAX);
+	ASSERT_FALSE(apelexer_parse_int("18446744073709551616", 20, &v));
+	ASSERT_FALSE(apelexer_parse_int("99999999999999999999", 20, &v));
+	ASSERT_FALSE(apelexer_parse_int("0x10000000000000000", 19, &v));
+	ASSERT_FALSE(apelexer_parse_int("0b102", 5, &v));
+	ASSERT_FALSE(apelexer_parse_int("12a", 3, &v));
+	ASSERT_FALSE(apelexer_parse_int("", 0, &v));
+	char buf[32];
+	uint64_t x = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < 10000; i++) {
+		x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+		uint64_t n = x >> (x & 63);
+		int len = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)n);
+		ASSERT_TRUE(apelexer_parse_int(buf, (size_t)len, &v));
+		ASSERT_TRUE(v == n);
+	}
+	return PASSED;
+}
+
+TEST(number_parse_float)
+{
+	const char *exact[] = { "0.30000000000000004", "4.9e-324", "2.2250738585072014e-308", "9007199254740993",
+				"3.14159265358979323846264338327950288", "1e400", "1e-400", "0.000000000000000000000000001",
+				"7.3177701707893310e+15", "1.", "1e23", "8.589973e9" };
+	double d = 0;
+	for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+		ASSERT_TRUE(apelexer_parse_float(exact[i], strlen(exact[i]), &d));
+		ASSERT_TRUE(d == strtod(exact[i], NULL));
+	}
+	ASSERT_FALSE(apelexer_parse_float("1e", 2, &d));
+	ASSERT_FALSE(apelexer_parse_float("1e+", 3, &d));
+	ASSERT_FALSE(apelexer_parse_float("1.5x", 4, &d));
+	ASSERT_FALSE(apelexer_parse_float(".5", 2, &d));
+	// Compare random literals against strtod, covering both the fast path and the fallback
+	char buf[64];
+	uint64_t x = 0x2545F4914F6CDD1Dull;
+	for (int i = 0; i < 100000; i++) {
+		x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+		unsigned digits = 1 + (unsigned)(x % 20);
+		int exp = (int)((x >> 8) % 700) - 350;
+		int len = snprintf(buf, sizeof(buf), "%.*lluE%d", (int)digits, (unsigned long long)(x >> 20) % 10000000000000000000ull, exp);
+		if (i & 1) {
+			// move the decimal point into the digits
+			memmove(buf + 2, buf + 1, (size_t)len);
+			buf[1] = '.';
+			len++;
+		}
+		ASSERT_TRUE(apelexer_parse_float(buf, (size_t)len, &d));
+		ASSERT_TRUE(d == strtod(buf, NULL));
+	}
+	return PASSED;
+}
+
+static void run_tokenize_tests(void)
+{
+	LOG_INFO("Tokenize tests:");
+	RUN_TEST(tokenize_basic);
+	RUN_TEST(tokenize_operators);
+	RUN_TEST(tokenize_literals);
+	RUN_TEST(tokenize_unicode_escapes);
+	LOG_INFO("");
+}
+
+static void run_stream_tests(void)
+{
+	LOG_INFO("Streaming tests:");
+	RUN_TEST(stream_single_chunk);
+	RUN_TEST(stream_small_chunks);
+	RUN_TEST(stream_reader);
+	LOG_INFO("");
+}
+
+static void run_compact_tests(void)
+{
+	LOG_INFO("Compact output tests:");
+	RUN_TEST(compact_matches_tokenize);
+	RUN_TEST(compact_line_breaks);
+	LOG_INFO("");
+}
+
+static void run_language_tests(void)
+{
+	LOG_INFO("Language tests:");
+	RUN_TEST(language_custom);
+	RUN_TEST(language_c_comments);
+	RUN_TEST(language_stream_block_comment);
+	RUN_TEST(language_parallel_block_comment);
+	RUN_TEST(language_invalid_spec);
+	LOG_INFO("");
+}
+
+static void run_ownership_tests(void)
+{
+	LOG_INFO("Token ownership tests:");
+	RUN_TEST(tokens_large_values);
+	RUN_TEST(tokens_ctx_reuse);
+	RUN_TEST(tokens_side_values);
+	LOG_INFO("");
+}
+
+static void run_symbol_tests(void)
+{
+	LOG_INFO("Symbol tests:");
+	RUN_TEST(symbols_tokenize);
+	RUN_TEST(symbols_stream);
+	LOG_INFO("");
+}
+
+static void run_dfa_tests(void)
+{
+	LOG_INFO("DFA generator tests:");
+	RUN_TEST(dfa_tokenize);
+	RUN_TEST(dfa_minimized);
+	RUN_TEST(dfa_invalid);
+	RUN_TEST(dfa_emit);
+	LOG_INFO("");
+}
+
+static void run_number_tests(void)
+{
+	LOG_INFO("Number tests:");
+	RUN_TEST(number_exponents);
+	RUN_TEST(number_decode);
+	RUN_TEST(number_parse_int);
+	RUN_TEST(number_parse_float);
+	LOG_INFO("");
+}
+
+static void run_parallel_tests(void)
+{
+	LOG_INFO("Parallel tests:");
+	RUN_TEST(parallel_matches_tokenize);
+	RUN_TEST(parallel_continued_lines);
+	LOG_INFO("");
+}
+
+int main(void)
+{
+	LOG_INFO("Running tests...");
+	run_tokenize_tests();
+	run_stream_tests();
+	run_parallel_tests();
+	run_compact_tests();
+	run_language_tests();
+	run_ownership_tests();
+	run_symbol_tests();
+	run_dfa_tests();
+	run_number_tests();
+	LOG_INFO("Tests finished");
+	LOG_INFO("%d Total", tests_run);
+	if (tests_failed > 0)
+		LOG_INFO("%d \x1b[31mFAILED\x1b[0m", tests_failed);
+	if (tests_passed > 0)
+		LOG_INFO("%d \x1b[32mPASSED\x1b[0m", tests_passed);
+	return tests_failed > 0 ? 1 : 0;
+}
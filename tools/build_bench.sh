@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+
+cd "$(dirname "$0")/.." || exit
+
+exec_name="$0"
+
+lib_name="$1"
+
+source "tools/lib/option_parser"
+
+if [[ -z "$lib_name" ]]; then
+    print_usage "$exec_name"
+    exit 1
+fi
+
+run_command() {
+    echo "CMD: $*"
+    eval "$*"
+}
+
+add_option "cc" "string" "C compiler to use (default: gcc)"
+add_option "cflags" "string" "Extra compiler flags (default: -O2)"
+
+parse_options "${@:2}"
+
+CC="gcc"
+if [[ -n "${options[cc]}" ]]; then
+    CC="${options[cc]}"
+fi
+
+cflags="-O2"
+if [[ -n "${options[cflags]}" ]]; then
+    cflags="${options[cflags]}"
+fi
+
+if [[ -z "$lib_name" || ! -d "src/$lib_name" ]]; then
+    printf "ERROR: %s: No such directory\n" "$lib_name"
+    exit 1
+fi
+
+if [[ ! -d "src/$lib_name/bench" ]]; then
+    printf "ERROR: %s has no benchmarks (src/%s/bench)\n" "$lib_name" "$lib_name"
+    exit 1
+fi
+
+# Benchmarks are built against the generated single header so they measure what users ship
+run_command "./tools/generate_from_source.sh $lib_name"
+
+if [[ ! -d "bin" ]]; then
+    run_command "mkdir bin"
+fi
+
+run_command "$CC -Iinclude -Wall -Wextra $cflags src/$lib_name/bench/*.c -o bin/${lib_name}_bench -lpthread"